@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/frozen_set.h"
+#include "../common/node_pool.h"
+#include "../common/perf_counters.h"
+#include "../common/trace_log.h"
+#include "../common/tree_image.h"
+#include "../common/workload_trace.h"
+
+/*
+
+The AVL tree of avl_tree.c with its nodes in a node_pool_t: the links are
+32-bit indices into one array rather than pointers, which takes a node
+from 32 bytes plus the malloc header down to 20 bytes. Index 0 is NIL,
+and its zeroed slot reads as a subtree of height 0.
+
+Each node keeps the height of its subtree and the rotations relink the
+nodes, so the balance is restored in a single pass up the parent links
+that stops as soon as a subtree's height comes out unchanged.
+
+The whole tree is the pool plus the root index, so freeing it is a single
+munmap and the array can be grown with mremap or written out as it is.
+Pointers to nodes are only held between allocations.
+
+*/
+
+typedef struct avl_pool_node {
+  int value;
+  uint32_t parent;
+  uint32_t left;
+  uint32_t right;
+  // of the subtree, 1 for a leaf and 0 for NIL
+  int32_t height;
+} avl_pool_node_t;
+
+typedef struct avl_pool_tree {
+  node_pool_t pool;
+  uint32_t root;
+  uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
+} avl_pool_tree_t;
+
+#define NIL NODE_POOL_NIL
+#define AVL_NODE(TREE, INDEX) ((avl_pool_node_t *)(TREE)->pool.base + (INDEX))
+
+avl_pool_tree_t avl_pool_create(int value) {
+  avl_pool_tree_t tree = {.root = NIL, .size = 0};
+
+  if (node_pool_init(&tree.pool, sizeof(avl_pool_node_t), 0) < 0) {
+    return tree;
+  }
+
+  tree.root = node_pool_alloc(&tree.pool);
+  tree.size = 1;
+
+  avl_pool_node_t *node = AVL_NODE(&tree, tree.root);
+  node->value = value;
+  node->height = 1;
+
+  return tree;
+}
+
+void avl_pool_free(avl_pool_tree_t *tree) {
+  node_pool_destroy(&tree->pool);
+
+  tree->root = NIL;
+  tree->size = 0;
+}
+
+static inline int32_t avl_pool_height(avl_pool_tree_t *tree, uint32_t index) {
+  return AVL_NODE(tree, index)->height;
+}
+
+static inline void avl_pool_update_height(avl_pool_tree_t *tree,
+                                          uint32_t index) {
+  avl_pool_node_t *node = AVL_NODE(tree, index);
+  int32_t left = avl_pool_height(tree, node->left);
+  int32_t right = avl_pool_height(tree, node->right);
+
+  node->height = 1 + (left > right ? left : right);
+}
+
+// points whatever pointed at `from` (its parent or the root) at `to`
+static inline void avl_pool_replace(avl_pool_tree_t *tree, uint32_t parent,
+                                    uint32_t from, uint32_t to) {
+  if (parent == NIL) {
+    tree->root = to;
+  } else if (AVL_NODE(tree, parent)->left == from) {
+    AVL_NODE(tree, parent)->left = to;
+  } else {
+    AVL_NODE(tree, parent)->right = to;
+  }
+
+  if (to != NIL) {
+    AVL_NODE(tree, to)->parent = parent;
+  }
+}
+
+/*
+
+The below describes a left rotation, the right one is its mirror.
+
+     X                 Y
+      \               / \
+       Y      =>     X   C
+      / \             \
+     B   C             B
+
+*/
+
+static uint32_t avl_pool_rotate_left(avl_pool_tree_t *tree, uint32_t x) {
+  avl_pool_node_t *x_node = AVL_NODE(tree, x);
+  uint32_t y = x_node->right;
+  avl_pool_node_t *y_node = AVL_NODE(tree, y);
+
+  avl_pool_replace(tree, x_node->parent, x, y);
+
+  x_node->right = y_node->left;
+
+  if (y_node->left != NIL) {
+    AVL_NODE(tree, y_node->left)->parent = x;
+  }
+
+  y_node->left = x;
+  x_node->parent = y;
+
+  avl_pool_update_height(tree, x);
+  avl_pool_update_height(tree, y);
+
+  return y;
+}
+
+static uint32_t avl_pool_rotate_right(avl_pool_tree_t *tree, uint32_t x) {
+  avl_pool_node_t *x_node = AVL_NODE(tree, x);
+  uint32_t y = x_node->left;
+  avl_pool_node_t *y_node = AVL_NODE(tree, y);
+
+  avl_pool_replace(tree, x_node->parent, x, y);
+
+  x_node->left = y_node->right;
+
+  if (y_node->right != NIL) {
+    AVL_NODE(tree, y_node->right)->parent = x;
+  }
+
+  y_node->right = x;
+  x_node->parent = y;
+
+  avl_pool_update_height(tree, x);
+  avl_pool_update_height(tree, y);
+
+  return y;
+}
+
+PERF_DEFINE_REGION(avl_pool_perf_descent, "descent");
+PERF_DEFINE_REGION(avl_pool_perf_update, "avl_pool_update");
+
+// Walks up from the node whose subtree just changed, restoring the
+// heights and the balance. The heights above a subtree only change with
+// its own, so the walk ends at the first one that keeps its old height.
+void avl_pool_update(avl_pool_tree_t *tree, uint32_t index) {
+  PERF_BEGIN(avl_pool_perf_update);
+
+  while (index != NIL) {
+    avl_pool_node_t *node = AVL_NODE(tree, index);
+    int32_t old_height = node->height;
+    int32_t left = avl_pool_height(tree, node->left);
+    int32_t right = avl_pool_height(tree, node->right);
+
+    if (left - right > 1) {
+      avl_pool_node_t *child = AVL_NODE(tree, node->left);
+
+      if (avl_pool_height(tree, child->left) <
+          avl_pool_height(tree, child->right)) {
+        avl_pool_rotate_left(tree, node->left);
+      }
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "%d: rotate right",
+                node->value);
+
+      index = avl_pool_rotate_right(tree, index);
+    } else if (right - left > 1) {
+      avl_pool_node_t *child = AVL_NODE(tree, node->right);
+
+      if (avl_pool_height(tree, child->right) <
+          avl_pool_height(tree, child->left)) {
+        avl_pool_rotate_right(tree, node->right);
+      }
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "%d: rotate left",
+                node->value);
+
+      index = avl_pool_rotate_left(tree, index);
+    } else {
+      node->height = 1 + (left > right ? left : right);
+    }
+
+    node = AVL_NODE(tree, index);
+
+    if (node->height == old_height) {
+      break;
+    }
+
+    index = node->parent;
+  }
+
+  PERF_END(avl_pool_perf_update);
+}
+
+int avl_pool_insert(avl_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
+  if (tree->pool.base == NULL &&
+      node_pool_init(&tree->pool, sizeof(avl_pool_node_t), 0) < 0) {
+    return -1;
+  }
+
+  uint32_t index = node_pool_alloc(&tree->pool);
+
+  if (index == NIL) {
+    return -1;
+  }
+
+  avl_pool_node_t *node = AVL_NODE(tree, index);
+  node->value = value;
+  node->height = 1;
+
+  tree->size++;
+
+  if (tree->root == NIL) {
+    tree->root = index;
+
+    return 0;
+  }
+
+  PERF_BEGIN(avl_pool_perf_descent);
+
+  uint32_t current = tree->root;
+
+  for (;;) {
+    avl_pool_node_t *current_node = AVL_NODE(tree, current);
+    uint32_t *link =
+        value < current_node->value ? &current_node->left : &current_node->right;
+
+    if (*link == NIL) {
+      *link = index;
+      node->parent = current;
+      break;
+    }
+
+    current = *link;
+  }
+
+  PERF_END(avl_pool_perf_descent);
+
+  avl_pool_update(tree, current);
+
+  return 0;
+}
+
+uint32_t avl_pool_find(avl_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
+
+  uint32_t current = tree->root;
+
+  while (current != NIL && AVL_NODE(tree, current)->value != value) {
+    avl_pool_node_t *node = AVL_NODE(tree, current);
+
+    current = value < node->value ? node->left : node->right;
+  }
+
+  return current;
+}
+
+int avl_pool_remove(avl_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
+  PERF_BEGIN(avl_pool_perf_descent);
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && AVL_NODE(tree, index)->value != value) {
+    avl_pool_node_t *node = AVL_NODE(tree, index);
+
+    index = value < node->value ? node->left : node->right;
+  }
+
+  PERF_END(avl_pool_perf_descent);
+
+  if (index == NIL) {
+    return -1;
+  }
+
+  avl_pool_node_t *node = AVL_NODE(tree, index);
+
+  // with two children, take over the value of the successor and unlink
+  // that instead, it has no left child
+  if (node->left != NIL && node->right != NIL) {
+    uint32_t successor = node->right;
+
+    while (AVL_NODE(tree, successor)->left != NIL) {
+      successor = AVL_NODE(tree, successor)->left;
+    }
+
+    TRACE_LOG(TRACE_DEBUG, TRACE_REMOVE, "%d: replaced by %d", value,
+              AVL_NODE(tree, successor)->value);
+
+    node->value = AVL_NODE(tree, successor)->value;
+    index = successor;
+    node = AVL_NODE(tree, index);
+  }
+
+  uint32_t parent = node->parent;
+
+  avl_pool_replace(tree, parent, index,
+                   node->left != NIL ? node->left : node->right);
+  node_pool_release(&tree->pool, index);
+
+  tree->size--;
+
+  avl_pool_update(tree, parent);
+
+  return 0;
+}
+
+// in order successor, NIL after the largest value
+uint32_t avl_pool_next(avl_pool_tree_t *tree, uint32_t index) {
+  avl_pool_node_t *node = AVL_NODE(tree, index);
+
+  if (node->right != NIL) {
+    index = node->right;
+
+    while (AVL_NODE(tree, index)->left != NIL) {
+      index = AVL_NODE(tree, index)->left;
+    }
+
+    return index;
+  }
+
+  while (node->parent != NIL && AVL_NODE(tree, node->parent)->right == index) {
+    index = node->parent;
+    node = AVL_NODE(tree, index);
+  }
+
+  return node->parent;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t avl_pool_range(avl_pool_tree_t *tree, int low, int high, int *out,
+                        uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  uint32_t current = tree->root;
+  uint32_t first = NIL;
+  uint64_t count = 0;
+
+  // the leftmost node not below low
+  while (current != NIL) {
+    if (AVL_NODE(tree, current)->value >= low) {
+      first = current;
+      current = AVL_NODE(tree, current)->left;
+    } else {
+      current = AVL_NODE(tree, current)->right;
+    }
+  }
+
+  for (uint32_t index = first;
+       index != NIL && AVL_NODE(tree, index)->value <= high;
+       index = avl_pool_next(tree, index)) {
+    if (out != NULL && count < capacity) {
+      out[count] = AVL_NODE(tree, index)->value;
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+// Copies the values into a read-only frozen set, which answers lookups
+// without chasing node indices. The tree is left as it is.
+int avl_pool_freeze(avl_pool_tree_t *tree, frozen_set_t *set) {
+  int *sorted = (int *)malloc(sizeof(int) * (tree->size ? tree->size : 1));
+  uint64_t count = 0;
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && AVL_NODE(tree, index)->left != NIL) {
+    index = AVL_NODE(tree, index)->left;
+  }
+
+  for (; index != NIL; index = avl_pool_next(tree, index)) {
+    sorted[count++] = AVL_NODE(tree, index)->value;
+  }
+
+  int result = frozen_set_init(set, sorted, count);
+
+  free(sorted);
+
+  return result;
+}
+
+// Writes the node array to path as a tree image (common/tree_image.h),
+// free slots included, so that saving is a single copy.
+int avl_pool_save(avl_pool_tree_t *tree, const char *path) {
+  return tree_image_save_pool(path, TREE_IMAGE_AVL, &tree->pool, tree->root,
+                              tree->size, sizeof(avl_pool_node_t));
+}
+
+// Replaces the tree with the image at path. The nodes are mapped rather
+// than read, so lookups can start at once and only fault in the pages
+// they visit; inserts and removes copy a page on its first write, and
+// the first growth of the pool moves the tree to anonymous memory. With
+// verify the whole image is read and checked against its checksum.
+int avl_pool_load(avl_pool_tree_t *tree, const char *path, bool verify) {
+  node_pool_t pool;
+  tree_image_header_t header;
+
+  if (tree_image_load(&pool, path, TREE_IMAGE_AVL, sizeof(avl_pool_node_t),
+                      &header, verify) < 0) {
+    return -1;
+  }
+
+  node_pool_destroy(&tree->pool);
+  tree->pool = pool;
+  tree->root = header.root;
+  tree->size = header.size;
+
+  return 0;
+}
+
+void avl_pool_print(avl_pool_tree_t *tree) {
+  printf("Tree Size: %llu, %u nodes mapped, ", (unsigned long long)tree->size,
+         tree->pool.capacity);
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && AVL_NODE(tree, index)->left != NIL) {
+    index = AVL_NODE(tree, index)->left;
+  }
+
+  for (; index != NIL; index = avl_pool_next(tree, index)) {
+    printf("(%d)", AVL_NODE(tree, index)->value);
+  }
+
+  printf("\n");
+}
+
+#ifndef AVL_POOL_NO_MAIN
+int main() {
+  printf("%zu bytes per node\n", sizeof(avl_pool_node_t));
+
+  avl_pool_tree_t tree = avl_pool_create(7);
+  avl_pool_insert(&tree, 3);
+  avl_pool_insert(&tree, 18);
+  avl_pool_insert(&tree, 10);
+  avl_pool_insert(&tree, 22);
+  avl_pool_insert(&tree, 26);
+  avl_pool_insert(&tree, 8);
+  avl_pool_print(&tree);
+  avl_pool_insert(&tree, 11);
+  avl_pool_insert(&tree, 15);
+  avl_pool_print(&tree);
+  avl_pool_remove(&tree, 18);
+  avl_pool_remove(&tree, 11);
+  avl_pool_print(&tree);
+
+  for (int i = 0; i < 100000; i++) {
+    avl_pool_insert(&tree, i);
+  }
+
+  printf("height %d after %llu inserts\n",
+         AVL_NODE(&tree, tree.root)->height, (unsigned long long)tree.size);
+
+  avl_pool_free(&tree);
+  return 0;
+}
+#endif
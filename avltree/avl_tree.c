@@ -4,67 +4,17 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct avl_node avl_node_t;
-
-/* ---------------------------------------------- */
-
-typedef struct avl_node_stack {
-  avl_node_t **array;
-  uint32_t size;
-  int64_t top;
-} avl_node_stack_t;
-
-avl_node_stack_t stack_create(uint32_t size) {
-  avl_node_stack_t stack = {
-      .array = (avl_node_t **)malloc(sizeof(avl_node_t *) * size),
-      .size = size,
-      .top = -1};
-
-  return stack;
-}
-
-void stack_free(avl_node_stack_t *stack) {
-  if (stack->array != NULL) {
-    free(stack->array);
-  }
-
-  stack->size = 0;
-  stack->top = -1;
-}
-
-avl_node_t *stack_peek(avl_node_stack_t *stack) {
-  if (stack->top == -1) {
-    return NULL;
-  }
-
-  return stack->array[stack->top];
-}
-
-avl_node_t *stack_pop(avl_node_stack_t *stack) {
-  if (stack->top == -1) {
-    return NULL;
-  }
-
-  avl_node_t *node = stack->array[stack->top];
-
-  stack->array[(stack->top)--] = NULL;
-
-  return node;
-}
-
-int stack_push(avl_node_stack_t *stack, avl_node_t *node) {
-  if (stack->top + 1 >= stack->size) {
-    return -1;
-  }
-
-  stack->array[++(stack->top)] = node;
-
-  return 0;
-}
-
-bool stack_is_empty(avl_node_stack_t *stack) { return stack->top == -1; }
+#include "../common/ascii_tree.h"
+#include "../common/frozen_set.h"
+#include "../common/node_stack.h"
+#include "../common/perf_counters.h"
+#include "../common/radix_sort.h"
+#include "../common/trace_log.h"
+#include "../common/tree_export.h"
+#include "../common/tree_image.h"
+#include "../common/workload_trace.h"
 
-/* ---------------------------------------------- */
+typedef struct avl_node avl_node_t;
 
 struct avl_node {
   int value;
@@ -95,257 +45,206 @@ void avl_print_node(avl_node_t *node) {
 typedef struct avl_tree {
   avl_node_t *root;
   uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
 } avl_tree_t;
 
-// TAKEN FROM THE INTERNET
-//
-// https://gist.github.com/ximik777/e04e5a9f0548a2f41cb09530924bdd9a/
-
-// printing tree in ascii
+// Printing the tree in ascii, see common/ascii_tree.h
 
-typedef struct asciinode_struct asciinode;
+// The number of nodes and the height of the subtree under top, for the
+// marker of a subtree that a view leaves out. The height is kept in the
+// node, the nodes are counted in preorder over the parent links.
+static void avl_subtree_shape(avl_node_t *top, uint64_t *count,
+                              int32_t *height) {
+  avl_node_t *node = top;
 
-struct asciinode_struct {
-  asciinode *left, *right;
+  *count = 0;
+  *height = 1 + (top->left_height > top->right_height ? top->left_height
+                                                      : top->right_height);
 
-  // length of the edge from this node to its children
-  int edge_length;
+  while (node != NULL) {
+    (*count)++;
 
-  int height;
+    if (node->left != NULL) {
+      node = node->left;
+    } else if (node->right != NULL) {
+      node = node->right;
+    } else {
+      // up to the first left child with a right sibling
+      while (node != top && (node->parent->right == node ||
+                             node->parent->right == NULL)) {
+        node = node->parent;
+      }
 
-  int lablen;
+      node = node != top ? node->parent->right : NULL;
+    }
+  }
+}
 
-  //-1=I am left, 0=I am root, 1=right
-  int parent_dir;
+// Copy the top depth levels of the tree under root into the ascii node
+// structure, all of them for a negative depth, with a marker of its size
+// for each subtree below them and the label of focus, if it is there, in
+// angle brackets. In preorder with a stack of the tree nodes still to
+// copy, each on top of its level and of the link its copy goes to, a
+// right child for each level at most. NULL if memory runs out.
+asciinode *build_ascii_view(avl_node_t *root, int depth, avl_node_t *focus) {
+  asciinode *proot = NULL;
+  node_stack_t pending;
+  bool failed = false;
+
+  if (root == NULL)
+    return NULL;
 
-  // max supported unit32 in dec, 10 digits max
-  char label[11];
-};
+  node_stack_init(&pending);
+  node_stack_push(&pending, &proot);
+  node_stack_push(&pending, (void *)(uintptr_t)0);
+  node_stack_push(&pending, root);
 
-#define MAX_HEIGHT 1000
-int lprofile[MAX_HEIGHT];
-int rprofile[MAX_HEIGHT];
-#define INFINITY (1 << 20)
+  while (!failed && !node_stack_is_empty(&pending)) {
+    avl_node_t *t = (avl_node_t *)node_stack_pop(&pending);
+    int level = (int)(uintptr_t)node_stack_pop(&pending);
+    asciinode **link = (asciinode **)node_stack_pop(&pending);
+    asciinode *node = malloc(sizeof(asciinode));
 
-// adjust gap between left and right nodes
-int gap = 3;
+    *link = node;
 
-// used for printing next node in the same level,
-// this is the x coordinate of the next char printed
-int print_next;
+    if (node == NULL) {
+      failed = true;
+      break;
+    }
 
-int MIN(int X, int Y) { return ((X) < (Y)) ? (X) : (Y); }
+    if (depth >= 0 && level >= depth) {
+      uint64_t count;
+      int32_t height;
 
-int MAX(int X, int Y) { return ((X) > (Y)) ? (X) : (Y); }
+      avl_subtree_shape(t, &count, &height);
+      ascii_tree_collapse(node, count, height);
+      continue;
+    }
 
-asciinode *build_ascii_tree_recursive(avl_node_t *t) {
-  asciinode *node;
+    node->left = NULL;
+    node->right = NULL;
+    node->x = 0;
+    sprintf(node->label, t == focus ? "<%d>" : "%d", t->value);
+    node->lablen = (int)strlen(node->label);
+
+    // the right child is copied after the left one
+    if (t->right != NULL) {
+      failed = node_stack_push(&pending, &node->right) < 0 ||
+               node_stack_push(&pending, (void *)(uintptr_t)(level + 1)) < 0 ||
+               node_stack_push(&pending, t->right) < 0;
+    }
 
-  if (t == NULL)
-    return NULL;
+    if (t->left != NULL && !failed) {
+      failed = node_stack_push(&pending, &node->left) < 0 ||
+               node_stack_push(&pending, (void *)(uintptr_t)(level + 1)) < 0 ||
+               node_stack_push(&pending, t->left) < 0;
+    }
+  }
 
-  node = malloc(sizeof(asciinode));
-  node->left = build_ascii_tree_recursive(t->left);
-  node->right = build_ascii_tree_recursive(t->right);
+  node_stack_free(&pending);
 
-  if (node->left != NULL) {
-    node->left->parent_dir = -1;
-  }
+  // out of memory, the links still pending are NULL
+  if (failed) {
+    free_ascii_tree(proot);
 
-  if (node->right != NULL) {
-    node->right->parent_dir = 1;
+    return NULL;
   }
 
-  sprintf(node->label, "%d", t->value);
-  node->lablen = (int)strlen(node->label);
+  return proot;
+}
 
-  return node;
+// Copy the tree into the ascii node structure. NULL if memory runs out.
+asciinode *build_ascii_tree(avl_node_t *root) {
+  return build_ascii_view(root, -1, NULL);
 }
 
-// Copy the tree into the ascii node structre
-asciinode *build_ascii_tree(avl_node_t *t) {
-  asciinode *node;
-  if (t == NULL)
-    return NULL;
-  node = build_ascii_tree_recursive(t);
-  node->parent_dir = 0;
-  return node;
+// Draws the tree under t to fd in one write, without touching stdout or
+// any global state, so that threads can draw trees at the same time.
+// Returns -1 if memory runs out or the write fails.
+int print_ascii_tree_fd(avl_node_t *t, int fd) {
+  asciinode *proot = build_ascii_tree(t);
+  ascii_tree_t ascii;
+  int result;
+
+  if (t != NULL && proot == NULL)
+    return -1;
+
+  ascii_tree_init(&ascii);
+  result = ascii_tree_render(&ascii, proot);
+  if (result == 0)
+    result = ascii_tree_write(&ascii, fd);
+  ascii_tree_free(&ascii);
+  free_ascii_tree(proot);
+
+  return result;
 }
 
-// Free all the nodes of the given tree
-void free_ascii_tree(asciinode *node) {
-  if (node == NULL)
-    return;
-  free_ascii_tree(node->left);
-  free_ascii_tree(node->right);
-  free(node);
+// Draws the view of build_ascii_view to fd, a line at a time.
+static int print_ascii_tree_view(avl_node_t *t, int fd, int depth,
+                                 avl_node_t *focus) {
+  asciinode *proot = build_ascii_view(t, depth, focus);
+  ascii_tree_t ascii;
+  int result;
+
+  if (t != NULL && proot == NULL)
+    return -1;
+
+  ascii_tree_init(&ascii);
+  ascii.fd = fd;
+  result = ascii_tree_render(&ascii, proot);
+  ascii_tree_free(&ascii);
+  free_ascii_tree(proot);
+
+  return result;
 }
 
-// The following function fills in the lprofile array for the given tree.
-// It assumes that the center of the label of the root of this tree
-// is located at a position (x,y).  It assumes that the edge_length
-// fields have been computed for this tree.
-void compute_lprofile(asciinode *node, int x, int y) {
-  int i, isleft;
-  if (node == NULL)
-    return;
-  isleft = (node->parent_dir == -1);
-  lprofile[y] = MIN(lprofile[y], x - ((node->lablen - isleft) / 2));
-  if (node->left != NULL) {
-    for (i = 1; i <= node->edge_length && y + i < MAX_HEIGHT; i++) {
-      lprofile[y + i] = MIN(lprofile[y + i], x - i);
-    }
-  }
-  compute_lprofile(node->left, x - node->edge_length - 1,
-                   y + node->edge_length + 1);
-  compute_lprofile(node->right, x + node->edge_length + 1,
-                   y + node->edge_length + 1);
+// prints ascii tree for given Tree structure
+void print_ascii_tree(avl_node_t *t) {
+  // what printf holds back goes first
+  fflush(stdout);
+  print_ascii_tree_fd(t, STDOUT_FILENO);
 }
 
-void compute_rprofile(asciinode *node, int x, int y) {
-  int i, notleft;
-  if (node == NULL)
-    return;
-  notleft = (node->parent_dir != -1);
-  rprofile[y] = MAX(rprofile[y], x + ((node->lablen - notleft) / 2));
-  if (node->right != NULL) {
-    for (i = 1; i <= node->edge_length && y + i < MAX_HEIGHT; i++) {
-      rprofile[y + i] = MAX(rprofile[y + i], x + i);
-    }
-  }
-  compute_rprofile(node->left, x - node->edge_length - 1,
-                   y + node->edge_length + 1);
-  compute_rprofile(node->right, x + node->edge_length + 1,
-                   y + node->edge_length + 1);
+// Draws the top depth levels of the tree under t to fd, with the size
+// of each subtree below them in its place. The lines go out as they are
+// drawn, so the memory it takes goes with the part that is drawn rather
+// than with the tree, and counting the nodes of the subtrees left out is
+// a walk over them in constant space. Returns -1 if memory runs out or a
+// write fails.
+int print_ascii_tree_top(avl_node_t *t, int fd, int depth) {
+  return print_ascii_tree_view(t, fd, depth < 0 ? 0 : depth, NULL);
 }
 
-// This function fills in the edge_length and
-// height fields of the specified tree
-void compute_edge_lengths(asciinode *node) {
-  int h, hmin, i, delta;
-  if (node == NULL)
-    return;
-  compute_edge_lengths(node->left);
-  compute_edge_lengths(node->right);
+// Draws the part of the tree under t around key: from above levels over
+// the node of key, or the one it would go under if it is not there, down
+// to below levels under it, with that node in angle brackets. As
+// print_ascii_tree_top otherwise.
+int print_ascii_tree_around(avl_node_t *t, int fd, int key, int above,
+                            int below) {
+  avl_node_t *focus = t;
+  avl_node_t *top;
+  int depth = 1 + (below < 0 ? 0 : below);
 
-  /* first fill in the edge_length of node */
-  if (node->right == NULL && node->left == NULL) {
-    node->edge_length = 0;
-  } else {
-    if (node->left != NULL) {
-      for (i = 0; i < node->left->height && i < MAX_HEIGHT; i++) {
-        rprofile[i] = -INFINITY;
-      }
-      compute_rprofile(node->left, 0, 0);
-      hmin = node->left->height;
-    } else {
-      hmin = 0;
-    }
-    if (node->right != NULL) {
-      for (i = 0; i < node->right->height && i < MAX_HEIGHT; i++) {
-        lprofile[i] = INFINITY;
-      }
-      compute_lprofile(node->right, 0, 0);
-      hmin = MIN(node->right->height, hmin);
-    } else {
-      hmin = 0;
-    }
-    delta = 4;
-    for (i = 0; i < hmin; i++) {
-      delta = MAX(delta, gap + 1 + rprofile[i] - lprofile[i]);
-    }
+  while (focus != NULL && focus->value != key) {
+    avl_node_t *next = focus->value > key ? focus->left : focus->right;
 
-    // If the node has two children of height 1, then we allow the
-    // two leaves to be within 1, instead of 2
-    if (((node->left != NULL && node->left->height == 1) ||
-         (node->right != NULL && node->right->height == 1)) &&
-        delta > 4) {
-      delta--;
+    if (next == NULL) {
+      break;
     }
 
-    node->edge_length = ((delta + 1) / 2) - 1;
-  }
-
-  // now fill in the height of node
-  h = 1;
-  if (node->left != NULL) {
-    h = MAX(node->left->height + node->edge_length + 1, h);
-  }
-  if (node->right != NULL) {
-    h = MAX(node->right->height + node->edge_length + 1, h);
+    focus = next;
   }
-  node->height = h;
-}
 
-// This function prints the given level of the given tree, assuming
-// that the node has the given x cordinate.
-void print_level(asciinode *node, int x, int level) {
-  int i, isleft;
-  if (node == NULL)
-    return;
-  isleft = (node->parent_dir == -1);
-  if (level == 0) {
-    for (i = 0; i < (x - print_next - ((node->lablen - isleft) / 2)); i++) {
-      printf(" ");
-    }
-    print_next += i;
-    printf("%s", node->label);
-    print_next += node->lablen;
-  } else if (node->edge_length >= level) {
-    if (node->left != NULL) {
-      for (i = 0; i < (x - print_next - (level)); i++) {
-        printf(" ");
-      }
-      print_next += i;
-      printf("/");
-      print_next++;
-    }
-    if (node->right != NULL) {
-      for (i = 0; i < (x - print_next + (level)); i++) {
-        printf(" ");
-      }
-      print_next += i;
-      printf("\\");
-      print_next++;
-    }
-  } else {
-    print_level(node->left, x - node->edge_length - 1,
-                level - node->edge_length - 1);
-    print_level(node->right, x + node->edge_length + 1,
-                level - node->edge_length - 1);
+  for (top = focus; top != NULL && top != t && above > 0; above--) {
+    top = top->parent;
+    depth++;
   }
-}
 
-// prints ascii tree for given Tree structure
-void print_ascii_tree(avl_node_t *t) {
-  asciinode *proot;
-  int xmin, i;
-  if (t == NULL)
-    return;
-  proot = build_ascii_tree(t);
-  compute_edge_lengths(proot);
-  for (i = 0; i < proot->height && i < MAX_HEIGHT; i++) {
-    lprofile[i] = INFINITY;
-  }
-  compute_lprofile(proot, 0, 0);
-  xmin = 0;
-  for (i = 0; i < proot->height && i < MAX_HEIGHT; i++) {
-    xmin = MIN(xmin, lprofile[i]);
-  }
-  for (i = 0; i < proot->height; i++) {
-    print_next = 0;
-    print_level(proot, -xmin, i);
-    printf("\n");
-  }
-  if (proot->height >= MAX_HEIGHT) {
-    printf("(This tree is taller than %d, and may be drawn incorrectly.)\n",
-           MAX_HEIGHT);
-  }
-  free_ascii_tree(proot);
+  return print_ascii_tree_view(top, fd, depth, focus);
 }
 
-// THE ABOVE WAS TAKEN FROM THE INTERNET
-
 avl_tree_t avl_tree_create(int value) {
   avl_node_t *node = (avl_node_t *)malloc(sizeof(avl_node_t));
   node->value = value;
@@ -360,32 +259,157 @@ avl_tree_t avl_tree_create(int value) {
   return tree;
 }
 
+// Post-order walks in constant space, over the parent links: the first
+// node of a subtree is the leaf reached by going left where there is a
+// left child and right otherwise, and the node after one is its parent,
+// unless it is a left child with a right sibling, whose subtree comes
+// first. avl_post_next reads nothing of node but its parent link, so the
+// caller may free node right after.
+
+static avl_node_t *avl_post_first(avl_node_t *node) {
+  while (node->left != NULL || node->right != NULL) {
+    node = node->left != NULL ? node->left : node->right;
+  }
+
+  return node;
+}
+
+// the node after node in the post-order of the subtree under top, or NULL
+// after top
+static avl_node_t *avl_post_next(avl_node_t *node, avl_node_t *top) {
+  if (node == top) {
+    return NULL;
+  }
+
+  avl_node_t *parent = node->parent;
+
+  if (parent->left == node && parent->right != NULL) {
+    return avl_post_first(parent->right);
+  }
+
+  return parent;
+}
+
+static void avl_free_subtree(avl_node_t *top) {
+  avl_node_t *node = avl_post_first(top);
+
+  while (node != NULL) {
+    avl_node_t *next = avl_post_next(node, top);
+
+    free(node);
+    node = next;
+  }
+}
+
 void avl_tree_free(avl_tree_t *tree) {
-  avl_node_stack_t node_stack = stack_create(tree->size);
-  avl_node_stack_t temp_stack = stack_create(tree->size);
+  if (tree->root == NULL) {
+    return;
+  }
 
-  stack_push(&temp_stack, tree->root);
+  avl_free_subtree(tree->root);
 
-  while (!stack_is_empty(&temp_stack)) {
-    avl_node_t *node = stack_pop(&temp_stack);
+  tree->root = NULL;
+  tree->size = 0;
+}
 
-    if (node->left != NULL) {
-      stack_push(&temp_stack, node->left);
+// subtrees handed out to the threads, several for each thread
+#define AVL_FREE_TASKS_PER_THREAD 4
+// below this many nodes per thread the threads cost more than they save
+#define AVL_FREE_MIN_NODES (1 << 16)
+
+typedef struct avl_free_job {
+  avl_node_t **tops;
+  uint64_t count;
+  _Atomic uint64_t next;
+} avl_free_job_t;
+
+static void *avl_free_worker(void *arg) {
+  avl_free_job_t *job = (avl_free_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->count) {
+      return NULL;
     }
 
-    if (node->right != NULL) {
-      stack_push(&temp_stack, node->right);
+    avl_free_subtree(job->tops[index]);
+  }
+}
+
+// Frees the tree as avl_tree_free does, on up to nthreads threads: the
+// top levels are freed a level at a time until there are enough disjoint
+// subtrees left under them, and the threads take those. Falls back to one
+// thread if the list of subtrees cannot be allocated. Build with -pthread.
+void avl_tree_free_parallel(avl_tree_t *tree, uint32_t nthreads) {
+  if (nthreads > tree->size / AVL_FREE_MIN_NODES) {
+    nthreads = (uint32_t)(tree->size / AVL_FREE_MIN_NODES);
+  }
+
+  if (nthreads > RADIX_MAX_THREADS) {
+    nthreads = RADIX_MAX_THREADS;
+  }
+
+  uint64_t wide = (uint64_t)nthreads * AVL_FREE_TASKS_PER_THREAD;
+  // a level of the subtrees holds at most twice as many as the one above
+  avl_node_t **tops = nthreads > 1
+                          ? (avl_node_t **)malloc(sizeof(avl_node_t *) * 4 *
+                                                  wide)
+                          : NULL;
+
+  if (tops == NULL) {
+    avl_tree_free(tree);
+
+    return;
+  }
+
+  avl_node_t **level = tops;
+  avl_node_t **below = tops + 2 * wide;
+  uint64_t count = 1;
+
+  level[0] = tree->root;
+
+  while (count > 0 && count < wide) {
+    uint64_t next = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+      avl_node_t *node = level[i];
+
+      if (node->left != NULL) {
+        below[next++] = node->left;
+      }
+
+      if (node->right != NULL) {
+        below[next++] = node->right;
+      }
+
+      free(node);
     }
 
-    stack_push(&node_stack, node);
+    avl_node_t **swap = level;
+    level = below;
+    below = swap;
+    count = next;
+  }
+
+  avl_free_job_t job = {.tops = level, .count = count, .next = 0};
+  pthread_t threads[RADIX_MAX_THREADS];
+  bool started[RADIX_MAX_THREADS];
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    started[t] =
+        pthread_create(&threads[t], NULL, avl_free_worker, &job) == 0;
   }
 
-  while (!stack_is_empty(&node_stack)) {
-    free(stack_pop(&node_stack));
+  avl_free_worker(&job);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
   }
 
-  stack_free(&node_stack);
-  stack_free(&temp_stack);
+  free(tops);
 
   tree->root = NULL;
   tree->size = 0;
@@ -520,7 +544,12 @@ static inline bool avl_is_left(avl_node_t *node, avl_node_t *other) {
   return node->left == other;
 }
 
+PERF_DEFINE_REGION(avl_perf_descent, "descent");
+PERF_DEFINE_REGION(avl_perf_update, "avl_tree_update");
+
 void avl_tree_update(avl_node_t *node) {
+  PERF_BEGIN(avl_perf_update);
+
   do {
     if (node->left == NULL) {
       node->left_height = 0;
@@ -538,15 +567,14 @@ void avl_tree_update(avl_node_t *node) {
 
     int32_t height_diff = avl_height_diff(node);
 
-    if (abs(height_diff) <= 1) {
-      printf("no rotate\n");
-    } else {
-      printf("rotate\n");
-    }
+    TRACE_LOG(TRACE_VERBOSE, TRACE_REBALANCE, "%d: heights %d/%d",
+              node->value, node->left_height, node->right_height);
 
     if (height_diff > 1) { // left heavy
       avl_node_t *child_node = node->left;
-      printf("%p\n", child_node);
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "%d: rotate with left %d",
+                node->value, child_node->value);
 
       // ll rotate
       if (child_node->left_height >= child_node->right_height) {
@@ -560,6 +588,9 @@ void avl_tree_update(avl_node_t *node) {
     if (height_diff < -1) { // right heavy
       avl_node_t *child_node = node->right;
 
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "%d: rotate with right %d",
+                node->value, child_node->value);
+
       // rr rotate
       if (child_node->right_height >= child_node->left_height) {
         avl_rotate_rr(node, child_node);
@@ -571,11 +602,15 @@ void avl_tree_update(avl_node_t *node) {
 
     node = node->parent;
   } while (node);
+
+  PERF_END(avl_perf_update);
 }
 
 int avl_node_insert(avl_node_t *node, avl_node_t *new_node) {
   avl_node_t *current_node = node;
 
+  PERF_BEGIN(avl_perf_descent);
+
   for (;;) {
     bool can_step = avl_can_step(current_node, new_node);
 
@@ -592,6 +627,8 @@ int avl_node_insert(avl_node_t *node, avl_node_t *new_node) {
     }
   }
 
+  PERF_END(avl_perf_descent);
+
   new_node->parent = current_node;
 
   // left
@@ -611,6 +648,8 @@ int avl_node_insert(avl_node_t *node, avl_node_t *new_node) {
 }
 
 int avl_tree_insert(avl_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
   avl_node_t *node = (avl_node_t *)malloc(sizeof(avl_node_t));
   node->value = value;
   node->parent = NULL;
@@ -642,35 +681,136 @@ void avl_tree_print(avl_tree_t *tree) {
   printf("Tree Size: %lu, ", tree->size);
 #endif
 
-  avl_node_stack_t node_stack = stack_create(tree->size);
-  avl_node_stack_t temp_stack = stack_create(tree->size);
+  if (tree->root != NULL) {
+    avl_node_t *node = avl_post_first(tree->root);
+
+    for (; node != NULL; node = avl_post_next(node, tree->root)) {
+      printf("(%d)", node->value);
+    }
+  }
+
+  printf("\n");
+}
+
+// Writes the tree to fd in the DOT language of Graphviz, see
+// common/tree_export.h, in preorder over the parent links. Returns -1 if
+// a write fails.
+int avl_tree_export_dot(avl_tree_t *tree, int fd) {
+  tree_export_t *out = (tree_export_t *)malloc(sizeof(tree_export_t));
+  avl_node_t *node = tree->root;
+
+  if (out == NULL) {
+    return -1;
+  }
 
-  stack_push(&temp_stack, tree->root);
+  tree_export_init(out, fd);
+  tree_export_dot_begin(out);
 
-  while (!stack_is_empty(&temp_stack)) {
-    avl_node_t *node = stack_pop(&temp_stack);
+  while (node != NULL) {
+    tree_export_dot_node(out, node, node->value, NULL);
 
     if (node->left != NULL) {
-      stack_push(&temp_stack, node->left);
+      tree_export_dot_edge(out, node, node->left);
+    } else if (node->right != NULL) {
+      tree_export_dot_nil(out, node);
     }
 
     if (node->right != NULL) {
-      stack_push(&temp_stack, node->right);
+      tree_export_dot_edge(out, node, node->right);
+    } else if (node->left != NULL) {
+      tree_export_dot_nil(out, node);
     }
 
-    stack_push(&node_stack, node);
+    if (node->left != NULL) {
+      node = node->left;
+    } else if (node->right != NULL) {
+      node = node->right;
+    } else {
+      // up to the first left child with a right sibling
+      while (node->parent != NULL && (node->parent->right == node ||
+                                      node->parent->right == NULL)) {
+        node = node->parent;
+      }
+
+      node = node->parent != NULL ? node->parent->right : NULL;
+    }
+  }
+
+  tree_export_dot_end(out);
+
+  int result = tree_export_finish(out);
+
+  free(out);
+
+  return result;
+}
+
+// Writes the tree to fd in JSON, see common/tree_export.h, in a walk over
+// the parent links that writes each node on the way down and closes it on
+// the way back up. Returns -1 if a write fails.
+int avl_tree_export_json(avl_tree_t *tree, int fd) {
+  tree_export_t *out = (tree_export_t *)malloc(sizeof(tree_export_t));
+  avl_node_t *node = tree->root;
+
+  if (out == NULL) {
+    return -1;
   }
 
-  while (!stack_is_empty(&node_stack)) {
-    avl_node_t *node = stack_pop(&node_stack);
+  tree_export_init(out, fd);
+  tree_export_json_begin(out, tree->size);
 
-    printf("(%d)", node->value);
+  if (node == NULL) {
+    tree_export_json_null(out);
   }
 
-  printf("\n");
+  while (node != NULL) {
+    tree_export_json_open(out, node->value, NULL);
+
+    if (node->left != NULL) {
+      node = node->left;
+      continue;
+    }
+
+    tree_export_json_null(out);
+    tree_export_json_right(out);
+
+    if (node->right != NULL) {
+      node = node->right;
+      continue;
+    }
+
+    tree_export_json_null(out);
+    tree_export_json_close(out);
+
+    // up to the first node whose right subtree is still to write, closing
+    // the ones that are done
+    while (node != tree->root) {
+      avl_node_t *parent = node->parent;
+
+      if (parent->left == node) {
+        tree_export_json_right(out);
+
+        if (parent->right != NULL) {
+          break;
+        }
+
+        tree_export_json_null(out);
+      }
+
+      tree_export_json_close(out);
+      node = parent;
+    }
+
+    node = node != tree->root ? node->parent->right : NULL;
+  }
 
-  stack_free(&node_stack);
-  stack_free(&temp_stack);
+  tree_export_json_end(out);
+
+  int result = tree_export_finish(out);
+
+  free(out);
+
+  return result;
 }
 
 bool avl_is_leaf(avl_node_t *node) {
@@ -680,14 +820,13 @@ bool avl_is_leaf(avl_node_t *node) {
 avl_node_t *avl_find_max(avl_node_t *node) {
   avl_node_t *current_node = node;
 
-  printf("Find\n");
-  avl_print_node(current_node);
-
   while (current_node->right) {
     current_node = current_node->right;
-    avl_print_node(current_node);
   }
 
+  TRACE_LOG(TRACE_VERBOSE, TRACE_SEARCH, "max below %d is %d", node->value,
+            current_node->value);
+
   return current_node;
 }
 
@@ -696,34 +835,41 @@ int avl_node_remove(avl_node_t *node, int value) {
 
   bool found = false;
 
+  PERF_BEGIN(avl_perf_descent);
+
   while (!found && current_node) {
     if (current_node->value == value) {
       found = true;
-    }
-
-    // left
-    if (current_node->value > value) {
+      // left
+    } else if (current_node->value > value) {
       current_node = current_node->left;
-    }
-
-    // right
-    if (current_node->value < value) {
+      // right
+    } else {
       current_node = current_node->right;
     }
   }
 
+  PERF_END(avl_perf_descent);
+
   if (!found) {
     return -1;
   }
 
   avl_node_t *update_node;
 
-  printf("Delete\n");
-  avl_print_node(current_node);
+  TRACE_LOG(TRACE_DEBUG, TRACE_REMOVE, "%d: left %p right %p", value,
+            (void *)current_node->left, (void *)current_node->right);
 
   if (avl_is_leaf(current_node)) {
     update_node = current_node->parent;
 
+    // the last node of the tree, avl_tree_remove clears the root
+    if (update_node == NULL) {
+      free(current_node);
+
+      return 0;
+    }
+
     if (avl_is_left(update_node, current_node)) {
       update_node->left = NULL;
     } else {
@@ -735,8 +881,8 @@ int avl_node_remove(avl_node_t *node, int value) {
     if (current_node->left) {
       avl_node_t *max_node = avl_find_max(current_node->left);
 
-      printf("Max\n");
-      avl_print_node(max_node);
+      TRACE_LOG(TRACE_DEBUG, TRACE_REMOVE, "%d: replaced by %d", value,
+                max_node->value);
 
       current_node->value = max_node->value;
 
@@ -749,7 +895,13 @@ int avl_node_remove(avl_node_t *node, int value) {
 
         update_node = max_node;
       } else {
-        max_node->parent->right = NULL;
+        // max_node is current_node->left itself when that has no right
+        // subtree
+        if (avl_is_left(max_node->parent, max_node)) {
+          max_node->parent->left = NULL;
+        } else {
+          max_node->parent->right = NULL;
+        }
 
         update_node = max_node->parent;
 
@@ -774,6 +926,8 @@ int avl_node_remove(avl_node_t *node, int value) {
 }
 
 int avl_tree_remove(avl_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
   if (tree->root == NULL) {
     return 0;
   }
@@ -791,17 +945,1349 @@ int avl_tree_remove(avl_tree_t *tree, int value) {
   return -1;
 }
 
-int main() {
-  avl_tree_t tree = avl_tree_create(7);
-  avl_tree_insert(&tree, 3);
-  avl_tree_insert(&tree, 18);
-  avl_tree_insert(&tree, 10);
-  avl_tree_insert(&tree, 22);
-  avl_tree_insert(&tree, 26);
-  avl_tree_insert(&tree, 8);
-  avl_tree_print(&tree);
-  print_ascii_tree(tree.root);
-  avl_tree_insert(&tree, 11);
+avl_node_t *avl_tree_find(avl_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
+
+  avl_node_t *current_node = tree->root;
+
+  while (current_node != NULL && current_node->value != value) {
+    // left
+    if (current_node->value > value) {
+      current_node = current_node->left;
+      // right
+    } else {
+      current_node = current_node->right;
+    }
+  }
+
+  return current_node;
+}
+
+// in order successor, NULL after the largest value
+avl_node_t *avl_next(avl_node_t *node) {
+  if (node->right != NULL) {
+    node = node->right;
+
+    while (node->left != NULL) {
+      node = node->left;
+    }
+
+    return node;
+  }
+
+  while (node->parent != NULL && node->parent->right == node) {
+    node = node->parent;
+  }
+
+  return node->parent;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t avl_tree_range(avl_tree_t *tree, int low, int high, int *out,
+                        uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  avl_node_t *current_node = tree->root;
+  avl_node_t *first = NULL;
+  uint64_t count = 0;
+
+  // the leftmost node not below low
+  while (current_node != NULL) {
+    if (current_node->value >= low) {
+      first = current_node;
+      current_node = current_node->left;
+    } else {
+      current_node = current_node->right;
+    }
+  }
+
+  for (avl_node_t *node = first; node != NULL && node->value <= high;
+       node = avl_next(node)) {
+    if (out != NULL && count < capacity) {
+      out[count] = node->value;
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+// Copies the values into a read-only frozen set, which answers lookups
+// without chasing node pointers. The tree is left as it is.
+int avl_tree_freeze(avl_tree_t *tree, frozen_set_t *set) {
+  int *sorted = (int *)malloc(sizeof(int) * (tree->size ? tree->size : 1));
+  uint64_t count = 0;
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  avl_node_t *node = tree->root;
+
+  while (node != NULL && node->left != NULL) {
+    node = node->left;
+  }
+
+  for (; node != NULL; node = avl_next(node)) {
+    sorted[count++] = node->value;
+  }
+
+  int result = frozen_set_init(set, sorted, count);
+
+  free(sorted);
+
+  return result;
+}
+
+/* ---------------------------------------------- */
+
+// Bulk construction from an unsorted batch: the values are radix sorted
+// (common/radix_sort.h) and the tree is built top down by splitting the
+// sorted run at its middle, which gives a subtree of n values the height
+// ceil(log2(n + 1)) and heights differing by at most one between
+// siblings, so every height is known from the sizes alone. The top
+// levels are built on the calling thread and the subtrees below them
+// handed out to the threads. A thread mallocs the nodes of its subtrees
+// one at a time, in the order it builds them.
+
+// subtrees below the top levels, several per thread for the balance
+#define AVL_BUILD_TASKS_PER_THREAD 4
+
+typedef struct avl_build_task {
+  uint64_t begin;
+  uint64_t end;
+  avl_node_t *parent;
+  // where the root of the subtree goes
+  avl_node_t **link;
+} avl_build_task_t;
+
+typedef struct avl_build_job {
+  const int *sorted;
+  avl_build_task_t *tasks;
+  uint64_t count;
+  _Atomic uint64_t next;
+  _Atomic bool failed;
+} avl_build_job_t;
+
+// of a subtree built from n values
+static inline int32_t avl_build_height(uint64_t n) {
+  return n ? 64 - __builtin_clzll(n) : 0;
+}
+
+static avl_node_t *avl_build_node(avl_build_job_t *job, uint64_t begin,
+                                  uint64_t end, avl_node_t *parent) {
+  uint64_t middle = begin + (end - begin) / 2;
+  avl_node_t *node = (avl_node_t *)malloc(sizeof(avl_node_t));
+
+  if (node == NULL) {
+    job->failed = true;
+
+    return NULL;
+  }
+
+  node->value = job->sorted[middle];
+  node->parent = parent;
+  node->left = NULL;
+  node->right = NULL;
+  node->left_height = avl_build_height(middle - begin);
+  node->right_height = avl_build_height(end - middle - 1);
+
+  return node;
+}
+
+static avl_node_t *avl_build_subtree(avl_build_job_t *job, uint64_t begin,
+                                     uint64_t end, avl_node_t *parent) {
+  if (begin == end) {
+    return NULL;
+  }
+
+  avl_node_t *node = avl_build_node(job, begin, end, parent);
+  uint64_t middle = begin + (end - begin) / 2;
+
+  if (node != NULL) {
+    node->left = avl_build_subtree(job, begin, middle, node);
+    node->right = avl_build_subtree(job, middle + 1, end, node);
+  }
+
+  return node;
+}
+
+// builds the levels above `depth` and queues the subtrees below them
+static void avl_build_top(avl_build_job_t *job, uint64_t begin, uint64_t end,
+                          avl_node_t *parent, avl_node_t **link,
+                          uint32_t depth) {
+  if (begin == end) {
+    *link = NULL;
+
+    return;
+  }
+
+  if (depth == 0) {
+    job->tasks[job->count++] = (avl_build_task_t){begin, end, parent, link};
+
+    return;
+  }
+
+  avl_node_t *node = *link = avl_build_node(job, begin, end, parent);
+  uint64_t middle = begin + (end - begin) / 2;
+
+  if (node != NULL) {
+    avl_build_top(job, begin, middle, node, &node->left, depth - 1);
+    avl_build_top(job, middle + 1, end, node, &node->right, depth - 1);
+  }
+}
+
+static void *avl_build_worker(void *arg) {
+  avl_build_job_t *job = (avl_build_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->count) {
+      return NULL;
+    }
+
+    avl_build_task_t *task = &job->tasks[index];
+
+    *task->link =
+        avl_build_subtree(job, task->begin, task->end, task->parent);
+  }
+}
+
+// Builds the tree from n values in any order, into an empty tree, using
+// up to nthreads threads for the sort and the build. With unique only
+// one copy of each value is kept. Returns -1 if the tree is not empty or
+// memory runs out, leaving it empty. Build with -pthread.
+int avl_tree_build(avl_tree_t *tree, const int *keys, uint64_t n,
+                   uint32_t nthreads, bool unique) {
+  if (tree->root != NULL) {
+    return -1;
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  if (nthreads == 0) {
+    nthreads = 1;
+  } else if (nthreads > RADIX_MAX_THREADS) {
+    nthreads = RADIX_MAX_THREADS;
+  }
+
+  int *sorted = (int *)malloc(sizeof(int) * n);
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  memcpy(sorted, keys, sizeof(int) * n);
+
+  if (radix_sort(sorted, n, nthreads) < 0) {
+    free(sorted);
+
+    return -1;
+  }
+
+  if (unique) {
+    n = radix_unique(sorted, n);
+  }
+
+  // enough levels on top for AVL_BUILD_TASKS_PER_THREAD subtrees a thread
+  uint64_t tasks = (uint64_t)nthreads * AVL_BUILD_TASKS_PER_THREAD;
+  uint32_t depth = 0;
+
+  while (nthreads > 1 && ((uint64_t)1 << depth) < tasks &&
+         ((uint64_t)1 << depth) < n) {
+    depth++;
+  }
+
+  avl_build_job_t job = {.sorted = sorted, .count = 0, .next = 0,
+                         .failed = false};
+  pthread_t threads[RADIX_MAX_THREADS];
+  bool started[RADIX_MAX_THREADS];
+
+  job.tasks = (avl_build_task_t *)malloc(sizeof(avl_build_task_t) *
+                                         ((size_t)1 << depth));
+
+  if (job.tasks == NULL) {
+    free(sorted);
+
+    return -1;
+  }
+
+  avl_build_top(&job, 0, n, NULL, &tree->root, depth);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    started[t] =
+        pthread_create(&threads[t], NULL, avl_build_worker, &job) == 0;
+  }
+
+  avl_build_worker(&job);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+
+  free(job.tasks);
+  free(sorted);
+
+  tree->size = n;
+
+  if (job.failed) {
+    avl_tree_free(tree);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// Batched updates: the batch is radix sorted and merged into the tree by
+// a union (insert) or difference (remove) built on join, as in Blelloch,
+// Ferizovic and Sun, "Just Join for Parallel Ordered Sets". It goes in
+// two sweeps. The first goes down breadth first, splitting the sorted
+// run of keys that reaches each node around its value by a binary search
+// and prefetching the children the two halves go on to, so that the
+// cache misses of a whole level of the tree overlap rather than come one
+// key at a time. Subtrees no key reaches are never entered, and a run of
+// a single key goes on down by itself: for an insert to a leaf, for a
+// remove to its node, which is joined out, either rebalancing up the
+// parent links only as far as the heights change, within the subtree the
+// run reached. That saves the entries of the levels below, most of the
+// tree for a small batch. The second goes back up, building the subtrees
+// that runs of keys land in empty and joining the two sides back under
+// each node, which rebalances the one spine where their heights meet, so
+// every touched path is fixed up once for the batch instead of once for
+// every key. Below the first level with enough nodes on it the sides are
+// disjoint, and the threads take the subtrees from there up.
+
+// nodes of the level handed out to the threads, several for each thread
+#define AVL_BATCH_TASKS_PER_THREAD 4
+// below this many keys per thread the threads cost more than they save
+#define AVL_BATCH_MIN_KEYS (1 << 16)
+// runs of one key taken down together, few enough that a child prefetched
+// on one pass over them is still in the cache on the next
+#define AVL_BATCH_TAIL_GROUP 64
+
+typedef struct avl_batch_entry {
+  avl_node_t *node;
+  // the run of keys that reaches node
+  uint64_t begin;
+  uint64_t end;
+  // the entries of the two sides, 0 for a side no key goes to
+  uint64_t left;
+  uint64_t right;
+  // a key of a remove is equal to the value of node
+  bool removed;
+  // the one key went down the rest of the way on its own
+  bool tail;
+  avl_node_t *result;
+  int32_t height;
+} avl_batch_entry_t;
+
+// a run of one key on its way down on its own
+typedef struct avl_batch_tail {
+  avl_node_t *node;
+  uint64_t entry;
+  int key;
+} avl_batch_tail_t;
+
+typedef struct avl_batch_job {
+  // the sorted batch
+  const int *keys;
+  // for an insert, a node holding each key
+  avl_node_t **nodes;
+  // for a remove, set for the keys that took out a node
+  bool *found;
+  avl_batch_entry_t *entries;
+  uint64_t count;
+  uint64_t capacity;
+  avl_batch_tail_t *tails;
+  // the level handed out to the threads
+  uint64_t first;
+  uint64_t last;
+  _Atomic uint64_t next;
+} avl_batch_job_t;
+
+// The joins take the heights of their subtrees from the caller, which
+// knows them from the fields of the parent, and relink only the sides
+// that change, so a node the batch does not reach is never read.
+
+static inline int32_t avl_join_height(avl_node_t *node) {
+  return 1 + max(node->left_height, node->right_height);
+}
+
+static inline void avl_join_set_left(avl_node_t *node, avl_node_t *child,
+                                     int32_t height) {
+  node->left = child;
+  node->left_height = height;
+
+  UPNULL(child, parent, node);
+}
+
+static inline void avl_join_set_right(avl_node_t *node, avl_node_t *child,
+                                      int32_t height) {
+  node->right = child;
+  node->right_height = height;
+
+  UPNULL(child, parent, node);
+}
+
+// unlike avl_rotate_ll and the others these move the nodes rather than
+// the values, returning the new top of the subtree
+static avl_node_t *avl_join_rotate_left(avl_node_t *node) {
+  avl_node_t *right = node->right;
+
+  avl_join_set_right(node, right->left, right->left_height);
+  avl_join_set_left(right, node, avl_join_height(node));
+
+  return right;
+}
+
+static avl_node_t *avl_join_rotate_right(avl_node_t *node) {
+  avl_node_t *left = node->left;
+
+  avl_join_set_left(node, left->right, left->right_height);
+  avl_join_set_right(left, node, avl_join_height(node));
+
+  return left;
+}
+
+// one rotation or two, if the sides of node are two levels apart
+static avl_node_t *avl_join_balance(avl_node_t *node) {
+  if (node->left_height > node->right_height + 1) {
+    avl_node_t *left = node->left;
+
+    if (left->right_height > left->left_height) {
+      left = avl_join_rotate_left(left);
+      avl_join_set_left(node, left, avl_join_height(left));
+    }
+
+    return avl_join_rotate_right(node);
+  }
+
+  if (node->right_height > node->left_height + 1) {
+    avl_node_t *right = node->right;
+
+    if (right->left_height > right->right_height) {
+      right = avl_join_rotate_right(right);
+      avl_join_set_right(node, right, avl_join_height(right));
+    }
+
+    return avl_join_rotate_left(node);
+  }
+
+  return node;
+}
+
+// left is taller than right by two or more: node and right go down its
+// right spine to where the heights meet
+static avl_node_t *avl_join_right(avl_node_t *left, avl_node_t *node,
+                                  avl_node_t *right, int32_t right_height) {
+  avl_node_t *child;
+
+  if (left->right_height <= right_height + 1) {
+    avl_join_set_left(node, left->right, left->right_height);
+    avl_join_set_right(node, right, right_height);
+
+    child = avl_join_height(node) > left->left_height + 1
+                ? avl_join_rotate_right(node)
+                : node;
+  } else {
+    child = avl_join_right(left->right, node, right, right_height);
+  }
+
+  avl_join_set_right(left, child, avl_join_height(child));
+
+  if (left->right_height <= left->left_height + 1) {
+    return left;
+  }
+
+  return avl_join_rotate_left(left);
+}
+
+static avl_node_t *avl_join_left(avl_node_t *left, int32_t left_height,
+                                 avl_node_t *node, avl_node_t *right) {
+  avl_node_t *child;
+
+  if (right->left_height <= left_height + 1) {
+    avl_join_set_left(node, left, left_height);
+    avl_join_set_right(node, right->left, right->left_height);
+
+    child = avl_join_height(node) > right->right_height + 1
+                ? avl_join_rotate_left(node)
+                : node;
+  } else {
+    child = avl_join_left(left, left_height, node, right->left);
+  }
+
+  avl_join_set_left(right, child, avl_join_height(child));
+
+  if (right->left_height <= right->right_height + 1) {
+    return right;
+  }
+
+  return avl_join_rotate_right(right);
+}
+
+// Makes a balanced subtree of left, node and right, where every value in
+// left is at most that of node and every one in right at least that.
+static avl_node_t *avl_join(avl_node_t *left, int32_t left_height,
+                            avl_node_t *node, avl_node_t *right,
+                            int32_t right_height) {
+  if (left_height > right_height + 1) {
+    return avl_join_right(left, node, right, right_height);
+  }
+
+  if (right_height > left_height + 1) {
+    return avl_join_left(left, left_height, node, right);
+  }
+
+  avl_join_set_left(node, left, left_height);
+  avl_join_set_right(node, right, right_height);
+
+  return node;
+}
+
+// takes the largest node out of the subtree, returns what is left
+static avl_node_t *avl_split_last(avl_node_t *node, avl_node_t **last,
+                                  int32_t *height) {
+  if (node->right == NULL) {
+    *last = node;
+    *height = node->left_height;
+
+    return node->left;
+  }
+
+  int32_t right_height;
+  avl_node_t *right = avl_split_last(node->right, last, &right_height);
+
+  // the right side lost at most one level
+  if (right_height + 1 >= node->left_height) {
+    avl_join_set_right(node, right, right_height);
+  } else {
+    node = avl_join(node->left, node->left_height, node, right, right_height);
+  }
+
+  *height = avl_join_height(node);
+
+  return node;
+}
+
+// avl_join without the node in the middle
+static avl_node_t *avl_join2(avl_node_t *left, int32_t left_height,
+                             avl_node_t *right, int32_t right_height,
+                             int32_t *height) {
+  if (left == NULL) {
+    *height = right_height;
+
+    return right;
+  }
+
+  avl_node_t *last;
+
+  left = avl_split_last(left, &last, &left_height);
+  last = avl_join(left, left_height, last, right, right_height);
+  *height = avl_join_height(last);
+
+  return last;
+}
+
+// the first key in [begin, end) not below value
+static uint64_t avl_batch_search(const int *keys, uint64_t begin,
+                                 uint64_t end, int value) {
+  while (begin < end) {
+    uint64_t middle = begin + (end - begin) / 2;
+
+    if (keys[middle] < value) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+
+  return begin;
+}
+
+// Entries a batch of n keys can need on a tree of the given height: the
+// runs on a level are disjoint, so it has no more entries than keys, and
+// there is one level below the nodes for the empty links.
+static uint64_t avl_batch_capacity(int32_t height, uint64_t n) {
+  uint64_t capacity = 0;
+
+  for (int32_t depth = 0; depth <= height; depth++) {
+    capacity += depth < 63 && ((uint64_t)1 << depth) < n
+                    ? (uint64_t)1 << depth
+                    : n;
+  }
+
+  return capacity;
+}
+
+static int avl_batch_reserve(avl_batch_job_t *job, uint64_t capacity) {
+  if (capacity <= job->capacity) {
+    return 0;
+  }
+
+  avl_batch_entry_t *entries = (avl_batch_entry_t *)realloc(
+      job->entries, sizeof(avl_batch_entry_t) * capacity);
+
+  if (entries == NULL) {
+    return -1;
+  }
+
+  job->entries = entries;
+  job->capacity = capacity;
+
+  return 0;
+}
+
+// Hangs leaf under node, at the bottom of the subtree of entry, and
+// rebalances the path up to its top, as avl_tree_update does but only
+// as far as the heights change.
+static void avl_batch_attach(avl_batch_entry_t *entry, avl_node_t *node,
+                             avl_node_t *leaf) {
+  avl_node_t *child = leaf;
+  bool left = leaf->value < node->value;
+
+  avl_join_set_left(leaf, NULL, 0);
+  avl_join_set_right(leaf, NULL, 0);
+
+  for (;;) {
+    int32_t height = avl_join_height(node);
+    avl_node_t *parent = node->parent;
+
+    if (left) {
+      avl_join_set_left(node, child, avl_join_height(child));
+    } else {
+      avl_join_set_right(node, child, avl_join_height(child));
+    }
+
+    avl_node_t *top = avl_join_balance(node);
+
+    if (node == entry->node) {
+      entry->result = top;
+      entry->height = avl_join_height(top);
+
+      return;
+    }
+
+    // a rotation brings the height back to what it was
+    if (top != node || avl_join_height(node) == height) {
+      if (parent->left == node) {
+        avl_join_set_left(parent, top, avl_join_height(top));
+      } else {
+        avl_join_set_right(parent, top, avl_join_height(top));
+      }
+
+      entry->result = entry->node;
+      entry->height = avl_join_height(entry->node);
+
+      return;
+    }
+
+    left = parent->left == node;
+    child = node;
+    node = parent;
+  }
+}
+
+// Takes the runs of one key down the rest of the way, a level at a time
+// for a group of them, so that their cache misses overlap as well.
+static void avl_batch_tails(avl_batch_job_t *job, uint64_t total) {
+  for (uint64_t begin = 0; begin < total; begin += AVL_BATCH_TAIL_GROUP) {
+    avl_batch_tail_t *tails = job->tails + begin;
+    uint64_t count = total - begin < AVL_BATCH_TAIL_GROUP
+                         ? total - begin
+                         : AVL_BATCH_TAIL_GROUP;
+
+    while (count > 0) {
+      for (uint64_t i = 0; i < count;) {
+        avl_node_t *node = tails[i].node;
+        avl_node_t *child =
+            tails[i].key < node->value ? node->left : node->right;
+
+        if (child != NULL) {
+          __builtin_prefetch(child);
+
+          tails[i++].node = child;
+        } else {
+          avl_batch_entry_t *entry = &job->entries[tails[i].entry];
+
+          avl_batch_attach(entry, node, job->nodes[entry->begin]);
+
+          tails[i] = tails[--count];
+        }
+      }
+    }
+  }
+}
+
+// Takes node out of the bottom of the subtree of entry, and joins its
+// sides back together in its place, rebalancing the path up to the top
+// of the subtree as avl_tree_update does, but only as far as the heights
+// change.
+static void avl_batch_detach(avl_batch_entry_t *entry, avl_node_t *node) {
+  avl_node_t *top = entry->node;
+  avl_node_t *current = node;
+  avl_node_t *parent = node != top ? node->parent : NULL;
+  bool left = parent != NULL && parent->left == node;
+  int32_t height;
+  avl_node_t *result = avl_join2(node->left, node->left_height, node->right,
+                                 node->right_height, &height);
+
+  free(node);
+
+  // current is the node whose place result takes, on the left of parent
+  // or on its right
+  while (current != top) {
+    avl_node_t *above = parent != top ? parent->parent : NULL;
+    bool above_left = above != NULL && above->left == parent;
+    int32_t before = avl_join_height(parent);
+
+    if (left) {
+      avl_join_set_left(parent, result, height);
+    } else {
+      avl_join_set_right(parent, result, height);
+    }
+
+    result = avl_join_balance(parent);
+    height = avl_join_height(result);
+
+    // the rest of the path keeps its heights
+    if (height == before && above != NULL) {
+      if (above_left) {
+        avl_join_set_left(above, result, height);
+      } else {
+        avl_join_set_right(above, result, height);
+      }
+
+      entry->result = top;
+      entry->height = avl_join_height(top);
+
+      return;
+    }
+
+    current = parent;
+    parent = above;
+    left = above_left;
+  }
+
+  entry->result = result;
+  entry->height = height;
+}
+
+// avl_batch_tails for a remove, down to the node of each key
+static void avl_batch_remove_tails(avl_batch_job_t *job, uint64_t total) {
+  for (uint64_t begin = 0; begin < total; begin += AVL_BATCH_TAIL_GROUP) {
+    avl_batch_tail_t *tails = job->tails + begin;
+    uint64_t count = total - begin < AVL_BATCH_TAIL_GROUP
+                         ? total - begin
+                         : AVL_BATCH_TAIL_GROUP;
+
+    while (count > 0) {
+      for (uint64_t i = 0; i < count;) {
+        avl_node_t *node = tails[i].node;
+        avl_batch_entry_t *entry = &job->entries[tails[i].entry];
+
+        if (tails[i].key == node->value) {
+          job->found[entry->begin] = true;
+          avl_batch_detach(entry, node);
+
+          tails[i] = tails[--count];
+          continue;
+        }
+
+        avl_node_t *child =
+            tails[i].key < node->value ? node->left : node->right;
+
+        if (child != NULL) {
+          __builtin_prefetch(child);
+
+          tails[i++].node = child;
+        } else {
+          // not there, the subtree is as it was
+          entry->result = entry->node;
+          entry->height = avl_join_height(entry->node);
+
+          tails[i] = tails[--count];
+        }
+      }
+    }
+  }
+}
+
+// The first sweep, down from root with keys[0, n). It changes nothing
+// but the tails, which go last, so it can fail for want of memory with
+// the tree as it was.
+static int avl_batch_descend(avl_batch_job_t *job, avl_node_t *root,
+                             uint64_t n, uint32_t nthreads) {
+  int32_t height = root != NULL ? avl_join_height(root) : 0;
+
+  if (avl_batch_reserve(job, avl_batch_capacity(height, n)) < 0) {
+    return -1;
+  }
+
+  avl_batch_entry_t *entries = job->entries;
+  uint64_t wide = (uint64_t)nthreads * AVL_BATCH_TASKS_PER_THREAD;
+  uint64_t count = 1;
+  uint64_t level_end = 1;
+  uint64_t tails = 0;
+
+  entries[0] = (avl_batch_entry_t){.node = root, .begin = 0, .end = n};
+  job->first = 0;
+  job->last = 0;
+
+  for (uint64_t i = 0; i < count; i++) {
+    // [i, count) is the next level down
+    if (i == level_end) {
+      if (nthreads > 1 && job->last == 0 && count - i >= wide) {
+        job->first = i;
+        job->last = count;
+      }
+
+      level_end = count;
+    }
+
+    avl_batch_entry_t *entry = &entries[i];
+    avl_node_t *node = entry->node;
+
+    entry->left = 0;
+    entry->right = 0;
+    entry->removed = false;
+    entry->tail = false;
+
+    if (node == NULL) {
+      continue;
+    }
+
+    if (entry->end - entry->begin == 1) {
+      entry->tail = true;
+      job->tails[tails++] = (avl_batch_tail_t){
+          .node = node, .entry = i, .key = job->keys[entry->begin]};
+
+      continue;
+    }
+
+    // equal values go right, as in avl_node_insert
+    uint64_t split =
+        avl_batch_search(job->keys, entry->begin, entry->end, node->value);
+    uint64_t right = split;
+
+    if (job->found != NULL && split < entry->end &&
+        job->keys[split] == node->value) {
+      entry->removed = true;
+      job->found[split] = true;
+      right++;
+    }
+
+    if (split > entry->begin) {
+      if (node->left != NULL) {
+        __builtin_prefetch(node->left);
+      }
+
+      entry->left = count;
+      entries[count++] = (avl_batch_entry_t){
+          .node = node->left, .begin = entry->begin, .end = split};
+    }
+
+    if (right < entry->end) {
+      if (node->right != NULL) {
+        __builtin_prefetch(node->right);
+      }
+
+      entry->right = count;
+      entries[count++] = (avl_batch_entry_t){
+          .node = node->right, .begin = right, .end = entry->end};
+    }
+  }
+
+  job->count = count;
+
+  if (job->found != NULL) {
+    avl_batch_remove_tails(job, tails);
+  } else {
+    avl_batch_tails(job, tails);
+  }
+
+  return 0;
+}
+
+static avl_node_t *avl_batch_build(avl_node_t **nodes, uint64_t begin,
+                                   uint64_t end) {
+  if (begin == end) {
+    return NULL;
+  }
+
+  uint64_t middle = begin + (end - begin) / 2;
+  avl_node_t *node = nodes[middle];
+
+  avl_join_set_left(node, avl_batch_build(nodes, begin, middle),
+                    avl_build_height(middle - begin));
+  avl_join_set_right(node, avl_batch_build(nodes, middle + 1, end),
+                     avl_build_height(end - middle - 1));
+
+  return node;
+}
+
+// The second sweep at one entry, whose sides are done. A side no key went
+// to is as it was, still linked to node, and unless the heights are too
+// far apart it is not touched at all: for a small batch most of the
+// nodes on the way down have such a side.
+static void avl_batch_settle(avl_batch_job_t *job, avl_batch_entry_t *entry) {
+  avl_node_t *node = entry->node;
+
+  if (entry->tail) {
+    return;
+  }
+
+  if (node == NULL) {
+    entry->result = job->nodes != NULL
+                        ? avl_batch_build(job->nodes, entry->begin, entry->end)
+                        : NULL;
+    entry->height =
+        job->nodes != NULL ? avl_build_height(entry->end - entry->begin) : 0;
+
+    return;
+  }
+
+  avl_batch_entry_t *left = entry->left ? &job->entries[entry->left] : NULL;
+  avl_batch_entry_t *right = entry->right ? &job->entries[entry->right] : NULL;
+  avl_node_t *left_node = left != NULL ? left->result : node->left;
+  avl_node_t *right_node = right != NULL ? right->result : node->right;
+  int32_t left_height = left != NULL ? left->height : node->left_height;
+  int32_t right_height = right != NULL ? right->height : node->right_height;
+
+  if (entry->removed) {
+    entry->result = avl_join2(left_node, left_height, right_node,
+                              right_height, &entry->height);
+
+    free(node);
+
+    return;
+  }
+
+  if (abs(left_height - right_height) > 1) {
+    node = avl_join(left_node, left_height, node, right_node, right_height);
+  } else {
+    if (left != NULL) {
+      avl_join_set_left(node, left_node, left_height);
+    }
+
+    if (right != NULL) {
+      avl_join_set_right(node, right_node, right_height);
+    }
+  }
+
+  entry->result = node;
+  entry->height = avl_join_height(node);
+}
+
+// the second sweep over the subtree of an entry, depth first
+static void avl_batch_finish(avl_batch_job_t *job, uint64_t index) {
+  avl_batch_entry_t *entry = &job->entries[index];
+
+  if (entry->left) {
+    avl_batch_finish(job, entry->left);
+  }
+
+  if (entry->right) {
+    avl_batch_finish(job, entry->right);
+  }
+
+  avl_batch_settle(job, entry);
+}
+
+static void *avl_batch_worker(void *arg) {
+  avl_batch_job_t *job = (avl_batch_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->last) {
+      return NULL;
+    }
+
+    avl_batch_finish(job, index);
+  }
+}
+
+// runs both sweeps for keys[0, n), returns -1, with the tree as it was,
+// if memory runs out
+static int avl_batch_run(avl_batch_job_t *job, avl_node_t **root,
+                         uint64_t n, uint32_t nthreads) {
+  if (avl_batch_descend(job, *root, n, nthreads) < 0) {
+    return -1;
+  }
+
+  uint64_t top = job->count;
+
+  if (job->last > job->first) {
+    pthread_t threads[RADIX_MAX_THREADS];
+    bool started[RADIX_MAX_THREADS];
+
+    job->next = job->first;
+
+    for (uint32_t t = 0; t + 1 < nthreads; t++) {
+      started[t] =
+          pthread_create(&threads[t], NULL, avl_batch_worker, job) == 0;
+    }
+
+    avl_batch_worker(job);
+
+    for (uint32_t t = 0; t + 1 < nthreads; t++) {
+      if (started[t]) {
+        pthread_join(threads[t], NULL);
+      }
+    }
+
+    top = job->first;
+  }
+
+  // every entry comes after its parent
+  while (top-- > 0) {
+    avl_batch_settle(job, &job->entries[top]);
+  }
+
+  *root = job->entries[0].result;
+
+  UPNULL((*root), parent, NULL);
+
+  return 0;
+}
+
+// the threads a batch of n keys is worth
+static inline uint32_t avl_batch_threads(uint32_t nthreads, uint64_t n) {
+  if (nthreads > n / AVL_BATCH_MIN_KEYS) {
+    nthreads = (uint32_t)(n / AVL_BATCH_MIN_KEYS);
+  }
+
+  if (nthreads == 0) {
+    return 1;
+  }
+
+  return nthreads > RADIX_MAX_THREADS ? RADIX_MAX_THREADS : nthreads;
+}
+
+// Inserts n values in any order, with the same result as inserting them
+// one at a time, using up to nthreads threads. Returns -1, with the tree
+// as it was, if memory runs out. Build with -pthread.
+int avl_tree_insert_batch(avl_tree_t *tree, const int *keys, uint64_t n,
+                          uint32_t nthreads) {
+  for (uint64_t i = 0; i < n; i++) {
+    WORKLOAD_RECORD(tree, WORKLOAD_INSERT, keys[i], keys[i]);
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  nthreads = avl_batch_threads(nthreads, n);
+
+  avl_batch_job_t job = {.found = NULL, .entries = NULL, .capacity = 0};
+  int *sorted = (int *)malloc(sizeof(int) * n);
+
+  job.nodes = (avl_node_t **)malloc(sizeof(avl_node_t *) * n);
+  job.tails = (avl_batch_tail_t *)malloc(sizeof(avl_batch_tail_t) * n);
+
+  uint64_t allocated = 0;
+
+  if (sorted != NULL && job.nodes != NULL && job.tails != NULL) {
+    memcpy(sorted, keys, sizeof(int) * n);
+
+    if (radix_sort(sorted, n, nthreads) == 0) {
+      for (; allocated < n; allocated++) {
+        job.nodes[allocated] = (avl_node_t *)malloc(sizeof(avl_node_t));
+
+        if (job.nodes[allocated] == NULL) {
+          break;
+        }
+
+        job.nodes[allocated]->value = sorted[allocated];
+      }
+    }
+  }
+
+  job.keys = sorted;
+
+  int result = allocated == n
+                   ? avl_batch_run(&job, &tree->root, n, nthreads)
+                   : -1;
+
+  if (result < 0) {
+    for (uint64_t i = 0; i < allocated; i++) {
+      free(job.nodes[i]);
+    }
+  } else {
+    tree->size += n;
+  }
+
+  free(sorted);
+  free(job.nodes);
+  free(job.tails);
+  free(job.entries);
+
+  return result;
+}
+
+// Removes one copy of each of n values in any order, with the same
+// result as removing them one at a time, using up to nthreads threads.
+// Returns how many were found, or -1, with the tree as it was, if memory
+// runs out. Build with -pthread.
+int64_t avl_tree_remove_batch(avl_tree_t *tree, const int *keys, uint64_t n,
+                              uint32_t nthreads) {
+  for (uint64_t i = 0; i < n; i++) {
+    WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, keys[i], keys[i]);
+  }
+
+  if (n == 0 || tree->root == NULL) {
+    return 0;
+  }
+
+  nthreads = avl_batch_threads(nthreads, n);
+
+  avl_batch_job_t job = {.nodes = NULL, .entries = NULL, .capacity = 0};
+  int *sorted = (int *)malloc(sizeof(int) * n);
+  int *copies = (int *)malloc(sizeof(int) * n);
+
+  job.found = (bool *)malloc(sizeof(bool) * n);
+  job.tails = (avl_batch_tail_t *)malloc(sizeof(avl_batch_tail_t) * n);
+
+  if (sorted == NULL || copies == NULL || job.found == NULL ||
+      job.tails == NULL) {
+    free(sorted);
+    free(copies);
+    free(job.found);
+    free(job.tails);
+
+    return -1;
+  }
+
+  memcpy(sorted, keys, sizeof(int) * n);
+
+  int64_t removed = radix_sort(sorted, n, nthreads);
+
+  // A node goes with one key at most, so the keys go in rounds of
+  // distinct ones: the copies of a value come back in the next round as
+  // long as the value was found.
+  for (bool first = true; removed >= 0 && n > 0; first = false) {
+    uint64_t unique = 0;
+    uint64_t extra = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+      if (unique == 0 || sorted[i] != sorted[unique - 1]) {
+        sorted[unique++] = sorted[i];
+      } else {
+        copies[extra++] = sorted[i];
+      }
+    }
+
+    memset(job.found, 0, sizeof(bool) * unique);
+
+    job.keys = sorted;
+
+    if (avl_batch_run(&job, &tree->root, unique, nthreads) < 0) {
+      if (first) {
+        removed = -1;
+
+        break;
+      }
+
+      // what is left, one at a time, rather than stop half way
+      memcpy(sorted + unique, copies, sizeof(int) * extra);
+
+      for (uint64_t i = 0; i < n; i++) {
+        if (tree->root != NULL && avl_node_remove(tree->root, sorted[i]) >= 0) {
+          if (tree->size == (uint64_t)++removed) {
+            tree->root = NULL;
+          }
+        }
+      }
+
+      break;
+    }
+
+    n = 0;
+
+    for (uint64_t i = 0, j = 0; i < extra; i++) {
+      while (sorted[j] != copies[i]) {
+        j++;
+      }
+
+      if (job.found[j]) {
+        copies[n++] = copies[i];
+      }
+    }
+
+    for (uint64_t j = 0; j < unique; j++) {
+      removed += job.found[j];
+    }
+
+    int *swap = sorted;
+    sorted = copies;
+    copies = swap;
+  }
+
+  if (removed > 0) {
+    tree->size -= removed;
+  }
+
+  free(sorted);
+  free(copies);
+  free(job.found);
+  free(job.tails);
+  free(job.entries);
+
+  return removed;
+}
+
+// A node as avltree/avl_pool.c lays it out, which is what the image holds.
+typedef struct avl_image_node {
+  int value;
+  uint32_t parent;
+  uint32_t left;
+  uint32_t right;
+  int32_t height;
+} avl_image_node_t;
+
+typedef struct avl_image_entry {
+  avl_node_t *node;
+  uint32_t parent;
+  // 0 for the root, else which link of the parent to fill in
+  uint32_t side;
+  uint32_t depth;
+} avl_image_entry_t;
+
+// Writes the tree to path as a tree image (common/tree_image.h), to be
+// loaded with avl_pool_load. The nodes are laid out in blocks: each
+// block is the top levels of a subtree, in breadth first order, as many
+// as fill a page, so a lookup in the mapped image faults in about one
+// page per block rather than one per level.
+int avl_tree_save(avl_tree_t *tree, const char *path) {
+  uint32_t block_depth = tree_image_block_depth(sizeof(avl_image_node_t));
+  uint64_t roots_capacity = 64;
+  uint64_t roots_count = 0;
+  avl_image_entry_t *roots =
+      (avl_image_entry_t *)malloc(sizeof(avl_image_entry_t) * roots_capacity);
+  avl_image_entry_t *block = (avl_image_entry_t *)malloc(
+      sizeof(avl_image_entry_t) * ((size_t)1 << block_depth));
+  tree_image_writer_t writer;
+
+  if (roots == NULL || block == NULL ||
+      tree_image_create(&writer, path, TREE_IMAGE_AVL,
+                        sizeof(avl_image_node_t), tree->size + 1) < 0) {
+    free(roots);
+    free(block);
+
+    return -1;
+  }
+
+  avl_image_node_t *nodes = (avl_image_node_t *)writer.nodes;
+  uint32_t next = 1;
+
+  if (tree->root != NULL) {
+    roots[roots_count++] = (avl_image_entry_t){tree->root, 0, 0, 0};
+  }
+
+  for (uint64_t r = 0; r < roots_count; r++) {
+    uint64_t head = 0;
+    uint64_t tail = 0;
+
+    block[tail++] = roots[r];
+
+    while (head < tail) {
+      avl_image_entry_t entry = block[head++];
+      avl_node_t *node = entry.node;
+
+      if (next > tree->size) {
+        // more nodes than the tree claims to hold
+        free(roots);
+        free(block);
+
+        return tree_image_abort(&writer);
+      }
+
+      uint32_t index = next++;
+      avl_image_node_t *image = &nodes[index];
+
+      image->value = node->value;
+      image->parent = entry.parent;
+      image->height = 1 + (node->left_height > node->right_height
+                               ? node->left_height
+                               : node->right_height);
+
+      if (entry.side == 1) {
+        nodes[entry.parent].left = index;
+      } else if (entry.side == 2) {
+        nodes[entry.parent].right = index;
+      }
+
+      avl_node_t *children[2] = {node->left, node->right};
+
+      for (uint32_t side = 0; side < 2; side++) {
+        if (children[side] == NULL) {
+          continue;
+        }
+
+        avl_image_entry_t child = {children[side], index, side + 1,
+                                   entry.depth + 1};
+
+        if (child.depth < block_depth) {
+          block[tail++] = child;
+          continue;
+        }
+
+        if (roots_count == roots_capacity) {
+          avl_image_entry_t *grown = (avl_image_entry_t *)realloc(
+              roots, sizeof(avl_image_entry_t) * roots_capacity * 2);
+
+          if (grown == NULL) {
+            free(roots);
+            free(block);
+
+            return tree_image_abort(&writer);
+          }
+
+          roots = grown;
+          roots_capacity *= 2;
+        }
+
+        child.depth = 0;
+        roots[roots_count++] = child;
+      }
+    }
+  }
+
+  free(roots);
+  free(block);
+
+  // fewer nodes than the tree claims to hold
+  if (next != tree->size + 1) {
+    return tree_image_abort(&writer);
+  }
+
+  return tree_image_finish(&writer, tree->root != NULL ? 1 : 0, tree->size,
+                           0);
+}
+
+#ifndef AVL_TREE_NO_MAIN
+int main() {
+  avl_tree_t tree = avl_tree_create(7);
+  avl_tree_insert(&tree, 3);
+  avl_tree_insert(&tree, 18);
+  avl_tree_insert(&tree, 10);
+  avl_tree_insert(&tree, 22);
+  avl_tree_insert(&tree, 26);
+  avl_tree_insert(&tree, 8);
+  avl_tree_print(&tree);
+  print_ascii_tree(tree.root);
+  avl_tree_insert(&tree, 11);
   avl_tree_print(&tree);
   print_ascii_tree(tree.root);
   avl_tree_insert(&tree, 15);
@@ -817,3 +2303,4 @@ int main() {
   avl_tree_free(&tree);
   return 0;
 }
+#endif
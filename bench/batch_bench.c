@@ -0,0 +1,213 @@
+// cc -O2 -DNDEBUG -DBENCH_AVL -pthread -o batch_bench_avl batch_bench.c
+// cc -O2 -DNDEBUG -DBENCH_RB -pthread -o batch_bench_rb batch_bench.c
+//
+// batch_bench [--seed N] [--keys N] [--batch N[,N...]] [--threads N[,N...]]
+//             [--ops N] [--json] [--check]
+//
+// Compares the two ways of applying batches of random keys to a tree of
+// --keys random keys: one insert or remove per key, and the batched
+// insert and remove on each thread count of --threads. Every batch is
+// inserted and then removed again, for about --ops keys in all per batch
+// size, so the tree keeps its size. Reports the wall time of each in
+// nanoseconds per key. --check validates the tree invariants after every
+// run.
+
+#include "tree_engine.h"
+
+#include <time.h>
+
+#include "bench_random.h"
+
+#if !defined(BENCH_AVL) && !defined(BENCH_RB)
+#error "the batched updates are only there for the AVL and red-black trees"
+#endif
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t bench_parse(char *list, uint64_t *values) {
+  uint32_t count = 0;
+
+  while (*list != '\0' && count < 32) {
+    values[count++] = strtoull(list, &list, 10);
+
+    if (*list == ',') {
+      list++;
+    }
+  }
+
+  return count;
+}
+
+static void bench_print(bool json, bool first, uint64_t batch,
+                        const char *method, uint64_t threads, double ns,
+                        bool check, bool valid) {
+  if (json) {
+    printf("%s{\"batch\": %llu, \"method\": \"%s\", \"threads\": %llu, "
+           "\"ns_per_key\": %.1f",
+           first ? "" : ", ", (unsigned long long)batch, method,
+           (unsigned long long)threads, ns);
+
+    if (check) {
+      printf(", \"valid\": %s", valid ? "true" : "false");
+    }
+
+    printf("}");
+  } else {
+    printf("%-4s %10llu %-12s %8llu %10.1f%s\n", BENCH_ENGINE,
+           (unsigned long long)batch, method, (unsigned long long)threads,
+           ns, check && !valid ? "  invalid" : "");
+  }
+}
+
+// inserts and then removes every batch, one key at a time if threads is
+// 0, adding the time of each to insert_ns and remove_ns
+static bool bench_run(bench_tree_t *tree, const int *keys, uint64_t batch,
+                      uint64_t rounds, uint32_t threads, uint64_t *insert_ns,
+                      uint64_t *remove_ns) {
+  for (uint64_t r = 0; r < rounds; r++) {
+    const int *run = keys + r * batch;
+    uint64_t start = bench_now();
+
+    if (threads == 0) {
+      for (uint64_t j = 0; j < batch; j++) {
+        bench_insert(tree, run[j]);
+      }
+    } else if (bench_insert_batch(tree, run, batch, threads) < 0) {
+      return false;
+    }
+
+    uint64_t middle = bench_now();
+
+    if (threads == 0) {
+      for (uint64_t j = 0; j < batch; j++) {
+        bench_remove(tree, run[j]);
+      }
+    } else if (bench_remove_batch(tree, run, batch, threads) !=
+               (int64_t)batch) {
+      return false;
+    }
+
+    *insert_ns += middle - start;
+    *remove_ns += bench_now() - middle;
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint64_t n = 1000000;
+  uint64_t ops = 1000000;
+  uint64_t batches[32] = {1000, 10000, 100000};
+  uint64_t threads[32] = {1, 2, 4, 8};
+  uint32_t batch_count = 3;
+  uint32_t thread_count = 4;
+  bool json = false;
+  bool check = false;
+  bool valid = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      bench_state = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      n = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch_count = bench_parse(argv[++i], batches);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_count = bench_parse(argv[++i], threads);
+    } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      ops = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--seed N] [--keys N] [--batch N[,N...]] "
+              "[--threads N[,N...]] [--ops N] [--json] [--check]\n",
+              argv[0]);
+
+      return 1;
+    }
+  }
+
+  int *base = (int *)malloc(sizeof(int) * (n ? n : 1));
+
+  if (base == NULL) {
+    fprintf(stderr, "out of memory at %llu keys\n", (unsigned long long)n);
+
+    return 1;
+  }
+
+  for (uint64_t j = 0; j < n; j++) {
+    base[j] = (int)bench_random();
+  }
+
+  if (json) {
+    printf("{\"engine\": \"%s\", \"keys\": %llu, \"results\": [",
+           BENCH_ENGINE, (unsigned long long)n);
+  } else {
+    printf("%-4s %10s %-12s %8s %10s\n", "tree", "batch", "method",
+           "threads", "ns/key");
+  }
+
+  for (uint32_t i = 0; i < batch_count; i++) {
+    uint64_t batch = batches[i] ? batches[i] : 1;
+    uint64_t rounds = ops / batch ? ops / batch : 1;
+    int *keys = (int *)malloc(sizeof(int) * batch * rounds);
+
+    if (keys == NULL) {
+      fprintf(stderr, "out of memory at batches of %llu\n",
+              (unsigned long long)batch);
+
+      return 1;
+    }
+
+    for (uint64_t j = 0; j < batch * rounds; j++) {
+      keys[j] = (int)bench_random();
+    }
+
+    // 0 threads for the loop of single updates
+    for (uint32_t t = 0; t <= thread_count; t++) {
+      uint32_t nthreads = t == 0 ? 0 : (uint32_t)threads[t - 1];
+      uint64_t insert_ns = 0;
+      uint64_t remove_ns = 0;
+      bench_tree_t tree = {0};
+
+      if (bench_build(&tree, base, n, 1) < 0 ||
+          !bench_run(&tree, keys, batch, rounds, nthreads, &insert_ns,
+                     &remove_ns)) {
+        fprintf(stderr, "batch failed at batches of %llu\n",
+                (unsigned long long)batch);
+
+        return 1;
+      }
+
+      bool ok = !check || (tree.size == n && bench_check(&tree));
+      double total = (double)(batch * rounds);
+
+      bench_print(json, i == 0 && t == 0, batch,
+                  t == 0 ? "insert" : "insert_batch", t == 0 ? 1 : nthreads,
+                  insert_ns / total, check, ok);
+      bench_print(json, false, batch, t == 0 ? "remove" : "remove_batch",
+                  t == 0 ? 1 : nthreads, remove_ns / total, check, ok);
+      valid = valid && ok;
+      bench_free(&tree);
+    }
+
+    free(keys);
+  }
+
+  if (json) {
+    printf("]}\n");
+  }
+
+  free(base);
+
+  return valid ? 0 : 2;
+}
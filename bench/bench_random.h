@@ -0,0 +1,20 @@
+#ifndef BENCH_RANDOM_H
+#define BENCH_RANDOM_H
+
+#include <stdint.h>
+
+// The random numbers of the benchmarks, splitmix64, so that runs are
+// reproducible across platforms. --seed sets bench_state.
+
+static uint64_t bench_state = 1;
+
+static inline uint64_t bench_random(void) {
+  uint64_t z = (bench_state += UINT64_C(0x9e3779b97f4a7c15));
+
+  z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+
+  return z ^ (z >> 31);
+}
+
+#endif
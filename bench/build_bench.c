@@ -0,0 +1,166 @@
+// cc -O2 -DNDEBUG -DBENCH_AVL -pthread -o build_bench_avl build_bench.c
+// cc -O2 -DNDEBUG -DBENCH_RB -pthread -o build_bench_rb build_bench.c
+//
+// build_bench [--seed N] [--keys N[,N...]] [--threads N[,N...]] [--json]
+//             [--check]
+//
+// Compares the two ways of filling a tree from an unsorted batch of
+// random keys: one insert per key, and the bulk build (radix sort, then
+// a balanced tree built top down) on each thread count of --threads.
+// Reports the wall time of each in nanoseconds per key, and that of
+// freeing the tree again, on one thread after the inserts and on as many
+// as the build had after it. --check validates the tree invariants after
+// every build.
+
+#include "tree_engine.h"
+
+#include <time.h>
+
+#include "bench_random.h"
+
+#if !defined(BENCH_AVL) && !defined(BENCH_RB)
+#error "the bulk build is only there for the AVL and red-black trees"
+#endif
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t bench_parse(char *list, uint64_t *values) {
+  uint32_t count = 0;
+
+  while (*list != '\0' && count < 32) {
+    values[count++] = strtoull(list, &list, 10);
+
+    if (*list == ',') {
+      list++;
+    }
+  }
+
+  return count;
+}
+
+static void bench_print(bool json, bool first, uint64_t keys,
+                        const char *method, uint64_t threads, double ns,
+                        bool check, bool valid) {
+  if (json) {
+    printf("%s{\"keys\": %llu, \"method\": \"%s\", \"threads\": %llu, "
+           "\"ns_per_key\": %.1f",
+           first ? "" : ", ", (unsigned long long)keys, method,
+           (unsigned long long)threads, ns);
+
+    if (check) {
+      printf(", \"valid\": %s", valid ? "true" : "false");
+    }
+
+    printf("}");
+  } else {
+    printf("%-4s %10llu %-7s %8llu %10.1f%s\n", BENCH_ENGINE,
+           (unsigned long long)keys, method, (unsigned long long)threads, ns,
+           check && !valid ? "  invalid" : "");
+  }
+}
+
+int main(int argc, char **argv) {
+  uint64_t sizes[32] = {100000, 1000000, 10000000};
+  uint64_t threads[32] = {1, 2, 4, 8};
+  uint32_t size_count = 3;
+  uint32_t thread_count = 4;
+  bool json = false;
+  bool check = false;
+  bool valid = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      bench_state = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      size_count = bench_parse(argv[++i], sizes);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_count = bench_parse(argv[++i], threads);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--seed N] [--keys N[,N...]] [--threads N[,N...]] "
+              "[--json] [--check]\n",
+              argv[0]);
+
+      return 1;
+    }
+  }
+
+  if (json) {
+    printf("{\"engine\": \"%s\", \"results\": [", BENCH_ENGINE);
+  } else {
+    printf("%-4s %10s %-7s %8s %10s\n", "tree", "keys", "method", "threads",
+           "ns/key");
+  }
+
+  for (uint32_t i = 0; i < size_count; i++) {
+    uint64_t n = sizes[i];
+    int *keys = (int *)malloc(sizeof(int) * (n ? n : 1));
+
+    if (keys == NULL) {
+      fprintf(stderr, "out of memory at %llu keys\n", (unsigned long long)n);
+
+      return 1;
+    }
+
+    for (uint64_t j = 0; j < n; j++) {
+      keys[j] = (int)bench_random();
+    }
+
+    bench_tree_t tree = {0};
+    uint64_t start = bench_now();
+
+    for (uint64_t j = 0; j < n; j++) {
+      bench_insert(&tree, keys[j]);
+    }
+
+    double ns = (double)(bench_now() - start) / (n ? n : 1);
+    bool ok = !check || bench_check(&tree);
+
+    bench_print(json, i == 0, n, "insert", 1, ns, check, ok);
+    valid = valid && ok;
+    start = bench_now();
+    bench_free(&tree);
+    ns = (double)(bench_now() - start) / (n ? n : 1);
+    bench_print(json, false, n, "free", 1, ns, false, true);
+
+    for (uint32_t t = 0; t < thread_count; t++) {
+      bench_tree_t built = {0};
+
+      start = bench_now();
+
+      if (bench_build(&built, keys, n, (uint32_t)threads[t]) < 0) {
+        fprintf(stderr, "build failed at %llu keys\n", (unsigned long long)n);
+
+        return 1;
+      }
+
+      ns = (double)(bench_now() - start) / (n ? n : 1);
+      ok = !check || (built.size == n && bench_check(&built));
+
+      bench_print(json, false, n, "build", threads[t], ns, check, ok);
+      valid = valid && ok;
+      start = bench_now();
+      bench_free_parallel(&built, (uint32_t)threads[t]);
+      ns = (double)(bench_now() - start) / (n ? n : 1);
+      bench_print(json, false, n, "free", threads[t], ns, false, true);
+    }
+
+    free(keys);
+  }
+
+  if (json) {
+    printf("]}\n");
+  }
+
+  return valid ? 0 : 2;
+}
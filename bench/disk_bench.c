@@ -0,0 +1,197 @@
+// cc -O2 -DNDEBUG -o disk_bench disk_bench.c
+//
+// disk_bench [--seed N] [--keys N] [--queries N] [--frames N[,N...]]
+//            [--file PATH] [--json]
+//
+// Measures lookups on the on-disk B+tree (disktree/disk_tree.c) against a
+// local file. The tree is built once with --keys random values in PATH
+// (disk_bench.db by default, removed at the end). Then, for every buffer
+// pool size in --frames, the file is reopened and the same --queries
+// lookups, half of them values that are present, run twice:
+//
+//   cold   after disk_tree_drop_cache, which empties the buffer pool and
+//          asks the kernel to drop the file from its page cache
+//   warm   right after the cold pass, with whatever it left cached
+//
+// and the time per lookup and buffer pool misses per lookup are reported.
+// A pool smaller than the tree stays cold for the pages it cannot hold.
+
+#define DISK_TREE_NO_MAIN
+#include "../disktree/disk_tree.c"
+
+#include <time.h>
+
+#include "bench_random.h"
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct disk_result {
+  double ns;
+  double misses;
+  uint64_t hits;
+} disk_result_t;
+
+static void bench_lookups(disk_tree_t *tree, const int *query,
+                          uint64_t queries, disk_result_t *result) {
+  uint64_t misses = tree->cache.misses;
+  uint64_t hits = 0;
+  uint64_t start = bench_now();
+
+  for (uint64_t i = 0; i < queries; i++) {
+    hits += disk_tree_find(tree, query[i]);
+  }
+
+  result->ns = (double)(bench_now() - start) / queries;
+  result->misses = (double)(tree->cache.misses - misses) / queries;
+  result->hits = hits;
+}
+
+static void bench_print(bool json, bool first, uint64_t keys, uint32_t frames,
+                        const char *phase, disk_result_t *result) {
+  if (json) {
+    printf("%s{\"keys\": %llu, \"frames\": %u, \"phase\": \"%s\", "
+           "\"ns\": %.1f, \"misses\": %.3f, \"hits\": %llu}",
+           first ? "" : ", ", (unsigned long long)keys, frames, phase,
+           result->ns, result->misses, (unsigned long long)result->hits);
+  } else {
+    printf("%-6s %10llu %8u %-6s %10.1f %10.3f %10llu\n", "disk",
+           (unsigned long long)keys, frames, phase, result->ns,
+           result->misses, (unsigned long long)result->hits);
+  }
+}
+
+int main(int argc, char **argv) {
+  uint32_t frames[32] = {64, 1024, 16384};
+  int count = 3;
+  uint64_t keys = 10000000;
+  uint64_t queries = 100000;
+  const char *path = "disk_bench.db";
+  bool json = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      bench_state = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      keys = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+      queries = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      char *list = argv[++i];
+
+      for (count = 0; *list != '\0' && count < 32; count++) {
+        frames[count] = (uint32_t)strtoul(list, &list, 10);
+
+        if (*list == ',') {
+          list++;
+        }
+      }
+    } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+      path = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--seed N] [--keys N] [--queries N] "
+              "[--frames N[,N...]] [--file PATH] [--json]\n",
+              argv[0]);
+
+      return 1;
+    }
+  }
+
+  if (queries == 0) {
+    fprintf(stderr, "--queries must be positive\n");
+
+    return 1;
+  }
+
+  int *inserted = (int *)malloc(sizeof(int) * (keys ? keys : 1));
+  int *query = (int *)malloc(sizeof(int) * queries);
+  disk_tree_t tree;
+
+  if (inserted == NULL || query == NULL) {
+    fprintf(stderr, "out of memory\n");
+
+    return 1;
+  }
+
+  unlink(path);
+
+  // build with a pool large enough that the build is not the benchmark
+  if (disk_tree_open(&tree, path, 65536) < 0) {
+    perror(path);
+
+    return 1;
+  }
+
+  uint64_t start = bench_now();
+
+  for (uint64_t i = 0; i < keys; i++) {
+    inserted[i] = (int)bench_random();
+
+    if (disk_tree_insert(&tree, inserted[i]) < 0) {
+      fprintf(stderr, "insert failed at %llu keys\n", (unsigned long long)i);
+
+      return 1;
+    }
+  }
+
+  if (disk_tree_close(&tree) < 0) {
+    perror(path);
+
+    return 1;
+  }
+
+  double build = (double)(bench_now() - start) / (keys ? keys : 1);
+
+  for (uint64_t i = 0; i < queries; i++) {
+    uint64_t r = bench_random();
+
+    query[i] = (r & 1) && keys > 0 ? inserted[(r >> 1) % keys] : (int)(r >> 32);
+  }
+
+  if (json) {
+    printf("{\"engine\": \"disk\", \"keys\": %llu, \"insert_ns\": %.1f, "
+           "\"queries\": %llu, \"results\": [",
+           (unsigned long long)keys, build, (unsigned long long)queries);
+  } else {
+    printf("built %llu keys at %.1f ns per insert\n", (unsigned long long)keys,
+           build);
+    printf("%-6s %10s %8s %-6s %10s %10s %10s\n", "engine", "keys", "frames",
+           "phase", "ns", "misses", "hits");
+  }
+
+  for (int i = 0; i < count; i++) {
+    disk_result_t cold;
+    disk_result_t warm;
+
+    if (disk_tree_open(&tree, path, frames[i]) < 0 ||
+        disk_tree_drop_cache(&tree) < 0) {
+      perror(path);
+
+      return 1;
+    }
+
+    bench_lookups(&tree, query, queries, &cold);
+    bench_lookups(&tree, query, queries, &warm);
+    bench_print(json, i == 0, keys, tree.cache.capacity, "cold", &cold);
+    bench_print(json, false, keys, tree.cache.capacity, "warm", &warm);
+    disk_tree_close(&tree);
+  }
+
+  if (json) {
+    printf("]}\n");
+  }
+
+  unlink(path);
+  free(inserted);
+  free(query);
+
+  return 0;
+}
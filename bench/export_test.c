@@ -0,0 +1,226 @@
+// cc -O2 -DBENCH_AVL -pthread -o export_test_avl export_test.c
+// cc -O2 -DBENCH_RB -pthread -o export_test_rb export_test.c
+//
+// export_test [--seed N] [--keys N]
+//
+// Exports trees holding equal keys more than once, the 5 5 5 3 7 of the
+// smallest case and --keys random keys out of a range of a tenth as many,
+// as DOT and reads the graph back: each node has to be named once, with
+// its key as the label, and every edge has to join two of them, with no
+// node its own child and every node but the root the child of just one.
+// Exits with 1 on the first graph that is off.
+
+#include "tree_engine.h"
+
+#include <string.h>
+
+#include "bench_random.h"
+
+#if !defined(BENCH_AVL) && !defined(BENCH_RB)
+#error "the DOT export is only there for the AVL and red-black trees"
+#endif
+
+typedef struct export_node {
+  unsigned long long id;
+  int label;
+  uint32_t parents;
+} export_node_t;
+
+static int export_compare_ids(const void *a, const void *b) {
+  unsigned long long x = ((const export_node_t *)a)->id;
+  unsigned long long y = ((const export_node_t *)b)->id;
+
+  return (x > y) - (x < y);
+}
+
+static int export_compare_ints(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+
+  return (x > y) - (x < y);
+}
+
+static export_node_t *export_lookup(export_node_t *nodes, uint64_t n,
+                                    unsigned long long id) {
+  export_node_t key = {.id = id};
+
+  return bsearch(&key, nodes, n, sizeof(export_node_t), export_compare_ids);
+}
+
+// Checks the DOT in file against the n keys the tree was built from.
+// Returns false, having said why, when it is off.
+static bool export_check(FILE *file, int *keys, uint64_t n) {
+  export_node_t *nodes = malloc((n + 1) * sizeof(export_node_t));
+  int *labels = malloc((n + 1) * sizeof(int));
+  uint64_t count = 0;
+  uint64_t edges = 0;
+  bool ok = true;
+  char line[256];
+
+  if (nodes == NULL || labels == NULL) {
+    fprintf(stderr, "out of memory\n");
+    free(nodes);
+    free(labels);
+    return false;
+  }
+
+  // the nodes first, then the edges between them
+  while (fgets(line, sizeof(line), file) != NULL) {
+    unsigned long long id;
+    int label;
+
+    if (sscanf(line, " n%llx [label=\"%d\"", &id, &label) != 2) {
+      continue;
+    }
+
+    if (count == n) {
+      fprintf(stderr, "more nodes than the %llu keys\n",
+              (unsigned long long)n);
+      ok = false;
+      break;
+    }
+
+    nodes[count] = (export_node_t){.id = id, .label = label};
+    labels[count] = label;
+    count++;
+  }
+
+  if (ok && count != n) {
+    fprintf(stderr, "%llu nodes for %llu keys\n", (unsigned long long)count,
+            (unsigned long long)n);
+    ok = false;
+  }
+
+  qsort(nodes, count, sizeof(export_node_t), export_compare_ids);
+
+  for (uint64_t i = 1; ok && i < count; i++) {
+    if (nodes[i].id == nodes[i - 1].id) {
+      fprintf(stderr, "node n%llx named twice\n", nodes[i].id);
+      ok = false;
+    }
+  }
+
+  qsort(labels, count, sizeof(int), export_compare_ints);
+  qsort(keys, n, sizeof(int), export_compare_ints);
+
+  if (ok && memcmp(labels, keys, n * sizeof(int)) != 0) {
+    fprintf(stderr, "the labels are not the keys\n");
+    ok = false;
+  }
+
+  rewind(file);
+
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    unsigned long long from;
+    unsigned long long to;
+    char end;
+
+    if (sscanf(line, " n%llx -> n%llx%c", &from, &to, &end) != 3 ||
+        end != ';') {
+      continue;
+    }
+
+    export_node_t *child = export_lookup(nodes, count, to);
+
+    if (from == to) {
+      fprintf(stderr, "node n%llx is its own child\n", from);
+      ok = false;
+    } else if (export_lookup(nodes, count, from) == NULL || child == NULL) {
+      fprintf(stderr, "edge n%llx -> n%llx to no node\n", from, to);
+      ok = false;
+    } else if (++child->parents > 1) {
+      fprintf(stderr, "node n%llx has two parents\n", to);
+      ok = false;
+    }
+
+    edges++;
+  }
+
+  if (ok && n > 0 && edges != n - 1) {
+    fprintf(stderr, "%llu edges between %llu nodes\n",
+            (unsigned long long)edges, (unsigned long long)n);
+    ok = false;
+  }
+
+  free(nodes);
+  free(labels);
+
+  return ok;
+}
+
+// builds a tree of the n keys, exports it and checks what comes out
+static bool export_test(int *keys, uint64_t n) {
+  bench_tree_t tree = {0};
+  FILE *file = tmpfile();
+  bool ok;
+
+  if (file == NULL) {
+    perror("tmpfile");
+    return false;
+  }
+
+  for (uint64_t i = 0; i < n; i++) {
+    bench_insert(&tree, keys[i]);
+  }
+
+  if (bench_export_dot(&tree, fileno(file)) != 0) {
+    fprintf(stderr, "export failed\n");
+    ok = false;
+  } else {
+    // the export wrote to the descriptor behind the stream, and left it
+    // at the end
+    rewind(file);
+    ok = export_check(file, keys, n);
+  }
+
+  fclose(file);
+  bench_free(&tree);
+
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint64_t nkeys = 10000;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      bench_state = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      nkeys = strtoull(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--seed N] [--keys N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int small[] = {5, 5, 5, 3, 7};
+
+  if (!export_test(small, sizeof(small) / sizeof(small[0]))) {
+    fprintf(stderr, BENCH_ENGINE ": 5 5 5 3 7 exported wrong\n");
+    return 1;
+  }
+
+  int *keys = malloc((nkeys + 1) * sizeof(int));
+  uint64_t range = nkeys / 10 + 1;
+
+  if (keys == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  for (uint64_t i = 0; i < nkeys; i++) {
+    keys[i] = (int)(bench_random() % range);
+  }
+
+  if (!export_test(keys, nkeys)) {
+    fprintf(stderr, BENCH_ENGINE ": %llu keys exported wrong\n",
+            (unsigned long long)nkeys);
+    free(keys);
+    return 1;
+  }
+
+  free(keys);
+  printf(BENCH_ENGINE ": ok\n");
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+// cc -O2 -DNDEBUG -DBENCH_AVL -pthread -o frozen_bench_avl frozen_bench.c
+// cc -O2 -DNDEBUG -DBENCH_RB -pthread -o frozen_bench_rb frozen_bench.c
+// cc -O2 -DNDEBUG -DBENCH_BP -o frozen_bench_bp frozen_bench.c
+// cc -O2 -DNDEBUG -DBENCH_AVL_POOL -o frozen_bench_avl_pool frozen_bench.c
+// cc -O2 -DNDEBUG -DBENCH_RB_POOL -o frozen_bench_rb_pool frozen_bench.c
+//
+// Adding -mavx2 (or -march=native) turns on the gather based batch search.
+//
+// frozen_bench [--seed N] [--keys N[,N...]] [--queries N] [--json] [--check]
+//
+// Compares lookups on a live tree with the same keys frozen into an
+// Eytzinger array (common/frozen_set.h). For every size the tree is
+// filled with random keys and frozen, then the same queries, half of them
+// keys that are present, go through
+//
+//   tree      bench_find on the live tree
+//   frozen    frozen_set_contains, one search at a time
+//   batch     frozen_set_lower_bound_batch over the whole query array
+//
+// and the best of three passes is reported in nanoseconds per query.
+// --check compares every answer with a binary search over the sorted keys.
+
+#include "tree_engine.h"
+
+#include <time.h>
+
+#include "bench_random.h"
+
+#define FROZEN_BENCH_PASSES 3
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_compare(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+
+  return (x > y) - (x < y);
+}
+
+// first index in sorted[0, n) whose key is >= key
+static uint64_t bench_lower_bound(const int *sorted, uint64_t n, int key) {
+  uint64_t low = 0;
+
+  while (n > 0) {
+    uint64_t half = n / 2;
+
+    if (sorted[low + half] < key) {
+      low += half + 1;
+      n -= half + 1;
+    } else {
+      n = half;
+    }
+  }
+
+  return low;
+}
+
+typedef struct frozen_result {
+  double tree_ns;
+  double frozen_ns;
+  double batch_ns;
+  // number of hits, equal for all three when they agree
+  uint64_t tree_hits;
+  uint64_t frozen_hits;
+  uint64_t batch_hits;
+  bool valid;
+} frozen_result_t;
+
+// checks one lower_bound answer against the sorted keys
+static bool bench_check_answer(const frozen_set_t *set, const int *sorted,
+                               uint64_t n, int query, uint64_t index) {
+  uint64_t expected = bench_lower_bound(sorted, n, query);
+
+  if (expected == n) {
+    return index == FROZEN_NONE;
+  }
+
+  return index != FROZEN_NONE && frozen_set_key(set, index) == sorted[expected];
+}
+
+static int bench_size(uint64_t n, uint64_t queries, bool check,
+                      frozen_result_t *result) {
+  bench_tree_t tree = {0};
+  frozen_set_t set;
+  int *keys = (int *)malloc(sizeof(int) * (n ? n : 1));
+  int *query = (int *)malloc(sizeof(int) * queries);
+  uint64_t *out = (uint64_t *)malloc(sizeof(uint64_t) * queries);
+
+  if (keys == NULL || query == NULL || out == NULL) {
+    free(keys);
+    free(query);
+    free(out);
+
+    return -1;
+  }
+
+  for (uint64_t i = 0; i < n; i++) {
+    keys[i] = (int)bench_random();
+    bench_insert(&tree, keys[i]);
+  }
+
+  for (uint64_t i = 0; i < queries; i++) {
+    uint64_t r = bench_random();
+
+    query[i] = (r & 1) && n > 0 ? keys[(r >> 1) % n] : (int)(r >> 32);
+  }
+
+  if (bench_freeze(&tree, &set) < 0) {
+    bench_free(&tree);
+    free(keys);
+    free(query);
+    free(out);
+
+    return -1;
+  }
+
+  result->tree_ns = result->frozen_ns = result->batch_ns = 0;
+  result->valid = true;
+
+  for (int pass = 0; pass < FROZEN_BENCH_PASSES; pass++) {
+    uint64_t hits = 0;
+    uint64_t start = bench_now();
+
+    for (uint64_t i = 0; i < queries; i++) {
+      hits += bench_find(&tree, query[i]);
+    }
+
+    double ns = (double)(bench_now() - start) / queries;
+
+    if (pass == 0 || ns < result->tree_ns) {
+      result->tree_ns = ns;
+    }
+
+    result->tree_hits = hits;
+
+    hits = 0;
+    start = bench_now();
+
+    for (uint64_t i = 0; i < queries; i++) {
+      hits += frozen_set_contains(&set, query[i]);
+    }
+
+    ns = (double)(bench_now() - start) / queries;
+
+    if (pass == 0 || ns < result->frozen_ns) {
+      result->frozen_ns = ns;
+    }
+
+    result->frozen_hits = hits;
+
+    hits = 0;
+    start = bench_now();
+
+    frozen_set_lower_bound_batch(&set, query, queries, out);
+
+    for (uint64_t i = 0; i < queries; i++) {
+      hits += out[i] != FROZEN_NONE && frozen_set_key(&set, out[i]) == query[i];
+    }
+
+    ns = (double)(bench_now() - start) / queries;
+
+    if (pass == 0 || ns < result->batch_ns) {
+      result->batch_ns = ns;
+    }
+
+    result->batch_hits = hits;
+  }
+
+  if (check) {
+    qsort(keys, n, sizeof(int), bench_compare);
+
+    for (uint64_t i = 0; i < queries && result->valid; i++) {
+      result->valid =
+          bench_check_answer(&set, keys, n, query[i], out[i]) &&
+          bench_check_answer(&set, keys, n, query[i],
+                             frozen_set_lower_bound(&set, query[i]));
+    }
+
+    result->valid = result->valid && result->tree_hits == result->frozen_hits &&
+                    result->tree_hits == result->batch_hits;
+  }
+
+  frozen_set_free(&set);
+  bench_free(&tree);
+  free(keys);
+  free(query);
+  free(out);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint64_t sizes[32] = {1000, 10000, 100000, 1000000};
+  int count = 4;
+  uint64_t queries = 1000000;
+  bool json = false;
+  bool check = false;
+  bool valid = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      bench_state = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      char *list = argv[++i];
+
+      for (count = 0; *list != '\0' && count < 32; count++) {
+        sizes[count] = strtoull(list, &list, 10);
+
+        if (*list == ',') {
+          list++;
+        }
+      }
+    } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+      queries = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--seed N] [--keys N[,N...]] [--queries N] [--json] "
+              "[--check]\n",
+              argv[0]);
+
+      return 1;
+    }
+  }
+
+  if (queries == 0) {
+    fprintf(stderr, "--queries must be positive\n");
+
+    return 1;
+  }
+
+  if (json) {
+    printf("{\"engine\": \"%s\", \"queries\": %llu, \"results\": [",
+           BENCH_ENGINE, (unsigned long long)queries);
+  } else {
+    printf("%-6s %10s %10s %10s %10s %10s\n", "engine", "keys", "tree",
+           "frozen", "batch", "hits");
+  }
+
+  for (int i = 0; i < count; i++) {
+    frozen_result_t result;
+
+    if (bench_size(sizes[i], queries, check, &result) < 0) {
+      fprintf(stderr, "out of memory at %llu keys\n",
+              (unsigned long long)sizes[i]);
+
+      return 1;
+    }
+
+    valid = valid && result.valid;
+
+    if (json) {
+      printf("%s{\"keys\": %llu, \"tree_ns\": %.2f, \"frozen_ns\": %.2f, "
+             "\"batch_ns\": %.2f, \"hits\": %llu",
+             i ? ", " : "", (unsigned long long)sizes[i], result.tree_ns,
+             result.frozen_ns, result.batch_ns,
+             (unsigned long long)result.tree_hits);
+
+      if (check) {
+        printf(", \"valid\": %s", result.valid ? "true" : "false");
+      }
+
+      printf("}");
+    } else {
+      printf("%-6s %10llu %10.2f %10.2f %10.2f %10llu%s\n", BENCH_ENGINE,
+             (unsigned long long)sizes[i], result.tree_ns, result.frozen_ns,
+             result.batch_ns, (unsigned long long)result.tree_hits,
+             check && !result.valid ? "  mismatch" : "");
+    }
+  }
+
+  if (json) {
+    printf("]}\n");
+  }
+
+  return valid ? 0 : 2;
+}
@@ -0,0 +1,141 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Log-linear latency histogram in the style of HdrHistogram. Values are
+// bucketed by their highest set bit, and each power of two is split into
+// HISTOGRAM_SUB_BUCKETS linear sub-buckets, so any recorded value is
+// reported within 1 / HISTOGRAM_SUB_BUCKETS of its true value. Recording
+// is a couple of shifts and an increment.
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram {
+  uint64_t *counts;
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  double sum;
+} histogram_t;
+
+static inline int histogram_init(histogram_t *histogram) {
+  histogram->counts = (uint64_t *)calloc(HISTOGRAM_BUCKETS, sizeof(uint64_t));
+  histogram->count = 0;
+  histogram->min = UINT64_MAX;
+  histogram->max = 0;
+  histogram->sum = 0;
+
+  return histogram->counts == NULL ? -1 : 0;
+}
+
+static inline void histogram_free(histogram_t *histogram) {
+  free(histogram->counts);
+
+  histogram->counts = NULL;
+}
+
+static inline void histogram_reset(histogram_t *histogram) {
+  memset(histogram->counts, 0, HISTOGRAM_BUCKETS * sizeof(uint64_t));
+
+  histogram->count = 0;
+  histogram->min = UINT64_MAX;
+  histogram->max = 0;
+  histogram->sum = 0;
+}
+
+// values below HISTOGRAM_SUB_BUCKETS are exact, above that the bucket is
+// the position of the highest bit and the sub-bucket the bits below it
+static inline uint64_t histogram_index(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return value;
+  }
+
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+
+  return (uint64_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS +
+         ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// the smallest value that maps to a bucket
+static inline uint64_t histogram_value(uint64_t index) {
+  if (index < HISTOGRAM_SUB_BUCKETS) {
+    return index;
+  }
+
+  int shift = (int)(index / HISTOGRAM_SUB_BUCKETS) - 1;
+
+  return (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+static inline void histogram_record(histogram_t *histogram, uint64_t value) {
+  histogram->counts[histogram_index(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+
+  if (value < histogram->min) {
+    histogram->min = value;
+  }
+
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+static inline void histogram_merge(histogram_t *into, const histogram_t *from) {
+  for (uint64_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->counts[i] += from->counts[i];
+  }
+
+  into->count += from->count;
+  into->sum += from->sum;
+
+  if (from->min < into->min) {
+    into->min = from->min;
+  }
+
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+// value at the given percentile (0 to 100), clamped to the recorded range
+static inline uint64_t histogram_percentile(const histogram_t *histogram,
+                                            double percentile) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+  uint64_t seen = 0;
+
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  for (uint64_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+
+    if (seen >= rank) {
+      uint64_t value = histogram_value(i);
+
+      if (value < histogram->min) {
+        return histogram->min;
+      }
+
+      return value > histogram->max ? histogram->max : value;
+    }
+  }
+
+  return histogram->max;
+}
+
+static inline double histogram_mean(const histogram_t *histogram) {
+  return histogram->count ? histogram->sum / histogram->count : 0;
+}
+
+#endif
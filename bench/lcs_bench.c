@@ -0,0 +1,602 @@
+// cc -O2 -pthread -o lcs_bench lcs_bench.c ../lcs/lcs.c ../lcs/lcs_*.c
+//
+// lcs_bench [--seed N] [--length N] [--pairs N] [--repeat N] [--json]
+//           [--corpus-dir DIR] [--mode NAME]
+//
+// Generates the corpora from the seed, times every mode on every corpus
+// and reports the best of --repeat runs. With --corpus-dir the corpora
+// are also written out as <corpus>.<pair>.x/y files plus a manifest, so
+// that lcs_bench.py can time the Python reference on the same data, and
+// the file mode is enabled.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lcs/lcs.h"
+#include "bench_random.h"
+
+static inline double bench_uniform(void) {
+  return (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---------------------------------------------- */
+
+typedef struct bench_pair {
+  char *x;
+  char *y;
+  uint64_t xl;
+  uint64_t yl;
+  // set by --corpus-dir
+  char *xpath;
+  char *ypath;
+} bench_pair_t;
+
+typedef struct bench_corpus {
+  const char *name;
+  bench_pair_t *pairs;
+  uint64_t count;
+} bench_corpus_t;
+
+// Symbols are drawn from 'a' onwards, the widest alphabet uses every byte
+// but NUL so that the string based modes see the whole input.
+static char bench_symbol(uint32_t alphabet) {
+  if (alphabet >= 255) {
+    return (char)(1 + bench_random() % 255);
+  }
+
+  return (char)('a' + bench_random() % alphabet);
+}
+
+static char *bench_random_string(uint64_t length, uint32_t alphabet) {
+  char *s = (char *)malloc(length + 1);
+
+  for (uint64_t i = 0; i < length; i++) {
+    s[i] = bench_symbol(alphabet);
+  }
+
+  s[length] = '\0';
+
+  return s;
+}
+
+// copies x applying substitutions, insertions and deletions, each at
+// rate / 3 per symbol
+static char *bench_mutate(const char *x, uint64_t xl, double rate,
+                          uint32_t alphabet, uint64_t *length) {
+  char *y = (char *)malloc(2 * xl + 1);
+  uint64_t yl = 0;
+
+  for (uint64_t i = 0; i < xl; i++) {
+    double r = bench_uniform();
+
+    if (r < rate / 3) {
+      y[yl++] = bench_symbol(alphabet);
+    } else if (r < 2 * rate / 3) {
+      y[yl++] = bench_symbol(alphabet);
+      y[yl++] = x[i];
+    } else if (r >= rate) {
+      y[yl++] = x[i];
+    }
+  }
+
+  y[yl] = '\0';
+  *length = yl;
+
+  return y;
+}
+
+// Text-like data: words from a fixed vocabulary with Zipf distributed
+// frequencies, separated by spaces with a newline every dozen words or so.
+
+#define BENCH_VOCABULARY 4096
+
+static char *bench_words[BENCH_VOCABULARY];
+static double bench_zipf[BENCH_VOCABULARY];
+
+static void bench_vocabulary(void) {
+  static const char *syllables[] = {"an", "be", "co", "de", "en", "fo", "ga",
+                                    "hi", "in", "jo", "ka", "le", "mo", "ne",
+                                    "or", "pa", "qu", "re", "st", "th", "un",
+                                    "ve", "wi", "xe", "yo", "ze"};
+  double total = 0;
+
+  for (int i = 0; i < BENCH_VOCABULARY; i++) {
+    int count = 1 + bench_random() % 4;
+
+    bench_words[i] = (char *)calloc(2 * count + 1, 1);
+
+    for (int s = 0; s < count; s++) {
+      strcat(bench_words[i], syllables[bench_random() % 26]);
+    }
+
+    total += 1.0 / (i + 1);
+    bench_zipf[i] = total;
+  }
+
+  for (int i = 0; i < BENCH_VOCABULARY; i++) {
+    bench_zipf[i] /= total;
+  }
+}
+
+static const char *bench_word(void) {
+  double r = bench_uniform();
+  int lo = 0;
+  int hi = BENCH_VOCABULARY - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (bench_zipf[mid] < r) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return bench_words[lo];
+}
+
+static char *bench_text(uint64_t length, const char *base, uint64_t base_length,
+                        double rate, uint64_t *out_length) {
+  char *s = (char *)malloc(length + 64);
+  uint64_t sl = 0;
+  uint64_t words = 0;
+  uint64_t bi = 0;
+
+  while (sl < length) {
+    const char *word;
+    uint64_t wl;
+
+    // follow the base text word by word, replacing a word at `rate`
+    if (base != NULL && bi < base_length && bench_uniform() >= rate) {
+      uint64_t start = bi;
+
+      while (bi < base_length && base[bi] != ' ' && base[bi] != '\n') {
+        bi++;
+      }
+
+      word = base + start;
+      wl = bi - start;
+      bi++;
+    } else {
+      if (base != NULL) {
+        while (bi < base_length && base[bi] != ' ' && base[bi] != '\n') {
+          bi++;
+        }
+
+        bi++;
+      }
+
+      word = bench_word();
+      wl = strlen(word);
+    }
+
+    if (sl + wl + 1 > length) {
+      break;
+    }
+
+    memcpy(s + sl, word, wl);
+    sl += wl;
+    s[sl++] = ++words % 12 == 0 ? '\n' : ' ';
+  }
+
+  s[sl] = '\0';
+  *out_length = sl;
+
+  return s;
+}
+
+typedef enum bench_kind {
+  BENCH_RANDOM,
+  BENCH_NEAR,
+  BENCH_TEXT,
+} bench_kind_t;
+
+typedef struct bench_spec {
+  const char *name;
+  bench_kind_t kind;
+  uint32_t alphabet;
+  double rate;
+} bench_spec_t;
+
+static const bench_spec_t bench_specs[] = {
+    {"random-2", BENCH_RANDOM, 2, 0},
+    {"random-4", BENCH_RANDOM, 4, 0},
+    {"random-26", BENCH_RANDOM, 26, 0},
+    {"random-255", BENCH_RANDOM, 255, 0},
+    {"near-1e-3", BENCH_NEAR, 26, 0.001},
+    {"near-1e-2", BENCH_NEAR, 26, 0.01},
+    {"near-1e-1", BENCH_NEAR, 26, 0.1},
+    {"text", BENCH_TEXT, 0, 0.02},
+};
+
+#define BENCH_CORPORA (sizeof(bench_specs) / sizeof(bench_specs[0]))
+
+static void bench_generate(bench_corpus_t *corpus, const bench_spec_t *spec,
+                           uint64_t length, uint64_t count) {
+  corpus->name = spec->name;
+  corpus->count = count;
+  corpus->pairs = (bench_pair_t *)calloc(count, sizeof(bench_pair_t));
+
+  for (uint64_t i = 0; i < count; i++) {
+    bench_pair_t *pair = &corpus->pairs[i];
+
+    switch (spec->kind) {
+    case BENCH_RANDOM:
+      pair->x = bench_random_string(length, spec->alphabet);
+      pair->y = bench_random_string(length, spec->alphabet);
+      pair->xl = length;
+      pair->yl = length;
+      break;
+    case BENCH_NEAR:
+      pair->x = bench_random_string(length, spec->alphabet);
+      pair->xl = length;
+      pair->y = bench_mutate(pair->x, length, spec->rate, spec->alphabet,
+                             &pair->yl);
+      break;
+    case BENCH_TEXT:
+      pair->x = bench_text(length, NULL, 0, 0, &pair->xl);
+      pair->y = bench_text(length, pair->x, pair->xl, spec->rate, &pair->yl);
+      break;
+    }
+  }
+}
+
+static int bench_dump(bench_corpus_t *corpora, uint64_t count,
+                      const char *dir) {
+  char path[4096];
+
+  snprintf(path, sizeof(path), "%s/manifest.json", dir);
+
+  FILE *manifest = fopen(path, "w");
+
+  if (manifest == NULL) {
+    return -1;
+  }
+
+  fprintf(manifest, "[");
+
+  for (uint64_t c = 0; c < count; c++) {
+    bench_corpus_t *corpus = &corpora[c];
+
+    fprintf(manifest, "%s\n  {\"corpus\": \"%s\", \"pairs\": [", c ? "," : "",
+            corpus->name);
+
+    for (uint64_t i = 0; i < corpus->count; i++) {
+      bench_pair_t *pair = &corpus->pairs[i];
+      char *paths[2];
+
+      for (int side = 0; side < 2; side++) {
+        snprintf(path, sizeof(path), "%s/%s.%llu.%c", dir, corpus->name,
+                 (unsigned long long)i, side ? 'y' : 'x');
+
+        FILE *file = fopen(path, "wb");
+
+        if (file == NULL) {
+          fclose(manifest);
+
+          return -1;
+        }
+
+        fwrite(side ? pair->y : pair->x, 1, side ? pair->yl : pair->xl, file);
+        fclose(file);
+
+        paths[side] = strdup(path);
+      }
+
+      pair->xpath = paths[0];
+      pair->ypath = paths[1];
+
+      fprintf(manifest, "%s[\"%s\", \"%s\"]", i ? ", " : "", pair->xpath,
+              pair->ypath);
+    }
+
+    fprintf(manifest, "]}");
+  }
+
+  fprintf(manifest, "\n]\n");
+  fclose(manifest);
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// Every mode returns a checksum of its results, which keeps the work from
+// being optimised away and lets runs be compared, and the cells of the
+// m*n dynamic programming tables of its pairs. Only the table modes visit
+// all of them; Myers, banded, substring, text diff and the others do other
+// work, so their rate is dp-equivalent: the table they stand in for over
+// the time they took.
+
+typedef uint64_t (*bench_pair_fn)(bench_pair_t *pair);
+typedef uint64_t (*bench_corpus_fn)(bench_corpus_t *corpus, double *cells);
+
+static uint64_t bench_dp(bench_pair_t *pair) {
+  char *cs = lcs(pair->x, pair->y);
+  uint64_t length = strlen(cs);
+
+  free(cs);
+
+  return length;
+}
+
+static uint64_t bench_myers(bench_pair_t *pair) {
+  lcs_script_t script;
+
+  lcs_diff(pair->x, pair->xl, pair->y, pair->yl, LCS_UNBOUNDED, &script);
+  lcs_script_free(&script);
+
+  return script.cost;
+}
+
+static uint64_t bench_myers_budget(bench_pair_t *pair) {
+  lcs_script_t script;
+
+  lcs_diff(pair->x, pair->xl, pair->y, pair->yl, (pair->xl + pair->yl) / 100,
+           &script);
+  lcs_script_free(&script);
+
+  return script.cost;
+}
+
+static uint64_t bench_bit_parallel(bench_pair_t *pair) {
+  return lcs_length(pair->x, pair->xl, pair->y, pair->yl);
+}
+
+static uint64_t bench_banded(bench_pair_t *pair) {
+  return lcs_similar(pair->x, pair->xl, pair->y, pair->yl, 0.9);
+}
+
+static uint64_t bench_distances(bench_pair_t *pair) {
+  lcs_distances_t distances;
+
+  lcs_distances(pair->x, pair->xl, pair->y, pair->yl, &distances);
+
+  return distances.lcs + distances.levenshtein + distances.indel;
+}
+
+static uint64_t bench_distances_separate(bench_pair_t *pair) {
+  uint64_t lcs = lcs_length(pair->x, pair->xl, pair->y, pair->yl);
+  uint64_t levenshtein = lcs_levenshtein(pair->x, pair->xl, pair->y, pair->yl);
+  uint64_t indel =
+      pair->xl + pair->yl - 2 * lcs_length(pair->x, pair->xl, pair->y, pair->yl);
+
+  return lcs + levenshtein + indel;
+}
+
+static uint64_t bench_substring(bench_pair_t *pair) {
+  uint64_t offset;
+  uint64_t length;
+
+  lcs_substring(pair->x, pair->xl, pair->y, pair->yl, &offset, &length);
+
+  return length;
+}
+
+static FILE *bench_null;
+
+static uint64_t bench_text_diff(bench_pair_t *pair) {
+  lcs_diff_text(pair->x, pair->xl, pair->y, pair->yl, LCS_SPLIT_TOKENS, 3, "x",
+                "y", bench_null);
+
+  return 0;
+}
+
+static uint64_t bench_file(bench_pair_t *pair) {
+  return lcs_file_length(pair->xpath, pair->ypath);
+}
+
+static uint64_t bench_batch(bench_corpus_t *corpus, double *cells) {
+  const char *query = corpus->pairs[0].x;
+  char **candidates = (char **)malloc(sizeof(char *) * corpus->count);
+  uint64_t *lengths = (uint64_t *)malloc(sizeof(uint64_t) * corpus->count);
+  uint64_t checksum = 0;
+
+  *cells = 0;
+
+  for (uint64_t i = 0; i < corpus->count; i++) {
+    candidates[i] = corpus->pairs[i].y;
+    *cells += (double)corpus->pairs[0].xl * corpus->pairs[i].yl;
+  }
+
+  lcs_batch(query, candidates, corpus->count, lengths, 0, 0);
+
+  for (uint64_t i = 0; i < corpus->count; i++) {
+    checksum += lengths[i];
+  }
+
+  free(candidates);
+  free(lengths);
+
+  return checksum;
+}
+
+typedef struct bench_mode {
+  const char *name;
+  bench_pair_fn pair;
+  bench_corpus_fn corpus;
+  // longest input the mode is run on, 0 for no limit
+  uint64_t max_length;
+  bool needs_files;
+} bench_mode_t;
+
+static const bench_mode_t bench_modes[] = {
+    // the table is (m + 1) * (n + 1) ints
+    {"dp", bench_dp, NULL, 8192, false},
+    {"myers", bench_myers, NULL, 0, false},
+    {"myers-budget", bench_myers_budget, NULL, 0, false},
+    {"bit-parallel", bench_bit_parallel, NULL, 0, false},
+    {"batch", NULL, bench_batch, 0, false},
+    {"banded-0.9", bench_banded, NULL, 0, false},
+    {"distances", bench_distances, NULL, 0, false},
+    {"distances-separate", bench_distances_separate, NULL, 0, false},
+    {"substring", bench_substring, NULL, 0, false},
+    {"text-diff", bench_text_diff, NULL, 0, false},
+    {"file", bench_file, NULL, 0, true},
+};
+
+#define BENCH_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+static uint64_t bench_run(const bench_mode_t *mode, bench_corpus_t *corpus,
+                          double *cells) {
+  if (mode->corpus != NULL) {
+    return mode->corpus(corpus, cells);
+  }
+
+  uint64_t checksum = 0;
+
+  *cells = 0;
+
+  for (uint64_t i = 0; i < corpus->count; i++) {
+    bench_pair_t *pair = &corpus->pairs[i];
+
+    checksum += mode->pair(pair);
+    *cells += (double)pair->xl * pair->yl;
+  }
+
+  return checksum;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  uint64_t length = 4096;
+  uint64_t pairs = 16;
+  uint64_t repeat = 3;
+  bool json = false;
+  const char *corpus_dir = NULL;
+  const char *only = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--length") == 0 && has_value) {
+      length = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--pairs") == 0 && has_value) {
+      pairs = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--repeat") == 0 && has_value) {
+      repeat = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--corpus-dir") == 0 && has_value) {
+      corpus_dir = argv[++i];
+    } else if (strcmp(argv[i], "--mode") == 0 && has_value) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      fprintf(stderr, "unknown argument %s\n", argv[i]);
+
+      return 1;
+    }
+  }
+
+  if (pairs == 0 || repeat == 0) {
+    fprintf(stderr, "--pairs and --repeat must be positive\n");
+
+    return 1;
+  }
+
+  bench_state = seed;
+  bench_null = fopen("/dev/null", "w");
+  bench_vocabulary();
+
+  bench_corpus_t corpora[BENCH_CORPORA];
+
+  for (uint64_t c = 0; c < BENCH_CORPORA; c++) {
+    bench_generate(&corpora[c], &bench_specs[c], length, pairs);
+  }
+
+  if (corpus_dir != NULL && bench_dump(corpora, BENCH_CORPORA, corpus_dir) < 0) {
+    fprintf(stderr, "cannot write corpora to %s\n", corpus_dir);
+
+    return 1;
+  }
+
+  if (json) {
+    printf("{\"seed\": %llu, \"length\": %llu, \"pairs\": %llu, "
+           "\"results\": [",
+           (unsigned long long)seed, (unsigned long long)length,
+           (unsigned long long)pairs);
+  } else {
+    printf("%-12s %-20s %12s %22s %20s\n", "corpus", "mode", "seconds",
+           "dp-equivalent cells/s", "checksum");
+  }
+
+  bool first = true;
+
+  for (uint64_t c = 0; c < BENCH_CORPORA; c++) {
+    for (uint64_t m = 0; m < BENCH_MODES; m++) {
+      const bench_mode_t *mode = &bench_modes[m];
+
+      if (only != NULL && strcmp(only, mode->name) != 0) {
+        continue;
+      }
+
+      if ((mode->max_length != 0 && length > mode->max_length) ||
+          (mode->needs_files && corpus_dir == NULL)) {
+        continue;
+      }
+
+      double best = 0;
+      double cells = 0;
+      uint64_t checksum = 0;
+
+      for (uint64_t r = 0; r < repeat; r++) {
+        double start = bench_now();
+
+        checksum = bench_run(mode, &corpora[c], &cells);
+
+        double elapsed = bench_now() - start;
+
+        if (r == 0 || elapsed < best) {
+          best = elapsed;
+        }
+      }
+
+      if (json) {
+        printf("%s\n  {\"corpus\": \"%s\", \"mode\": \"%s\", "
+               "\"seconds\": %.9f, \"dp_cells\": %.0f, "
+               "\"dp_cells_per_second\": %.6e, \"checksum\": %llu}",
+               first ? "" : ",", corpora[c].name, mode->name, best, cells,
+               cells / best, (unsigned long long)checksum);
+      } else {
+        printf("%-12s %-20s %12.6f %22.4e %20llu\n", corpora[c].name,
+               mode->name, best, cells / best, (unsigned long long)checksum);
+      }
+
+      first = false;
+    }
+  }
+
+  if (json) {
+    printf("\n]}\n");
+  }
+
+  for (uint64_t c = 0; c < BENCH_CORPORA; c++) {
+    for (uint64_t i = 0; i < corpora[c].count; i++) {
+      free(corpora[c].pairs[i].x);
+      free(corpora[c].pairs[i].y);
+      free(corpora[c].pairs[i].xpath);
+      free(corpora[c].pairs[i].ypath);
+    }
+
+    free(corpora[c].pairs);
+  }
+
+  fclose(bench_null);
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+# Runs the C benchmark and times the Python entry points on the same
+# corpora, merging everything into one JSON report.
+#
+# python3 lcs_bench.py [--binary ./lcs_bench] [--python-pairs N] [-- ARGS]
+#
+# ARGS are passed to lcs_bench as they are. The pure Python reference is
+# O(m*n) in the interpreter so it only runs on the first --python-pairs
+# pairs of each corpus, cells per second stays comparable. Cells are those
+# of the m*n dynamic programming table, whatever a mode actually does.
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "lcs"))
+
+import lcs  # noqa: E402
+
+
+def best_of(repeat, run):
+    best = None
+    checksum = 0
+
+    for _ in range(repeat):
+        start = time.perf_counter()
+        checksum = run()
+        elapsed = time.perf_counter() - start
+
+        if best is None or elapsed < best:
+            best = elapsed
+
+    return best, checksum
+
+
+def load(paths):
+    with open(paths[0], "rb") as x, open(paths[1], "rb") as y:
+        return x.read(), y.read()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--binary", default="./lcs_bench")
+    parser.add_argument("--python-pairs", type=int, default=1)
+    parser.add_argument("--repeat", type=int, default=1)
+    parser.add_argument("args", nargs=argparse.REMAINDER)
+    options = parser.parse_args()
+
+    args = [a for a in options.args if a != "--"]
+
+    with tempfile.TemporaryDirectory() as corpus_dir:
+        output = subprocess.run(
+            [options.binary, "--json", "--corpus-dir", corpus_dir] + args,
+            check=True,
+            stdout=subprocess.PIPE,
+        ).stdout
+        report = json.loads(output)
+
+        with open(os.path.join(corpus_dir, "manifest.json")) as f:
+            manifest = json.load(f)
+
+        modes = [("python-reference", lambda x, y: len(lcs.lcs_py(x, y)))]
+
+        if lcs._lcs is not None:
+            modes.append(("python-native", lcs.lcs_length))
+
+        for corpus in manifest:
+            pairs = [load(p) for p in corpus["pairs"][: options.python_pairs]]
+            cells = sum(len(x) * len(y) for x, y in pairs)
+
+            for name, function in modes:
+                seconds, checksum = best_of(
+                    options.repeat, lambda: sum(function(x, y) for x, y in pairs)
+                )
+                report["results"].append(
+                    {
+                        "corpus": corpus["corpus"],
+                        "mode": name,
+                        "seconds": seconds,
+                        "dp_cells": cells,
+                        "dp_cells_per_second": cells / seconds,
+                        "checksum": checksum,
+                    }
+                )
+
+    json.dump(report, sys.stdout, indent=2)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
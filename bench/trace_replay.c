@@ -0,0 +1,261 @@
+// cc -O2 -DNDEBUG -DBENCH_AVL -pthread -o trace_replay_avl trace_replay.c
+// cc -O2 -DNDEBUG -DBENCH_RB -pthread -o trace_replay_rb trace_replay.c
+// cc -O2 -DNDEBUG -DBENCH_BP -o trace_replay_bp trace_replay.c
+// cc -O2 -DNDEBUG -DBENCH_AVL_POOL -o trace_replay_avl_pool trace_replay.c
+// cc -O2 -DNDEBUG -DBENCH_RB_POOL -o trace_replay_rb_pool trace_replay.c
+//
+// trace_replay TRACE [--repeat N] [--no-latency] [--json] [--check]
+//
+// Plays a workload trace (see common/workload_trace.h) against an empty
+// tree of the engine picked at compile time. The trace is mapped and
+// decoded in place. Each operation's latency goes into a histogram per
+// operation kind. --no-latency skips the clock reads for a pure
+// throughput number. With --repeat the trace is replayed on a fresh tree
+// each time; the histograms cover all runs and the wall time is the best
+// run. --check validates the tree invariants at the end of every run.
+
+#include "tree_engine.h"
+
+#include <time.h>
+
+#include "histogram.h"
+
+static const char *replay_op_names[WORKLOAD_OPS] = {"insert", "remove", "find",
+                                                     "range"};
+
+static inline uint64_t replay_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct replay_result {
+  histogram_t latency[WORKLOAD_OPS];
+  uint64_t ops[WORKLOAD_OPS];
+  // finds that hit and values returned by ranges, to compare runs
+  uint64_t found;
+  uint64_t ranged;
+  uint64_t final_size;
+  double seconds;
+  bool valid;
+} replay_result_t;
+
+static inline void replay_step(bench_tree_t *tree, workload_step_t *step,
+                               replay_result_t *result) {
+  switch (step->op) {
+  case WORKLOAD_INSERT:
+    bench_insert(tree, step->key);
+    break;
+  case WORKLOAD_REMOVE:
+    bench_remove(tree, step->key);
+    break;
+  case WORKLOAD_FIND:
+    result->found += bench_find(tree, step->key);
+    break;
+  case WORKLOAD_RANGE:
+    result->ranged += bench_range(tree, step->key, step->high);
+    break;
+  default:
+    break;
+  }
+}
+
+static int replay_run(workload_reader_t *reader, replay_result_t *result,
+                      bool latency, bool check) {
+  bench_tree_t tree = {0};
+  workload_step_t step;
+
+  workload_reader_rewind(reader);
+
+  result->found = 0;
+  result->ranged = 0;
+  memset(result->ops, 0, sizeof(result->ops));
+
+  uint64_t start = replay_now();
+
+  if (latency) {
+    uint64_t last = start;
+
+    while (workload_next(reader, &step)) {
+      replay_step(&tree, &step, result);
+
+      uint64_t now = replay_now();
+
+      histogram_record(&result->latency[step.op], now - last);
+      result->ops[step.op]++;
+      last = now;
+    }
+  } else {
+    while (workload_next(reader, &step)) {
+      replay_step(&tree, &step, result);
+      result->ops[step.op]++;
+    }
+  }
+
+  double seconds = (replay_now() - start) / 1e9;
+
+  if (result->seconds == 0 || seconds < result->seconds) {
+    result->seconds = seconds;
+  }
+
+  if (check && !bench_check(&tree)) {
+    result->valid = false;
+  }
+
+  result->final_size = tree.size;
+
+  bench_free(&tree);
+
+  return reader->truncated ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  uint64_t repeat = 1;
+  bool latency = true;
+  bool json = false;
+  bool check = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--no-latency") == 0) {
+      latency = false;
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else if (path == NULL && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      fprintf(stderr, "unknown argument %s\n", argv[i]);
+
+      return 1;
+    }
+  }
+
+  if (path == NULL || repeat == 0) {
+    fprintf(stderr, "usage: %s TRACE [--repeat N] [--no-latency] [--json] "
+                    "[--check]\n",
+            argv[0]);
+
+    return 1;
+  }
+
+  workload_reader_t reader;
+
+  if (workload_reader_open(&reader, path) < 0) {
+    fprintf(stderr, "cannot read trace %s\n", path);
+
+    return 1;
+  }
+
+  replay_result_t result = {.seconds = 0, .valid = true};
+
+  for (int op = 0; op < WORKLOAD_OPS; op++) {
+    histogram_init(&result.latency[op]);
+  }
+
+  for (uint64_t r = 0; r < repeat; r++) {
+    if (replay_run(&reader, &result, latency, check) < 0) {
+      fprintf(stderr, "%s is truncated or corrupt, replayed up to byte %llu\n",
+              path, (unsigned long long)reader.offset);
+    }
+  }
+
+  uint64_t total = 0;
+
+  for (int op = 0; op < WORKLOAD_OPS; op++) {
+    total += result.ops[op];
+  }
+
+  if (reader.count != 0 && reader.count != total) {
+    fprintf(stderr, "the header promises %llu operations, replayed %llu\n",
+            (unsigned long long)reader.count, (unsigned long long)total);
+  }
+
+  if (json) {
+    printf("{\"engine\": \"%s\", \"trace\": \"%s\", \"ops\": %llu, "
+           "\"repeat\": %llu, \"seconds\": %.6f, \"ops_per_second\": %.1f, "
+           "\"found\": %llu, \"ranged\": %llu, \"final_size\": %llu",
+           BENCH_ENGINE, path, (unsigned long long)total,
+           (unsigned long long)repeat, result.seconds, total / result.seconds,
+           (unsigned long long)result.found, (unsigned long long)result.ranged,
+           (unsigned long long)result.final_size);
+
+    if (check) {
+      printf(", \"valid\": %s", result.valid ? "true" : "false");
+    }
+
+    if (latency) {
+      printf(", \"latency\": {");
+
+      for (int op = 0, first = 1; op < WORKLOAD_OPS; op++) {
+        histogram_t *histogram = &result.latency[op];
+
+        if (histogram->count == 0) {
+          continue;
+        }
+
+        printf("%s\"%s\": {\"ops\": %llu, \"mean_ns\": %.1f, "
+               "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+               "\"p999_ns\": %llu, \"max_ns\": %llu}",
+               first ? "" : ", ", replay_op_names[op],
+               (unsigned long long)histogram->count, histogram_mean(histogram),
+               (unsigned long long)histogram_percentile(histogram, 50),
+               (unsigned long long)histogram_percentile(histogram, 90),
+               (unsigned long long)histogram_percentile(histogram, 99),
+               (unsigned long long)histogram_percentile(histogram, 99.9),
+               (unsigned long long)histogram->max);
+        first = 0;
+      }
+
+      printf("}");
+    }
+
+    printf("}\n");
+  } else {
+    printf("%s: %llu ops in %.6f s, %.3e ops/s, %llu found, %llu in ranges, "
+           "%llu keys left\n",
+           BENCH_ENGINE, (unsigned long long)total, result.seconds,
+           total / result.seconds, (unsigned long long)result.found,
+           (unsigned long long)result.ranged,
+           (unsigned long long)result.final_size);
+
+    if (latency) {
+      printf("%-6s %10s %8s %8s %8s %8s %8s %10s\n", "op", "ops", "mean",
+             "p50", "p90", "p99", "p99.9", "max");
+
+      for (int op = 0; op < WORKLOAD_OPS; op++) {
+        histogram_t *histogram = &result.latency[op];
+
+        if (histogram->count == 0) {
+          continue;
+        }
+
+        printf("%-6s %10llu %8.1f %8llu %8llu %8llu %8llu %10llu\n",
+               replay_op_names[op], (unsigned long long)histogram->count,
+               histogram_mean(histogram),
+               (unsigned long long)histogram_percentile(histogram, 50),
+               (unsigned long long)histogram_percentile(histogram, 90),
+               (unsigned long long)histogram_percentile(histogram, 99),
+               (unsigned long long)histogram_percentile(histogram, 99.9),
+               (unsigned long long)histogram->max);
+      }
+    }
+
+    if (check && !result.valid) {
+      printf("invariants violated\n");
+    }
+  }
+
+  for (int op = 0; op < WORKLOAD_OPS; op++) {
+    histogram_free(&result.latency[op]);
+  }
+
+  workload_reader_close(&reader);
+
+  return result.valid ? 0 : 2;
+}
@@ -0,0 +1,541 @@
+// cc -O2 -DNDEBUG -DBENCH_AVL -pthread -o tree_bench_avl tree_bench.c -lm
+// cc -O2 -DNDEBUG -DBENCH_RB -pthread -o tree_bench_rb tree_bench.c -lm
+// cc -O2 -DNDEBUG -DBENCH_BP -o tree_bench_bp tree_bench.c -lm
+// cc -O2 -DNDEBUG -DBENCH_AVL_POOL -o tree_bench_avl_pool tree_bench.c -lm
+// cc -O2 -DNDEBUG -DBENCH_RB_POOL -o tree_bench_rb_pool tree_bench.c -lm
+//
+// Adding -DTREE_PERF reads the hardware counters around the descent and
+// rebalancing code of the tree and reports their averages per call.
+//
+// tree_bench [--seed N] [--keys N[,N...]] [--workload NAME] [--window N]
+//            [--json] [--check]
+//
+// Drives one tree engine, picked at compile time, through seeded
+// workloads and reports per operation latency percentiles, bytes per key
+// (heap plus the node pool of the pool engines) and the height of the
+// tree when it is at its largest.
+//
+//   uniform   inserts random keys, then removes them in a shuffled order
+//   zipf      the same with Zipf distributed keys (s = 0.99), so hot keys
+//             are inserted many times
+//   sorted    inserts 0..n-1, removes them in the same order
+//   reverse   inserts and removes n-1..0
+//   sliding   inserts 0..n-1 keeping only the last --window keys (n / 8
+//             by default), removing the oldest one after each insert
+//
+// --check validates the tree invariants at its largest and after the run.
+//
+// Built with -DTREE_RECORD, --record FILE writes every tree operation of
+// the run to a workload trace that trace_replay can play back.
+
+#include "tree_engine.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <time.h>
+
+#include "bench_random.h"
+#include "histogram.h"
+
+/* ---------------------------------------------- */
+
+static inline double bench_uniform(void) {
+  return (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Zipf distributed ranks in [1, n] by rejection-inversion (Hörmann and
+// Derflinger), constant time per sample without a table of n weights.
+
+typedef struct bench_zipf {
+  double s;
+  double n;
+  double h_x1;
+  double h_n;
+  double threshold;
+} bench_zipf_t;
+
+static double bench_zipf_helper1(double x) {
+  return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double bench_zipf_helper2(double x) {
+  return fabs(x) > 1e-8 ? expm1(x) / x
+                        : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+static double bench_zipf_h(bench_zipf_t *zipf, double x) {
+  return exp(-zipf->s * log(x));
+}
+
+static double bench_zipf_integral(bench_zipf_t *zipf, double x) {
+  double log_x = log(x);
+
+  return bench_zipf_helper2((1 - zipf->s) * log_x) * log_x;
+}
+
+static double bench_zipf_inverse(bench_zipf_t *zipf, double x) {
+  double t = x * (1 - zipf->s);
+
+  if (t < -1) {
+    t = -1;
+  }
+
+  return exp(bench_zipf_helper1(t) * x);
+}
+
+static void bench_zipf_init(bench_zipf_t *zipf, uint64_t n, double s) {
+  zipf->s = s;
+  zipf->n = (double)n;
+  zipf->h_x1 = bench_zipf_integral(zipf, 1.5) - 1;
+  zipf->h_n = bench_zipf_integral(zipf, zipf->n + 0.5);
+  zipf->threshold =
+      2 - bench_zipf_inverse(zipf, bench_zipf_integral(zipf, 2.5) -
+                                       bench_zipf_h(zipf, 2));
+}
+
+static uint64_t bench_zipf_sample(bench_zipf_t *zipf) {
+  for (;;) {
+    double u = zipf->h_n + bench_uniform() * (zipf->h_x1 - zipf->h_n);
+    double x = bench_zipf_inverse(zipf, u);
+    double k = floor(x + 0.5);
+
+    if (k < 1) {
+      k = 1;
+    } else if (k > zipf->n) {
+      k = zipf->n;
+    }
+
+    if (k - x <= zipf->threshold ||
+        u >= bench_zipf_integral(zipf, k + 0.5) - bench_zipf_h(zipf, k)) {
+      return (uint64_t)k;
+    }
+  }
+}
+
+/* ---------------------------------------------- */
+
+typedef enum bench_op { BENCH_INSERT, BENCH_REMOVE } bench_op_t;
+
+typedef struct bench_step {
+  int key;
+  bench_op_t op;
+} bench_step_t;
+
+typedef struct bench_workload {
+  bench_step_t *steps;
+  uint64_t count;
+  // index of the step after which the tree is at its largest
+  uint64_t peak;
+} bench_workload_t;
+
+static void bench_shuffle(int *keys, uint64_t n) {
+  for (uint64_t i = n; i > 1; i--) {
+    uint64_t j = bench_random() % i;
+    int key = keys[i - 1];
+
+    keys[i - 1] = keys[j];
+    keys[j] = key;
+  }
+}
+
+// inserts keys in order, then removes them in `remove` order
+static void bench_phases(bench_workload_t *workload, const int *insert,
+                         const int *remove, uint64_t n) {
+  workload->count = 2 * n;
+  workload->peak = n - 1;
+  workload->steps = (bench_step_t *)malloc(sizeof(bench_step_t) * 2 * n);
+
+  for (uint64_t i = 0; i < n; i++) {
+    workload->steps[i] = (bench_step_t){insert[i], BENCH_INSERT};
+    workload->steps[n + i] = (bench_step_t){remove[i], BENCH_REMOVE};
+  }
+}
+
+static int bench_generate(bench_workload_t *workload, const char *name,
+                          uint64_t n, uint64_t window) {
+  int *insert = (int *)malloc(sizeof(int) * n);
+  int *remove = (int *)malloc(sizeof(int) * n);
+
+  if (strcmp(name, "uniform") == 0 || strcmp(name, "zipf") == 0) {
+    bench_zipf_t zipf;
+
+    bench_zipf_init(&zipf, n, 0.99);
+
+    for (uint64_t i = 0; i < n; i++) {
+      if (name[0] == 'u') {
+        insert[i] = (int)bench_random();
+      } else {
+        // scatter the ranks so that the hot keys are not neighbours
+        uint64_t rank = bench_zipf_sample(&zipf);
+
+        insert[i] = (int)(rank * UINT64_C(0x9e3779b97f4a7c15) >> 32);
+      }
+    }
+
+    memcpy(remove, insert, sizeof(int) * n);
+    bench_shuffle(remove, n);
+    bench_phases(workload, insert, remove, n);
+  } else if (strcmp(name, "sorted") == 0) {
+    for (uint64_t i = 0; i < n; i++) {
+      insert[i] = (int)i;
+    }
+
+    bench_phases(workload, insert, insert, n);
+  } else if (strcmp(name, "reverse") == 0) {
+    for (uint64_t i = 0; i < n; i++) {
+      insert[i] = (int)(n - 1 - i);
+    }
+
+    bench_phases(workload, insert, insert, n);
+  } else if (strcmp(name, "sliding") == 0) {
+    uint64_t count = 0;
+
+    if (window == 0) {
+      window = n / 8 ? n / 8 : 1;
+    }
+
+    if (window > n) {
+      window = n;
+    }
+
+    workload->steps = (bench_step_t *)malloc(sizeof(bench_step_t) * 2 * n);
+    workload->peak = window - 1;
+
+    for (uint64_t i = 0; i < n; i++) {
+      workload->steps[count++] = (bench_step_t){(int)i, BENCH_INSERT};
+
+      if (i >= window) {
+        workload->steps[count++] = (bench_step_t){(int)(i - window), BENCH_REMOVE};
+      }
+    }
+
+    // drain what is left of the window
+    for (uint64_t i = n - window; i < n; i++) {
+      workload->steps[count++] = (bench_step_t){(int)i, BENCH_REMOVE};
+    }
+
+    workload->count = count;
+  } else {
+    free(insert);
+    free(remove);
+
+    return -1;
+  }
+
+  free(insert);
+  free(remove);
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+typedef struct bench_result {
+  histogram_t insert;
+  histogram_t remove;
+  double seconds;
+  double bytes_per_key;
+  uint32_t max_height;
+  uint64_t peak_size;
+  bool valid;
+} bench_result_t;
+
+#ifdef TREE_RECORD
+static workload_recorder_t *bench_recorder;
+#endif
+
+static void bench_run(bench_workload_t *workload, bench_result_t *result,
+                      bool check) {
+  bench_tree_t tree = {0};
+#ifdef TREE_RECORD
+  tree.recorder = bench_recorder;
+#endif
+  size_t heap = mallinfo2().uordblks;
+
+  histogram_reset(&result->insert);
+  histogram_reset(&result->remove);
+  result->valid = true;
+
+  uint64_t start = bench_now();
+  uint64_t last = start;
+
+  for (uint64_t i = 0; i < workload->count; i++) {
+    bench_step_t *step = &workload->steps[i];
+
+    if (step->op == BENCH_INSERT) {
+      bench_insert(&tree, step->key);
+    } else {
+      bench_remove(&tree, step->key);
+    }
+
+    // one clock read per operation, each latency runs from the end of
+    // the previous operation
+    uint64_t now = bench_now();
+
+    histogram_record(step->op == BENCH_INSERT ? &result->insert
+                                              : &result->remove,
+                     now - last);
+
+    if (i == workload->peak) {
+      uint64_t paused = bench_now();
+
+      result->peak_size = tree.size;
+      result->bytes_per_key =
+          tree.size ? (double)(mallinfo2().uordblks - heap +
+                               bench_mapped_bytes(&tree)) /
+                          tree.size
+                    : 0;
+      result->max_height = bench_tree_height(&tree);
+
+      if (check && !bench_check(&tree)) {
+        result->valid = false;
+      }
+
+      // leave the bookkeeping out of the wall time and the next latency
+      start += bench_now() - paused;
+      now = bench_now();
+    }
+
+    last = now;
+  }
+
+  result->seconds = (bench_now() - start) / 1e9;
+
+  if (check && (tree.size != 0 || !bench_check(&tree))) {
+    result->valid = false;
+  }
+
+  bench_free(&tree);
+}
+
+#ifdef TREE_PERF
+#define bench_perf_reset() perf_reset()
+#else
+#define bench_perf_reset()
+#endif
+
+static void bench_json_ops(const char *name, histogram_t *histogram) {
+  printf("\"%s\": {\"ops\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, "
+         "\"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+         "\"max_ns\": %llu}",
+         name, (unsigned long long)histogram->count, histogram_mean(histogram),
+         (unsigned long long)histogram_percentile(histogram, 50),
+         (unsigned long long)histogram_percentile(histogram, 90),
+         (unsigned long long)histogram_percentile(histogram, 99),
+         (unsigned long long)histogram_percentile(histogram, 99.9),
+         (unsigned long long)histogram->max);
+}
+
+static void bench_table_ops(const char *workload, uint64_t keys,
+                            const char *name, histogram_t *histogram,
+                            bench_result_t *result) {
+  printf("%-4s %-8s %10llu %-6s %10llu %8.1f %8llu %8llu %8llu %8llu %10llu "
+         "%8.1f %6u\n",
+         BENCH_ENGINE, workload, (unsigned long long)keys, name,
+         (unsigned long long)histogram->count, histogram_mean(histogram),
+         (unsigned long long)histogram_percentile(histogram, 50),
+         (unsigned long long)histogram_percentile(histogram, 90),
+         (unsigned long long)histogram_percentile(histogram, 99),
+         (unsigned long long)histogram_percentile(histogram, 99.9),
+         (unsigned long long)histogram->max, result->bytes_per_key,
+         result->max_height);
+}
+
+static const char *bench_workloads[] = {"uniform", "zipf", "sorted", "reverse",
+                                        "sliding"};
+
+#define BENCH_WORKLOADS (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  uint64_t keys[32] = {1000, 10000, 100000, 1000000};
+  uint64_t key_counts = 4;
+  uint64_t window = 0;
+  const char *only = NULL;
+  bool json = false;
+  bool check = false;
+#ifdef TREE_RECORD
+  workload_recorder_t recorder;
+  const char *record = NULL;
+#endif
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--keys") == 0 && has_value) {
+      char *list = argv[++i];
+
+      key_counts = 0;
+
+      while (*list != '\0' && key_counts < 32) {
+        keys[key_counts++] = strtoull(list, &list, 10);
+
+        if (*list == ',') {
+          list++;
+        }
+      }
+    } else if (strcmp(argv[i], "--workload") == 0 && has_value) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "--window") == 0 && has_value) {
+      window = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+#ifdef TREE_RECORD
+    } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+      record = argv[++i];
+#endif
+    } else {
+      fprintf(stderr, "unknown argument %s\n", argv[i]);
+
+      return 1;
+    }
+  }
+
+  for (uint64_t k = 0; k < key_counts; k++) {
+    if (keys[k] == 0 || keys[k] > INT32_MAX) {
+      fprintf(stderr, "--keys must be between 1 and %d\n", INT32_MAX);
+
+      return 1;
+    }
+  }
+
+#ifdef TREE_RECORD
+  if (record != NULL) {
+    if (workload_recorder_open(&recorder, record) < 0) {
+      fprintf(stderr, "cannot open %s\n", record);
+
+      return 1;
+    }
+
+    bench_recorder = &recorder;
+  }
+#endif
+
+  bench_result_t result;
+
+  if (histogram_init(&result.insert) < 0 || histogram_init(&result.remove) < 0) {
+    return 1;
+  }
+
+  // what a latency sample costs on its own
+  uint64_t timer_start = bench_now();
+
+  for (int i = 0; i < 1000000; i++) {
+    bench_now();
+  }
+
+  double timer_ns = (bench_now() - timer_start) / 1e6;
+
+  if (json) {
+    printf("{\"engine\": \"%s\", \"seed\": %llu, \"timer_ns\": %.1f, "
+           "\"results\": [",
+           BENCH_ENGINE, (unsigned long long)seed, timer_ns);
+  } else {
+    printf("# clock read %.1f ns, included in every latency\n", timer_ns);
+    printf("%-4s %-8s %10s %-6s %10s %8s %8s %8s %8s %8s %10s %8s %6s\n",
+           "tree", "workload", "keys", "op", "ops", "mean", "p50", "p90",
+           "p99", "p99.9", "max", "B/key", "height");
+  }
+
+#ifdef TREE_PERF
+  if (perf_init() < 0) {
+    fprintf(stderr, "hardware counters are not available, only calls are "
+                    "counted\n");
+  }
+#endif
+
+  bool first = true;
+  bool valid = true;
+
+  for (uint64_t w = 0; w < BENCH_WORKLOADS; w++) {
+    if (only != NULL && strcmp(only, bench_workloads[w]) != 0) {
+      continue;
+    }
+
+    for (uint64_t k = 0; k < key_counts; k++) {
+      bench_workload_t workload;
+
+      // every workload and size starts from the same seed, so adding or
+      // dropping one does not change the others
+      bench_state = seed;
+
+      bench_generate(&workload, bench_workloads[w], keys[k], window);
+      bench_perf_reset();
+      bench_run(&workload, &result, check);
+      free(workload.steps);
+
+      if (json) {
+        printf("%s\n  {\"workload\": \"%s\", \"keys\": %llu, "
+               "\"seconds\": %.6f, \"peak_size\": %llu, "
+               "\"bytes_per_key\": %.2f, \"max_height\": %u, ",
+               first ? "" : ",", bench_workloads[w],
+               (unsigned long long)keys[k], result.seconds,
+               (unsigned long long)result.peak_size, result.bytes_per_key,
+               result.max_height);
+        bench_json_ops("insert", &result.insert);
+        printf(", ");
+        bench_json_ops("remove", &result.remove);
+
+        if (check) {
+          printf(", \"valid\": %s", result.valid ? "true" : "false");
+        }
+
+#ifdef TREE_PERF
+        printf(", \"perf\": ");
+        perf_json(stdout);
+#endif
+
+        printf("}");
+      } else {
+        bench_table_ops(bench_workloads[w], keys[k], "insert", &result.insert,
+                        &result);
+        bench_table_ops(bench_workloads[w], keys[k], "remove", &result.remove,
+                        &result);
+#ifdef TREE_PERF
+        perf_report(stdout);
+#endif
+
+        if (check && !result.valid) {
+          printf("# %s %llu: invariants violated\n", bench_workloads[w],
+                 (unsigned long long)keys[k]);
+        }
+      }
+
+      valid = valid && result.valid;
+      first = false;
+    }
+  }
+
+  if (json) {
+    printf("\n]}\n");
+  }
+
+  histogram_free(&result.insert);
+  histogram_free(&result.remove);
+
+#ifdef TREE_RECORD
+  if (record != NULL && workload_recorder_close(&recorder) < 0) {
+    fprintf(stderr, "writing %s failed\n", record);
+
+    return 1;
+  }
+#endif
+
+#ifdef TREE_PERF
+  perf_close();
+#endif
+
+  return valid ? 0 : 2;
+}
@@ -0,0 +1,574 @@
+#ifndef TREE_ENGINE_H
+#define TREE_ENGINE_H
+
+// The tree under benchmark, picked at compile time with -DBENCH_AVL,
+// -DBENCH_RB, -DBENCH_BP, -DBENCH_AVL_POOL or -DBENCH_RB_POOL. The tree
+// source is included whole, so its functions can be inlined into the
+// drivers, and wrapped in a common bench_* interface.
+
+#if defined(BENCH_AVL)
+#define AVL_TREE_NO_MAIN
+#include "../avltree/avl_tree.c"
+#elif defined(BENCH_RB)
+#define RB_TREE_NO_MAIN
+#include "../rbtree/rb_tree.c"
+#elif defined(BENCH_BP)
+#define BP_TREE_NO_MAIN
+#include "../bptree/bp_tree.c"
+#elif defined(BENCH_AVL_POOL)
+#define AVL_POOL_NO_MAIN
+#define BENCH_POOL
+#include "../avltree/avl_pool.c"
+#elif defined(BENCH_RB_POOL)
+#define RB_POOL_NO_MAIN
+#define BENCH_POOL
+#include "../rbtree/rb_pool.c"
+#else
+#error "build with -DBENCH_AVL, -DBENCH_RB, -DBENCH_BP, -DBENCH_AVL_POOL or -DBENCH_RB_POOL"
+#endif
+
+// the binary trees define their own INFINITY for the ascii printer
+#undef INFINITY
+
+#if defined(BENCH_AVL)
+
+#define BENCH_ENGINE "avl"
+#define BENCH_LEFT(NODE) ((NODE)->left)
+#define BENCH_RIGHT(NODE) ((NODE)->right)
+
+typedef avl_tree_t bench_tree_t;
+typedef avl_node_t bench_node_t;
+
+static inline void bench_insert(bench_tree_t *tree, int key) {
+  avl_tree_insert(tree, key);
+}
+
+static inline void bench_remove(bench_tree_t *tree, int key) {
+  avl_tree_remove(tree, key);
+}
+
+static inline bool bench_find(bench_tree_t *tree, int key) {
+  return avl_tree_find(tree, key) != NULL;
+}
+
+static inline uint64_t bench_range(bench_tree_t *tree, int low, int high) {
+  return avl_tree_range(tree, low, high, NULL, 0);
+}
+
+static inline void bench_free(bench_tree_t *tree) { avl_tree_free(tree); }
+
+static inline void bench_free_parallel(bench_tree_t *tree, uint32_t nthreads) {
+  avl_tree_free_parallel(tree, nthreads);
+}
+
+static inline int bench_freeze(bench_tree_t *tree, frozen_set_t *set) {
+  return avl_tree_freeze(tree, set);
+}
+
+static inline int bench_build(bench_tree_t *tree, const int *keys, uint64_t n,
+                              uint32_t nthreads) {
+  return avl_tree_build(tree, keys, n, nthreads, false);
+}
+
+static inline int bench_insert_batch(bench_tree_t *tree, const int *keys,
+                                     uint64_t n, uint32_t nthreads) {
+  return avl_tree_insert_batch(tree, keys, n, nthreads);
+}
+
+static inline int64_t bench_remove_batch(bench_tree_t *tree, const int *keys,
+                                         uint64_t n, uint32_t nthreads) {
+  return avl_tree_remove_batch(tree, keys, n, nthreads);
+}
+
+static inline int bench_export_dot(bench_tree_t *tree, int fd) {
+  return avl_tree_export_dot(tree, fd);
+}
+
+// returns the height of the subtree, or -1 when the stored heights or the
+// balance are off
+static inline int32_t bench_check_node(avl_node_t *node) {
+  if (node == NULL) {
+    return 0;
+  }
+
+  int32_t left = bench_check_node(node->left);
+  int32_t right = bench_check_node(node->right);
+
+  if (left < 0 || right < 0 || left != node->left_height ||
+      right != node->right_height || abs(left - right) > 1) {
+    return -1;
+  }
+
+  return 1 + max(left, right);
+}
+
+static inline bool bench_check_balance(bench_tree_t *tree) {
+  return bench_check_node(tree->root) >= 0;
+}
+
+#elif defined(BENCH_RB)
+
+#define BENCH_ENGINE "rb"
+#define BENCH_LEFT(NODE) (LCHILD(NODE))
+#define BENCH_RIGHT(NODE) (RCHILD(NODE))
+
+typedef rb_tree_t bench_tree_t;
+typedef rb_node_t bench_node_t;
+
+static inline void bench_insert(bench_tree_t *tree, int key) {
+  rb_tree_insert(tree, key);
+}
+
+static inline void bench_remove(bench_tree_t *tree, int key) {
+  rb_tree_remove(tree, key);
+}
+
+static inline bool bench_find(bench_tree_t *tree, int key) {
+  return rb_tree_find(tree, key) != NIL;
+}
+
+static inline uint64_t bench_range(bench_tree_t *tree, int low, int high) {
+  return rb_tree_range(tree, low, high, NULL, 0);
+}
+
+static inline void bench_free(bench_tree_t *tree) { rb_tree_free(tree); }
+
+static inline void bench_free_parallel(bench_tree_t *tree, uint32_t nthreads) {
+  rb_tree_free_parallel(tree, nthreads);
+}
+
+static inline int bench_freeze(bench_tree_t *tree, frozen_set_t *set) {
+  return rb_tree_freeze(tree, set);
+}
+
+static inline int bench_build(bench_tree_t *tree, const int *keys, uint64_t n,
+                              uint32_t nthreads) {
+  return rb_tree_build(tree, keys, n, nthreads, false);
+}
+
+static inline int bench_insert_batch(bench_tree_t *tree, const int *keys,
+                                     uint64_t n, uint32_t nthreads) {
+  return rb_tree_insert_batch(tree, keys, n, nthreads);
+}
+
+static inline int64_t bench_remove_batch(bench_tree_t *tree, const int *keys,
+                                         uint64_t n, uint32_t nthreads) {
+  return rb_tree_remove_batch(tree, keys, n, nthreads);
+}
+
+static inline int bench_export_dot(bench_tree_t *tree, int fd) {
+  return rb_tree_export_dot(tree, fd);
+}
+
+// returns the black height of the subtree, or -1 when a red node has a
+// red child or the black heights of the two sides differ
+static inline int32_t bench_check_node(rb_node_t *node) {
+  if (node == NIL) {
+    return 1;
+  }
+
+  if (node->color == RED &&
+      (!rb_is_black(LCHILD(node)) || !rb_is_black(RCHILD(node)))) {
+    return -1;
+  }
+
+  int32_t left = bench_check_node(LCHILD(node));
+  int32_t right = bench_check_node(RCHILD(node));
+
+  if (left < 0 || left != right) {
+    return -1;
+  }
+
+  return left + (node->color == BLACK);
+}
+
+static inline bool bench_check_balance(bench_tree_t *tree) {
+  return rb_is_black(tree->root) && bench_check_node(tree->root) >= 0;
+}
+
+#elif defined(BENCH_BP)
+
+#define BENCH_ENGINE "bp"
+
+typedef bp_tree_t bench_tree_t;
+typedef bp_node_t bench_node_t;
+
+static inline void bench_insert(bench_tree_t *tree, int key) {
+  bp_tree_insert(tree, key);
+}
+
+static inline void bench_remove(bench_tree_t *tree, int key) {
+  bp_tree_remove(tree, key);
+}
+
+static inline bool bench_find(bench_tree_t *tree, int key) {
+  return bp_tree_find(tree, key) != NULL;
+}
+
+static inline uint64_t bench_range(bench_tree_t *tree, int low, int high) {
+  return bp_tree_range(tree, low, high, NULL, 0);
+}
+
+static inline void bench_free(bench_tree_t *tree) { bp_tree_free(tree); }
+
+static inline int bench_freeze(bench_tree_t *tree, frozen_set_t *set) {
+  return bp_tree_freeze(tree, set);
+}
+
+// every leaf is at the same depth, so the height is that of the leftmost
+static inline uint32_t bench_tree_height(bench_tree_t *tree) {
+  bench_node_t *node = tree->root;
+  uint32_t height = 0;
+
+  for (; node != NULL; node = node->leaf ? NULL : node->child[0]) {
+    height++;
+  }
+
+  return height;
+}
+
+// Checks the subtree against the bounds [low, high] from the separators
+// above it: sorted keys within the bounds, INT_MAX in the unused slots, no
+// node but the root below the minimum and all leaves at `depth`. Leaves
+// are matched in order against the linked list through *leaf.
+static inline bool bench_check_node(bp_node_t *node, bool root, int64_t low,
+                                    int64_t high, uint32_t depth,
+                                    bp_node_t **leaf, uint64_t *count) {
+  if ((!root && node->count < BP_MIN_KEYS) || node->count > BP_KEYS) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < BP_KEYS; i++) {
+    if (i >= node->count ? node->keys[i] != INT_MAX
+                         : node->keys[i] < low || node->keys[i] > high ||
+                               (i > 0 && node->keys[i - 1] > node->keys[i])) {
+      return false;
+    }
+  }
+
+  if (node->leaf) {
+    if (depth != 1 || node != *leaf) {
+      return false;
+    }
+
+    *leaf = node->next;
+    *count += node->count;
+
+    return true;
+  }
+
+  if (depth == 1 || (root && node->count == 0)) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i <= node->count; i++) {
+    if (!bench_check_node(node->child[i], false,
+                          i > 0 ? node->keys[i - 1] : low,
+                          i < node->count ? node->keys[i] : high, depth - 1,
+                          leaf, count)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static inline bool bench_check(bench_tree_t *tree) {
+  bp_node_t *leaf = bp_first_leaf(tree);
+  uint64_t count = 0;
+
+  if (tree->root == NULL) {
+    return tree->size == 0;
+  }
+
+  return bench_check_node(tree->root, true, INT64_MIN, INT64_MAX,
+                          bench_tree_height(tree), &leaf, &count) &&
+         leaf == NULL && count == tree->size;
+}
+
+#elif defined(BENCH_AVL_POOL)
+
+#define BENCH_ENGINE "avl_pool"
+#define BENCH_NODE(TREE, INDEX) AVL_NODE(TREE, INDEX)
+#define BENCH_LEFT(NODE) ((NODE)->left)
+#define BENCH_RIGHT(NODE) ((NODE)->right)
+#define BENCH_PARENT(TREE, INDEX) (AVL_NODE(TREE, INDEX)->parent)
+
+typedef avl_pool_tree_t bench_tree_t;
+
+static inline void bench_insert(bench_tree_t *tree, int key) {
+  avl_pool_insert(tree, key);
+}
+
+static inline void bench_remove(bench_tree_t *tree, int key) {
+  avl_pool_remove(tree, key);
+}
+
+static inline bool bench_find(bench_tree_t *tree, int key) {
+  return avl_pool_find(tree, key) != NIL;
+}
+
+static inline uint64_t bench_range(bench_tree_t *tree, int low, int high) {
+  return avl_pool_range(tree, low, high, NULL, 0);
+}
+
+static inline void bench_free(bench_tree_t *tree) { avl_pool_free(tree); }
+
+static inline int bench_freeze(bench_tree_t *tree, frozen_set_t *set) {
+  return avl_pool_freeze(tree, set);
+}
+
+// returns the height of the subtree, or -1 when the stored heights or the
+// balance are off
+static inline int32_t bench_check_node(bench_tree_t *tree, uint32_t index) {
+  if (index == NIL) {
+    return 0;
+  }
+
+  avl_pool_node_t *node = AVL_NODE(tree, index);
+  int32_t left = bench_check_node(tree, node->left);
+  int32_t right = bench_check_node(tree, node->right);
+
+  if (left < 0 || right < 0 || abs(left - right) > 1 ||
+      node->height != 1 + (left > right ? left : right)) {
+    return -1;
+  }
+
+  return node->height;
+}
+
+static inline bool bench_check_balance(bench_tree_t *tree) {
+  return bench_check_node(tree, tree->root) >= 0;
+}
+
+#elif defined(BENCH_RB_POOL)
+
+#define BENCH_ENGINE "rb_pool"
+#define BENCH_NODE(TREE, INDEX) RB_NODE(TREE, INDEX)
+#define BENCH_LEFT(NODE) ((NODE)->child[LEFT])
+#define BENCH_RIGHT(NODE) ((NODE)->child[RIGHT])
+#define BENCH_PARENT(TREE, INDEX) rb_pool_parent(TREE, INDEX)
+
+typedef rb_pool_tree_t bench_tree_t;
+
+static inline void bench_insert(bench_tree_t *tree, int key) {
+  rb_pool_insert(tree, key);
+}
+
+static inline void bench_remove(bench_tree_t *tree, int key) {
+  rb_pool_remove(tree, key);
+}
+
+static inline bool bench_find(bench_tree_t *tree, int key) {
+  return rb_pool_find(tree, key) != NIL;
+}
+
+static inline uint64_t bench_range(bench_tree_t *tree, int low, int high) {
+  return rb_pool_range(tree, low, high, NULL, 0);
+}
+
+static inline void bench_free(bench_tree_t *tree) { rb_pool_free(tree); }
+
+static inline int bench_freeze(bench_tree_t *tree, frozen_set_t *set) {
+  return rb_pool_freeze(tree, set);
+}
+
+// returns the black height of the subtree, or -1 when a red node has a
+// red child or the black heights of the two sides differ
+static inline int32_t bench_check_node(bench_tree_t *tree, uint32_t index) {
+  if (index == NIL) {
+    return 1;
+  }
+
+  rb_pool_node_t *node = RB_NODE(tree, index);
+  bool red = rb_pool_is_red(tree, index);
+
+  if (red && (rb_pool_is_red(tree, node->child[LEFT]) ||
+              rb_pool_is_red(tree, node->child[RIGHT]))) {
+    return -1;
+  }
+
+  int32_t left = bench_check_node(tree, node->child[LEFT]);
+  int32_t right = bench_check_node(tree, node->child[RIGHT]);
+
+  if (left < 0 || left != right) {
+    return -1;
+  }
+
+  return left + !red;
+}
+
+static inline bool bench_check_balance(bench_tree_t *tree) {
+  return tree->root == NIL ||
+         (!rb_pool_is_red(tree, tree->root) && !rb_pool_is_red(tree, NIL) &&
+          bench_check_node(tree, tree->root) >= 0);
+}
+
+#endif
+
+/* ---------------------------------------------- */
+
+#if defined(BENCH_POOL)
+
+static inline uint32_t bench_height(bench_tree_t *tree, uint32_t index) {
+  if (index == NIL) {
+    return 0;
+  }
+
+  uint32_t left = bench_height(tree, BENCH_LEFT(BENCH_NODE(tree, index)));
+  uint32_t right = bench_height(tree, BENCH_RIGHT(BENCH_NODE(tree, index)));
+
+  return 1 + (left > right ? left : right);
+}
+
+static inline uint32_t bench_tree_height(bench_tree_t *tree) {
+  return bench_height(tree, tree->root);
+}
+
+// the pool is mapped outside the heap, count the slots handed out
+static inline uint64_t bench_mapped_bytes(bench_tree_t *tree) {
+  return (uint64_t)tree->pool.count * tree->pool.node_size;
+}
+
+// in order walk over the parent links checking that the keys do not
+// decrease and that every child links back to its parent
+static inline bool bench_check_order(bench_tree_t *tree) {
+  uint32_t index = tree->root;
+  uint64_t count = 0;
+  bool first = true;
+  int previous = 0;
+
+  if (index == NIL) {
+    return tree->size == 0;
+  }
+
+  if (BENCH_PARENT(tree, index) != NIL) {
+    return false;
+  }
+
+  while (BENCH_LEFT(BENCH_NODE(tree, index)) != NIL) {
+    index = BENCH_LEFT(BENCH_NODE(tree, index));
+  }
+
+  while (index != NIL) {
+    uint32_t left = BENCH_LEFT(BENCH_NODE(tree, index));
+    uint32_t right = BENCH_RIGHT(BENCH_NODE(tree, index));
+    int value = BENCH_NODE(tree, index)->value;
+
+    if ((left != NIL && BENCH_PARENT(tree, left) != index) ||
+        (right != NIL && BENCH_PARENT(tree, right) != index) ||
+        (!first && previous > value)) {
+      return false;
+    }
+
+    previous = value;
+    first = false;
+    count++;
+
+    if (right != NIL) {
+      index = right;
+
+      while (BENCH_LEFT(BENCH_NODE(tree, index)) != NIL) {
+        index = BENCH_LEFT(BENCH_NODE(tree, index));
+      }
+    } else {
+      uint32_t parent = BENCH_PARENT(tree, index);
+
+      while (parent != NIL && BENCH_RIGHT(BENCH_NODE(tree, parent)) == index) {
+        index = parent;
+        parent = BENCH_PARENT(tree, index);
+      }
+
+      index = parent;
+    }
+  }
+
+  return count == tree->size;
+}
+
+static inline bool bench_check(bench_tree_t *tree) {
+  return bench_check_order(tree) && bench_check_balance(tree);
+}
+
+#else
+
+// the other engines allocate with malloc, which mallinfo2 sees
+static inline uint64_t bench_mapped_bytes(bench_tree_t *tree) {
+  (void)tree;
+
+  return 0;
+}
+
+#endif
+
+#if defined(BENCH_AVL) || defined(BENCH_RB)
+
+static inline uint32_t bench_height(bench_node_t *node) {
+  if (node == NULL) {
+    return 0;
+  }
+
+  uint32_t left = bench_height(BENCH_LEFT(node));
+  uint32_t right = bench_height(BENCH_RIGHT(node));
+
+  return 1 + (left > right ? left : right);
+}
+
+static inline uint32_t bench_tree_height(bench_tree_t *tree) {
+  return bench_height(tree->root);
+}
+
+// in order walk over the parent pointers checking that the keys do not
+// decrease and that every child points back at its parent
+static inline bool bench_check_order(bench_tree_t *tree) {
+  bench_node_t *node = tree->root;
+  bench_node_t *previous = NULL;
+  uint64_t count = 0;
+
+  if (node == NULL) {
+    return tree->size == 0;
+  }
+
+  if (node->parent != NULL) {
+    return false;
+  }
+
+  while (BENCH_LEFT(node) != NULL) {
+    node = BENCH_LEFT(node);
+  }
+
+  while (node != NULL) {
+    if ((BENCH_LEFT(node) != NULL && BENCH_LEFT(node)->parent != node) ||
+        (BENCH_RIGHT(node) != NULL && BENCH_RIGHT(node)->parent != node) ||
+        (previous != NULL && previous->value > node->value)) {
+      return false;
+    }
+
+    previous = node;
+    count++;
+
+    if (BENCH_RIGHT(node) != NULL) {
+      node = BENCH_RIGHT(node);
+
+      while (BENCH_LEFT(node) != NULL) {
+        node = BENCH_LEFT(node);
+      }
+    } else {
+      while (node->parent != NULL && BENCH_RIGHT(node->parent) == node) {
+        node = node->parent;
+      }
+
+      node = node->parent;
+    }
+  }
+
+  return count == tree->size;
+}
+
+static inline bool bench_check(bench_tree_t *tree) {
+  return bench_check_order(tree) && bench_check_balance(tree);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,825 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "../common/frozen_set.h"
+#include "../common/perf_counters.h"
+#include "../common/trace_log.h"
+#include "../common/workload_trace.h"
+
+/*
+
+A B+tree of ints with the same interface as the AVL and red-black trees.
+
+Every node keeps its keys in one 64 byte cache line, so a level of the
+descent costs one line of keys and one child pointer, against a line per
+comparison in the binary trees. Unused key slots hold INT_MAX, which lets
+the search count the keys below the one searched for over the whole line
+with a few SIMD compares and no branches.
+
+The values live in the leaves, which are linked in order for range scans.
+An inner node with n keys has n + 1 children, and every key in child[i]
+lies in [keys[i - 1], keys[i]]. The bounds are closed because duplicate
+values are kept and can straddle a separator. A search goes to the first
+child whose upper bound is not below the value, so it reaches the
+leftmost leaf that may hold it. If that leaf ends first, the value can
+only be at the start of the next leaf.
+
+*/
+
+#define BP_KEYS 16
+#define BP_MIN_KEYS (BP_KEYS / 2)
+// fanout is at least BP_MIN_KEYS + 1 below the root, far more than enough
+// for 2^64 values
+#define BP_MAX_DEPTH 24
+
+typedef struct bp_node {
+  int keys[BP_KEYS] __attribute__((aligned(64)));
+  uint32_t count;
+  bool leaf;
+  // next leaf in order, NULL for the last one and for inner nodes
+  struct bp_node *next;
+  // BP_KEYS + 1 of them in inner nodes, none in leaves
+  struct bp_node *child[];
+} bp_node_t;
+
+#define BP_INNER_SIZE                                                          \
+  ((offsetof(bp_node_t, child) + sizeof(bp_node_t *) * (BP_KEYS + 1) + 63) &  \
+   ~(size_t)63)
+
+typedef struct bp_tree {
+  bp_node_t *root;
+  uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
+} bp_tree_t;
+
+// the nodes a descent went through and the child taken in each,
+// node[depth - 1] is the leaf and index[depth - 1] a slot in it
+typedef struct bp_path {
+  bp_node_t *node[BP_MAX_DEPTH];
+  uint32_t index[BP_MAX_DEPTH];
+  uint32_t depth;
+} bp_path_t;
+
+static bp_node_t *bp_node_create(bool leaf) {
+  bp_node_t *node = (bp_node_t *)aligned_alloc(
+      64, leaf ? sizeof(bp_node_t) : BP_INNER_SIZE);
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < BP_KEYS; i++) {
+    node->keys[i] = INT_MAX;
+  }
+
+  node->count = 0;
+  node->leaf = leaf;
+  node->next = NULL;
+
+  return node;
+}
+
+// number of keys in the node smaller than value
+static inline uint32_t bp_rank(const bp_node_t *node, int value) {
+#if defined(__AVX2__)
+  __m256i x = _mm256_set1_epi32(value);
+  __m256i low = _mm256_load_si256((const __m256i *)node->keys);
+  __m256i high = _mm256_load_si256((const __m256i *)(node->keys + 8));
+  uint32_t mask =
+      (uint32_t)_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpgt_epi32(x, low))) |
+      (uint32_t)_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpgt_epi32(x, high)))
+          << 8;
+
+  return __builtin_popcount(mask);
+#elif defined(__SSE2__)
+  __m128i x = _mm_set1_epi32(value);
+  uint32_t mask = 0;
+
+  for (int i = 0; i < BP_KEYS; i += 4) {
+    __m128i keys = _mm_load_si128((const __m128i *)(node->keys + i));
+
+    mask |= (uint32_t)_mm_movemask_ps(
+                _mm_castsi128_ps(_mm_cmpgt_epi32(x, keys)))
+            << i;
+  }
+
+  return __builtin_popcount(mask);
+#else
+  uint32_t rank = 0;
+
+  for (int i = 0; i < BP_KEYS; i++) {
+    rank += node->keys[i] < value;
+  }
+
+  return rank;
+#endif
+}
+
+PERF_DEFINE_REGION(bp_perf_descent, "descent");
+PERF_DEFINE_REGION(bp_perf_split, "bp_split");
+PERF_DEFINE_REGION(bp_perf_rebalance, "bp_rebalance");
+
+// walks down to the leftmost leaf that may hold value, recording the path
+static inline void bp_descend(bp_tree_t *tree, int value, bp_path_t *path) {
+  bp_node_t *node = tree->root;
+
+  PERF_BEGIN(bp_perf_descent);
+
+  path->depth = 0;
+
+  for (;;) {
+    uint32_t index = bp_rank(node, value);
+
+    path->node[path->depth] = node;
+    path->index[path->depth++] = index;
+
+    if (node->leaf) {
+      break;
+    }
+
+    node = node->child[index];
+  }
+
+  PERF_END(bp_perf_descent);
+}
+
+// moves the path to the first slot of the next leaf, returns false after
+// the last one
+static bool bp_path_next(bp_path_t *path) {
+  int32_t level = (int32_t)path->depth - 2;
+
+  while (level >= 0 && path->index[level] >= path->node[level]->count) {
+    level--;
+  }
+
+  if (level < 0) {
+    return false;
+  }
+
+  bp_node_t *node = path->node[level]->child[++path->index[level]];
+
+  for (level++; level < (int32_t)path->depth; level++) {
+    path->node[level] = node;
+    path->index[level] = 0;
+
+    if (!node->leaf) {
+      node = node->child[0];
+    }
+  }
+
+  return true;
+}
+
+bp_tree_t bp_tree_create(int value) {
+  bp_node_t *node = bp_node_create(true);
+  node->keys[0] = value;
+  node->count = 1;
+
+  bp_tree_t tree = {.root = node, .size = 1};
+
+  return tree;
+}
+
+static void bp_node_free(bp_node_t *node) {
+  if (!node->leaf) {
+    for (uint32_t i = 0; i <= node->count; i++) {
+      bp_node_free(node->child[i]);
+    }
+  }
+
+  free(node);
+}
+
+void bp_tree_free(bp_tree_t *tree) {
+  if (tree->root == NULL) {
+    return;
+  }
+
+  bp_node_free(tree->root);
+
+  tree->root = NULL;
+  tree->size = 0;
+}
+
+/* ---------------------------------------------- */
+
+// Splits the full node at path->node[level] that is about to take `key`
+// (and, for inner nodes, `child` to its right) at `index`, then pushes
+// the new separator into the parent, splitting upwards as needed.
+static int bp_split_insert(bp_tree_t *tree, bp_path_t *path, int32_t level,
+                           uint32_t index, int key, bp_node_t *child) {
+  int keys[BP_KEYS + 1];
+  bp_node_t *children[BP_KEYS + 2];
+
+  PERF_BEGIN(bp_perf_split);
+
+  for (; level >= 0; level--) {
+    bp_node_t *node = path->node[level];
+
+    if (node->count < BP_KEYS) {
+      memmove(node->keys + index + 1, node->keys + index,
+              sizeof(int) * (node->count - index));
+      node->keys[index] = key;
+
+      if (!node->leaf) {
+        memmove(node->child + index + 2, node->child + index + 1,
+                sizeof(bp_node_t *) * (node->count - index));
+        node->child[index + 1] = child;
+      }
+
+      node->count++;
+
+      PERF_END(bp_perf_split);
+
+      return 0;
+    }
+
+    bp_node_t *right = bp_node_create(node->leaf);
+
+    if (right == NULL) {
+      PERF_END(bp_perf_split);
+
+      return -1;
+    }
+
+    memcpy(keys, node->keys, sizeof(int) * index);
+    keys[index] = key;
+    memcpy(keys + index + 1, node->keys + index,
+           sizeof(int) * (BP_KEYS - index));
+
+    if (node->leaf) {
+      // the left leaf keeps BP_KEYS / 2 + 1 values and its largest
+      // becomes the separator
+      uint32_t left_count = BP_KEYS / 2 + 1;
+
+      memcpy(node->keys, keys, sizeof(int) * left_count);
+      memcpy(right->keys, keys + left_count,
+             sizeof(int) * (BP_KEYS + 1 - left_count));
+
+      for (uint32_t i = left_count; i < BP_KEYS; i++) {
+        node->keys[i] = INT_MAX;
+      }
+
+      node->count = left_count;
+      right->count = BP_KEYS + 1 - left_count;
+      right->next = node->next;
+      node->next = right;
+      key = keys[left_count - 1];
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "split leaf at %d", key);
+    } else {
+      // BP_KEYS + 1 keys: half stay, the middle one moves up, half move
+      // to the new node with the children on its right
+      uint32_t left_count = BP_KEYS / 2;
+
+      memcpy(children, node->child, sizeof(bp_node_t *) * (index + 1));
+      children[index + 1] = child;
+      memcpy(children + index + 2, node->child + index + 1,
+             sizeof(bp_node_t *) * (BP_KEYS - index));
+
+      memcpy(node->keys, keys, sizeof(int) * left_count);
+      memcpy(node->child, children, sizeof(bp_node_t *) * (left_count + 1));
+      memcpy(right->keys, keys + left_count + 1,
+             sizeof(int) * (BP_KEYS - left_count));
+      memcpy(right->child, children + left_count + 1,
+             sizeof(bp_node_t *) * (BP_KEYS - left_count + 1));
+
+      for (uint32_t i = left_count; i < BP_KEYS; i++) {
+        node->keys[i] = INT_MAX;
+      }
+
+      node->count = left_count;
+      right->count = BP_KEYS - left_count;
+      key = keys[left_count];
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "split inner node at %d", key);
+    }
+
+    child = right;
+
+    if (level == 0) {
+      bp_node_t *root = bp_node_create(false);
+
+      if (root == NULL) {
+        PERF_END(bp_perf_split);
+
+        return -1;
+      }
+
+      root->keys[0] = key;
+      root->child[0] = node;
+      root->child[1] = right;
+      root->count = 1;
+      tree->root = root;
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "new root at %d", key);
+    } else {
+      index = path->index[level - 1];
+    }
+  }
+
+  PERF_END(bp_perf_split);
+
+  return 0;
+}
+
+int bp_tree_insert(bp_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
+  if (tree->root == NULL) {
+    tree->root = bp_node_create(true);
+
+    if (tree->root == NULL) {
+      return -1;
+    }
+  }
+
+  bp_path_t path;
+
+  bp_descend(tree, value, &path);
+
+  if (bp_split_insert(tree, &path, path.depth - 1, path.index[path.depth - 1],
+                      value, NULL) < 0) {
+    return -1;
+  }
+
+  tree->size++;
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+static inline void bp_remove_slot(bp_node_t *node, uint32_t index) {
+  memmove(node->keys + index, node->keys + index + 1,
+          sizeof(int) * (node->count - index - 1));
+
+  if (!node->leaf) {
+    memmove(node->child + index + 1, node->child + index + 2,
+            sizeof(bp_node_t *) * (node->count - index - 1));
+  }
+
+  node->keys[--node->count] = INT_MAX;
+}
+
+// appends right and the separator between them (inner nodes only) to
+// left, which must have room, and frees right
+static void bp_merge(bp_node_t *left, int separator, bp_node_t *right) {
+  uint32_t count = left->count;
+
+  if (left->leaf) {
+    memcpy(left->keys + count, right->keys, sizeof(int) * right->count);
+    left->count += right->count;
+    left->next = right->next;
+  } else {
+    left->keys[count] = separator;
+    memcpy(left->keys + count + 1, right->keys, sizeof(int) * right->count);
+    memcpy(left->child + count + 1, right->child,
+           sizeof(bp_node_t *) * (right->count + 1));
+    left->count += right->count + 1;
+  }
+
+  free(right);
+}
+
+// Refills the node at path->node[level] that dropped below BP_MIN_KEYS,
+// by taking a key from a sibling when one can spare it and by merging
+// with one otherwise, which takes a key from the parent and may leave it
+// short in turn.
+static void bp_rebalance(bp_tree_t *tree, bp_path_t *path, int32_t level) {
+  PERF_BEGIN(bp_perf_rebalance);
+
+  for (; level > 0; level--) {
+    bp_node_t *node = path->node[level];
+
+    if (node->count >= BP_MIN_KEYS) {
+      break;
+    }
+
+    bp_node_t *parent = path->node[level - 1];
+    uint32_t index = path->index[level - 1];
+    bp_node_t *left = index > 0 ? parent->child[index - 1] : NULL;
+    bp_node_t *right = index < parent->count ? parent->child[index + 1] : NULL;
+
+    if (left != NULL && left->count > BP_MIN_KEYS) {
+      memmove(node->keys + 1, node->keys, sizeof(int) * node->count);
+
+      if (node->leaf) {
+        node->keys[0] = left->keys[left->count - 1];
+        left->keys[--left->count] = INT_MAX;
+        parent->keys[index - 1] = left->keys[left->count - 1];
+      } else {
+        memmove(node->child + 1, node->child,
+                sizeof(bp_node_t *) * (node->count + 1));
+        node->keys[0] = parent->keys[index - 1];
+        node->child[0] = left->child[left->count];
+        parent->keys[index - 1] = left->keys[left->count - 1];
+        left->keys[--left->count] = INT_MAX;
+      }
+
+      node->count++;
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "took %d from the left",
+                node->keys[0]);
+      break;
+    }
+
+    if (right != NULL && right->count > BP_MIN_KEYS) {
+      if (node->leaf) {
+        node->keys[node->count++] = right->keys[0];
+        parent->keys[index] = right->keys[0];
+      } else {
+        node->keys[node->count++] = parent->keys[index];
+        node->child[node->count] = right->child[0];
+        parent->keys[index] = right->keys[0];
+        memmove(right->child, right->child + 1,
+                sizeof(bp_node_t *) * right->count);
+      }
+
+      memmove(right->keys, right->keys + 1, sizeof(int) * (right->count - 1));
+      right->keys[--right->count] = INT_MAX;
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "took %d from the right",
+                parent->keys[index]);
+      break;
+    }
+
+    if (left != NULL) {
+      bp_merge(left, parent->keys[index - 1], node);
+      bp_remove_slot(parent, index - 1);
+    } else {
+      bp_merge(node, parent->keys[index], right);
+      bp_remove_slot(parent, index);
+    }
+
+    TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "merged under %p",
+              (void *)parent);
+  }
+
+  // the root may go down to a single child, which takes its place
+  bp_node_t *root = tree->root;
+
+  if (!root->leaf && root->count == 0) {
+    tree->root = root->child[0];
+    free(root);
+  }
+
+  PERF_END(bp_perf_rebalance);
+}
+
+int bp_tree_remove(bp_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
+  if (tree->root == NULL) {
+    return -1;
+  }
+
+  bp_path_t path;
+
+  bp_descend(tree, value, &path);
+
+  uint32_t last = path.depth - 1;
+
+  if (path.index[last] == path.node[last]->count && !bp_path_next(&path)) {
+    return -1;
+  }
+
+  bp_node_t *leaf = path.node[last];
+  uint32_t index = path.index[last];
+
+  if (leaf->keys[index] != value) {
+    return -1;
+  }
+
+  bp_remove_slot(leaf, index);
+  tree->size--;
+
+  if (tree->size == 0) {
+    free(leaf);
+    tree->root = NULL;
+
+    return 0;
+  }
+
+  bp_rebalance(tree, &path, last);
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// the leaf holding value, or NULL
+bp_node_t *bp_tree_find(bp_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
+
+  bp_node_t *node = tree->root;
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  while (!node->leaf) {
+    node = node->child[bp_rank(node, value)];
+  }
+
+  uint32_t index = bp_rank(node, value);
+
+  if (index == node->count) {
+    node = node->next;
+    index = 0;
+  }
+
+  return node != NULL && node->keys[index] == value ? node : NULL;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t bp_tree_range(bp_tree_t *tree, int low, int high, int *out,
+                       uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  bp_node_t *node = tree->root;
+  uint64_t count = 0;
+
+  if (node == NULL) {
+    return 0;
+  }
+
+  while (!node->leaf) {
+    node = node->child[bp_rank(node, low)];
+  }
+
+  for (uint32_t index = bp_rank(node, low); node != NULL;
+       node = node->next, index = 0) {
+    for (; index < node->count; index++) {
+      if (node->keys[index] > high) {
+        return count;
+      }
+
+      if (out != NULL && count < capacity) {
+        out[count] = node->keys[index];
+      }
+
+      count++;
+    }
+  }
+
+  return count;
+}
+
+// the leftmost leaf, NULL for an empty tree
+bp_node_t *bp_first_leaf(bp_tree_t *tree) {
+  bp_node_t *node = tree->root;
+
+  while (node != NULL && !node->leaf) {
+    node = node->child[0];
+  }
+
+  return node;
+}
+
+// Copies the values into a read-only frozen set, which answers lookups
+// without chasing node pointers. The tree is left as it is.
+int bp_tree_freeze(bp_tree_t *tree, frozen_set_t *set) {
+  int *sorted = (int *)malloc(sizeof(int) * (tree->size ? tree->size : 1));
+  uint64_t count = 0;
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  for (bp_node_t *node = bp_first_leaf(tree); node != NULL;
+       node = node->next) {
+    memcpy(sorted + count, node->keys, sizeof(int) * node->count);
+    count += node->count;
+  }
+
+  int result = frozen_set_init(set, sorted, count);
+
+  free(sorted);
+
+  return result;
+}
+
+/* ---------------------------------------------- */
+
+// Builds the tree bottom up from n values in ascending order, into an
+// empty tree. Every level is spread evenly over as few nodes as it fits
+// in, so the nodes are full or close to it and none is below the minimum.
+// Returns -1 if the tree is not empty or memory runs out, leaving it
+// empty.
+int bp_tree_bulk_load(bp_tree_t *tree, const int *sorted, uint64_t n) {
+  if (tree->root != NULL) {
+    return -1;
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  uint64_t count = (n + BP_KEYS - 1) / BP_KEYS;
+  bp_node_t **level = (bp_node_t **)malloc(sizeof(bp_node_t *) * count);
+  // largest value under each node of the level, the separators above it
+  int *high = (int *)malloc(sizeof(int) * count);
+  bp_node_t *previous = NULL;
+
+  if (level == NULL || high == NULL) {
+    free(level);
+    free(high);
+
+    return -1;
+  }
+
+  for (uint64_t i = 0, taken = 0; i < count; i++) {
+    uint64_t end = n * (i + 1) / count;
+    bp_node_t *leaf = bp_node_create(true);
+
+    if (leaf == NULL) {
+      for (uint64_t j = 0; j < i; j++) {
+        free(level[j]);
+      }
+
+      free(level);
+      free(high);
+
+      return -1;
+    }
+
+    memcpy(leaf->keys, sorted + taken, sizeof(int) * (end - taken));
+    leaf->count = end - taken;
+    taken = end;
+
+    if (previous != NULL) {
+      previous->next = leaf;
+    }
+
+    previous = level[i] = leaf;
+    high[i] = leaf->keys[leaf->count - 1];
+  }
+
+  while (count > 1) {
+    uint64_t parents = (count + BP_KEYS) / (BP_KEYS + 1);
+
+    for (uint64_t i = 0, taken = 0; i < parents; i++) {
+      uint64_t end = count * (i + 1) / parents;
+      bp_node_t *node = bp_node_create(false);
+
+      if (node == NULL) {
+        // free the subtrees built so far and the ones not yet taken
+        for (; taken < count; taken++) {
+          bp_node_free(level[taken]);
+        }
+
+        for (uint64_t j = 0; j < i; j++) {
+          bp_node_free(level[j]);
+        }
+
+        free(level);
+        free(high);
+
+        return -1;
+      }
+
+      for (uint64_t j = taken; j < end; j++) {
+        node->child[j - taken] = level[j];
+
+        if (j + 1 < end) {
+          node->keys[j - taken] = high[j];
+        }
+      }
+
+      node->count = end - taken - 1;
+      level[i] = node;
+      high[i] = high[end - 1];
+      taken = end;
+    }
+
+    count = parents;
+  }
+
+  tree->root = level[0];
+  tree->size = n;
+
+  free(level);
+  free(high);
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+void bp_tree_print(bp_tree_t *tree) {
+#ifdef __APPLE__
+  printf("Tree Size: %llu\n", tree->size);
+#elif __linux__
+  printf("Tree Size: %lu\n", tree->size);
+#endif
+
+  if (tree->root == NULL) {
+    return;
+  }
+
+  // one line per level, walking each through the parents of the level
+  // below the previous one
+  bp_node_t *first = tree->root;
+  bp_node_t **nodes = (bp_node_t **)malloc(sizeof(bp_node_t *));
+  uint64_t count = 1;
+
+  nodes[0] = first;
+
+  while (count > 0) {
+    uint64_t next_count = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+      printf("[");
+
+      for (uint32_t j = 0; j < nodes[i]->count; j++) {
+        printf(j ? " %d" : "%d", nodes[i]->keys[j]);
+      }
+
+      printf("] ");
+
+      if (!nodes[i]->leaf) {
+        next_count += nodes[i]->count + 1;
+      }
+    }
+
+    printf("\n");
+
+    bp_node_t **next = (bp_node_t **)malloc(
+        sizeof(bp_node_t *) * (next_count ? next_count : 1));
+
+    for (uint64_t i = 0, k = 0; i < count; i++) {
+      if (!nodes[i]->leaf) {
+        for (uint32_t j = 0; j <= nodes[i]->count; j++) {
+          next[k++] = nodes[i]->child[j];
+        }
+      }
+    }
+
+    free(nodes);
+    nodes = next;
+    count = next_count;
+  }
+
+  free(nodes);
+}
+
+#ifndef BP_TREE_NO_MAIN
+int main() {
+  bp_tree_t tree = bp_tree_create(7);
+
+  for (int i = 0; i < 40; i++) {
+    bp_tree_insert(&tree, (i * 37) % 41);
+  }
+
+  bp_tree_print(&tree);
+
+  for (int i = 0; i < 30; i++) {
+    bp_tree_remove(&tree, (i * 11) % 41);
+  }
+
+  bp_tree_print(&tree);
+
+  int values[8];
+  uint64_t count = bp_tree_range(&tree, 10, 30, values, 8);
+
+  printf("%lu values in [10, 30], first:", (unsigned long)count);
+
+  for (uint64_t i = 0; i < count && i < 8; i++) {
+    printf(" %d", values[i]);
+  }
+
+  printf("\n");
+
+  bp_tree_free(&tree);
+
+  int sorted[100];
+
+  for (int i = 0; i < 100; i++) {
+    sorted[i] = i / 2;
+  }
+
+  bp_tree_bulk_load(&tree, sorted, 100);
+  bp_tree_print(&tree);
+  bp_tree_free(&tree);
+
+  return 0;
+}
+#endif
@@ -0,0 +1,605 @@
+#ifndef ASCII_TREE_H
+#define ASCII_TREE_H
+
+// Drawing a binary tree in ASCII, shared by print_ascii_tree of the AVL
+// and red-black trees, which copy their nodes into asciinodes with the
+// labels to draw and hand them to ascii_tree_render.
+//
+// All the state of a drawing is in an ascii_tree_t, so any number of
+// them can run at once, on different threads, as long as the trees they
+// copy are not changed meanwhile. The drawing goes into a buffer that
+// doubles as it fills, and ascii_tree_write hands it to the file
+// descriptor in one write, so that the lines of two drawings going to
+// the same place do not interleave. With fd set, each line goes out as
+// soon as it is drawn instead, and the buffer holds one line at a time.
+//
+// Every level of the tree takes two lines, one with the labels and one
+// with the edges down to the next level, whose horizontal part is drawn
+// with underscores on the line of the labels:
+
+/*
+ *      13_
+ *     /   \
+ *    5     20
+ *   / \   /
+ *  1   8 15
+ */
+
+// The layout is that of Reingold and Tilford, "Tidier Drawings of Trees":
+// bottom up, the two subtrees of a node are pushed apart until their
+// contours, the leftmost and rightmost columns of their levels, are gap
+// apart on every level they share. A contour is kept bottom level first,
+// so that of a node is that of its taller child with the levels of the
+// other one and its own appended: the work at a node goes with the
+// height of its shorter child, which adds up to less than the number of
+// nodes over the whole tree. The layout and the drawing both iterate,
+// with no bound on the height.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "node_stack.h"
+
+// the spaces between two subtrees side by side, at the least
+#define ASCII_TREE_GAP 1
+
+typedef struct asciinode_struct asciinode;
+
+struct asciinode_struct {
+  asciinode *left, *right;
+
+  // column of the first character of the label, from that of the parent
+  // until the drawing gets to it
+  int64_t x;
+
+  int lablen;
+
+  // a color letter and an int in decimal, sign included, or the size of
+  // a subtree left out, see ascii_tree_collapse
+  char label[32];
+};
+
+typedef struct ascii_tree {
+  int gap;
+  // the column of the next character on the line being drawn
+  int64_t print_next;
+  char *output;
+  size_t size;
+  size_t capacity;
+  // set once the buffer cannot grow, what fits is kept
+  bool failed;
+  // where each line is written once drawn, or -1 to keep them all
+  int fd;
+} ascii_tree_t;
+
+static inline int64_t ascii_tree_min(int64_t x, int64_t y) {
+  return x < y ? x : y;
+}
+
+static inline int64_t ascii_tree_max(int64_t x, int64_t y) {
+  return x > y ? x : y;
+}
+
+static inline void ascii_tree_init(ascii_tree_t *ascii) {
+  ascii->gap = ASCII_TREE_GAP;
+  ascii->print_next = 0;
+  ascii->output = NULL;
+  ascii->size = 0;
+  ascii->capacity = 0;
+  ascii->failed = false;
+  ascii->fd = -1;
+}
+
+static inline void ascii_tree_free(ascii_tree_t *ascii) {
+  free(ascii->output);
+  ascii_tree_init(ascii);
+}
+
+// makes room for n more bytes, returns false if there is none
+static inline bool ascii_tree_reserve(ascii_tree_t *ascii, size_t n) {
+  if (ascii->failed) {
+    return false;
+  }
+
+  if (ascii->size + n <= ascii->capacity) {
+    return true;
+  }
+
+  size_t capacity = ascii->capacity ? ascii->capacity : 4096;
+
+  while (capacity < ascii->size + n) {
+    capacity *= 2;
+  }
+
+  char *output = (char *)realloc(ascii->output, capacity);
+
+  if (output == NULL) {
+    ascii->failed = true;
+
+    return false;
+  }
+
+  ascii->output = output;
+  ascii->capacity = capacity;
+
+  return true;
+}
+
+static inline void ascii_tree_append(ascii_tree_t *ascii, const char *text,
+                                     size_t n) {
+  if (ascii_tree_reserve(ascii, n)) {
+    memcpy(ascii->output + ascii->size, text, n);
+    ascii->size += n;
+  }
+
+  ascii->print_next += (int64_t)n;
+}
+
+// moves the line on by n copies of c, or none for n below 1
+static inline void ascii_tree_fill(ascii_tree_t *ascii, char c, int64_t n) {
+  if (n > 0 && ascii_tree_reserve(ascii, (size_t)n)) {
+    memset(ascii->output + ascii->size, c, (size_t)n);
+    ascii->size += (size_t)n;
+  }
+
+  ascii->print_next += ascii_tree_max(n, 0);
+}
+
+// Writes the buffer to fd, in a single write unless fd takes less at a
+// time, and empties it. Returns -1 if the write fails.
+static inline int ascii_tree_write(ascii_tree_t *ascii, int fd) {
+  size_t done = 0;
+
+  while (done < ascii->size) {
+    ssize_t n = write(fd, ascii->output + done, ascii->size - done);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      return -1;
+    }
+
+    done += (size_t)n;
+  }
+
+  ascii->size = 0;
+
+  return 0;
+}
+
+// ends the line, and writes it out if the drawing goes to fd as it is made
+static inline int ascii_tree_end_line(ascii_tree_t *ascii) {
+  ascii_tree_append(ascii, "\n", 1);
+
+  return ascii->fd >= 0 ? ascii_tree_write(ascii, ascii->fd) : 0;
+}
+
+// Free all the nodes of the given tree, in preorder with a stack of the
+// right subtrees still to free, one for each level at most
+static void free_ascii_tree(asciinode *node) {
+  node_stack_t pending;
+
+  node_stack_init(&pending);
+
+  while (node != NULL) {
+    asciinode *next = node->left;
+
+    if (next == NULL) {
+      next = node->right;
+    } else if (node->right != NULL &&
+               node_stack_push(&pending, node->right) < 0) {
+      free_ascii_tree(node->right);
+    }
+
+    if (next == NULL) {
+      next = (asciinode *)node_stack_pop(&pending);
+    }
+
+    free(node);
+    node = next;
+  }
+
+  node_stack_free(&pending);
+}
+
+// Labels node as a subtree of count nodes and the given height that is
+// not drawn, for the views that show part of a tree.
+static inline void ascii_tree_collapse(asciinode *node, uint64_t count,
+                                       int32_t height) {
+  node->left = NULL;
+  node->right = NULL;
+  node->x = 0;
+  snprintf(node->label, sizeof(node->label), "[n=%llu h=%d]",
+           (unsigned long long)count, height);
+  node->lablen = (int)strlen(node->label);
+}
+
+/* ---------------------------------------------- */
+
+// One side of the outline of a subtree: the leftmost or rightmost column
+// of each of its levels, bottom level first, from the label of its top
+// node once offset is added, so that moving the subtree is a change of
+// offset only.
+typedef struct ascii_contour {
+  int64_t *columns;
+  uint64_t size;
+  uint64_t capacity;
+  int64_t offset;
+} ascii_contour_t;
+
+// the outline of a subtree whose parent is not laid out yet
+typedef struct ascii_layout {
+  ascii_contour_t left;
+  ascii_contour_t right;
+} ascii_layout_t;
+
+// the column of the given level, 0 for the top one
+static inline int64_t ascii_contour_at(const ascii_contour_t *contour,
+                                       uint64_t level) {
+  return contour->columns[contour->size - 1 - level] + contour->offset;
+}
+
+// adds a level on top, at the given column
+static inline int ascii_contour_push(ascii_contour_t *contour,
+                                     int64_t column) {
+  if (contour->size == contour->capacity) {
+    uint64_t capacity = contour->capacity ? 2 * contour->capacity : 8;
+    int64_t *columns =
+        (int64_t *)realloc(contour->columns, sizeof(int64_t) * capacity);
+
+    if (columns == NULL) {
+      return -1;
+    }
+
+    contour->columns = columns;
+    contour->capacity = capacity;
+  }
+
+  contour->columns[contour->size++] = column - contour->offset;
+
+  return 0;
+}
+
+// Leaves in wins the contour of two sides under a node at column top:
+// wins gives the levels both sides have, loses those below them. The
+// levels of the shorter one are copied onto the array of the taller one,
+// and the other array is freed.
+static int ascii_contour_join(ascii_contour_t *wins, ascii_contour_t *loses,
+                              int64_t top) {
+  int result = 0;
+
+  if (loses->size > wins->size) {
+    loses->size -= wins->size;
+
+    for (uint64_t level = wins->size; level-- > 0 && result == 0;) {
+      result = ascii_contour_push(loses, ascii_contour_at(wins, level));
+    }
+
+    ascii_contour_t swap = *wins;
+    *wins = *loses;
+    *loses = swap;
+  }
+
+  free(loses->columns);
+  loses->columns = NULL;
+
+  return result < 0 ? -1 : ascii_contour_push(wins, top);
+}
+
+// the columns of the edges down from node, which are those of the
+// middle of the labels of its children but one towards node
+static inline int64_t ascii_tree_left_edge(asciinode *node) {
+  return node->left->x + (node->left->lablen - 1) / 2 + 1;
+}
+
+static inline int64_t ascii_tree_right_edge(asciinode *node) {
+  return node->right->x + (node->right->lablen - 1) / 2 - 1;
+}
+
+// Lays out node from the layouts of its children, if it has them, which
+// it takes over, and sets their x from that of node. The label of node
+// goes as close to its edges as it fits, in the middle of them if it has
+// two children, which are pushed apart until the label fits and their
+// subtrees are gap apart.
+static int ascii_tree_place(ascii_tree_t *ascii, asciinode *node,
+                            ascii_layout_t *left, ascii_layout_t *right,
+                            ascii_layout_t *layout) {
+  int64_t width = node->lablen;
+
+  if (left != NULL && right != NULL) {
+    // from the label of the left child to start with
+    node->left->x = 0;
+    node->right->x = width + 3 + (node->left->lablen - 1) / 2 -
+                     (node->right->lablen - 1) / 2;
+
+    uint64_t shared = left->right.size < right->left.size
+                          ? left->right.size
+                          : right->left.size;
+
+    for (uint64_t level = 0; level < shared; level++) {
+      int64_t x = ascii_contour_at(&left->right, level) + ascii->gap + 1 -
+                  ascii_contour_at(&right->left, level);
+
+      if (x > node->right->x) {
+        node->right->x = x;
+      }
+    }
+
+    int64_t from = ascii_tree_left_edge(node) + 1;
+    int64_t room = ascii_tree_right_edge(node) - from;
+    int64_t x = from + (room - width) / 2;
+
+    node->left->x -= x;
+    node->right->x -= x;
+  } else if (left != NULL) {
+    node->left->x = 0;
+    node->left->x -= ascii_tree_left_edge(node) + 1;
+  } else if (right != NULL) {
+    node->right->x = 0;
+    node->right->x += width - ascii_tree_right_edge(node);
+  }
+
+  int64_t top_left = left != NULL ? ascii_tree_left_edge(node) : 0;
+  int64_t top_right = right != NULL ? ascii_tree_right_edge(node) : width - 1;
+  ascii_layout_t empty = {{NULL, 0, 0, 0}, {NULL, 0, 0, 0}};
+
+  if (left != NULL) {
+    left->left.offset += node->left->x;
+    left->right.offset += node->left->x;
+  }
+
+  if (right != NULL) {
+    right->left.offset += node->right->x;
+    right->right.offset += node->right->x;
+  }
+
+  if (left != NULL && right != NULL) {
+    int result = ascii_contour_join(&left->left, &right->left, top_left);
+
+    if (ascii_contour_join(&right->right, &left->right, top_right) < 0) {
+      result = -1;
+    }
+
+    layout->left = left->left;
+    layout->right = right->right;
+
+    return result;
+  }
+
+  *layout = left != NULL ? *left : right != NULL ? *right : empty;
+
+  if (ascii_contour_push(&layout->left, top_left) < 0 ||
+      ascii_contour_push(&layout->right, top_right) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static void ascii_layout_free(ascii_layout_t *layout) {
+  free(layout->left.columns);
+  free(layout->right.columns);
+}
+
+// Lays out the tree under proot bottom up, in postorder with a stack of
+// the nodes on the way down and one of the layouts of the subtrees whose
+// parents are not done, and leaves in x the column of each label from
+// that of its parent, the root starting at column 0 and nothing going
+// left of it.
+static int ascii_tree_layout(ascii_tree_t *ascii, asciinode *proot) {
+  node_stack_t path;
+  ascii_layout_t *layouts = NULL;
+  uint64_t count = 0;
+  uint64_t capacity = 0;
+  asciinode *node = proot;
+  asciinode *last = NULL;
+  int result = 0;
+
+  node_stack_init(&path);
+
+  while (result == 0 && (node != NULL || !node_stack_is_empty(&path))) {
+    if (node != NULL) {
+      if (node_stack_push(&path, node) < 0) {
+        result = -1;
+      }
+
+      node = node->left;
+      continue;
+    }
+
+    asciinode *top = (asciinode *)node_stack_peek(&path);
+
+    if (top->right != NULL && last != top->right) {
+      node = top->right;
+      continue;
+    }
+
+    if (count == capacity) {
+      uint64_t grown = capacity ? 2 * capacity : 64;
+      ascii_layout_t *resized = (ascii_layout_t *)realloc(
+          layouts, sizeof(ascii_layout_t) * grown);
+
+      if (resized == NULL) {
+        result = -1;
+        break;
+      }
+
+      layouts = resized;
+      capacity = grown;
+    }
+
+    ascii_layout_t *right = top->right != NULL ? &layouts[--count] : NULL;
+    ascii_layout_t *left = top->left != NULL ? &layouts[--count] : NULL;
+    ascii_layout_t layout;
+
+    result = ascii_tree_place(ascii, top, left, right, &layout);
+    layouts[count++] = layout;
+    last = (asciinode *)node_stack_pop(&path);
+  }
+
+  if (result == 0 && count == 1) {
+    int64_t leftmost = 0;
+
+    for (uint64_t level = 0; level < layouts[0].left.size; level++) {
+      leftmost = ascii_tree_min(leftmost,
+                                ascii_contour_at(&layouts[0].left, level));
+    }
+
+    proot->x = -leftmost;
+  }
+
+  while (count > 0) {
+    ascii_layout_free(&layouts[--count]);
+  }
+
+  free(layouts);
+  node_stack_free(&path);
+
+  return result;
+}
+
+// makes room for the given number of nodes in a level
+static int ascii_tree_level_reserve(asciinode ***nodes, uint64_t *capacity,
+                                    uint64_t count) {
+  if (count <= *capacity) {
+    return 0;
+  }
+
+  uint64_t grown = *capacity ? *capacity : 64;
+
+  while (grown < count) {
+    grown *= 2;
+  }
+
+  asciinode **resized =
+      (asciinode **)realloc(*nodes, sizeof(asciinode *) * grown);
+
+  if (resized == NULL) {
+    return -1;
+  }
+
+  *nodes = resized;
+  *capacity = grown;
+
+  return 0;
+}
+
+// Draws the tree under proot at the end of the buffer, two lines for
+// each level, or to fd a line at a time if it is set. Returns -1 if
+// memory runs out or the write fails, with what fits drawn.
+static inline int ascii_tree_render(ascii_tree_t *ascii, asciinode *proot) {
+  if (proot == NULL) {
+    return 0;
+  }
+
+  if (ascii_tree_layout(ascii, proot) < 0) {
+    return -1;
+  }
+
+  asciinode **level = NULL;
+  asciinode **below = NULL;
+  uint64_t level_capacity = 0;
+  uint64_t below_capacity = 0;
+  uint64_t count = 1;
+  int result = ascii_tree_level_reserve(&level, &level_capacity, 1);
+
+  if (result == 0) {
+    level[0] = proot;
+  }
+
+  while (result == 0 && count > 0) {
+    uint64_t next = 0;
+
+    ascii->print_next = 0;
+
+    // the labels, with the children placed from them
+    for (uint64_t i = 0; i < count; i++) {
+      asciinode *node = level[i];
+      int64_t start = node->x;
+
+      if (node->left != NULL) {
+        node->left->x += node->x;
+        start = ascii_tree_left_edge(node) + 1;
+        next++;
+      }
+
+      if (node->right != NULL) {
+        node->right->x += node->x;
+        next++;
+      }
+
+      ascii_tree_fill(ascii, ' ', start - ascii->print_next);
+      ascii_tree_fill(ascii, '_', node->x - start);
+      ascii_tree_append(ascii, node->label, (size_t)node->lablen);
+
+      if (node->right != NULL) {
+        ascii_tree_fill(ascii, '_',
+                        ascii_tree_right_edge(node) - ascii->print_next);
+      }
+    }
+
+    if (ascii_tree_end_line(ascii) < 0) {
+      result = -1;
+      break;
+    }
+
+    if (next == 0) {
+      break;
+    }
+
+    if (ascii_tree_level_reserve(&below, &below_capacity, next) < 0) {
+      result = -1;
+      break;
+    }
+
+    // the edges down to the next level
+    ascii->print_next = 0;
+    next = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+      asciinode *node = level[i];
+
+      if (node->left != NULL) {
+        ascii_tree_fill(ascii, ' ',
+                        ascii_tree_left_edge(node) - ascii->print_next);
+        ascii_tree_append(ascii, "/", 1);
+        below[next++] = node->left;
+      }
+
+      if (node->right != NULL) {
+        ascii_tree_fill(ascii, ' ',
+                        ascii_tree_right_edge(node) - ascii->print_next);
+        ascii_tree_append(ascii, "\\", 1);
+        below[next++] = node->right;
+      }
+    }
+
+    if (ascii_tree_end_line(ascii) < 0) {
+      result = -1;
+      break;
+    }
+
+    asciinode **swap = level;
+    uint64_t swap_capacity = level_capacity;
+
+    level = below;
+    level_capacity = below_capacity;
+    below = swap;
+    below_capacity = swap_capacity;
+    count = next;
+  }
+
+  free(level);
+  free(below);
+
+  return result < 0 || ascii->failed ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef FROZEN_SET_H
+#define FROZEN_SET_H
+
+// A read-only sorted set in Eytzinger (BFS) order: the children of the
+// key at index k are at 2k and 2k + 1, with the root at 1. A search then
+// reads one key per level from addresses it can compute ahead of time,
+// so it needs no branches on the comparisons and can prefetch the
+// cache line holding the 16 descendants four levels down while it works
+// on the current one.
+//
+// Duplicates are kept, lower_bound finds the first of them.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+typedef struct frozen_set {
+  // 1-based, keys[0] is unused. Aligned to a cache line so that keys
+  // 16k to 16k + 15 share one.
+  int *keys;
+  uint64_t size;
+  // number of complete levels, every search takes at least this many
+  // steps without a bounds check
+  uint32_t levels;
+} frozen_set_t;
+
+// index returned when every key is smaller than the one searched for
+#define FROZEN_NONE 0
+
+static uint64_t frozen_set_fill(frozen_set_t *set, const int *sorted,
+                                uint64_t i, uint64_t k) {
+  // in order walk of the implicit tree, recursing to the left and
+  // looping to the right
+  while (k <= set->size) {
+    i = frozen_set_fill(set, sorted, i, 2 * k);
+    set->keys[k] = sorted[i++];
+    k = 2 * k + 1;
+  }
+
+  return i;
+}
+
+// builds the set from n keys in ascending order
+static inline int frozen_set_init(frozen_set_t *set, const int *sorted,
+                                  uint64_t n) {
+  uint64_t bytes = ((n + 1) * sizeof(int) + 63) & ~(uint64_t)63;
+
+  set->keys = (int *)aligned_alloc(64, bytes);
+  set->size = n;
+  set->levels = 0;
+
+  if (set->keys == NULL) {
+    return -1;
+  }
+
+  while (((uint64_t)2 << set->levels) - 1 <= n) {
+    set->levels++;
+  }
+
+  set->keys[0] = 0;
+  frozen_set_fill(set, sorted, 0, 1);
+
+  return 0;
+}
+
+static inline void frozen_set_free(frozen_set_t *set) {
+  free(set->keys);
+
+  set->keys = NULL;
+  set->size = 0;
+}
+
+static inline int frozen_set_key(const frozen_set_t *set, uint64_t index) {
+  return set->keys[index];
+}
+
+// The search went right at every key smaller than `key` and left
+// otherwise, so the answer is the last node where it went left: drop the
+// trailing right turns (ones) and the left turn before them.
+static inline uint64_t frozen_set_settle(uint64_t k) {
+  return k >> (__builtin_ctzll(~k) + 1);
+}
+
+// index of the first key >= key, or FROZEN_NONE
+static inline uint64_t frozen_set_lower_bound(const frozen_set_t *set,
+                                              int key) {
+  const int *keys = set->keys;
+  uint64_t k = 1;
+
+  while (k <= set->size) {
+    __builtin_prefetch(keys + 16 * k);
+    k = 2 * k + (keys[k] < key);
+  }
+
+  return frozen_set_settle(k);
+}
+
+static inline bool frozen_set_contains(const frozen_set_t *set, int key) {
+  uint64_t index = frozen_set_lower_bound(set, key);
+
+  return index != FROZEN_NONE && set->keys[index] == key;
+}
+
+// One lane of the batch search. The first `levels` levels are complete
+// so every lane can step through them unconditionally, only the last,
+// partial level needs a bounds check.
+static inline void frozen_set_batch_tail(const frozen_set_t *set,
+                                         const uint32_t *k, const int *queries,
+                                         uint64_t count, uint64_t *out) {
+  for (uint64_t j = 0; j < count; j++) {
+    uint64_t index = k[j];
+
+    if (index <= set->size) {
+      index = 2 * index + (set->keys[index] < queries[j]);
+    }
+
+    out[j] = frozen_set_settle(index);
+  }
+}
+
+// lower_bound of n queries at once. The searches are interleaved eight at
+// a time, so their cache misses overlap instead of following each other;
+// with AVX2 each level of all eight is a single gather and compare.
+static inline void frozen_set_lower_bound_batch(const frozen_set_t *set,
+                                                const int *queries, uint64_t n,
+                                                uint64_t *out) {
+  uint64_t i = 0;
+  uint32_t k[8];
+
+  // the gather takes 32-bit indices, which reach 2 * size + 1
+  if (set->size >= INT32_MAX / 2) {
+    for (; i < n; i++) {
+      out[i] = frozen_set_lower_bound(set, queries[i]);
+    }
+
+    return;
+  }
+
+  for (; i + 8 <= n; i += 8) {
+#ifdef __AVX2__
+    __m256i x = _mm256_loadu_si256((const __m256i *)(queries + i));
+    __m256i index = _mm256_set1_epi32(1);
+
+    for (uint32_t level = 0; level < set->levels; level++) {
+      __m256i key = _mm256_i32gather_epi32(set->keys, index, 4);
+      // all ones where key < x, subtracting it adds one
+      __m256i right = _mm256_cmpgt_epi32(x, key);
+
+      index = _mm256_sub_epi32(_mm256_add_epi32(index, index), right);
+    }
+
+    _mm256_storeu_si256((__m256i *)k, index);
+#else
+    for (int j = 0; j < 8; j++) {
+      k[j] = 1;
+    }
+
+    for (uint32_t level = 0; level < set->levels; level++) {
+      for (int j = 0; j < 8; j++) {
+        k[j] = 2 * k[j] + (set->keys[k[j]] < queries[i + j]);
+      }
+    }
+#endif
+
+    frozen_set_batch_tail(set, k, queries + i, 8, out + i);
+  }
+
+  for (; i < n; i++) {
+    out[i] = frozen_set_lower_bound(set, queries[i]);
+  }
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+// Fixed-size nodes in one contiguous mapping, addressed by 32-bit index
+// instead of by pointer. Index 0 is reserved and zero filled, so it can
+// stand for NIL, and a tree can read the fields of NIL (a height of 0, a
+// black color) without checking for it first.
+//
+// Nothing in the array refers to an address, so it can move: it grows
+// with mremap, which remaps the pages instead of copying them, and it can
+// be written out and mapped back as it is. The flip side is that a
+// pointer into the pool is only good until the next node_pool_alloc.
+//
+// Released nodes are kept on a free list threaded through their first
+// four bytes and handed out again before the array grows. Indices stay
+// below 2^31, which leaves the top bit of a stored index to the caller.
+//
+// The array may also be a private mapping of a file (see tree_image.h):
+// pages are then copied on their first write and the file is left alone,
+// and the first growth moves the nodes to anonymous memory, as the pages
+// past the end of the file cannot be touched.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define NODE_POOL_NIL 0
+#define NODE_POOL_MAX ((uint32_t)1 << 31)
+// first mapping, in bytes
+#define NODE_POOL_INITIAL (64 * 1024)
+
+typedef struct node_pool {
+  uint8_t *base;
+  uint32_t node_size;
+  // slots handed out so far, including the reserved one
+  uint32_t count;
+  // slots that fit in the mapping
+  uint32_t capacity;
+  uint32_t free_list;
+  uint64_t mapped;
+  // base is a private mapping of a file rather than anonymous memory
+  bool file_backed;
+} node_pool_t;
+
+static inline uint64_t node_pool_round(uint64_t bytes) {
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+
+  return (bytes + page - 1) / page * page;
+}
+
+// maps room for at least `capacity` nodes of node_size bytes (at least 4)
+static inline int node_pool_init(node_pool_t *pool, uint32_t node_size,
+                                 uint32_t capacity) {
+  uint64_t bytes = (uint64_t)capacity * node_size;
+
+  if (bytes < NODE_POOL_INITIAL) {
+    bytes = NODE_POOL_INITIAL;
+  }
+
+  bytes = node_pool_round(bytes);
+
+  void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base == MAP_FAILED) {
+    pool->base = NULL;
+
+    return -1;
+  }
+
+  pool->base = (uint8_t *)base;
+  pool->node_size = node_size;
+  pool->count = 1;
+  pool->capacity = bytes / node_size > NODE_POOL_MAX
+                       ? NODE_POOL_MAX
+                       : (uint32_t)(bytes / node_size);
+  pool->free_list = NODE_POOL_NIL;
+  pool->mapped = bytes;
+  pool->file_backed = false;
+
+  return 0;
+}
+
+static inline void node_pool_destroy(node_pool_t *pool) {
+  if (pool->base != NULL) {
+    munmap(pool->base, pool->mapped);
+  }
+
+  pool->base = NULL;
+  pool->count = 0;
+  pool->capacity = 0;
+  pool->free_list = NODE_POOL_NIL;
+  pool->mapped = 0;
+  pool->file_backed = false;
+}
+
+static inline void *node_pool_at(const node_pool_t *pool, uint32_t index) {
+  return pool->base + (uint64_t)index * pool->node_size;
+}
+
+// doubles the mapping, moving it if it cannot grow in place
+static inline int node_pool_grow(node_pool_t *pool) {
+  if (pool->capacity >= NODE_POOL_MAX) {
+    return -1;
+  }
+
+  uint64_t bytes = node_pool_round(pool->mapped * 2);
+  void *base;
+
+#ifdef MREMAP_MAYMOVE
+  if (!pool->file_backed) {
+    base = mremap(pool->base, pool->mapped, bytes, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED) {
+      return -1;
+    }
+  } else
+#endif
+  {
+    base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+      return -1;
+    }
+
+    memcpy(base, pool->base, (uint64_t)pool->count * pool->node_size);
+    munmap(pool->base, pool->mapped);
+    pool->file_backed = false;
+  }
+
+  pool->base = (uint8_t *)base;
+  pool->capacity = bytes / pool->node_size > NODE_POOL_MAX
+                       ? NODE_POOL_MAX
+                       : (uint32_t)(bytes / pool->node_size);
+  pool->mapped = bytes;
+
+  return 0;
+}
+
+// a zeroed node, or NODE_POOL_NIL when the pool cannot grow
+static inline uint32_t node_pool_alloc(node_pool_t *pool) {
+  uint32_t index = pool->free_list;
+
+  if (index != NODE_POOL_NIL) {
+    void *node = node_pool_at(pool, index);
+
+    memcpy(&pool->free_list, node, sizeof(uint32_t));
+    memset(node, 0, pool->node_size);
+
+    return index;
+  }
+
+  if (pool->count == pool->capacity && node_pool_grow(pool) < 0) {
+    return NODE_POOL_NIL;
+  }
+
+  // fresh pages are already zero
+  return pool->count++;
+}
+
+static inline void node_pool_release(node_pool_t *pool, uint32_t index) {
+  memcpy(node_pool_at(pool, index), &pool->free_list, sizeof(uint32_t));
+  pool->free_list = index;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef NODE_STACK_H
+#define NODE_STACK_H
+
+// A stack of node pointers for the traversals that keep one entry per
+// level of the tree, or a few. The first NODE_STACK_INLINE entries live in
+// the stack itself, so on the C stack when it is a local, which covers
+// the height of any balanced tree that fits in memory; past that it moves
+// to the heap and doubles as it fills, with no bound but memory.
+//
+// The entries are void pointers, the caller casts them back to its node
+// type. A stack points into itself, so it must not be copied or moved
+// once initialized.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_STACK_INLINE 64
+
+typedef struct node_stack {
+  // inline until the entries outgrow it, then on the heap
+  void **items;
+  uint64_t size;
+  uint64_t capacity;
+  void *inline_items[NODE_STACK_INLINE];
+} node_stack_t;
+
+static inline void node_stack_init(node_stack_t *stack) {
+  stack->items = stack->inline_items;
+  stack->size = 0;
+  stack->capacity = NODE_STACK_INLINE;
+}
+
+// releases the heap entries, if any, and leaves the stack empty
+static inline void node_stack_free(node_stack_t *stack) {
+  if (stack->items != stack->inline_items) {
+    free(stack->items);
+  }
+
+  node_stack_init(stack);
+}
+
+static inline bool node_stack_is_empty(const node_stack_t *stack) {
+  return stack->size == 0;
+}
+
+// Returns -1, with the stack as it was, if it is full and cannot grow.
+static inline int node_stack_push(node_stack_t *stack, void *node) {
+  if (stack->size == stack->capacity) {
+    uint64_t capacity = 2 * stack->capacity;
+    void **items;
+
+    if (stack->items == stack->inline_items) {
+      items = (void **)malloc(sizeof(void *) * capacity);
+
+      if (items != NULL) {
+        memcpy(items, stack->inline_items, sizeof(void *) * stack->size);
+      }
+    } else {
+      items = (void **)realloc(stack->items, sizeof(void *) * capacity);
+    }
+
+    if (items == NULL) {
+      return -1;
+    }
+
+    stack->items = items;
+    stack->capacity = capacity;
+  }
+
+  stack->items[stack->size++] = node;
+
+  return 0;
+}
+
+// the top entry, or NULL if the stack is empty
+static inline void *node_stack_peek(const node_stack_t *stack) {
+  return stack->size > 0 ? stack->items[stack->size - 1] : NULL;
+}
+
+// takes off the top entry and returns it, or NULL if the stack is empty
+static inline void *node_stack_pop(node_stack_t *stack) {
+  return stack->size > 0 ? stack->items[--stack->size] : NULL;
+}
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Hardware counters around hot regions of the tree code. Build with
+// -DTREE_PERF to enable them, otherwise every macro below expands to
+// nothing and the instrumented code is unchanged.
+//
+//   PERF_DEFINE_REGION(avl_perf_update, "avl_tree_update");
+//
+//   void avl_tree_update(avl_node_t *node) {
+//     PERF_BEGIN(avl_perf_update);
+//     ...
+//     PERF_END(avl_perf_update);
+//   }
+//
+// A region adds the counter deltas between PERF_BEGIN and PERF_END to its
+// totals. perf_report() and perf_json() print the averages per call. The
+// counters are read with rdpmc when the kernel allows it, which costs a
+// few dozen cycles, and with read(2) on the group otherwise.
+//
+// Each thread that calls perf_init opens a group of its own and reads
+// only that one, the regions are shared and add up the deltas of every
+// thread with atomic adds. A thread that never called perf_init only
+// counts calls.
+
+#ifdef TREE_PERF
+
+#include <linux/perf_event.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef enum perf_counter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTERS
+} perf_counter_t;
+
+static const char *perf_counter_names[PERF_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+typedef struct perf_region {
+  const char *name;
+  _Atomic uint64_t calls;
+  _Atomic uint64_t totals[PERF_COUNTERS];
+  atomic_bool registered;
+} perf_region_t;
+
+typedef struct perf_sample {
+  uint64_t values[PERF_COUNTERS];
+} perf_sample_t;
+
+#define PERF_MAX_REGIONS 16
+
+// the counter group of one thread
+typedef struct perf_state {
+  // -1 for counters the cpu or the kernel does not provide
+  int fds[PERF_COUNTERS];
+  struct perf_event_mmap_page *pages[PERF_COUNTERS];
+  bool open;
+} perf_state_t;
+
+static _Thread_local perf_state_t perf_state = {.fds = {-1, -1, -1, -1, -1}};
+
+// the regions entered so far, by any thread
+static perf_region_t *perf_regions[PERF_MAX_REGIONS];
+static _Atomic uint32_t perf_region_count;
+
+static inline uint32_t perf_regions_size(void) {
+  uint32_t count = atomic_load(&perf_region_count);
+
+  return count < PERF_MAX_REGIONS ? count : PERF_MAX_REGIONS;
+}
+
+static inline void perf_attr(struct perf_event_attr *attr, perf_counter_t counter) {
+  memset(attr, 0, sizeof(*attr));
+
+  attr->size = sizeof(*attr);
+  attr->type = PERF_TYPE_HARDWARE;
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP;
+
+  switch (counter) {
+  case PERF_CYCLES:
+    attr->config = PERF_COUNT_HW_CPU_CYCLES;
+    // the leader starts disabled so that the group is enabled at once
+    attr->disabled = 1;
+    break;
+  case PERF_INSTRUCTIONS:
+    attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PERF_L1D_MISSES:
+    attr->type = PERF_TYPE_HW_CACHE;
+    attr->config = PERF_COUNT_HW_CACHE_L1D |
+                   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case PERF_LLC_MISSES:
+    attr->config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  case PERF_BRANCH_MISSES:
+    attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  default:
+    break;
+  }
+}
+
+// Opens the counters for the calling thread. Returns -1 when not even
+// the cycle counter is available, e.g. in most virtual machines or with a
+// restrictive perf_event_paranoid, the regions then only count calls.
+static inline int perf_init(void) {
+  struct perf_event_attr attr;
+
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    perf_attr(&attr, (perf_counter_t)i);
+
+    int leader = perf_state.fds[PERF_CYCLES];
+
+    if (i != PERF_CYCLES && leader < 0) {
+      break;
+    }
+
+    perf_state.fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                     i == PERF_CYCLES ? -1 : leader, 0);
+
+    if (perf_state.fds[i] < 0) {
+      continue;
+    }
+
+    void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                      perf_state.fds[i], 0);
+
+    perf_state.pages[i] =
+        page == MAP_FAILED ? NULL : (struct perf_event_mmap_page *)page;
+  }
+
+  if (perf_state.fds[PERF_CYCLES] < 0) {
+    return -1;
+  }
+
+  ioctl(perf_state.fds[PERF_CYCLES], PERF_EVENT_IOC_RESET,
+        PERF_IOC_FLAG_GROUP);
+  ioctl(perf_state.fds[PERF_CYCLES], PERF_EVENT_IOC_ENABLE,
+        PERF_IOC_FLAG_GROUP);
+
+  perf_state.open = true;
+
+  return 0;
+}
+
+static inline void perf_close(void) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (perf_state.pages[i] != NULL) {
+      munmap(perf_state.pages[i], sysconf(_SC_PAGESIZE));
+      perf_state.pages[i] = NULL;
+    }
+
+    if (perf_state.fds[i] >= 0) {
+      close(perf_state.fds[i]);
+      perf_state.fds[i] = -1;
+    }
+  }
+
+  perf_state.open = false;
+}
+
+static inline bool perf_available(perf_counter_t counter) {
+  return perf_state.fds[counter] >= 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t perf_rdpmc(uint32_t counter) {
+  uint32_t low;
+  uint32_t high;
+
+  __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+
+  return (uint64_t)high << 32 | low;
+}
+#endif
+
+// Reads one counter from its mapped page, following the protocol in
+// linux/perf_event.h. Returns false when rdpmc cannot be used.
+static inline bool perf_read_page(struct perf_event_mmap_page *page,
+                                  uint64_t *value) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t seq;
+  uint64_t count;
+
+  do {
+    seq = page->lock;
+    __asm__ volatile("" ::: "memory");
+
+    uint32_t index = page->index;
+
+    if (!page->cap_user_rdpmc || index == 0) {
+      return false;
+    }
+
+    int64_t pmc = (int64_t)perf_rdpmc(index - 1);
+    uint32_t width = page->pmc_width;
+
+    pmc <<= 64 - width;
+    pmc >>= 64 - width;
+    count = page->offset + pmc;
+
+    __asm__ volatile("" ::: "memory");
+  } while (page->lock != seq);
+
+  *value = count;
+
+  return true;
+#else
+  (void)page;
+  (void)value;
+
+  return false;
+#endif
+}
+
+static inline void perf_read(perf_sample_t *sample) {
+  if (!perf_state.open) {
+    return;
+  }
+
+  bool fallback = false;
+
+  for (int i = 0; i < PERF_COUNTERS && !fallback; i++) {
+    if (perf_state.fds[i] < 0) {
+      sample->values[i] = 0;
+    } else if (perf_state.pages[i] == NULL ||
+               !perf_read_page(perf_state.pages[i], &sample->values[i])) {
+      fallback = true;
+    }
+  }
+
+  if (!fallback) {
+    return;
+  }
+
+  // nr followed by the values of the group in the order it was opened
+  uint64_t group[1 + PERF_COUNTERS];
+
+  if (read(perf_state.fds[PERF_CYCLES], group, sizeof(group)) <= 0) {
+    return;
+  }
+
+  for (int i = 0, n = 1; i < PERF_COUNTERS; i++) {
+    sample->values[i] = perf_state.fds[i] >= 0 ? group[n++] : 0;
+  }
+}
+
+static inline void perf_begin(perf_sample_t *sample) { perf_read(sample); }
+
+static inline void perf_end(perf_region_t *region, perf_sample_t *start) {
+  perf_sample_t end;
+
+  if (!atomic_load_explicit(&region->registered, memory_order_relaxed) &&
+      !atomic_exchange(&region->registered, true)) {
+    uint32_t slot = atomic_fetch_add(&perf_region_count, 1);
+
+    if (slot < PERF_MAX_REGIONS) {
+      perf_regions[slot] = region;
+    }
+  }
+
+  atomic_fetch_add_explicit(&region->calls, 1, memory_order_relaxed);
+
+  if (!perf_state.open) {
+    return;
+  }
+
+  perf_read(&end);
+
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    atomic_fetch_add_explicit(&region->totals[i],
+                              end.values[i] - start->values[i],
+                              memory_order_relaxed);
+  }
+}
+
+static inline void perf_reset(void) {
+  for (uint32_t r = 0; r < perf_regions_size(); r++) {
+    perf_region_t *region = perf_regions[r];
+
+    atomic_store(&region->calls, 0);
+
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+      atomic_store(&region->totals[i], 0);
+    }
+  }
+}
+
+static inline void perf_report(FILE *out) {
+  fprintf(out, "# %-18s %12s", "region", "calls");
+
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    fprintf(out, " %14s", perf_counter_names[i]);
+  }
+
+  fprintf(out, "\n");
+
+  for (uint32_t r = 0; r < perf_regions_size(); r++) {
+    perf_region_t *region = perf_regions[r];
+    uint64_t calls = atomic_load(&region->calls);
+
+    fprintf(out, "# %-18s %12llu", region->name, (unsigned long long)calls);
+
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+      if (perf_available((perf_counter_t)i) && calls != 0) {
+        fprintf(out, " %14.2f",
+                (double)atomic_load(&region->totals[i]) / calls);
+      } else {
+        fprintf(out, " %14s", "-");
+      }
+    }
+
+    fprintf(out, "\n");
+  }
+}
+
+// {"region": {"calls": n, "cycles": average, ...}, ...}, counters that
+// are not available are null
+static inline void perf_json(FILE *out) {
+  fprintf(out, "{");
+
+  for (uint32_t r = 0; r < perf_regions_size(); r++) {
+    perf_region_t *region = perf_regions[r];
+    uint64_t calls = atomic_load(&region->calls);
+
+    fprintf(out, "%s\"%s\": {\"calls\": %llu", r ? ", " : "", region->name,
+            (unsigned long long)calls);
+
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+      if (perf_available((perf_counter_t)i) && calls != 0) {
+        fprintf(out, ", \"%s\": %.3f", perf_counter_names[i],
+                (double)atomic_load(&region->totals[i]) / calls);
+      } else {
+        fprintf(out, ", \"%s\": null", perf_counter_names[i]);
+      }
+    }
+
+    fprintf(out, "}");
+  }
+
+  fprintf(out, "}");
+}
+
+#define PERF_DEFINE_REGION(NAME, LABEL)                                        \
+  static perf_region_t NAME = {.name = LABEL}
+#define PERF_BEGIN(NAME)                                                       \
+  perf_sample_t NAME##_start;                                                  \
+  perf_begin(&NAME##_start)
+#define PERF_END(NAME) perf_end(&NAME, &NAME##_start)
+
+#else
+
+#define PERF_DEFINE_REGION(NAME, LABEL)
+#define PERF_BEGIN(NAME)
+#define PERF_END(NAME)
+
+#endif
+
+#endif
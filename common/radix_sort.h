@@ -0,0 +1,185 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+// Parallel LSD radix sort of ints, for building trees from unsorted
+// batches (see avl_tree_build and rb_tree_build).
+//
+// Four passes of 8 bits, each split across the threads in two steps:
+// every thread counts the digits of its slice of the array, then, from
+// the counts of all threads, scatters its slice to the places the earlier
+// threads and smaller digits leave free. The sort is stable, needs a
+// buffer of n ints, and skips the passes in which every key has the same
+// digit (the top bytes of small keys, say). The sign bit is flipped in
+// the digit so that negative keys come first.
+//
+// Build with -pthread.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RADIX_BITS 8
+#define RADIX_DIGITS (1 << RADIX_BITS)
+// below this many keys per thread the threads cost more than they save
+#define RADIX_MIN_SLICE (1 << 16)
+#define RADIX_MAX_THREADS 256
+
+typedef struct radix_job {
+  const int *src;
+  int *dst;
+  uint64_t begin;
+  uint64_t end;
+  uint32_t shift;
+  // counts of this slice, then where each digit of it goes in dst
+  uint64_t count[RADIX_DIGITS];
+} radix_job_t;
+
+static inline uint32_t radix_digit(int key, uint32_t shift) {
+  return (((uint32_t)key ^ UINT32_C(0x80000000)) >> shift) &
+         (RADIX_DIGITS - 1);
+}
+
+static void *radix_count(void *arg) {
+  radix_job_t *job = (radix_job_t *)arg;
+
+  memset(job->count, 0, sizeof(job->count));
+
+  for (uint64_t i = job->begin; i < job->end; i++) {
+    job->count[radix_digit(job->src[i], job->shift)]++;
+  }
+
+  return NULL;
+}
+
+static void *radix_scatter(void *arg) {
+  radix_job_t *job = (radix_job_t *)arg;
+
+  for (uint64_t i = job->begin; i < job->end; i++) {
+    int key = job->src[i];
+
+    job->dst[job->count[radix_digit(key, job->shift)]++] = key;
+  }
+
+  return NULL;
+}
+
+// runs fn on every job, on threads but for the last one, which runs on
+// the caller; falls back to the caller for jobs whose thread fails to start
+static void radix_run(void *(*fn)(void *), radix_job_t *jobs,
+                      uint32_t nthreads) {
+  pthread_t threads[RADIX_MAX_THREADS];
+  bool started[RADIX_MAX_THREADS];
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    started[t] = pthread_create(&threads[t], NULL, fn, &jobs[t]) == 0;
+
+    if (!started[t]) {
+      fn(&jobs[t]);
+    }
+  }
+
+  fn(&jobs[nthreads - 1]);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+}
+
+// Sorts keys[0, n) in ascending order on up to nthreads threads. Returns
+// -1, with the keys untouched, if the buffer cannot be allocated.
+static inline int radix_sort(int *keys, uint64_t n, uint32_t nthreads) {
+  if (n < 2) {
+    return 0;
+  }
+
+  if (nthreads > n / RADIX_MIN_SLICE) {
+    nthreads = (uint32_t)(n / RADIX_MIN_SLICE);
+  }
+
+  if (nthreads == 0) {
+    nthreads = 1;
+  } else if (nthreads > RADIX_MAX_THREADS) {
+    nthreads = RADIX_MAX_THREADS;
+  }
+
+  int *buffer = (int *)malloc(sizeof(int) * n);
+  radix_job_t *jobs = (radix_job_t *)malloc(sizeof(radix_job_t) * nthreads);
+
+  if (buffer == NULL || jobs == NULL) {
+    free(buffer);
+    free(jobs);
+
+    return -1;
+  }
+
+  int *src = keys;
+  int *dst = buffer;
+
+  for (uint32_t shift = 0; shift < 32; shift += RADIX_BITS) {
+    for (uint32_t t = 0; t < nthreads; t++) {
+      jobs[t].src = src;
+      jobs[t].dst = dst;
+      jobs[t].begin = n * t / nthreads;
+      jobs[t].end = n * (t + 1) / nthreads;
+      jobs[t].shift = shift;
+    }
+
+    radix_run(radix_count, jobs, nthreads);
+
+    // digit by digit, thread by thread, so that the sort is stable
+    uint64_t offset = 0;
+    bool trivial = false;
+
+    for (uint32_t digit = 0; digit < RADIX_DIGITS; digit++) {
+      uint64_t total = 0;
+
+      for (uint32_t t = 0; t < nthreads; t++) {
+        uint64_t count = jobs[t].count[digit];
+
+        jobs[t].count[digit] = offset + total;
+        total += count;
+      }
+
+      trivial = trivial || total == n;
+      offset += total;
+    }
+
+    if (trivial) {
+      continue;
+    }
+
+    radix_run(radix_scatter, jobs, nthreads);
+
+    int *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != keys) {
+    memcpy(keys, src, sizeof(int) * n);
+  }
+
+  free(buffer);
+  free(jobs);
+
+  return 0;
+}
+
+// drops the repeats from sorted keys, returns how many are left
+static inline uint64_t radix_unique(int *keys, uint64_t n) {
+  uint64_t count = n > 0;
+
+  for (uint64_t i = 1; i < n; i++) {
+    if (keys[i] != keys[count - 1]) {
+      keys[count++] = keys[i];
+    }
+  }
+
+  return count;
+}
+
+#endif
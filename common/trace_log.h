@@ -0,0 +1,175 @@
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+// Leveled, categorised tracing for the tree internals.
+//
+//   TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "rotate at %d", node->value);
+//
+// In release builds (NDEBUG) every TRACE_LOG expands to nothing, so the
+// arguments are not even evaluated. In debug builds a message that passes
+// the runtime level and category filter is formatted into a fixed-size
+// ring buffer, which keeps the last TRACE_LOG_ENTRIES messages. Writers
+// claim a slot with a single atomic increment and publish it with a
+// sequence number, so they never block each other. trace_log_dump()
+// prints the buffered messages, and trace_log_echo() makes each message
+// also go straight to a stream, as the old printf debugging did.
+//
+// The state is static, so each program that includes this header (the
+// trees are single-file programs) has its own buffer.
+
+#if defined(NDEBUG) && !defined(TRACE_LOG_ENABLE)
+
+#define TRACE_LOG(LEVEL, CATEGORY, ...) ((void)0)
+
+#else
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum trace_level {
+  TRACE_ERROR,
+  TRACE_WARN,
+  TRACE_INFO,
+  TRACE_DEBUG,
+  TRACE_VERBOSE
+} trace_level_t;
+
+// categories are bits so that several can be enabled at once
+typedef enum trace_category {
+  TRACE_INSERT = 1 << 0,
+  TRACE_REMOVE = 1 << 1,
+  TRACE_SEARCH = 1 << 2,
+  TRACE_REBALANCE = 1 << 3,
+  TRACE_MEMORY = 1 << 4,
+  TRACE_ALL = 0xffffffff
+} trace_category_t;
+
+#ifndef TRACE_LOG_ENTRIES
+#define TRACE_LOG_ENTRIES 4096 // a power of two
+#endif
+
+#define TRACE_LOG_MESSAGE 96
+
+typedef struct trace_entry {
+  // index + 1 of the message in the slot once it is complete, 0 while it
+  // is being written
+  _Atomic uint64_t sequence;
+  uint64_t time;
+  trace_level_t level;
+  uint32_t category;
+  const char *function;
+  char message[TRACE_LOG_MESSAGE];
+} trace_entry_t;
+
+typedef struct trace_log {
+  _Atomic uint64_t head;
+  _Atomic int level;
+  _Atomic uint32_t categories;
+  FILE *echo;
+  trace_entry_t entries[TRACE_LOG_ENTRIES];
+} trace_log_t;
+
+static trace_log_t trace_log_state = {.level = TRACE_WARN,
+                                      .categories = TRACE_ALL};
+
+static const char *trace_level_names[] = {"error", "warn", "info", "debug",
+                                          "verbose"};
+
+static inline void trace_log_configure(trace_level_t level,
+                                       uint32_t categories) {
+  atomic_store(&trace_log_state.level, level);
+  atomic_store(&trace_log_state.categories, categories);
+}
+
+// also write every message that passes the filter to out, NULL stops it
+static inline void trace_log_echo(FILE *out) { trace_log_state.echo = out; }
+
+static inline int trace_log_enabled(trace_level_t level, uint32_t category) {
+  return (int)level <= atomic_load_explicit(&trace_log_state.level,
+                                            memory_order_relaxed) &&
+         (category & atomic_load_explicit(&trace_log_state.categories,
+                                          memory_order_relaxed)) != 0;
+}
+
+__attribute__((format(printf, 4, 5))) static void
+trace_log_write(trace_level_t level, uint32_t category, const char *function,
+                const char *format, ...) {
+  uint64_t index = atomic_fetch_add_explicit(&trace_log_state.head, 1,
+                                             memory_order_relaxed);
+  trace_entry_t *entry =
+      &trace_log_state.entries[index & (TRACE_LOG_ENTRIES - 1)];
+  struct timespec ts;
+  va_list args;
+
+  atomic_store_explicit(&entry->sequence, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  entry->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  entry->level = level;
+  entry->category = category;
+  entry->function = function;
+
+  va_start(args, format);
+  vsnprintf(entry->message, sizeof(entry->message), format, args);
+  va_end(args);
+
+  atomic_store_explicit(&entry->sequence, index + 1, memory_order_release);
+
+  if (trace_log_state.echo != NULL) {
+    fprintf(trace_log_state.echo, "[%s] %s: %s\n", trace_level_names[level],
+            function, entry->message);
+  }
+}
+
+// Prints the buffered messages, oldest first. A slot that a writer is
+// filling in, or that was overwritten while it was copied, is skipped.
+static inline void trace_log_dump(FILE *out) {
+  uint64_t head = atomic_load_explicit(&trace_log_state.head,
+                                       memory_order_acquire);
+  uint64_t index = head > TRACE_LOG_ENTRIES ? head - TRACE_LOG_ENTRIES : 0;
+
+  for (; index < head; index++) {
+    trace_entry_t *entry =
+        &trace_log_state.entries[index & (TRACE_LOG_ENTRIES - 1)];
+    trace_entry_t copy;
+
+    if (atomic_load_explicit(&entry->sequence, memory_order_acquire) !=
+        index + 1) {
+      continue;
+    }
+
+    copy.time = entry->time;
+    copy.level = entry->level;
+    copy.function = entry->function;
+    memcpy(copy.message, entry->message, sizeof(copy.message));
+    copy.message[TRACE_LOG_MESSAGE - 1] = '\0';
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) !=
+        index + 1) {
+      continue;
+    }
+
+    fprintf(out, "%llu.%09llu [%s] %s: %s\n",
+            (unsigned long long)(copy.time / 1000000000),
+            (unsigned long long)(copy.time % 1000000000),
+            trace_level_names[copy.level], copy.function, copy.message);
+  }
+}
+
+#define TRACE_LOG(LEVEL, CATEGORY, ...)                                        \
+  do {                                                                         \
+    if (trace_log_enabled(LEVEL, CATEGORY))                                    \
+      trace_log_write(LEVEL, CATEGORY, __func__, __VA_ARGS__);                 \
+  } while (0)
+
+#endif
+
+#endif
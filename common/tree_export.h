@@ -0,0 +1,186 @@
+#ifndef TREE_EXPORT_H
+#define TREE_EXPORT_H
+
+// Tree exports for other tools: Graphviz DOT and JSON, written by
+// avl_tree_export_dot and the others as they walk the tree, a node at a
+// time, into a buffer of fixed size that goes to the file descriptor
+// whenever it fills. Nothing is copied, so the memory they take does not
+// grow with the tree.
+//
+// DOT: one statement for each node, labeled with its value, and one for
+// each edge, left before right under ordering=out. The trees hold equal
+// values more than once, so a node is named by its address, n followed
+// by it in hex, rather than by its value. A node with one child gets an
+// invisible one on the other side, so that the layout keeps left and
+// right apart.
+//
+// JSON: the nodes nested as in the tree,
+//
+//   {"size": 3, "root": {"value": 2, "left": {"value": 1, "left": null,
+//    "right": null}, "right": {...}}}
+//
+// with a "color" of "red" or "black" before "left" in the red-black tree.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define TREE_EXPORT_BUFFER 65536
+// the longest a single statement gets, once formatted
+#define TREE_EXPORT_STATEMENT 256
+
+typedef struct tree_export {
+  int fd;
+  size_t size;
+  // set once a write fails, nothing is written after it
+  bool failed;
+  char buffer[TREE_EXPORT_BUFFER];
+} tree_export_t;
+
+static inline void tree_export_init(tree_export_t *out, int fd) {
+  out->fd = fd;
+  out->size = 0;
+  out->failed = false;
+}
+
+// writes out the buffer and empties it
+static inline void tree_export_flush(tree_export_t *out) {
+  size_t done = 0;
+
+  while (!out->failed && done < out->size) {
+    ssize_t n = write(out->fd, out->buffer + done, out->size - done);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      out->failed = true;
+    } else {
+      done += (size_t)n;
+    }
+  }
+
+  out->size = 0;
+}
+
+// Writes out what is left. Returns -1 if any write failed.
+static inline int tree_export_finish(tree_export_t *out) {
+  tree_export_flush(out);
+
+  return out->failed ? -1 : 0;
+}
+
+static inline void tree_export_printf(tree_export_t *out, const char *format,
+                                      ...) {
+  if (TREE_EXPORT_BUFFER - out->size < TREE_EXPORT_STATEMENT) {
+    tree_export_flush(out);
+  }
+
+  if (out->failed) {
+    return;
+  }
+
+  va_list args;
+
+  va_start(args, format);
+  int n = vsnprintf(out->buffer + out->size, TREE_EXPORT_BUFFER - out->size,
+                    format, args);
+  va_end(args);
+
+  if (n > 0) {
+    out->size += (size_t)n < TREE_EXPORT_BUFFER - out->size
+                     ? (size_t)n
+                     : TREE_EXPORT_BUFFER - out->size - 1;
+  }
+}
+
+/* ---------------------------------------------- */
+
+// The color arguments are NULL for a tree without colors.
+
+static inline void tree_export_dot_begin(tree_export_t *out) {
+  tree_export_printf(out, "digraph tree {\n"
+                          "  graph [ordering=out];\n"
+                          "  node [shape=circle];\n");
+}
+
+// the name of node in the graph
+static inline unsigned long long tree_export_dot_id(const void *node) {
+  return (unsigned long long)(uintptr_t)node;
+}
+
+static inline void tree_export_dot_node(tree_export_t *out, const void *node,
+                                        int value, const char *color) {
+  if (color == NULL) {
+    tree_export_printf(out, "  n%llx [label=\"%d\"];\n",
+                       tree_export_dot_id(node), value);
+  } else {
+    tree_export_printf(out,
+                       "  n%llx [label=\"%d\", style=filled, fillcolor=%s, "
+                       "fontcolor=white];\n",
+                       tree_export_dot_id(node), value, color);
+  }
+}
+
+static inline void tree_export_dot_edge(tree_export_t *out,
+                                        const void *parent,
+                                        const void *child) {
+  tree_export_printf(out, "  n%llx -> n%llx;\n", tree_export_dot_id(parent),
+                     tree_export_dot_id(child));
+}
+
+// the stand-in for the missing child of a node with one
+static inline void tree_export_dot_nil(tree_export_t *out,
+                                       const void *parent) {
+  unsigned long long id = tree_export_dot_id(parent);
+
+  tree_export_printf(out,
+                     "  n%llxnil [shape=point, style=invis];\n"
+                     "  n%llx -> n%llxnil [style=invis];\n",
+                     id, id, id);
+}
+
+static inline void tree_export_dot_end(tree_export_t *out) {
+  tree_export_printf(out, "}\n");
+}
+
+// The JSON of a node is written in pieces as the walk goes by it: open
+// before its left subtree, right between its subtrees and close after
+// them, with null for a missing child.
+
+static inline void tree_export_json_begin(tree_export_t *out, uint64_t size) {
+  tree_export_printf(out, "{\"size\": %llu, \"root\": ",
+                     (unsigned long long)size);
+}
+
+static inline void tree_export_json_open(tree_export_t *out, int value,
+                                         const char *color) {
+  if (color == NULL) {
+    tree_export_printf(out, "{\"value\": %d, \"left\": ", value);
+  } else {
+    tree_export_printf(out, "{\"value\": %d, \"color\": \"%s\", \"left\": ",
+                       value, color);
+  }
+}
+
+static inline void tree_export_json_null(tree_export_t *out) {
+  tree_export_printf(out, "null");
+}
+
+static inline void tree_export_json_right(tree_export_t *out) {
+  tree_export_printf(out, ", \"right\": ");
+}
+
+static inline void tree_export_json_close(tree_export_t *out) {
+  tree_export_printf(out, "}");
+}
+
+static inline void tree_export_json_end(tree_export_t *out) {
+  tree_export_printf(out, "}\n");
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef TREE_IMAGE_H
+#define TREE_IMAGE_H
+
+// Tree images: a tree saved as the node array of its pool variant
+// (avltree/avl_pool.c, rbtree/rb_pool.c), so that loading it is an mmap
+// rather than one insert per value.
+//
+//   0      header, padded to TREE_IMAGE_OFFSET
+//   4096   count nodes of node_size bytes, slot 0 being NIL
+//
+// The nodes link to each other by index, so the array means the same
+// wherever it is mapped. Loading checks the header and its checksum and
+// maps the nodes privately: lookups fault in only the pages they touch,
+// the first write to a page copies it, and the file is never modified.
+// The checksum of the nodes is only verified on request, since it reads
+// the whole file.
+//
+// Everything is in the byte order of the machine that saved it, so that
+// the nodes can be mapped as they are; an image from a machine of the
+// other byte order fails the version check. The node layouts are those
+// of the pool trees:
+//
+//   TREE_IMAGE_AVL  int value, uint32 parent, left, right, int32 height
+//   TREE_IMAGE_RB   int value, uint32 parent | red << 31, child[2]
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "node_pool.h"
+
+#define TREE_IMAGE_MAGIC "TREEIMG"
+#define TREE_IMAGE_VERSION 1
+#define TREE_IMAGE_OFFSET 4096
+
+typedef enum tree_image_kind {
+  TREE_IMAGE_AVL = 1,
+  TREE_IMAGE_RB = 2
+} tree_image_kind_t;
+
+typedef struct tree_image_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  uint32_t node_size;
+  uint32_t root;
+  uint32_t free_list;
+  uint32_t reserved;
+  // values in the tree and slots in the array, including slot 0
+  uint64_t size;
+  uint64_t count;
+  uint64_t nodes_checksum;
+  // of all the fields above
+  uint64_t header_checksum;
+} tree_image_header_t;
+
+typedef struct tree_image_writer {
+  int fd;
+  // of the file being written, removed by tree_image_abort
+  const char *path;
+  uint8_t *nodes;
+  uint64_t bytes;
+  tree_image_header_t header;
+} tree_image_writer_t;
+
+// a word at a time multiply and rotate hash, not cryptographic, only
+// there to catch truncated or damaged files
+static inline uint64_t tree_image_checksum(const void *data, uint64_t bytes,
+                                           uint64_t hash) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t word;
+
+  for (; bytes >= 8; bytes -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    hash = (hash ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+    hash ^= hash >> 29;
+  }
+
+  word = 0;
+  memcpy(&word, p, bytes);
+
+  return ((hash ^ word) * UINT64_C(0x9e3779b97f4a7c15)) ^ bytes;
+}
+
+// Creates the file at path with room for `count` nodes and maps them for
+// the caller to fill in, slot 0 is zero. tree_image_finish completes it,
+// tree_image_abort throws it away.
+static inline int tree_image_create(tree_image_writer_t *writer,
+                                    const char *path, tree_image_kind_t kind,
+                                    uint32_t node_size, uint64_t count) {
+  memset(&writer->header, 0, sizeof(writer->header));
+  memcpy(writer->header.magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC));
+  writer->header.version = TREE_IMAGE_VERSION;
+  writer->header.kind = kind;
+  writer->header.node_size = node_size;
+  writer->header.count = count;
+  writer->bytes = count * node_size;
+  writer->nodes = NULL;
+  writer->path = path;
+
+  if (count == 0 || count > NODE_POOL_MAX) {
+    return -1;
+  }
+
+  writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (writer->fd < 0) {
+    return -1;
+  }
+
+  if (ftruncate(writer->fd, TREE_IMAGE_OFFSET + writer->bytes) < 0) {
+    close(writer->fd);
+
+    return -1;
+  }
+
+  void *nodes = mmap(NULL, writer->bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     writer->fd, TREE_IMAGE_OFFSET);
+
+  if (nodes == MAP_FAILED) {
+    close(writer->fd);
+
+    return -1;
+  }
+
+  writer->nodes = (uint8_t *)nodes;
+
+  return 0;
+}
+
+// checksums the nodes, writes the header and closes the file
+static inline int tree_image_finish(tree_image_writer_t *writer, uint32_t root,
+                                    uint64_t size, uint32_t free_list) {
+  tree_image_header_t *header = &writer->header;
+  int result = 0;
+
+  header->root = root;
+  header->size = size;
+  header->free_list = free_list;
+  header->nodes_checksum = tree_image_checksum(writer->nodes, writer->bytes, 0);
+  header->header_checksum = tree_image_checksum(
+      header, offsetof(tree_image_header_t, header_checksum), 0);
+
+  if (munmap(writer->nodes, writer->bytes) < 0 ||
+      pwrite(writer->fd, header, sizeof(*header), 0) != sizeof(*header)) {
+    result = -1;
+  }
+
+  if (close(writer->fd) < 0) {
+    result = -1;
+  }
+
+  return result;
+}
+
+// Closes and removes the file of a save that failed, with no header, so
+// that nothing is left that loads. Returns -1 for the caller to pass on.
+static inline int tree_image_abort(tree_image_writer_t *writer) {
+  munmap(writer->nodes, writer->bytes);
+  close(writer->fd);
+  unlink(writer->path);
+
+  return -1;
+}
+
+// writes the pool's node array as it is
+static inline int tree_image_save_pool(const char *path,
+                                       tree_image_kind_t kind,
+                                       const node_pool_t *pool, uint32_t root,
+                                       uint64_t size, uint32_t node_size) {
+  tree_image_writer_t writer;
+  uint64_t count = pool->base != NULL ? pool->count : 1;
+
+  if (tree_image_create(&writer, path, kind, node_size, count) < 0) {
+    return -1;
+  }
+
+  if (pool->base != NULL) {
+    memcpy(writer.nodes, pool->base, writer.bytes);
+  }
+
+  return tree_image_finish(&writer, root, size,
+                           pool->base != NULL ? pool->free_list : 0);
+}
+
+// Maps the image at path into pool, which must be empty, and fills in
+// header. Returns -1 if the file is not an image of that kind and node
+// size, is truncated, has a root or free list outside of its nodes, or,
+// when verify is set, fails the nodes checksum.
+static inline int tree_image_load(node_pool_t *pool, const char *path,
+                                  tree_image_kind_t kind, uint32_t node_size,
+                                  tree_image_header_t *header, bool verify) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+      fstat(fd, &st) < 0 ||
+      memcmp(header->magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC)) != 0 ||
+      header->version != TREE_IMAGE_VERSION || header->kind != kind ||
+      header->node_size != node_size ||
+      header->header_checksum !=
+          tree_image_checksum(header,
+                              offsetof(tree_image_header_t, header_checksum),
+                              0) ||
+      header->count == 0 || header->count > NODE_POOL_MAX ||
+      header->root >= header->count || header->free_list >= header->count ||
+      (uint64_t)st.st_size < TREE_IMAGE_OFFSET + header->count * node_size) {
+    close(fd);
+
+    return -1;
+  }
+
+  uint64_t bytes = header->count * node_size;
+  uint64_t mapped = node_pool_round(bytes);
+  void *base;
+
+  if (TREE_IMAGE_OFFSET % sysconf(_SC_PAGESIZE) == 0) {
+    base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                TREE_IMAGE_OFFSET);
+  } else {
+    // pages larger than the header, the nodes cannot be mapped in place
+    base = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base != MAP_FAILED &&
+        pread(fd, base, bytes, TREE_IMAGE_OFFSET) != (ssize_t)bytes) {
+      munmap(base, mapped);
+      base = MAP_FAILED;
+    }
+  }
+
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  if (verify && tree_image_checksum(base, bytes, 0) != header->nodes_checksum) {
+    munmap(base, mapped);
+
+    return -1;
+  }
+
+  pool->base = (uint8_t *)base;
+  pool->node_size = node_size;
+  pool->count = header->count;
+  pool->capacity = mapped / node_size;
+  pool->free_list = header->free_list;
+  pool->mapped = mapped;
+  pool->file_backed = true;
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// Depth of the subtrees that the saved layout packs together: a complete
+// one of this depth fits in a page, so a lookup touches about one page
+// per that many levels instead of one per level.
+static inline uint32_t tree_image_block_depth(uint32_t node_size) {
+  uint32_t depth = 1;
+
+  while ((((uint64_t)2 << depth) - 1) * node_size <= 4096) {
+    depth++;
+  }
+
+  return depth;
+}
+
+#endif
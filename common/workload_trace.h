@@ -0,0 +1,327 @@
+#ifndef WORKLOAD_TRACE_H
+#define WORKLOAD_TRACE_H
+
+// Binary traces of tree operations. A trace is a header followed by one
+// record per operation:
+//
+//   op        1 byte, a workload_op_t
+//   key       zigzag varint of the difference to the previous key
+//   span      range records only, zigzag varint of high - key
+//
+// Keys that follow each other, as in sorted or sliding window loads, take
+// a byte or two. The recorder fills a buffer and writes it out in large
+// blocks, so recording costs an encode and a store per operation. The
+// reader maps the whole trace and decodes it in place.
+//
+// Building the trees with -DTREE_RECORD adds a `recorder` to the tree,
+// while it is set every insert, remove, find and range call is recorded.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WORKLOAD_MAGIC "WLTRACE"
+#define WORKLOAD_VERSION 1
+#define WORKLOAD_BUFFER (1 << 20)
+// op byte plus two 10 byte varints
+#define WORKLOAD_MAX_RECORD 21
+
+typedef enum workload_op {
+  WORKLOAD_INSERT,
+  WORKLOAD_REMOVE,
+  WORKLOAD_FIND,
+  WORKLOAD_RANGE,
+  WORKLOAD_OPS
+} workload_op_t;
+
+typedef struct workload_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // filled in when the recorder is closed, 0 when it never was and the
+  // records run to the end of the file
+  uint64_t count;
+} workload_header_t;
+
+typedef struct workload_recorder {
+  int fd;
+  uint8_t *buffer;
+  uint64_t used;
+  uint64_t count;
+  int64_t previous;
+  bool failed;
+} workload_recorder_t;
+
+typedef struct workload_step {
+  workload_op_t op;
+  int key;
+  // upper end of a range, equal to key for the other ops
+  int high;
+} workload_step_t;
+
+typedef struct workload_reader {
+  const uint8_t *data;
+  uint64_t size;
+  uint64_t offset;
+  uint64_t count;
+  int64_t previous;
+  bool truncated;
+} workload_reader_t;
+
+static inline uint64_t workload_zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t workload_unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint8_t *workload_put_varint(uint8_t *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+
+  *out++ = (uint8_t)value;
+
+  return out;
+}
+
+static inline int workload_write_all(int fd, const uint8_t *data, uint64_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+
+    if (written <= 0) {
+      return -1;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return 0;
+}
+
+static inline int workload_recorder_flush(workload_recorder_t *recorder) {
+  if (recorder->used > 0 &&
+      workload_write_all(recorder->fd, recorder->buffer, recorder->used) < 0) {
+    recorder->failed = true;
+  }
+
+  recorder->used = 0;
+
+  return recorder->failed ? -1 : 0;
+}
+
+static inline int workload_recorder_open(workload_recorder_t *recorder,
+                                         const char *path) {
+  workload_header_t header = {.magic = WORKLOAD_MAGIC,
+                              .version = WORKLOAD_VERSION};
+
+  recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  recorder->buffer = NULL;
+  recorder->used = 0;
+  recorder->count = 0;
+  recorder->previous = 0;
+  recorder->failed = false;
+
+  if (recorder->fd < 0) {
+    return -1;
+  }
+
+  recorder->buffer = (uint8_t *)malloc(WORKLOAD_BUFFER);
+
+  if (recorder->buffer == NULL ||
+      workload_write_all(recorder->fd, (const uint8_t *)&header,
+                         sizeof(header)) < 0) {
+    free(recorder->buffer);
+    close(recorder->fd);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+static inline void workload_record(workload_recorder_t *recorder,
+                                   workload_op_t op, int key, int high) {
+  if (recorder->used + WORKLOAD_MAX_RECORD > WORKLOAD_BUFFER) {
+    workload_recorder_flush(recorder);
+  }
+
+  uint8_t *out = recorder->buffer + recorder->used;
+
+  *out++ = (uint8_t)op;
+  out = workload_put_varint(out, workload_zigzag(key - recorder->previous));
+
+  if (op == WORKLOAD_RANGE) {
+    out = workload_put_varint(out, workload_zigzag((int64_t)high - key));
+  }
+
+  recorder->used = out - recorder->buffer;
+  recorder->previous = key;
+  recorder->count++;
+}
+
+// flushes the buffer and fills in the record count, returns -1 if any
+// write failed
+static inline int workload_recorder_close(workload_recorder_t *recorder) {
+  workload_recorder_flush(recorder);
+
+  uint64_t count = recorder->count;
+
+  if (pwrite(recorder->fd, &count, sizeof(count),
+             offsetof(workload_header_t, count)) != sizeof(count)) {
+    recorder->failed = true;
+  }
+
+  free(recorder->buffer);
+  close(recorder->fd);
+
+  recorder->buffer = NULL;
+
+  return recorder->failed ? -1 : 0;
+}
+
+static inline int workload_reader_open(workload_reader_t *reader,
+                                       const char *path) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(workload_header_t)) {
+    close(fd);
+
+    return -1;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  const workload_header_t *header = (const workload_header_t *)data;
+
+  if (memcmp(header->magic, WORKLOAD_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != WORKLOAD_VERSION) {
+    munmap(data, st.st_size);
+
+    return -1;
+  }
+
+  reader->data = (const uint8_t *)data;
+  reader->size = st.st_size;
+  reader->offset = sizeof(workload_header_t);
+  reader->count = header->count;
+  reader->previous = 0;
+  reader->truncated = false;
+
+  return 0;
+}
+
+static inline void workload_reader_close(workload_reader_t *reader) {
+  munmap((void *)reader->data, reader->size);
+
+  reader->data = NULL;
+}
+
+static inline void workload_reader_rewind(workload_reader_t *reader) {
+  reader->offset = sizeof(workload_header_t);
+  reader->previous = 0;
+  reader->truncated = false;
+}
+
+static inline bool workload_get_varint(workload_reader_t *reader,
+                                       uint64_t *value) {
+  uint64_t result = 0;
+
+  for (int shift = 0; shift < 64 && reader->offset < reader->size;
+       shift += 7) {
+    uint8_t byte = reader->data[reader->offset++];
+
+    result |= (uint64_t)(byte & 0x7f) << shift;
+
+    if (byte < 0x80) {
+      *value = result;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Adds the encoded difference to base, an int, into sum. Returns false
+// when the sum is not an int, which the recorder never writes.
+static inline bool workload_add(int64_t base, uint64_t encoded, int *sum) {
+  int64_t difference = workload_unzigzag(encoded);
+
+  if (difference < (int64_t)INT_MIN - base ||
+      difference > (int64_t)INT_MAX - base) {
+    return false;
+  }
+
+  *sum = (int)(base + difference);
+
+  return true;
+}
+
+// decodes the next record, returns false at the end of the trace or when
+// it is cut short or corrupt, which sets `truncated`
+static inline bool workload_next(workload_reader_t *reader,
+                                 workload_step_t *step) {
+  uint64_t delta;
+  uint64_t span = 0;
+  int key;
+  int high;
+
+  if (reader->offset >= reader->size) {
+    return false;
+  }
+
+  uint8_t op = reader->data[reader->offset++];
+
+  if (op >= WORKLOAD_OPS || !workload_get_varint(reader, &delta) ||
+      (op == WORKLOAD_RANGE && !workload_get_varint(reader, &span)) ||
+      !workload_add(reader->previous, delta, &key) ||
+      !workload_add(key, span, &high)) {
+    reader->truncated = true;
+
+    return false;
+  }
+
+  step->op = (workload_op_t)op;
+  step->key = key;
+  step->high = high;
+  reader->previous = key;
+
+  return true;
+}
+
+#ifdef TREE_RECORD
+#define WORKLOAD_RECORD(TREE, OP, KEY, HIGH)                                   \
+  do {                                                                         \
+    if ((TREE)->recorder != NULL)                                              \
+      workload_record((TREE)->recorder, OP, KEY, HIGH);                        \
+  } while (0)
+#else
+#define WORKLOAD_RECORD(TREE, OP, KEY, HIGH)
+#endif
+
+#endif
@@ -0,0 +1,1153 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/perf_counters.h"
+#include "../common/trace_log.h"
+#include "../common/workload_trace.h"
+
+/*
+
+A B+tree of ints kept in a file, for key sets that do not fit in memory,
+with the same insert, remove, find and range interface as the other
+trees.
+
+The file is an array of DISK_PAGE_SIZE byte pages. Page 0 holds the
+metadata (root, size, free list) and every other page is a node: a leaf
+with up to DISK_LEAF_KEYS values or an inner node with up to
+DISK_INNER_KEYS separators and one more child page number. As in
+bp_tree.c the leaves are linked in order, duplicates are kept and the
+separators are closed bounds, so a search goes to the leftmost leaf that
+may hold a value and looks at the start of the next leaf if that one ends
+first. Within a page the search is a binary search over its keys.
+
+Pages are only accessed through a buffer pool of a fixed number of
+frames. disk_pin returns a page in a frame, reading it in on a miss, and
+keeps the frame until disk_unpin; a page that was changed is marked dirty
+and written back when its frame is reused or on disk_tree_sync. Frames
+are reused in CLOCK order: the hand skips pinned frames and gives each
+recently used one a second chance before it is taken. Inserts and
+removes keep the whole root to leaf path pinned, finds and ranges only
+the page they are reading.
+
+Pages freed by merges are chained through their `next` field and reused
+before the file grows. Nothing is written ahead of the pages, so the file
+is only consistent after disk_tree_sync or disk_tree_close.
+
+*/
+
+#define DISK_PAGE_SIZE 4096
+#define DISK_HEADER 16
+#define DISK_LEAF_KEYS ((DISK_PAGE_SIZE - DISK_HEADER) / sizeof(int))
+#define DISK_INNER_KEYS                                                        \
+  ((DISK_PAGE_SIZE - DISK_HEADER - sizeof(uint32_t)) /                         \
+   (sizeof(int) + sizeof(uint32_t)))
+// fanout is at least DISK_INNER_KEYS / 2 + 1 below the root
+#define DISK_MAX_DEPTH 12
+// the path of an insert or remove plus the pages it touches besides
+#define DISK_MIN_FRAMES (DISK_MAX_DEPTH + 4)
+// page 0 is the metadata, so no node is ever page 0
+#define DISK_NONE 0
+
+#define DISK_MAGIC "DISKTRE"
+#define DISK_VERSION 1
+
+typedef struct disk_page {
+  uint32_t count;
+  uint32_t leaf;
+  // next leaf in order, or next free page, DISK_NONE for none
+  uint32_t next;
+  uint32_t reserved;
+  union {
+    int keys[DISK_LEAF_KEYS];
+    // inner nodes use the first DISK_INNER_KEYS keys
+    struct {
+      int inner_keys[DISK_INNER_KEYS];
+      uint32_t child[DISK_INNER_KEYS + 1];
+    };
+  };
+} disk_page_t;
+
+_Static_assert(sizeof(disk_page_t) == DISK_PAGE_SIZE, "a node is a page");
+
+typedef struct disk_meta {
+  char magic[8];
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t root;
+  uint32_t free_list;
+  // pages in the file, the metadata included
+  uint32_t pages;
+  uint32_t reserved;
+  uint64_t size;
+} disk_meta_t;
+
+typedef struct disk_frame {
+  // page held, DISK_NONE for a free frame
+  uint32_t page;
+  uint32_t pins;
+  bool dirty;
+  // used since the hand last passed
+  bool referenced;
+} disk_frame_t;
+
+typedef struct disk_cache {
+  int fd;
+  // frame i holds its page at pages[i]
+  disk_page_t *pages;
+  disk_frame_t *frames;
+  uint32_t capacity;
+  uint32_t hand;
+  // page number to frame + 1, linear probing, 0 for an empty slot
+  uint32_t *table;
+  uint32_t table_mask;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writes;
+} disk_cache_t;
+
+typedef struct disk_tree {
+  disk_meta_t meta;
+  disk_cache_t cache;
+  uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
+} disk_tree_t;
+
+// the pinned pages of a descent and the child taken in each, page[depth -
+// 1] is the leaf and index[depth - 1] a slot in it
+typedef struct disk_path {
+  disk_page_t *page[DISK_MAX_DEPTH];
+  uint32_t id[DISK_MAX_DEPTH];
+  uint32_t index[DISK_MAX_DEPTH];
+  uint32_t depth;
+} disk_path_t;
+
+PERF_DEFINE_REGION(disk_perf_descent, "descent");
+PERF_DEFINE_REGION(disk_perf_split, "disk_split");
+PERF_DEFINE_REGION(disk_perf_rebalance, "disk_rebalance");
+
+/* ---------------------------------------------- */
+
+static inline uint32_t disk_hash(disk_cache_t *cache, uint32_t page) {
+  return (page * UINT32_C(0x9e3779b1)) & cache->table_mask;
+}
+
+// the slot holding page, or the empty slot where it would go
+static inline uint32_t disk_slot(disk_cache_t *cache, uint32_t page) {
+  uint32_t slot = disk_hash(cache, page);
+
+  while (cache->table[slot] != 0 &&
+         cache->frames[cache->table[slot] - 1].page != page) {
+    slot = (slot + 1) & cache->table_mask;
+  }
+
+  return slot;
+}
+
+// empties the slot, moving later entries of the probe run back into it
+static void disk_slot_erase(disk_cache_t *cache, uint32_t slot) {
+  uint32_t next = slot;
+
+  for (;;) {
+    next = (next + 1) & cache->table_mask;
+
+    if (cache->table[next] == 0) {
+      break;
+    }
+
+    uint32_t home =
+        disk_hash(cache, cache->frames[cache->table[next] - 1].page);
+
+    // the entry can move unless its home lies cyclically in (slot, next]
+    if (slot <= next ? home <= slot || home > next
+                     : home <= slot && home > next) {
+      cache->table[slot] = cache->table[next];
+      slot = next;
+    }
+  }
+
+  cache->table[slot] = 0;
+}
+
+static int disk_write_frame(disk_cache_t *cache, uint32_t frame) {
+  if (pwrite(cache->fd, &cache->pages[frame], DISK_PAGE_SIZE,
+             (off_t)cache->frames[frame].page * DISK_PAGE_SIZE) !=
+      DISK_PAGE_SIZE) {
+    return -1;
+  }
+
+  cache->frames[frame].dirty = false;
+  cache->writes++;
+
+  return 0;
+}
+
+// Moves the clock hand to a frame that can be reused, writing back its
+// page if dirty, and returns it empty. Returns -1 if every frame is
+// pinned or the write fails.
+static int64_t disk_victim(disk_cache_t *cache) {
+  for (uint64_t step = 0; step < 2 * (uint64_t)cache->capacity; step++) {
+    uint32_t frame = cache->hand;
+    disk_frame_t *entry = &cache->frames[frame];
+
+    cache->hand = cache->hand + 1 == cache->capacity ? 0 : cache->hand + 1;
+
+    if (entry->pins > 0) {
+      continue;
+    }
+
+    if (entry->referenced) {
+      entry->referenced = false;
+      continue;
+    }
+
+    if (entry->page != DISK_NONE) {
+      if (entry->dirty && disk_write_frame(cache, frame) < 0) {
+        return -1;
+      }
+
+      disk_slot_erase(cache, disk_slot(cache, entry->page));
+      entry->page = DISK_NONE;
+    }
+
+    return frame;
+  }
+
+  TRACE_LOG(TRACE_WARN, TRACE_MEMORY, "all %u frames pinned", cache->capacity);
+
+  return -1;
+}
+
+// puts page in the free frame and pins it
+static inline disk_page_t *disk_install(disk_cache_t *cache, uint32_t frame,
+                                        uint32_t page) {
+  disk_frame_t *entry = &cache->frames[frame];
+
+  entry->page = page;
+  entry->pins = 1;
+  entry->dirty = false;
+  entry->referenced = true;
+  cache->table[disk_slot(cache, page)] = frame + 1;
+
+  return &cache->pages[frame];
+}
+
+// the page, read in if needed and pinned, or NULL on a read error or when
+// no frame is free
+static disk_page_t *disk_pin(disk_tree_t *tree, uint32_t page) {
+  disk_cache_t *cache = &tree->cache;
+  uint32_t slot = disk_slot(cache, page);
+
+  if (cache->table[slot] != 0) {
+    disk_frame_t *entry = &cache->frames[cache->table[slot] - 1];
+
+    entry->pins++;
+    entry->referenced = true;
+    cache->hits++;
+
+    return &cache->pages[cache->table[slot] - 1];
+  }
+
+  int64_t frame = disk_victim(cache);
+
+  if (frame < 0) {
+    return NULL;
+  }
+
+  if (pread(cache->fd, &cache->pages[frame], DISK_PAGE_SIZE,
+            (off_t)page * DISK_PAGE_SIZE) != DISK_PAGE_SIZE) {
+    return NULL;
+  }
+
+  cache->misses++;
+
+  return disk_install(cache, frame, page);
+}
+
+static inline uint32_t disk_frame_of(disk_tree_t *tree, disk_page_t *page) {
+  return page - tree->cache.pages;
+}
+
+static inline void disk_unpin(disk_tree_t *tree, disk_page_t *page) {
+  tree->cache.frames[disk_frame_of(tree, page)].pins--;
+}
+
+static inline void disk_dirty(disk_tree_t *tree, disk_page_t *page) {
+  tree->cache.frames[disk_frame_of(tree, page)].dirty = true;
+}
+
+// a pinned, dirty, empty node, from the free list or the end of the file
+static disk_page_t *disk_page_new(disk_tree_t *tree, uint32_t *id,
+                                  bool leaf) {
+  disk_page_t *page;
+
+  if (tree->meta.free_list != DISK_NONE) {
+    page = disk_pin(tree, tree->meta.free_list);
+
+    if (page == NULL) {
+      return NULL;
+    }
+
+    *id = tree->meta.free_list;
+    tree->meta.free_list = page->next;
+  } else {
+    int64_t frame = disk_victim(&tree->cache);
+
+    if (frame < 0) {
+      return NULL;
+    }
+
+    *id = tree->meta.pages++;
+    page = disk_install(&tree->cache, frame, *id);
+  }
+
+  memset(page, 0, sizeof(*page));
+  page->leaf = leaf;
+  disk_dirty(tree, page);
+
+  return page;
+}
+
+// puts the page on the free list, the caller still unpins it
+static void disk_page_free(disk_tree_t *tree, disk_page_t *page, uint32_t id) {
+  page->count = 0;
+  page->next = tree->meta.free_list;
+  tree->meta.free_list = id;
+  disk_dirty(tree, page);
+}
+
+/* ---------------------------------------------- */
+
+static inline uint32_t disk_capacity(const disk_page_t *page) {
+  return page->leaf ? DISK_LEAF_KEYS : DISK_INNER_KEYS;
+}
+
+// number of keys in the page smaller than value
+static inline uint32_t disk_rank(const disk_page_t *page, int value) {
+  uint32_t low = 0;
+  uint32_t n = page->count;
+
+  while (n > 0) {
+    uint32_t half = n / 2;
+
+    if (page->keys[low + half] < value) {
+      low += half + 1;
+      n -= half + 1;
+    } else {
+      n = half;
+    }
+  }
+
+  return low;
+}
+
+static void disk_path_release(disk_tree_t *tree, disk_path_t *path) {
+  for (uint32_t level = 0; level < path->depth; level++) {
+    disk_unpin(tree, path->page[level]);
+  }
+
+  path->depth = 0;
+}
+
+// walks down to the leftmost leaf that may hold value, pinning the path
+static int disk_descend(disk_tree_t *tree, int value, disk_path_t *path) {
+  uint32_t id = tree->meta.root;
+
+  PERF_BEGIN(disk_perf_descent);
+
+  path->depth = 0;
+
+  for (;;) {
+    disk_page_t *page =
+        path->depth < DISK_MAX_DEPTH ? disk_pin(tree, id) : NULL;
+
+    if (page == NULL) {
+      disk_path_release(tree, path);
+      PERF_END(disk_perf_descent);
+
+      return -1;
+    }
+
+    uint32_t index = disk_rank(page, value);
+
+    path->page[path->depth] = page;
+    path->id[path->depth] = id;
+    path->index[path->depth++] = index;
+
+    if (page->leaf) {
+      break;
+    }
+
+    id = page->child[index];
+  }
+
+  PERF_END(disk_perf_descent);
+
+  return 0;
+}
+
+// Moves the path to the first slot of the next leaf. Returns 0 after the
+// last one and -1 on a read error, which releases the path.
+static int disk_path_next(disk_tree_t *tree, disk_path_t *path) {
+  int32_t level = (int32_t)path->depth - 2;
+
+  while (level >= 0 && path->index[level] >= path->page[level]->count) {
+    level--;
+  }
+
+  if (level < 0) {
+    return 0;
+  }
+
+  uint32_t id = path->page[level]->child[++path->index[level]];
+
+  for (level++; level < (int32_t)path->depth; level++) {
+    disk_page_t *page = disk_pin(tree, id);
+
+    if (page == NULL) {
+      disk_path_release(tree, path);
+
+      return -1;
+    }
+
+    disk_unpin(tree, path->page[level]);
+    path->page[level] = page;
+    path->id[level] = id;
+    path->index[level] = 0;
+
+    if (!page->leaf) {
+      id = page->child[0];
+    }
+  }
+
+  return 1;
+}
+
+/* ---------------------------------------------- */
+
+static int disk_flush(disk_tree_t *tree) {
+  disk_cache_t *cache = &tree->cache;
+
+  for (uint32_t frame = 0; frame < cache->capacity; frame++) {
+    if (cache->frames[frame].page != DISK_NONE && cache->frames[frame].dirty &&
+        disk_write_frame(cache, frame) < 0) {
+      return -1;
+    }
+  }
+
+  tree->meta.size = tree->size;
+
+  if (pwrite(cache->fd, &tree->meta, sizeof(tree->meta), 0) !=
+      sizeof(tree->meta)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// writes back every dirty page and the metadata and waits for the disk
+int disk_tree_sync(disk_tree_t *tree) {
+  if (disk_flush(tree) < 0 || fdatasync(tree->cache.fd) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// Opens the tree in the file at path, creating an empty one if the file
+// is new, with a buffer pool of `frames` pages (at least DISK_MIN_FRAMES).
+int disk_tree_open(disk_tree_t *tree, const char *path, uint32_t frames) {
+  disk_cache_t *cache = &tree->cache;
+  struct stat st;
+
+  memset(tree, 0, sizeof(*tree));
+
+  if (frames < DISK_MIN_FRAMES) {
+    frames = DISK_MIN_FRAMES;
+  }
+
+  cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (cache->fd < 0) {
+    return -1;
+  }
+
+  if (fstat(cache->fd, &st) < 0) {
+    close(cache->fd);
+
+    return -1;
+  }
+
+  if (st.st_size == 0) {
+    if (ftruncate(cache->fd, DISK_PAGE_SIZE) < 0) {
+      close(cache->fd);
+
+      return -1;
+    }
+
+    memcpy(tree->meta.magic, DISK_MAGIC, sizeof(DISK_MAGIC));
+    tree->meta.version = DISK_VERSION;
+    tree->meta.page_size = DISK_PAGE_SIZE;
+    tree->meta.root = DISK_NONE;
+    tree->meta.free_list = DISK_NONE;
+    tree->meta.pages = 1;
+  } else if (pread(cache->fd, &tree->meta, sizeof(tree->meta), 0) !=
+                 sizeof(tree->meta) ||
+             memcmp(tree->meta.magic, DISK_MAGIC, sizeof(DISK_MAGIC)) != 0 ||
+             tree->meta.version != DISK_VERSION ||
+             tree->meta.page_size != DISK_PAGE_SIZE ||
+             (uint64_t)st.st_size <
+                 (uint64_t)tree->meta.pages * DISK_PAGE_SIZE) {
+    close(cache->fd);
+
+    return -1;
+  }
+
+  uint32_t table = 1;
+
+  while (table < 2 * frames) {
+    table *= 2;
+  }
+
+  cache->capacity = frames;
+  cache->table_mask = table - 1;
+  cache->pages = (disk_page_t *)aligned_alloc(
+      DISK_PAGE_SIZE, (size_t)frames * DISK_PAGE_SIZE);
+  cache->frames = (disk_frame_t *)calloc(frames, sizeof(disk_frame_t));
+  cache->table = (uint32_t *)calloc(table, sizeof(uint32_t));
+
+  if (cache->pages == NULL || cache->frames == NULL || cache->table == NULL) {
+    free(cache->pages);
+    free(cache->frames);
+    free(cache->table);
+    close(cache->fd);
+
+    return -1;
+  }
+
+  tree->size = tree->meta.size;
+
+  return 0;
+}
+
+// syncs the tree and releases the buffer pool, the tree stays in the file
+int disk_tree_close(disk_tree_t *tree) {
+  int result = disk_tree_sync(tree);
+
+  if (close(tree->cache.fd) < 0) {
+    result = -1;
+  }
+
+  free(tree->cache.pages);
+  free(tree->cache.frames);
+  free(tree->cache.table);
+  memset(&tree->cache, 0, sizeof(tree->cache));
+
+  return result;
+}
+
+// Writes back and empties every frame, and asks the kernel to drop the
+// file from its page cache, so that the next accesses go to the disk.
+int disk_tree_drop_cache(disk_tree_t *tree) {
+  disk_cache_t *cache = &tree->cache;
+
+  if (disk_tree_sync(tree) < 0) {
+    return -1;
+  }
+
+  for (uint32_t frame = 0; frame < cache->capacity; frame++) {
+    if (cache->frames[frame].pins > 0) {
+      return -1;
+    }
+
+    cache->frames[frame].page = DISK_NONE;
+    cache->frames[frame].referenced = false;
+  }
+
+  memset(cache->table, 0, sizeof(uint32_t) * (cache->table_mask + 1));
+  cache->hand = 0;
+
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(cache->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// Splits the full page at path->page[level] that is about to take `key`
+// (and, for inner nodes, `child` to its right) at `index`, then pushes
+// the new separator into the parent, splitting upwards as needed.
+static int disk_split_insert(disk_tree_t *tree, disk_path_t *path,
+                             int32_t level, uint32_t index, int key,
+                             uint32_t child) {
+  int keys[DISK_LEAF_KEYS + 1];
+  uint32_t children[DISK_INNER_KEYS + 2];
+
+  PERF_BEGIN(disk_perf_split);
+
+  for (; level >= 0; level--) {
+    disk_page_t *page = path->page[level];
+    uint32_t capacity = disk_capacity(page);
+
+    disk_dirty(tree, page);
+
+    if (page->count < capacity) {
+      memmove(page->keys + index + 1, page->keys + index,
+              sizeof(int) * (page->count - index));
+      page->keys[index] = key;
+
+      if (!page->leaf) {
+        memmove(page->child + index + 2, page->child + index + 1,
+                sizeof(uint32_t) * (page->count - index));
+        page->child[index + 1] = child;
+      }
+
+      page->count++;
+
+      PERF_END(disk_perf_split);
+
+      return 0;
+    }
+
+    uint32_t right_id;
+    disk_page_t *right = disk_page_new(tree, &right_id, page->leaf);
+
+    if (right == NULL) {
+      PERF_END(disk_perf_split);
+
+      return -1;
+    }
+
+    memcpy(keys, page->keys, sizeof(int) * index);
+    keys[index] = key;
+    memcpy(keys + index + 1, page->keys + index,
+           sizeof(int) * (capacity - index));
+
+    if (page->leaf) {
+      // the left leaf keeps capacity / 2 + 1 values and its largest
+      // becomes the separator
+      uint32_t left_count = capacity / 2 + 1;
+
+      memcpy(page->keys, keys, sizeof(int) * left_count);
+      memcpy(right->keys, keys + left_count,
+             sizeof(int) * (capacity + 1 - left_count));
+
+      page->count = left_count;
+      right->count = capacity + 1 - left_count;
+      right->next = page->next;
+      page->next = right_id;
+      key = keys[left_count - 1];
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "split leaf %u at %d",
+                path->id[level], key);
+    } else {
+      // capacity + 1 keys: half stay, the middle one moves up, half move
+      // to the new page with the children on its right
+      uint32_t left_count = capacity / 2;
+
+      memcpy(children, page->child, sizeof(uint32_t) * (index + 1));
+      children[index + 1] = child;
+      memcpy(children + index + 2, page->child + index + 1,
+             sizeof(uint32_t) * (capacity - index));
+
+      memcpy(page->keys, keys, sizeof(int) * left_count);
+      memcpy(page->child, children, sizeof(uint32_t) * (left_count + 1));
+      memcpy(right->keys, keys + left_count + 1,
+             sizeof(int) * (capacity - left_count));
+      memcpy(right->child, children + left_count + 1,
+             sizeof(uint32_t) * (capacity - left_count + 1));
+
+      page->count = left_count;
+      right->count = capacity - left_count;
+      key = keys[left_count];
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "split inner page %u at %d",
+                path->id[level], key);
+    }
+
+    disk_unpin(tree, right);
+    child = right_id;
+
+    if (level == 0) {
+      uint32_t root_id;
+      disk_page_t *root = disk_page_new(tree, &root_id, false);
+
+      if (root == NULL) {
+        PERF_END(disk_perf_split);
+
+        return -1;
+      }
+
+      root->keys[0] = key;
+      root->child[0] = path->id[0];
+      root->child[1] = right_id;
+      root->count = 1;
+      tree->meta.root = root_id;
+      disk_unpin(tree, root);
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "new root %u at %d", root_id, key);
+    } else {
+      index = path->index[level - 1];
+    }
+  }
+
+  PERF_END(disk_perf_split);
+
+  return 0;
+}
+
+int disk_tree_insert(disk_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
+  if (tree->meta.root == DISK_NONE) {
+    uint32_t id;
+    disk_page_t *leaf = disk_page_new(tree, &id, true);
+
+    if (leaf == NULL) {
+      return -1;
+    }
+
+    leaf->keys[0] = value;
+    leaf->count = 1;
+    tree->meta.root = id;
+    tree->size = 1;
+    disk_unpin(tree, leaf);
+
+    return 0;
+  }
+
+  disk_path_t path;
+
+  if (disk_descend(tree, value, &path) < 0) {
+    return -1;
+  }
+
+  int result = disk_split_insert(tree, &path, path.depth - 1,
+                                 path.index[path.depth - 1], value, DISK_NONE);
+
+  disk_path_release(tree, &path);
+
+  if (result == 0) {
+    tree->size++;
+  }
+
+  return result;
+}
+
+/* ---------------------------------------------- */
+
+static inline void disk_remove_slot(disk_page_t *page, uint32_t index) {
+  memmove(page->keys + index, page->keys + index + 1,
+          sizeof(int) * (page->count - index - 1));
+
+  if (!page->leaf) {
+    memmove(page->child + index + 1, page->child + index + 2,
+            sizeof(uint32_t) * (page->count - index - 1));
+  }
+
+  page->count--;
+}
+
+// appends right and the separator between them (inner nodes only) to
+// left, which must have room, and frees right
+static void disk_merge(disk_tree_t *tree, disk_page_t *left, int separator,
+                       disk_page_t *right, uint32_t right_id) {
+  uint32_t count = left->count;
+
+  if (left->leaf) {
+    memcpy(left->keys + count, right->keys, sizeof(int) * right->count);
+    left->count += right->count;
+    left->next = right->next;
+  } else {
+    left->keys[count] = separator;
+    memcpy(left->keys + count + 1, right->keys, sizeof(int) * right->count);
+    memcpy(left->child + count + 1, right->child,
+           sizeof(uint32_t) * (right->count + 1));
+    left->count += right->count + 1;
+  }
+
+  disk_dirty(tree, left);
+  disk_page_free(tree, right, right_id);
+}
+
+// Refills the page at path->page[level] that dropped below half full, by
+// taking a key from a sibling when one can spare it and by merging with
+// one otherwise, which takes a key from the parent and may leave it short
+// in turn.
+static int disk_rebalance(disk_tree_t *tree, disk_path_t *path,
+                          int32_t level) {
+  PERF_BEGIN(disk_perf_rebalance);
+
+  for (; level > 0; level--) {
+    disk_page_t *page = path->page[level];
+    uint32_t minimum = disk_capacity(page) / 2;
+
+    if (page->count >= minimum) {
+      break;
+    }
+
+    disk_page_t *parent = path->page[level - 1];
+    uint32_t index = path->index[level - 1];
+    uint32_t left_id = index > 0 ? parent->child[index - 1] : DISK_NONE;
+    uint32_t right_id =
+        index < parent->count ? parent->child[index + 1] : DISK_NONE;
+    disk_page_t *left = left_id != DISK_NONE ? disk_pin(tree, left_id) : NULL;
+    disk_page_t *right =
+        right_id != DISK_NONE ? disk_pin(tree, right_id) : NULL;
+    bool done = true;
+
+    if ((left_id != DISK_NONE && left == NULL) ||
+        (right_id != DISK_NONE && right == NULL)) {
+      if (left != NULL) {
+        disk_unpin(tree, left);
+      }
+
+      if (right != NULL) {
+        disk_unpin(tree, right);
+      }
+
+      PERF_END(disk_perf_rebalance);
+
+      return -1;
+    }
+
+    disk_dirty(tree, page);
+    disk_dirty(tree, parent);
+
+    if (left != NULL && left->count > minimum) {
+      memmove(page->keys + 1, page->keys, sizeof(int) * page->count);
+
+      if (page->leaf) {
+        page->keys[0] = left->keys[--left->count];
+        parent->keys[index - 1] = left->keys[left->count - 1];
+      } else {
+        memmove(page->child + 1, page->child,
+                sizeof(uint32_t) * (page->count + 1));
+        page->keys[0] = parent->keys[index - 1];
+        page->child[0] = left->child[left->count];
+        parent->keys[index - 1] = left->keys[--left->count];
+      }
+
+      page->count++;
+      disk_dirty(tree, left);
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "took %d from the left",
+                page->keys[0]);
+    } else if (right != NULL && right->count > minimum) {
+      if (page->leaf) {
+        page->keys[page->count++] = right->keys[0];
+        parent->keys[index] = right->keys[0];
+      } else {
+        page->keys[page->count++] = parent->keys[index];
+        page->child[page->count] = right->child[0];
+        parent->keys[index] = right->keys[0];
+        memmove(right->child, right->child + 1,
+                sizeof(uint32_t) * right->count);
+      }
+
+      memmove(right->keys, right->keys + 1, sizeof(int) * (right->count - 1));
+      right->count--;
+      disk_dirty(tree, right);
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "took %d from the right",
+                parent->keys[index]);
+    } else {
+      if (left != NULL) {
+        disk_merge(tree, left, parent->keys[index - 1], page,
+                   path->id[level]);
+        disk_remove_slot(parent, index - 1);
+      } else {
+        disk_merge(tree, page, parent->keys[index], right, right_id);
+        disk_remove_slot(parent, index);
+      }
+
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "merged under page %u",
+                path->id[level - 1]);
+      done = false;
+    }
+
+    if (left != NULL) {
+      disk_unpin(tree, left);
+    }
+
+    if (right != NULL) {
+      disk_unpin(tree, right);
+    }
+
+    if (done) {
+      break;
+    }
+  }
+
+  // the root may go down to a single child, which takes its place
+  disk_page_t *root = path->page[0];
+
+  if (!root->leaf && root->count == 0) {
+    tree->meta.root = root->child[0];
+    disk_page_free(tree, root, path->id[0]);
+  }
+
+  PERF_END(disk_perf_rebalance);
+
+  return 0;
+}
+
+int disk_tree_remove(disk_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
+  if (tree->meta.root == DISK_NONE) {
+    return -1;
+  }
+
+  disk_path_t path;
+
+  if (disk_descend(tree, value, &path) < 0) {
+    return -1;
+  }
+
+  uint32_t last = path.depth - 1;
+
+  if (path.index[last] == path.page[last]->count &&
+      disk_path_next(tree, &path) <= 0) {
+    disk_path_release(tree, &path);
+
+    return -1;
+  }
+
+  disk_page_t *leaf = path.page[last];
+  uint32_t index = path.index[last];
+
+  if (leaf->keys[index] != value) {
+    disk_path_release(tree, &path);
+
+    return -1;
+  }
+
+  disk_remove_slot(leaf, index);
+  disk_dirty(tree, leaf);
+  tree->size--;
+
+  int result = 0;
+
+  if (tree->size == 0) {
+    disk_page_free(tree, leaf, path.id[last]);
+    tree->meta.root = DISK_NONE;
+  } else {
+    result = disk_rebalance(tree, &path, last);
+  }
+
+  disk_path_release(tree, &path);
+
+  return result;
+}
+
+/* ---------------------------------------------- */
+
+// the pinned leftmost leaf that may hold value, NULL for an empty tree or
+// on a read error
+static disk_page_t *disk_find_leaf(disk_tree_t *tree, int value) {
+  if (tree->meta.root == DISK_NONE) {
+    return NULL;
+  }
+
+  disk_page_t *page = disk_pin(tree, tree->meta.root);
+
+  while (page != NULL && !page->leaf) {
+    disk_page_t *child = disk_pin(tree, page->child[disk_rank(page, value)]);
+
+    disk_unpin(tree, page);
+    page = child;
+  }
+
+  return page;
+}
+
+// swaps the pinned leaf for the next one, NULL after the last
+static disk_page_t *disk_next_leaf(disk_tree_t *tree, disk_page_t *leaf) {
+  disk_page_t *next = leaf->next != DISK_NONE ? disk_pin(tree, leaf->next)
+                                              : NULL;
+
+  disk_unpin(tree, leaf);
+
+  return next;
+}
+
+bool disk_tree_find(disk_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
+
+  disk_page_t *leaf = disk_find_leaf(tree, value);
+
+  if (leaf == NULL) {
+    return false;
+  }
+
+  uint32_t index = disk_rank(leaf, value);
+
+  if (index == leaf->count) {
+    leaf = disk_next_leaf(tree, leaf);
+    index = 0;
+
+    if (leaf == NULL) {
+      return false;
+    }
+  }
+
+  bool found = leaf->keys[index] == value;
+
+  disk_unpin(tree, leaf);
+
+  return found;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t disk_tree_range(disk_tree_t *tree, int low, int high, int *out,
+                         uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  disk_page_t *leaf = disk_find_leaf(tree, low);
+  uint64_t count = 0;
+
+  for (uint32_t index = leaf != NULL ? disk_rank(leaf, low) : 0; leaf != NULL;
+       leaf = disk_next_leaf(tree, leaf), index = 0) {
+    for (; index < leaf->count; index++) {
+      if (leaf->keys[index] > high) {
+        disk_unpin(tree, leaf);
+
+        return count;
+      }
+
+      if (out != NULL && count < capacity) {
+        out[count] = leaf->keys[index];
+      }
+
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/* ---------------------------------------------- */
+
+void disk_tree_print(disk_tree_t *tree) {
+  printf("Tree Size: %llu, %u pages, %llu hits, %llu misses\n",
+         (unsigned long long)tree->size, tree->meta.pages,
+         (unsigned long long)tree->cache.hits,
+         (unsigned long long)tree->cache.misses);
+
+  if (tree->meta.root == DISK_NONE) {
+    return;
+  }
+
+  // one line per level, from the page numbers gathered on the one above
+  uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t));
+  uint64_t count = 1;
+
+  ids[0] = tree->meta.root;
+
+  while (count > 0 && ids != NULL) {
+    uint32_t *next = NULL;
+    uint64_t next_count = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+      disk_page_t *page = disk_pin(tree, ids[i]);
+
+      if (page == NULL) {
+        break;
+      }
+
+      printf("[");
+
+      for (uint32_t j = 0; j < page->count; j++) {
+        printf(j ? " %d" : "%d", page->keys[j]);
+      }
+
+      printf("] ");
+
+      if (!page->leaf) {
+        uint32_t *grown = (uint32_t *)realloc(
+            next, sizeof(uint32_t) * (next_count + page->count + 1));
+
+        if (grown != NULL) {
+          next = grown;
+          memcpy(next + next_count, page->child,
+                 sizeof(uint32_t) * (page->count + 1));
+          next_count += page->count + 1;
+        }
+      }
+
+      disk_unpin(tree, page);
+    }
+
+    printf("\n");
+
+    free(ids);
+    ids = next;
+    count = next_count;
+  }
+
+  free(ids);
+}
+
+#ifndef DISK_TREE_NO_MAIN
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "disk_tree.db";
+  disk_tree_t tree;
+
+  printf("%zu values per leaf, %zu keys per inner page\n",
+         (size_t)DISK_LEAF_KEYS, (size_t)DISK_INNER_KEYS);
+
+  unlink(path);
+
+  if (disk_tree_open(&tree, path, DISK_MIN_FRAMES) < 0) {
+    perror(path);
+
+    return 1;
+  }
+
+  for (int i = 0; i < 100000; i++) {
+    disk_tree_insert(&tree, (int)((i * 7919L) % 100003));
+  }
+
+  for (int i = 0; i < 99950; i++) {
+    disk_tree_remove(&tree, (int)((i * 7919L) % 100003));
+  }
+
+  disk_tree_close(&tree);
+
+  // reopen and read back what is left
+  if (disk_tree_open(&tree, path, DISK_MIN_FRAMES) < 0) {
+    perror(path);
+
+    return 1;
+  }
+
+  int values[8];
+  uint64_t count = disk_tree_range(&tree, 0, 50000, values, 8);
+
+  printf("%llu values in [0, 50000], first:", (unsigned long long)count);
+
+  for (uint64_t i = 0; i < count && i < 8; i++) {
+    printf(" %d", values[i]);
+  }
+
+  printf("\n");
+
+  disk_tree_print(&tree);
+  disk_tree_close(&tree);
+  unlink(path);
+
+  return 0;
+}
+#endif
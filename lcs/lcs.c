@@ -1,6 +1,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lcs.h"
+
 static inline int max(int x, int y) {
   return x < y ? y : x;
 }
@@ -10,32 +16,671 @@ static inline int min(int x, int y) {
 }
 
 char *lcs(char *x, char *y) {
-  int xi = 0;
-  int yi = 0;
-  int xj = 0;
-  int yj = 0;
-  int xl = strlen(x);
-  int yl = strlen(y);
-  char *cs = (char *)malloc(sizeof(char) * min(xl, yl));
-  cs[0] = '\0';
-  char *lcs = (char *)malloc(sizeof(char) * min(xl, yl));
-  lcs[0] = '\0';
+  uint64_t xl = strlen(x);
+  uint64_t yl = strlen(y);
+  uint64_t width = yl + 1;
+
+  // a value is at most the length of the shorter string, so it fits in
+  // an int for any table that fits in memory; the size itself may not
+  if (xl + 1 > SIZE_MAX / sizeof(int) / width) {
+    return NULL;
+  }
+
+  // table[i * width + j] is the length of the lcs of x[i..] and y[j..]
+  int *table = (int *)calloc((size_t)((xl + 1) * width), sizeof(int));
+
+  if (table == NULL) {
+    return NULL;
+  }
+
+  for (uint64_t i = xl; i-- > 0;) {
+    for (uint64_t j = yl; j-- > 0;) {
+      if (x[i] == y[j]) {
+        table[i * width + j] = 1 + table[(i + 1) * width + j + 1];
+      } else {
+        table[i * width + j] =
+            max(table[(i + 1) * width + j], table[i * width + j + 1]);
+      }
+    }
+  }
+
+  char *cs = (char *)malloc(sizeof(char) * ((size_t)table[0] + 1));
+
+  if (cs == NULL) {
+    free(table);
+
+    return NULL;
+  }
+
+  uint64_t si = 0;
+  uint64_t xi = 0;
+  uint64_t yi = 0;
+
+  while (xi < xl && yi < yl) {
+    if (x[xi] == y[yi]) {
+      cs[si++] = x[xi];
+      xi++;
+      yi++;
+    } else if (table[(xi + 1) * width + yi] >= table[xi * width + yi + 1]) {
+      xi++;
+    } else {
+      yi++;
+    }
+  }
+
+  cs[si] = '\0';
+
+  free(table);
+
+  return cs;
+}
+
+/* ---------------------------------------------- */
+
+// Myers' algorithm works on the edit graph of x and y, diagonal k holds
+// the points (i, j) with i - j = k. The search runs from both corners at
+// once and stops at the first "middle snake" where the two meet, which
+// splits the problem into two halves that are solved recursively. Only
+// the furthest reaching point of each diagonal is kept so the space is
+// linear in m + n.
+
+typedef struct lcs_context {
+  // bytes when width is 1, 32-bit ids when it is 4
+  const void *x;
+  const void *y;
+  uint32_t width;
+  // furthest reaching points of the forward and the backward search,
+  // indexed by diagonal
+  int64_t *fdiag;
+  int64_t *bdiag;
+  // half of the cost budget, the two searches advance together
+  uint64_t too_expensive;
+  lcs_script_t *script;
+} lcs_context_t;
+
+typedef struct lcs_partition {
+  int64_t xmid;
+  int64_t ymid;
+} lcs_partition_t;
+
+static inline bool lcs_equal(const lcs_context_t *ctx, int64_t i, int64_t j) {
+  if (ctx->width == 1) {
+    return ((const char *)ctx->x)[i] == ((const char *)ctx->y)[j];
+  }
+
+  return ((const uint32_t *)ctx->x)[i] == ((const uint32_t *)ctx->y)[j];
+}
+
+static int lcs_script_push(lcs_script_t *script, lcs_op_t op, uint64_t x,
+                           uint64_t y, uint64_t length) {
+  if (length == 0) {
+    return 0;
+  }
+
+  if (op != LCS_KEEP) {
+    script->cost += length;
+  }
+
+  if (script->size > 0) {
+    lcs_edit_t *last = &script->array[script->size - 1];
+
+    if (last->op == op) {
+      last->length += length;
+
+      return 0;
+    }
+  }
+
+  if (script->size == script->capacity) {
+    uint64_t capacity = script->capacity == 0 ? 16 : script->capacity * 2;
+    lcs_edit_t *array = (lcs_edit_t *)realloc(
+        script->array, sizeof(lcs_edit_t) * capacity);
+
+    if (array == NULL) {
+      return -1;
+    }
+
+    script->array = array;
+    script->capacity = capacity;
+  }
+
+  script->array[script->size++] =
+      (lcs_edit_t){.op = op, .x = x, .y = y, .length = length};
+
+  return 0;
+}
+
+static void lcs_middle_snake(lcs_context_t *ctx, int64_t xoff, int64_t xlim,
+                             int64_t yoff, int64_t ylim,
+                             lcs_partition_t *part) {
+  int64_t *fd = ctx->fdiag;
+  int64_t *bd = ctx->bdiag;
+
+  const int64_t dmin = xoff - ylim;
+  const int64_t dmax = xlim - yoff;
+  const int64_t fmid = xoff - yoff;
+  const int64_t bmid = xlim - ylim;
+  int64_t fmin = fmid;
+  int64_t fmax = fmid;
+  int64_t bmin = bmid;
+  int64_t bmax = bmid;
+  const bool odd = (fmid - bmid) & 1;
+
+  fd[fmid] = xoff;
+  bd[bmid] = xlim;
+
+  for (uint64_t c = 1;; c++) {
+    int64_t d;
+
+    // extend the forward search by one edit
+    if (fmin > dmin) {
+      fd[--fmin - 1] = -1;
+    } else {
+      fmin++;
+    }
+
+    if (fmax < dmax) {
+      fd[++fmax + 1] = -1;
+    } else {
+      fmax--;
+    }
+
+    for (d = fmax; d >= fmin; d -= 2) {
+      int64_t tlo = fd[d - 1];
+      int64_t thi = fd[d + 1];
+      int64_t i = tlo >= thi ? tlo + 1 : thi;
+      int64_t j = i - d;
+
+      while (i < xlim && j < ylim && lcs_equal(ctx, i, j)) {
+        i++;
+        j++;
+      }
+
+      fd[d] = i;
+
+      if (odd && bmin <= d && d <= bmax && bd[d] <= i) {
+        part->xmid = i;
+        part->ymid = j;
+
+        return;
+      }
+    }
+
+    // extend the backward search by one edit
+    if (bmin > dmin) {
+      bd[--bmin - 1] = INT64_MAX;
+    } else {
+      bmin++;
+    }
+
+    if (bmax < dmax) {
+      bd[++bmax + 1] = INT64_MAX;
+    } else {
+      bmax--;
+    }
+
+    for (d = bmax; d >= bmin; d -= 2) {
+      int64_t tlo = bd[d - 1];
+      int64_t thi = bd[d + 1];
+      int64_t i = tlo < thi ? tlo : thi - 1;
+      int64_t j = i - d;
+
+      while (xoff < i && yoff < j && lcs_equal(ctx, i - 1, j - 1)) {
+        i--;
+        j--;
+      }
+
+      bd[d] = i;
+
+      if (!odd && fmin <= d && d <= fmax && i <= fd[d]) {
+        part->xmid = i;
+        part->ymid = j;
+
+        return;
+      }
+    }
+
+    if (c < ctx->too_expensive) {
+      continue;
+    }
+
+    // Over budget, give up on the minimal path and split at whichever
+    // search got furthest. The forward search is measured by the largest
+    // i + j it reached, the backward search by the smallest.
+    int64_t fxybest = -1;
+    int64_t fxbest = xoff;
+
+    for (d = fmax; d >= fmin; d -= 2) {
+      int64_t i = fd[d] < xlim ? fd[d] : xlim;
+      int64_t j = i - d;
+
+      if (ylim < j) {
+        i = ylim + d;
+        j = ylim;
+      }
+
+      if (fxybest < i + j) {
+        fxybest = i + j;
+        fxbest = i;
+      }
+    }
+
+    int64_t bxybest = INT64_MAX;
+    int64_t bxbest = xlim;
+
+    for (d = bmax; d >= bmin; d -= 2) {
+      int64_t i = bd[d] > xoff ? bd[d] : xoff;
+      int64_t j = i - d;
+
+      if (j < yoff) {
+        i = yoff + d;
+        j = yoff;
+      }
+
+      if (i + j < bxybest) {
+        bxybest = i + j;
+        bxbest = i;
+      }
+    }
+
+    if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+      part->xmid = fxbest;
+      part->ymid = fxybest - fxbest;
+    } else {
+      part->xmid = bxbest;
+      part->ymid = bxybest - bxbest;
+    }
+
+    ctx->script->exact = false;
+
+    return;
+  }
+}
+
+static int lcs_compare(lcs_context_t *ctx, int64_t xoff, int64_t xlim,
+                       int64_t yoff, int64_t ylim) {
+  lcs_script_t *script = ctx->script;
+
+  // strip the common prefix and suffix, they are always kept
+  int64_t prefix = 0;
+
+  while (xoff + prefix < xlim && yoff + prefix < ylim &&
+         lcs_equal(ctx, xoff + prefix, yoff + prefix)) {
+    prefix++;
+  }
+
+  if (lcs_script_push(script, LCS_KEEP, xoff, yoff, prefix) < 0) {
+    return -1;
+  }
+
+  xoff += prefix;
+  yoff += prefix;
+
+  int64_t suffix = 0;
+
+  while (xoff < xlim - suffix && yoff < ylim - suffix &&
+         lcs_equal(ctx, xlim - suffix - 1, ylim - suffix - 1)) {
+    suffix++;
+  }
+
+  xlim -= suffix;
+  ylim -= suffix;
+
+  if (xoff == xlim) {
+    if (lcs_script_push(script, LCS_INSERT, xoff, yoff, ylim - yoff) < 0) {
+      return -1;
+    }
+  } else if (yoff == ylim) {
+    if (lcs_script_push(script, LCS_DELETE, xoff, yoff, xlim - xoff) < 0) {
+      return -1;
+    }
+  } else {
+    lcs_partition_t part;
+
+    lcs_middle_snake(ctx, xoff, xlim, yoff, ylim, &part);
+
+    if (lcs_compare(ctx, xoff, part.xmid, yoff, part.ymid) < 0) {
+      return -1;
+    }
+
+    if (lcs_compare(ctx, part.xmid, xlim, part.ymid, ylim) < 0) {
+      return -1;
+    }
+  }
+
+  return lcs_script_push(script, LCS_KEEP, xlim, ylim, suffix);
+}
 
-  int si = 0;
+static int lcs_diff_width(const void *x, uint64_t xl, const void *y,
+                          uint64_t yl, uint32_t width, uint64_t max_cost,
+                          lcs_script_t *script) {
+  script->array = NULL;
+  script->size = 0;
+  script->capacity = 0;
+  script->cost = 0;
+  script->exact = true;
 
-traverse_x:
-  if (xi < xl) {
-    while (xj < xl) {
-      if (y[yi] == x[xj]) {
-        cs[si++] = x[xj];
-        
+  // diagonals range over [-yl, xl], plus one on either side
+  uint64_t diagonals = xl + yl + 3;
+  int64_t *fdiag = (int64_t *)malloc(sizeof(int64_t) * diagonals);
+  int64_t *bdiag = (int64_t *)malloc(sizeof(int64_t) * diagonals);
+
+  if (fdiag == NULL || bdiag == NULL) {
+    free(fdiag);
+    free(bdiag);
+
+    return -1;
+  }
+
+  lcs_context_t ctx = {
+      .x = x,
+      .y = y,
+      .width = width,
+      .fdiag = fdiag + yl + 1,
+      .bdiag = bdiag + yl + 1,
+      .too_expensive = max_cost == LCS_UNBOUNDED ? UINT64_MAX
+                                                 : max_cost / 2 + 1,
+      .script = script};
+
+  int result = lcs_compare(&ctx, 0, xl, 0, yl);
+
+  free(fdiag);
+  free(bdiag);
+
+  if (result < 0) {
+    lcs_script_free(script);
+  }
+
+  return result;
+}
+
+int lcs_diff(const char *x, uint64_t xl, const char *y, uint64_t yl,
+             uint64_t max_cost, lcs_script_t *script) {
+  return lcs_diff_width(x, xl, y, yl, 1, max_cost, script);
+}
+
+int lcs_diff_ids(const uint32_t *x, uint64_t xl, const uint32_t *y,
+                 uint64_t yl, uint64_t max_cost, lcs_script_t *script) {
+  return lcs_diff_width(x, xl, y, yl, 4, max_cost, script);
+}
+
+void lcs_script_free(lcs_script_t *script) {
+  if (script->array != NULL) {
+    free(script->array);
+  }
+
+  script->array = NULL;
+  script->size = 0;
+  script->capacity = 0;
+}
+
+char *lcs_script_common(const char *x, lcs_script_t *script) {
+  uint64_t length = 0;
+
+  for (uint64_t i = 0; i < script->size; i++) {
+    if (script->array[i].op == LCS_KEEP) {
+      length += script->array[i].length;
+    }
+  }
+
+  char *cs = (char *)malloc(sizeof(char) * (length + 1));
+
+  if (cs == NULL) {
+    return NULL;
+  }
+
+  uint64_t si = 0;
+
+  for (uint64_t i = 0; i < script->size; i++) {
+    lcs_edit_t *edit = &script->array[i];
+
+    if (edit->op == LCS_KEEP) {
+      memcpy(cs + si, x + edit->x, edit->length);
+      si += edit->length;
+    }
+  }
+
+  cs[si] = '\0';
+
+  return cs;
+}
+
+char *lcs_myers(char *x, char *y, uint64_t max_cost) {
+  lcs_script_t script;
+
+  if (lcs_diff(x, strlen(x), y, strlen(y), max_cost, &script) < 0) {
+    return NULL;
+  }
+
+  char *cs = lcs_script_common(x, &script);
+
+  lcs_script_free(&script);
+
+  return cs;
+}
+
+/* ---------------------------------------------- */
+
+// Bit i of the vector is 0 when the lcs of x[..i] with the rows seen so
+// far is one more than the lcs of x[..i - 1], so the length is the number
+// of zero bits. Each row c updates it with
+//
+//   U = V & M[c]
+//   V = (V + U) | (V - U)
+//
+// where M[c] marks the positions of c in x. U is a subset of V so the
+// subtraction never borrows, only the addition carries across words.
+//
+// Rows are processed in chunks so that each word of the vector and of x
+// is loaded once per chunk rather than once per row.
+
+#define LCS_STREAM_ROWS 512
+
+static inline uint64_t lcs_match_mask(const char *block, char c) {
+#ifdef __SSE2__
+  __m128i needle = _mm_set1_epi8(c);
+  uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *)(block + 0)), needle));
+  uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *)(block + 16)), needle));
+  uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *)(block + 32)), needle));
+  uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *)(block + 48)), needle));
+
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+  uint64_t mask = 0;
+
+  for (int i = 0; i < 64; i++) {
+    mask |= (uint64_t)(block[i] == c) << i;
+  }
+
+  return mask;
+#endif
+}
+
+static inline uint64_t lcs_vector_length(const uint64_t *vector,
+                                         uint64_t words, uint64_t xl) {
+  uint64_t ones = 0;
+
+  for (uint64_t w = 0; w < words; w++) {
+    uint64_t v = vector[w];
+
+    // carries can reach the padding of the last word, ignore it
+    if (w * 64 + 64 > xl) {
+      v &= (UINT64_C(1) << (xl - w * 64)) - 1;
+    }
+
+    ones += __builtin_popcountll(v);
+  }
+
+  return xl - ones;
+}
+
+int lcs_stream_init(lcs_stream_t *stream, const char *x, uint64_t xl) {
+  stream->x = x;
+  stream->xl = xl;
+  stream->words = (xl + 63) / 64;
+  stream->vector = NULL;
+
+  if (stream->words == 0) {
+    return 0;
+  }
+
+  stream->vector = (uint64_t *)malloc(sizeof(uint64_t) * stream->words);
+
+  if (stream->vector == NULL) {
+    return -1;
+  }
+
+  memset(stream->vector, 0xff, sizeof(uint64_t) * stream->words);
+
+  return 0;
+}
+
+void lcs_stream_feed(lcs_stream_t *stream, const char *y, uint64_t yl) {
+  uint8_t carry[LCS_STREAM_ROWS];
+  char tail[64];
+
+  for (uint64_t row = 0; row < yl; row += LCS_STREAM_ROWS) {
+    uint64_t rows = yl - row < LCS_STREAM_ROWS ? yl - row : LCS_STREAM_ROWS;
+    const char *chunk = y + row;
+
+    memset(carry, 0, rows);
+
+    for (uint64_t w = 0; w < stream->words; w++) {
+      const char *block = stream->x + w * 64;
+      uint64_t valid = UINT64_MAX;
+
+      // the last word may be partial, never let its padding match
+      if (w * 64 + 64 > stream->xl) {
+        uint64_t bits = stream->xl - w * 64;
+
+        memcpy(tail, block, bits);
+        block = tail;
+        valid = (UINT64_C(1) << bits) - 1;
+      }
+
+      uint64_t v = stream->vector[w];
+
+      for (uint64_t r = 0; r < rows; r++) {
+        uint64_t u = v & lcs_match_mask(block, chunk[r]) & valid;
+        uint64_t t = v + u;
+        uint64_t s = t + carry[r];
+
+        carry[r] = (t < v) | (s < t);
+        v = s | (v - u);
       }
-    } 
+
+      stream->vector[w] = v;
+    }
+  }
+}
+
+uint64_t lcs_stream_length(lcs_stream_t *stream) {
+  return lcs_vector_length(stream->vector, stream->words, stream->xl);
+}
+
+void lcs_stream_free(lcs_stream_t *stream) {
+  if (stream->vector != NULL) {
+    free(stream->vector);
+  }
+
+  stream->vector = NULL;
+  stream->words = 0;
+}
+
+uint64_t lcs_length(const char *x, uint64_t xl, const char *y, uint64_t yl) {
+  // the shorter sequence becomes the bit vector
+  if (yl < xl) {
+    return lcs_length(y, yl, x, xl);
+  }
+
+  lcs_stream_t stream;
+
+  if (lcs_stream_init(&stream, x, xl) < 0) {
+    return 0;
   }
-traverse_y:
-  if (yi < yl) {
-    while (yj < xl) {
 
+  lcs_stream_feed(&stream, y, yl);
+
+  uint64_t length = lcs_stream_length(&stream);
+
+  lcs_stream_free(&stream);
+
+  return length;
+}
+
+/* ---------------------------------------------- */
+
+int lcs_pattern_init(lcs_pattern_t *pattern, const char *x, uint64_t xl) {
+  pattern->x = x;
+  pattern->xl = xl;
+  pattern->words = (xl + 63) / 64;
+  pattern->masks =
+      (uint64_t *)calloc(256 * (pattern->words ? pattern->words : 1),
+                         sizeof(uint64_t));
+
+  if (pattern->masks == NULL) {
+    return -1;
+  }
+
+  for (uint64_t i = 0; i < xl; i++) {
+    uint8_t c = (uint8_t)x[i];
+
+    pattern->masks[c * pattern->words + i / 64] |= UINT64_C(1) << (i % 64);
+  }
+
+  return 0;
+}
+
+void lcs_pattern_free(lcs_pattern_t *pattern) {
+  if (pattern->masks != NULL) {
+    free(pattern->masks);
+  }
+
+  pattern->masks = NULL;
+  pattern->words = 0;
+}
+
+// how many rows pass between checks of the bound
+#define LCS_BOUND_INTERVAL 64
+
+uint64_t lcs_pattern_length(const lcs_pattern_t *pattern, const char *y,
+                            uint64_t yl, uint64_t *vector, uint64_t bound) {
+  const uint64_t words = pattern->words;
+  const uint64_t xl = pattern->xl;
+
+  if ((xl < yl ? xl : yl) < bound) {
+    return LCS_PRUNED;
+  }
+
+  memset(vector, 0xff, sizeof(uint64_t) * words);
+
+  for (uint64_t row = 0; row < yl; row++) {
+    const uint64_t *mask = pattern->masks + (uint8_t)y[row] * words;
+    uint64_t carry = 0;
+
+    for (uint64_t w = 0; w < words; w++) {
+      uint64_t v = vector[w];
+      uint64_t u = v & mask[w];
+      uint64_t t = v + u;
+      uint64_t s = t + carry;
+
+      carry = (t < v) | (s < t);
+      vector[w] = s | (v - u);
+    }
+
+    if (bound > 0 && (row + 1) % LCS_BOUND_INTERVAL == 0) {
+      uint64_t length = lcs_vector_length(vector, words, xl);
+      uint64_t remaining = yl - row - 1;
+
+      if (length + remaining < bound) {
+        return LCS_PRUNED;
+      }
     }
   }
+
+  return lcs_vector_length(vector, words, xl);
 }
@@ -0,0 +1,160 @@
+#ifndef LCS_H
+#define LCS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// passing this as the cost budget disables the early bail out
+#define LCS_UNBOUNDED UINT64_MAX
+
+typedef enum lcs_op { LCS_KEEP, LCS_DELETE, LCS_INSERT } lcs_op_t;
+
+// A run of `length` operations of the same kind. `x` and `y` are the
+// positions in the two sequences at which the run starts.
+typedef struct lcs_edit {
+  lcs_op_t op;
+  uint64_t x;
+  uint64_t y;
+  uint64_t length;
+} lcs_edit_t;
+
+typedef struct lcs_script {
+  lcs_edit_t *array;
+  uint64_t size;
+  uint64_t capacity;
+  // number of deleted plus inserted symbols
+  uint64_t cost;
+  // false when the budget was exceeded, the script is then valid but
+  // not necessarily the shortest one
+  bool exact;
+} lcs_script_t;
+
+// classic O(m*n) dynamic programming, returns a malloc'd string
+char *lcs(char *x, char *y);
+
+// Myers' O((m+n)*D) difference algorithm with the linear space middle
+// snake refinement. Once the search for a middle snake costs more than
+// `max_cost` the best partial path found so far is used instead.
+int lcs_diff(const char *x, uint64_t xl, const char *y, uint64_t yl,
+             uint64_t max_cost, lcs_script_t *script);
+
+// lcs_diff over sequences of 32-bit ids, e.g. interned lines
+int lcs_diff_ids(const uint32_t *x, uint64_t xl, const uint32_t *y,
+                 uint64_t yl, uint64_t max_cost, lcs_script_t *script);
+
+void lcs_script_free(lcs_script_t *script);
+
+// collects the kept runs of a script into a malloc'd string
+char *lcs_script_common(const char *x, lcs_script_t *script);
+
+char *lcs_myers(char *x, char *y, uint64_t max_cost);
+
+// Bit-parallel lcs length. The state is one bit per symbol of `x`, the
+// symbols of the other sequence are fed as rows in any number of chunks
+// so it never has to be held in memory as a whole.
+typedef struct lcs_stream {
+  const char *x;
+  uint64_t xl;
+  uint64_t words;
+  uint64_t *vector;
+} lcs_stream_t;
+
+int lcs_stream_init(lcs_stream_t *stream, const char *x, uint64_t xl);
+void lcs_stream_feed(lcs_stream_t *stream, const char *y, uint64_t yl);
+uint64_t lcs_stream_length(lcs_stream_t *stream);
+void lcs_stream_free(lcs_stream_t *stream);
+
+uint64_t lcs_length(const char *x, uint64_t xl, const char *y, uint64_t yl);
+
+// Per symbol match masks of a sequence, bit i of masks[c * words + w] is
+// set when x[w * 64 + i] == c. Building them once lets many sequences be
+// compared against the same x.
+typedef struct lcs_pattern {
+  const char *x;
+  uint64_t xl;
+  uint64_t words;
+  uint64_t *masks;
+} lcs_pattern_t;
+
+// length reported for a batch candidate that was pruned
+#define LCS_PRUNED UINT64_MAX
+
+int lcs_pattern_init(lcs_pattern_t *pattern, const char *x, uint64_t xl);
+void lcs_pattern_free(lcs_pattern_t *pattern);
+
+// Bit-parallel lcs length of the pattern and y using `vector` (of
+// pattern->words words) as scratch. Gives up and returns LCS_PRUNED as
+// soon as the length can no longer reach `bound`.
+uint64_t lcs_pattern_length(const lcs_pattern_t *pattern, const char *y,
+                            uint64_t yl, uint64_t *vector, uint64_t bound);
+
+// Scores one query against n candidates on `threads` threads (0 picks
+// one per cpu). With a non zero threshold, candidates that cannot reach
+// it, or the best length found so far, are reported as LCS_PRUNED.
+int lcs_batch(const char *query, char **candidates, uint64_t n,
+              uint64_t *out_lengths, uint32_t threads, uint64_t threshold);
+
+typedef struct lcs_distances {
+  uint64_t lcs;
+  uint64_t levenshtein;
+  // insertions and deletions only, n + m - 2 * lcs
+  uint64_t indel;
+} lcs_distances_t;
+
+// Myers' 1999 bit-vector Levenshtein distance, `vectors` is scratch space
+// of 2 * pattern->words words
+uint64_t lcs_pattern_levenshtein(const lcs_pattern_t *pattern, const char *y,
+                                 uint64_t yl, uint64_t *vectors);
+
+// lcs, Levenshtein and indel distance from a single pass over y that
+// loads each match mask once for both kernels, `vectors` is scratch space
+// of 3 * pattern->words words
+void lcs_pattern_distances(const lcs_pattern_t *pattern, const char *y,
+                           uint64_t yl, uint64_t *vectors,
+                           lcs_distances_t *distances);
+
+uint64_t lcs_levenshtein(const char *x, uint64_t xl, const char *y,
+                         uint64_t yl);
+int lcs_distances(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  lcs_distances_t *distances);
+
+// Decides whether lcs(x, y) >= ratio * max(|x|, |y|). Only the diagonal
+// band that a path with that many matches can stay in is computed, and
+// the scan stops as soon as the answer is known either way. ratio is
+// clamped to [0, 1], so below 0 anything is similar and above 1 only
+// equal sequences are; with a NaN ratio nothing is.
+bool lcs_similar(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                 double ratio);
+bool lcs_pattern_similar(const lcs_pattern_t *pattern, const char *y,
+                         uint64_t yl, double ratio, uint64_t *vector);
+
+// lcs_similar of one query against n candidates, spread over threads
+// like lcs_batch
+int lcs_similar_batch(const char *query, char **candidates, uint64_t n,
+                      bool *out_similar, uint32_t threads, double ratio);
+
+typedef enum lcs_split { LCS_SPLIT_LINES, LCS_SPLIT_TOKENS } lcs_split_t;
+
+// Diffs two texts line by line, or by whitespace separated tokens, and
+// writes a unified diff with `context` lines of context to out. Lines
+// are interned to 32-bit ids so the diff itself only compares integers.
+int lcs_diff_text(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  lcs_split_t split, uint32_t context, const char *xname,
+                  const char *yname, FILE *out);
+
+// Longest common substring (contiguous) using a suffix automaton of x,
+// O(|x| + |y|). The match starts at x + *offset and is *length long.
+int lcs_substring(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  uint64_t *offset, uint64_t *length);
+
+// Longest substring shared by all k strings, the automaton is built on
+// the shortest one. The match starts at strings[*index] + *offset.
+int lcs_substring_k(const char **strings, const uint64_t *lengths, uint64_t k,
+                    uint64_t *index, uint64_t *offset, uint64_t *length);
+
+// lcs length of the contents of two files, both are mapped read-only and
+// the longer one is streamed through the shorter one, returns -1 on error
+int64_t lcs_file_length(const char *xpath, const char *ypath);
+
+#endif
@@ -1,45 +1,87 @@
-#     |
-#     |
-# X = aaaaaaabbbbbbbbb
-# Y = dsfbbbbbbbbdsfaa
-#     |
-#     |
-   
-def lcs(x, y):
-    lcs = ""
-    cs = ""
-    i = 0
-    j = 0
-    k = 0
+# The native engine lives in the _lcs extension (python setup.py
+# build_ext --inplace), it takes any buffer of single bytes without
+# copying and releases the GIL while it runs. Without it the pure Python
+# reference below is used.
+
+try:
+    import _lcs
+except ImportError:
+    _lcs = None
+
+
+def lcs_py(x, y):
     n = len(x)
     m = len(y)
 
-    while i < n:
-        cs = ""
-        j = 0
-        k = 0
-        print("cs = ", cs)
-        print("i = ", i)
-        print("j = ", j)
-        print("k = ", k)
+    # table[i][j] is the length of the lcs of x[i:] and y[j:]
+    table = [[0] * (m + 1) for _ in range(n + 1)]
+
+    for i in range(n - 1, -1, -1):
+        row = table[i]
+        below = table[i + 1]
+
+        for j in range(m - 1, -1, -1):
+            if x[i] == y[j]:
+                row[j] = below[j + 1] + 1
+            else:
+                row[j] = max(below[j], row[j + 1])
+
+    cs = []
+    i = 0
+    j = 0
+
+    while i < n and j < m:
+        if x[i] == y[j]:
+            cs.append(x[i])
+            i += 1
+            j += 1
+        elif table[i + 1][j] >= table[i][j + 1]:
+            i += 1
+        else:
+            j += 1
+
+    if isinstance(x, str):
+        return "".join(cs)
+
+    return bytes(cs)
+
+
+# both str or both bytes-like, a mix has no common alphabet
+def _check_types(x, y):
+    if isinstance(x, str) != isinstance(y, str):
+        raise TypeError(
+            "lcs arguments must both be str or both be bytes-like, not "
+            f"{type(x).__name__} and {type(y).__name__}"
+        )
+
+
+def lcs(x, y):
+    _check_types(x, y)
+
+    if _lcs is None:
+        return lcs_py(x, y)
+
+    if isinstance(x, str) or isinstance(y, str):
+        try:
+            common = _lcs.lcs(x.encode("latin-1"), y.encode("latin-1"))
+        except UnicodeEncodeError:
+            return lcs_py(x, y)
 
-        while k < m:
-            if x[j] == y[k]:
-                cs = f"{cs}{y[k]}"
+        return common.decode("latin-1")
 
-                j += 1
+    return _lcs.lcs(x, y)
 
-            k += 1
-            print("cs = ", cs)
-            print("i = ", i)
-            print("j = ", j)
-            print("k = ", k)
 
-        i += 1
+def lcs_length(x, y):
+    _check_types(x, y)
 
-        if len(cs) > len(lcs):
-            lcs = cs
+    if _lcs is None:
+        return len(lcs_py(x, y))
 
-        print("lcs ", lcs)
+    if isinstance(x, str) or isinstance(y, str):
+        try:
+            return _lcs.lcs_length(x.encode("latin-1"), y.encode("latin-1"))
+        except UnicodeEncodeError:
+            return len(lcs_py(x, y))
 
-    return lcs   
+    return _lcs.lcs_length(x, y)
@@ -0,0 +1,161 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcs.h"
+
+// A common subsequence of length `need` is a path through the edit graph
+// with n + m - 2 * need insertions and deletions. |n - m| of those are
+// spent getting from diagonal 0 to diagonal n - m, every other one takes
+// the path a step away from that range and has to be paid back, so the
+// path never strays more than (n + m - 2 * need - |n - m|) / 2 diagonals
+// beyond it.
+//
+// Only the words of the bit-parallel vector that overlap this band are
+// updated, 64 cells at a time. Words left of the band are frozen and
+// the carry out of the rightmost one is dropped, which is the same as
+// treating the cells outside of the band as mismatches. That can only
+// lower the result while paths that stay in the band are still found,
+// so the answer to the question is unchanged.
+
+// how many rows pass between checks of the bounds
+#define LCS_BAND_INTERVAL 32
+
+static inline uint64_t lcs_band_zeros(const uint64_t *vector, uint64_t wlo,
+                                      uint64_t whi, uint64_t bits) {
+  uint64_t zeros = 0;
+
+  for (uint64_t w = wlo; w < whi; w++) {
+    zeros += 64 - __builtin_popcountll(vector[w]);
+  }
+
+  // only the first `bits` bits of the last word are inside the band
+  uint64_t last = ~vector[whi];
+
+  if (bits < 64) {
+    last &= (UINT64_C(1) << bits) - 1;
+  }
+
+  return zeros + __builtin_popcountll(last);
+}
+
+bool lcs_pattern_similar(const lcs_pattern_t *pattern, const char *y,
+                         uint64_t yl, double ratio, uint64_t *vector) {
+  const uint64_t n = pattern->xl;
+  const uint64_t m = yl;
+  const uint64_t words = pattern->words;
+  const uint64_t longest = n > m ? n : m;
+  const uint64_t shortest = n > m ? m : n;
+
+  // NaN is no ratio at all, and none outside [0, 1] means anything more
+  if (isnan(ratio)) {
+    return false;
+  }
+
+  ratio = ratio < 0 ? 0 : ratio > 1 ? 1 : ratio;
+
+  double target = ratio * (double)longest;
+  uint64_t need = (uint64_t)target;
+
+  if ((double)need < target) {
+    need++;
+  }
+
+  if (need == 0) {
+    return true;
+  }
+
+  if (shortest < need) {
+    return false;
+  }
+
+  // diagonal k = j - i for column j of x and row i of y
+  const int64_t slack = (n + m - 2 * need - (longest - shortest)) / 2;
+  const int64_t kmin = (n < m ? (int64_t)n - (int64_t)m : 0) - slack;
+  const int64_t kmax = (n > m ? (int64_t)n - (int64_t)m : 0) + slack;
+
+  memset(vector, 0xff, sizeof(uint64_t) * words);
+
+  // matches in the frozen words below wfrozen
+  uint64_t frozen = 0;
+  uint64_t wfrozen = 0;
+
+  for (uint64_t i = 1; i <= m; i++) {
+    int64_t jlo = (int64_t)i + kmin;
+    int64_t jhi = (int64_t)i + kmax;
+
+    jlo = jlo < 1 ? 1 : jlo;
+    jhi = jhi > (int64_t)n ? (int64_t)n : jhi;
+
+    uint64_t wlo = (jlo - 1) / 64;
+    uint64_t whi = (jhi - 1) / 64;
+
+    while (wfrozen < wlo) {
+      frozen += 64 - __builtin_popcountll(vector[wfrozen++]);
+    }
+
+    const uint64_t *mask = pattern->masks + (uint8_t)y[i - 1] * words;
+    uint64_t carry = 0;
+
+    for (uint64_t w = wlo; w <= whi; w++) {
+      uint64_t v = vector[w];
+      uint64_t u = v & mask[w];
+      uint64_t t = v + u;
+      uint64_t s = t + carry;
+
+      carry = (t < v) | (s < t);
+      vector[w] = s | (v - u);
+    }
+
+    if (i % LCS_BAND_INTERVAL != 0 && i != m) {
+      continue;
+    }
+
+    // lcs of the first i rows and the first jhi columns
+    uint64_t reached =
+        frozen + lcs_band_zeros(vector, wlo, whi, jhi - whi * 64);
+
+    if (reached >= need) {
+      return true;
+    }
+
+    // any path still in the band crosses this row at or before jhi, and
+    // at or after i + kmin
+    int64_t start = (int64_t)i + kmin < 0 ? 0 : (int64_t)i + kmin;
+    uint64_t rest = m - i < n - start ? m - i : n - start;
+
+    if (reached + rest < need) {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+bool lcs_similar(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                 double ratio) {
+  // the shorter sequence becomes the bit vector
+  if (yl < xl) {
+    return lcs_similar(y, yl, x, xl, ratio);
+  }
+
+  lcs_pattern_t pattern;
+
+  if (lcs_pattern_init(&pattern, x, xl) < 0) {
+    return false;
+  }
+
+  uint64_t *vector = (uint64_t *)malloc(
+      sizeof(uint64_t) * (pattern.words ? pattern.words : 1));
+  bool similar = false;
+
+  if (vector != NULL) {
+    similar = lcs_pattern_similar(&pattern, y, yl, ratio, vector);
+
+    free(vector);
+  }
+
+  lcs_pattern_free(&pattern);
+
+  return similar;
+}
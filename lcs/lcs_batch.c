@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lcs.h"
+
+// candidates are handed out to the threads in blocks of this size
+#define LCS_BATCH_BLOCK 64
+
+typedef struct lcs_batch {
+  lcs_pattern_t pattern;
+  char **candidates;
+  uint64_t n;
+  uint64_t *out_lengths;
+  uint64_t threshold;
+  // set instead of out_lengths by lcs_similar_batch
+  bool *out_similar;
+  double ratio;
+  _Atomic uint64_t next;
+  // best length so far, only tracked when pruning
+  _Atomic uint64_t best;
+  _Atomic int failed;
+} lcs_batch_t;
+
+static void lcs_batch_score(lcs_batch_t *batch, uint64_t i,
+                            uint64_t *vector) {
+  const char *candidate = batch->candidates[i];
+  uint64_t bound = 0;
+
+  if (batch->threshold > 0) {
+    bound = atomic_load_explicit(&batch->best, memory_order_relaxed);
+    bound = bound < batch->threshold ? batch->threshold : bound;
+  }
+
+  uint64_t length = lcs_pattern_length(&batch->pattern, candidate,
+                                       strlen(candidate), vector, bound);
+
+  batch->out_lengths[i] = length;
+
+  if (batch->threshold == 0 || length == LCS_PRUNED) {
+    return;
+  }
+
+  uint64_t best = atomic_load_explicit(&batch->best, memory_order_relaxed);
+
+  while (best < length &&
+         !atomic_compare_exchange_weak(&batch->best, &best, length)) {
+  }
+}
+
+static void *lcs_batch_worker(void *arg) {
+  lcs_batch_t *batch = (lcs_batch_t *)arg;
+  uint64_t words = batch->pattern.words ? batch->pattern.words : 1;
+  uint64_t *vector = (uint64_t *)malloc(sizeof(uint64_t) * words);
+
+  if (vector == NULL) {
+    atomic_store(&batch->failed, 1);
+
+    return NULL;
+  }
+
+  for (;;) {
+    uint64_t start = atomic_fetch_add(&batch->next, LCS_BATCH_BLOCK);
+
+    if (start >= batch->n) {
+      break;
+    }
+
+    uint64_t end =
+        batch->n - start < LCS_BATCH_BLOCK ? batch->n : start + LCS_BATCH_BLOCK;
+
+    for (uint64_t i = start; i < end; i++) {
+      if (batch->out_similar != NULL) {
+        const char *candidate = batch->candidates[i];
+
+        batch->out_similar[i] =
+            lcs_pattern_similar(&batch->pattern, candidate, strlen(candidate),
+                                batch->ratio, vector);
+      } else {
+        lcs_batch_score(batch, i, vector);
+      }
+    }
+  }
+
+  free(vector);
+
+  return NULL;
+}
+
+static int lcs_batch_run(lcs_batch_t *batch, const char *query,
+                         uint32_t threads) {
+  uint64_t n = batch->n;
+
+  atomic_init(&batch->next, 0);
+  atomic_init(&batch->best, 0);
+  atomic_init(&batch->failed, 0);
+
+  if (lcs_pattern_init(&batch->pattern, query, strlen(query)) < 0) {
+    return -1;
+  }
+
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+
+  uint64_t blocks = (n + LCS_BATCH_BLOCK - 1) / LCS_BATCH_BLOCK;
+
+  if (threads > blocks) {
+    threads = blocks > 0 ? (uint32_t)blocks : 1;
+  }
+
+  pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+
+  if (workers == NULL) {
+    lcs_pattern_free(&batch->pattern);
+
+    return -1;
+  }
+
+  // the calling thread works too, so only threads - 1 are spawned
+  uint32_t spawned = 0;
+
+  for (; spawned + 1 < threads; spawned++) {
+    if (pthread_create(&workers[spawned], NULL, lcs_batch_worker, batch) !=
+        0) {
+      break;
+    }
+  }
+
+  lcs_batch_worker(batch);
+
+  for (uint32_t i = 0; i < spawned; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  free(workers);
+  lcs_pattern_free(&batch->pattern);
+
+  return atomic_load(&batch->failed) ? -1 : 0;
+}
+
+int lcs_batch(const char *query, char **candidates, uint64_t n,
+              uint64_t *out_lengths, uint32_t threads, uint64_t threshold) {
+  lcs_batch_t batch = {.candidates = candidates,
+                       .n = n,
+                       .out_lengths = out_lengths,
+                       .threshold = threshold};
+
+  return lcs_batch_run(&batch, query, threads);
+}
+
+int lcs_similar_batch(const char *query, char **candidates, uint64_t n,
+                      bool *out_similar, uint32_t threads, double ratio) {
+  lcs_batch_t batch = {.candidates = candidates,
+                       .n = n,
+                       .out_similar = out_similar,
+                       .ratio = ratio};
+
+  return lcs_batch_run(&batch, query, threads);
+}
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcs.h"
+
+// Myers' bit-vector algorithm keeps a column of the edit distance table
+// as two bit vectors, Pv and Mv, marking the rows where the distance
+// goes up or down by one relative to the row above. The pattern runs
+// down the column and every symbol of y advances it by one column.
+//
+// Across words the only thing that has to be carried is the horizontal
+// delta (-1, 0 or +1) coming out of the bottom row of the word above,
+// as in Hyyrö's block based formulation. Padding rows after the end of
+// the pattern never influence the rows above them, so the distance is
+// read from the last real row.
+
+#define LCS_HIGH_BIT (UINT64_C(1) << 63)
+
+static inline int lcs_levenshtein_block(uint64_t *pv, uint64_t *mv,
+                                        uint64_t eq, int hin,
+                                        uint64_t *ph_out, uint64_t *mh_out) {
+  uint64_t hin_negative = hin < 0;
+  uint64_t xv = eq | *mv;
+
+  eq |= hin_negative;
+
+  uint64_t xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+  uint64_t ph = *mv | ~(xh | *pv);
+  uint64_t mh = *pv & xh;
+
+  // deltas of the rows before the shift, used to read off the score
+  *ph_out = ph;
+  *mh_out = mh;
+
+  int hout = ((ph & LCS_HIGH_BIT) != 0) - ((mh & LCS_HIGH_BIT) != 0);
+
+  ph = (ph << 1) | (hin > 0);
+  mh = (mh << 1) | hin_negative;
+
+  *pv = mh | ~(xv | ph);
+  *mv = ph & xv;
+
+  return hout;
+}
+
+uint64_t lcs_pattern_levenshtein(const lcs_pattern_t *pattern, const char *y,
+                                 uint64_t yl, uint64_t *vectors) {
+  const uint64_t words = pattern->words;
+  const uint64_t xl = pattern->xl;
+
+  if (words == 0) {
+    return yl;
+  }
+
+  uint64_t *pv = vectors;
+  uint64_t *mv = vectors + words;
+  const uint64_t bit = (xl - 1) % 64;
+  uint64_t score = xl;
+
+  memset(pv, 0xff, sizeof(uint64_t) * words);
+  memset(mv, 0, sizeof(uint64_t) * words);
+
+  for (uint64_t row = 0; row < yl; row++) {
+    const uint64_t *mask = pattern->masks + (uint8_t)y[row] * words;
+    // the top row of the table counts up by one per column
+    int h = 1;
+    uint64_t ph;
+    uint64_t mh;
+
+    for (uint64_t w = 0; w < words; w++) {
+      h = lcs_levenshtein_block(&pv[w], &mv[w], mask[w], h, &ph, &mh);
+    }
+
+    score += ((ph >> bit) & 1);
+    score -= ((mh >> bit) & 1);
+  }
+
+  return score;
+}
+
+void lcs_pattern_distances(const lcs_pattern_t *pattern, const char *y,
+                           uint64_t yl, uint64_t *vectors,
+                           lcs_distances_t *distances) {
+  const uint64_t words = pattern->words;
+  const uint64_t xl = pattern->xl;
+
+  if (words == 0) {
+    distances->lcs = 0;
+    distances->levenshtein = yl;
+    distances->indel = yl;
+
+    return;
+  }
+
+  uint64_t *v = vectors;
+  uint64_t *pv = vectors + words;
+  uint64_t *mv = vectors + 2 * words;
+  const uint64_t bit = (xl - 1) % 64;
+  uint64_t score = xl;
+
+  memset(v, 0xff, sizeof(uint64_t) * words);
+  memset(pv, 0xff, sizeof(uint64_t) * words);
+  memset(mv, 0, sizeof(uint64_t) * words);
+
+  for (uint64_t row = 0; row < yl; row++) {
+    const uint64_t *mask = pattern->masks + (uint8_t)y[row] * words;
+    uint64_t carry = 0;
+    int h = 1;
+    uint64_t ph;
+    uint64_t mh;
+
+    for (uint64_t w = 0; w < words; w++) {
+      uint64_t eq = mask[w];
+
+      // lcs, see lcs_pattern_length
+      uint64_t x = v[w];
+      uint64_t u = x & eq;
+      uint64_t t = x + u;
+      uint64_t s = t + carry;
+
+      carry = (t < x) | (s < t);
+      v[w] = s | (x - u);
+
+      h = lcs_levenshtein_block(&pv[w], &mv[w], eq, h, &ph, &mh);
+    }
+
+    score += ((ph >> bit) & 1);
+    score -= ((mh >> bit) & 1);
+  }
+
+  uint64_t ones = 0;
+
+  for (uint64_t w = 0; w < words; w++) {
+    uint64_t x = v[w];
+
+    if (w == words - 1 && xl % 64 != 0) {
+      x &= (UINT64_C(1) << (xl % 64)) - 1;
+    }
+
+    ones += __builtin_popcountll(x);
+  }
+
+  distances->lcs = xl - ones;
+  distances->levenshtein = score;
+  distances->indel = xl + yl - 2 * distances->lcs;
+}
+
+uint64_t lcs_levenshtein(const char *x, uint64_t xl, const char *y,
+                         uint64_t yl) {
+  // the shorter sequence becomes the bit vectors
+  if (yl < xl) {
+    return lcs_levenshtein(y, yl, x, xl);
+  }
+
+  lcs_pattern_t pattern;
+
+  if (lcs_pattern_init(&pattern, x, xl) < 0) {
+    return UINT64_MAX;
+  }
+
+  uint64_t *vectors = (uint64_t *)malloc(
+      sizeof(uint64_t) * 2 * (pattern.words ? pattern.words : 1));
+  uint64_t distance = UINT64_MAX;
+
+  if (vectors != NULL) {
+    distance = lcs_pattern_levenshtein(&pattern, y, yl, vectors);
+
+    free(vectors);
+  }
+
+  lcs_pattern_free(&pattern);
+
+  return distance;
+}
+
+int lcs_distances(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  lcs_distances_t *distances) {
+  if (yl < xl) {
+    return lcs_distances(y, yl, x, xl, distances);
+  }
+
+  lcs_pattern_t pattern;
+
+  if (lcs_pattern_init(&pattern, x, xl) < 0) {
+    return -1;
+  }
+
+  uint64_t *vectors = (uint64_t *)malloc(
+      sizeof(uint64_t) * 3 * (pattern.words ? pattern.words : 1));
+
+  if (vectors == NULL) {
+    lcs_pattern_free(&pattern);
+
+    return -1;
+  }
+
+  lcs_pattern_distances(&pattern, y, yl, vectors, distances);
+
+  free(vectors);
+  lcs_pattern_free(&pattern);
+
+  return 0;
+}
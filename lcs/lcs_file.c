@@ -0,0 +1,118 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lcs.h"
+
+// the longer file is fed in chunks of this many bytes, each chunk is
+// dropped from the mapping once it has been consumed
+#define LCS_FILE_CHUNK (1 << 20)
+
+typedef struct lcs_mapping {
+  int fd;
+  const char *data;
+  uint64_t size;
+} lcs_mapping_t;
+
+static int lcs_map(lcs_mapping_t *mapping, const char *path) {
+  mapping->fd = open(path, O_RDONLY);
+  mapping->data = NULL;
+  mapping->size = 0;
+
+  if (mapping->fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+
+  if (fstat(mapping->fd, &st) < 0) {
+    close(mapping->fd);
+
+    return -1;
+  }
+
+  mapping->size = st.st_size;
+
+  // an empty file cannot be mapped, it also has nothing in common
+  if (mapping->size == 0) {
+    return 0;
+  }
+
+  void *data = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, mapping->fd,
+                    0);
+
+  if (data == MAP_FAILED) {
+    close(mapping->fd);
+
+    return -1;
+  }
+
+  madvise(data, mapping->size, MADV_SEQUENTIAL);
+
+  mapping->data = (const char *)data;
+
+  return 0;
+}
+
+static void lcs_unmap(lcs_mapping_t *mapping) {
+  if (mapping->data != NULL) {
+    munmap((void *)mapping->data, mapping->size);
+  }
+
+  close(mapping->fd);
+
+  mapping->data = NULL;
+  mapping->size = 0;
+}
+
+int64_t lcs_file_length(const char *xpath, const char *ypath) {
+  lcs_mapping_t x;
+  lcs_mapping_t y;
+
+  if (lcs_map(&x, xpath) < 0) {
+    return -1;
+  }
+
+  if (lcs_map(&y, ypath) < 0) {
+    lcs_unmap(&x);
+
+    return -1;
+  }
+
+  // the shorter input becomes the bit vector, the longer one the rows
+  lcs_mapping_t *columns = x.size <= y.size ? &x : &y;
+  lcs_mapping_t *rows = x.size <= y.size ? &y : &x;
+
+  lcs_stream_t stream;
+
+  if (lcs_stream_init(&stream, columns->data, columns->size) < 0) {
+    lcs_unmap(&x);
+    lcs_unmap(&y);
+
+    return -1;
+  }
+
+  if (columns->size > 0) {
+    for (uint64_t offset = 0; offset < rows->size; offset += LCS_FILE_CHUNK) {
+      uint64_t length = rows->size - offset < LCS_FILE_CHUNK
+                            ? rows->size - offset
+                            : LCS_FILE_CHUNK;
+
+      lcs_stream_feed(&stream, rows->data + offset, length);
+
+      // the chunk size is a multiple of the page size so this keeps the
+      // resident part of the longer file down to a single chunk
+      madvise((void *)(rows->data + offset), length, MADV_DONTNEED);
+    }
+  }
+
+  int64_t length = lcs_stream_length(&stream);
+
+  lcs_stream_free(&stream);
+  lcs_unmap(&x);
+  lcs_unmap(&y);
+
+  return length;
+}
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcs.h"
+
+// A suffix automaton recognises every substring of x with at most 2|x|
+// states and 3|x| transitions. Each state stands for a set of substrings
+// that end at the same positions, `len` is the longest of them and `link`
+// points to the state of the longest suffix that ends elsewhere too.
+//
+// Transitions live in an open addressing table keyed by (state, symbol),
+// apart from those of the root which is visited after every mismatch and
+// gets a direct table. Cloning a state has to copy all of its
+// transitions, so each state also keeps a list of the symbols it has a
+// transition on.
+
+#define SAM_NONE UINT32_MAX
+
+// key and target share a slot so a lookup costs a single cache miss
+typedef struct sam_slot {
+  // state + 1, 0 marks an empty slot
+  uint32_t state;
+  uint32_t target;
+  uint8_t symbol;
+} sam_slot_t;
+
+typedef struct sam_state {
+  uint32_t len;
+  uint32_t link;
+  // end position in x of the first occurrence
+  uint32_t firstpos;
+  // head of the symbol list
+  uint32_t edges;
+} sam_state_t;
+
+typedef struct sam {
+  sam_state_t *states;
+  uint32_t count;
+  uint32_t root[256];
+
+  // symbol lists
+  uint32_t *edge_next;
+  uint8_t *edge_symbol;
+  uint32_t edge_count;
+
+  // transition table
+  sam_slot_t *slots;
+  uint64_t mask;
+} sam_t;
+
+static inline sam_slot_t *sam_find(const sam_t *sam, uint32_t state,
+                                   uint8_t c) {
+  uint64_t key = (uint64_t)state << 8 | c;
+  uint64_t slot = (key * UINT64_C(0x9e3779b97f4a7c15)) >> 24;
+
+  for (;; slot++) {
+    sam_slot_t *entry = &sam->slots[slot & sam->mask];
+
+    if (entry->state == 0 ||
+        (entry->state == state + 1 && entry->symbol == c)) {
+      return entry;
+    }
+  }
+}
+
+static inline uint32_t sam_next(const sam_t *sam, uint32_t state, uint8_t c) {
+  if (state == 0) {
+    return sam->root[c];
+  }
+
+  sam_slot_t *entry = sam_find(sam, state, c);
+
+  return entry->state == 0 ? SAM_NONE : entry->target;
+}
+
+static inline void sam_add_edge(sam_t *sam, uint32_t state, uint8_t c) {
+  sam->edge_next[sam->edge_count] = sam->states[state].edges;
+  sam->edge_symbol[sam->edge_count] = c;
+  sam->states[state].edges = sam->edge_count++;
+}
+
+static inline void sam_set(sam_t *sam, uint32_t state, uint8_t c,
+                           uint32_t target) {
+  if (state == 0) {
+    if (sam->root[c] == SAM_NONE) {
+      sam_add_edge(sam, state, c);
+    }
+
+    sam->root[c] = target;
+
+    return;
+  }
+
+  sam_slot_t *entry = sam_find(sam, state, c);
+
+  if (entry->state == 0) {
+    entry->state = state + 1;
+    entry->symbol = c;
+    sam_add_edge(sam, state, c);
+  }
+
+  entry->target = target;
+}
+
+static void sam_free(sam_t *sam) {
+  free(sam->states);
+  free(sam->edge_next);
+  free(sam->edge_symbol);
+  free(sam->slots);
+}
+
+static int sam_build(sam_t *sam, const char *x, uint64_t xl) {
+  uint64_t max_states = 2 * xl + 2;
+  uint64_t max_edges = 3 * xl + 4;
+  uint64_t slots = 1;
+
+  // at most 3/4 full even in the worst case
+  while (3 * slots < 4 * max_edges) {
+    slots <<= 1;
+  }
+
+  memset(sam, 0, sizeof(sam_t));
+
+  if (max_states >= SAM_NONE) {
+    return -1;
+  }
+
+  sam->states = (sam_state_t *)malloc(sizeof(sam_state_t) * max_states);
+  sam->edge_next = (uint32_t *)malloc(sizeof(uint32_t) * max_edges);
+  sam->edge_symbol = (uint8_t *)malloc(sizeof(uint8_t) * max_edges);
+  sam->slots = (sam_slot_t *)calloc(slots, sizeof(sam_slot_t));
+  sam->mask = slots - 1;
+
+  if (!sam->states || !sam->edge_next || !sam->edge_symbol || !sam->slots) {
+    sam_free(sam);
+
+    return -1;
+  }
+
+  memset(sam->root, 0xff, sizeof(sam->root));
+
+  sam->states[0] = (sam_state_t){
+      .len = 0, .link = SAM_NONE, .firstpos = 0, .edges = SAM_NONE};
+  sam->count = 1;
+
+  uint32_t last = 0;
+
+  for (uint64_t i = 0; i < xl; i++) {
+    uint8_t c = (uint8_t)x[i];
+    uint32_t current = sam->count++;
+
+    sam->states[current] = (sam_state_t){.len = sam->states[last].len + 1,
+                                         .link = 0,
+                                         .firstpos = i,
+                                         .edges = SAM_NONE};
+
+    uint32_t p = last;
+
+    while (p != SAM_NONE && sam_next(sam, p, c) == SAM_NONE) {
+      sam_set(sam, p, c, current);
+      p = sam->states[p].link;
+    }
+
+    if (p != SAM_NONE) {
+      uint32_t q = sam_next(sam, p, c);
+
+      if (sam->states[p].len + 1 == sam->states[q].len) {
+        sam->states[current].link = q;
+      } else {
+        uint32_t clone = sam->count++;
+
+        sam->states[clone] = (sam_state_t){.len = sam->states[p].len + 1,
+                                           .link = sam->states[q].link,
+                                           .firstpos = sam->states[q].firstpos,
+                                           .edges = SAM_NONE};
+
+        for (uint32_t e = sam->states[q].edges; e != SAM_NONE;
+             e = sam->edge_next[e]) {
+          uint8_t symbol = sam->edge_symbol[e];
+
+          sam_set(sam, clone, symbol, sam_next(sam, q, symbol));
+        }
+
+        while (p != SAM_NONE && sam_next(sam, p, c) == q) {
+          sam_set(sam, p, c, clone);
+          p = sam->states[p].link;
+        }
+
+        sam->states[q].link = clone;
+        sam->states[current].link = clone;
+      }
+    }
+
+    last = current;
+  }
+
+  return 0;
+}
+
+// Walks y through the automaton. `match` (may be NULL) receives for
+// each state the longest match seen that ends in it, the overall best
+// is returned through state/length.
+static void sam_stream(const sam_t *sam, const char *y, uint64_t yl,
+                       uint32_t *match, uint32_t *best_state,
+                       uint32_t *best_length) {
+  uint32_t state = 0;
+  uint32_t length = 0;
+
+  *best_state = 0;
+  *best_length = 0;
+
+  for (uint64_t i = 0; i < yl; i++) {
+    uint8_t c = (uint8_t)y[i];
+    uint32_t next;
+
+    while ((next = sam_next(sam, state, c)) == SAM_NONE && state != 0) {
+      state = sam->states[state].link;
+      length = sam->states[state].len;
+    }
+
+    if (next == SAM_NONE) {
+      state = 0;
+      length = 0;
+
+      continue;
+    }
+
+    state = next;
+    length++;
+
+    if (match != NULL && match[state] < length) {
+      match[state] = length;
+    }
+
+    if (length > *best_length) {
+      *best_state = state;
+      *best_length = length;
+    }
+  }
+}
+
+int lcs_substring(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  uint64_t *offset, uint64_t *length) {
+  sam_t sam;
+
+  if (sam_build(&sam, x, xl) < 0) {
+    return -1;
+  }
+
+  uint32_t state;
+  uint32_t best;
+
+  sam_stream(&sam, y, yl, NULL, &state, &best);
+
+  *offset = best == 0 ? 0 : sam.states[state].firstpos + 1 - best;
+  *length = best;
+
+  sam_free(&sam);
+
+  return 0;
+}
+
+int lcs_substring_k(const char **strings, const uint64_t *lengths, uint64_t k,
+                    uint64_t *index, uint64_t *offset, uint64_t *length) {
+  *index = 0;
+  *offset = 0;
+  *length = 0;
+
+  if (k == 0) {
+    return 0;
+  }
+
+  uint64_t shortest = 0;
+
+  for (uint64_t s = 1; s < k; s++) {
+    if (lengths[s] < lengths[shortest]) {
+      shortest = s;
+    }
+  }
+
+  sam_t sam;
+
+  if (sam_build(&sam, strings[shortest], lengths[shortest]) < 0) {
+    return -1;
+  }
+
+  uint32_t states = sam.count;
+  uint32_t *best = (uint32_t *)malloc(sizeof(uint32_t) * states);
+  uint32_t *match = (uint32_t *)malloc(sizeof(uint32_t) * states);
+  uint32_t *order = (uint32_t *)malloc(sizeof(uint32_t) * states);
+  uint32_t *count =
+      (uint32_t *)calloc(lengths[shortest] + 2, sizeof(uint32_t));
+
+  if (!best || !match || !order || !count) {
+    free(best);
+    free(match);
+    free(order);
+    free(count);
+    sam_free(&sam);
+
+    return -1;
+  }
+
+  // order the states by decreasing len so that propagating along the
+  // suffix links visits every state before its link
+  for (uint32_t v = 0; v < states; v++) {
+    count[sam.states[v].len]++;
+  }
+
+  for (uint64_t l = lengths[shortest]; l > 0; l--) {
+    count[l - 1] += count[l];
+  }
+
+  for (uint32_t v = 0; v < states; v++) {
+    order[--count[sam.states[v].len]] = v;
+  }
+
+  for (uint32_t v = 0; v < states; v++) {
+    best[v] = sam.states[v].len;
+  }
+
+  for (uint64_t s = 0; s < k; s++) {
+    if (s == shortest) {
+      continue;
+    }
+
+    uint32_t state;
+    uint32_t longest;
+
+    memset(match, 0, sizeof(uint32_t) * states);
+
+    sam_stream(&sam, strings[s], lengths[s], match, &state, &longest);
+
+    // every suffix of a match is a match too
+    for (uint32_t i = 0; i < states; i++) {
+      uint32_t v = order[i];
+      uint32_t link = sam.states[v].link;
+
+      if (match[v] > 0 && link != SAM_NONE) {
+        match[link] = sam.states[link].len;
+      }
+
+      if (match[v] < best[v]) {
+        best[v] = match[v];
+      }
+    }
+  }
+
+  uint32_t best_state = 0;
+
+  for (uint32_t v = 1; v < states; v++) {
+    if (best[v] > best[best_state]) {
+      best_state = v;
+    }
+  }
+
+  *index = shortest;
+  *length = best[best_state];
+  *offset =
+      *length == 0 ? 0 : sam.states[best_state].firstpos + 1 - *length;
+
+  free(best);
+  free(match);
+  free(order);
+  free(count);
+  sam_free(&sam);
+
+  return 0;
+}
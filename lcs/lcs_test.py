@@ -0,0 +1,43 @@
+# python -m unittest lcs_test, from this directory. The cases that need
+# the _lcs extension are skipped when it is not built.
+
+import unittest
+
+import lcs
+
+
+class LcsTest(unittest.TestCase):
+    def check(self):
+        self.assertEqual(lcs.lcs("ABCBDAB", "BDCABA"), "BDAB")
+        self.assertEqual(lcs.lcs(b"ABCBDAB", b"BDCABA"), b"BDAB")
+        self.assertEqual(lcs.lcs_length("ABCBDAB", "BDCABA"), 4)
+        self.assertEqual(lcs.lcs_length(b"ABCBDAB", b"BDCABA"), 4)
+        self.assertEqual(lcs.lcs_length(bytearray(b"ABCBDAB"), b"BDCABA"), 4)
+        # outside latin-1, so not for the extension
+        self.assertEqual(lcs.lcs("αβγ", "βγ"), "βγ")
+        self.assertEqual(lcs.lcs_length("αβγ", "βγ"), 2)
+        self.assertEqual(lcs.lcs_length("", "ABC"), 0)
+
+        with self.assertRaises(TypeError):
+            lcs.lcs("ABC", b"ABC")
+
+        with self.assertRaises(TypeError):
+            lcs.lcs_length("ABC", b"ABC")
+
+    def test_without_extension(self):
+        native = lcs._lcs
+
+        lcs._lcs = None
+
+        try:
+            self.check()
+        finally:
+            lcs._lcs = native
+
+    @unittest.skipIf(lcs._lcs is None, "the _lcs extension is not built")
+    def test_with_extension(self):
+        self.check()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcs.h"
+
+typedef struct lcs_token {
+  const char *start;
+  uint64_t length;
+} lcs_token_t;
+
+typedef struct lcs_tokens {
+  lcs_token_t *array;
+  uint64_t size;
+  uint64_t capacity;
+} lcs_tokens_t;
+
+static int lcs_tokens_push(lcs_tokens_t *tokens, const char *start,
+                           uint64_t length) {
+  if (tokens->size == tokens->capacity) {
+    uint64_t capacity = tokens->capacity == 0 ? 1024 : tokens->capacity * 2;
+    lcs_token_t *array = (lcs_token_t *)realloc(
+        tokens->array, sizeof(lcs_token_t) * capacity);
+
+    if (array == NULL) {
+      return -1;
+    }
+
+    tokens->array = array;
+    tokens->capacity = capacity;
+  }
+
+  tokens->array[tokens->size++] =
+      (lcs_token_t){.start = start, .length = length};
+
+  return 0;
+}
+
+static inline bool lcs_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+static int lcs_tokenize(const char *text, uint64_t length, lcs_split_t split,
+                        lcs_tokens_t *tokens) {
+  const char *end = text + length;
+
+  tokens->array = NULL;
+  tokens->size = 0;
+  tokens->capacity = 0;
+
+  if (split == LCS_SPLIT_LINES) {
+    while (text < end) {
+      const char *newline = (const char *)memchr(text, '\n', end - text);
+      const char *stop = newline ? newline : end;
+
+      if (lcs_tokens_push(tokens, text, stop - text) < 0) {
+        return -1;
+      }
+
+      text = newline ? newline + 1 : end;
+    }
+
+    return 0;
+  }
+
+  while (text < end) {
+    while (text < end && lcs_is_space(*text)) {
+      text++;
+    }
+
+    const char *start = text;
+
+    while (text < end && !lcs_is_space(*text)) {
+      text++;
+    }
+
+    if (text > start && lcs_tokens_push(tokens, start, text - start) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static inline bool lcs_token_equal(const lcs_token_t *a, const lcs_token_t *b) {
+  return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+/* ---------------------------------------------- */
+
+// Interning maps every distinct token to a small integer so that the
+// diff compares one word instead of a whole line.
+
+typedef struct lcs_intern_entry {
+  uint64_t hash;
+  const lcs_token_t *token;
+  uint32_t id;
+} lcs_intern_entry_t;
+
+typedef struct lcs_intern {
+  lcs_intern_entry_t *entries;
+  uint64_t mask;
+  uint32_t next_id;
+} lcs_intern_t;
+
+static inline uint64_t lcs_hash(const char *s, uint64_t n) {
+  uint64_t h = UINT64_C(0x9e3779b97f4a7c15) ^ n;
+  uint64_t w;
+
+  for (; n >= 8; s += 8, n -= 8) {
+    memcpy(&w, s, 8);
+    h = (h ^ w) * UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 32;
+  }
+
+  w = 0;
+  memcpy(&w, s, n);
+  h = (h ^ w) * UINT64_C(0xc4ceb9fe1a85ec53);
+
+  return h ^ (h >> 29);
+}
+
+static int lcs_intern_init(lcs_intern_t *intern, uint64_t tokens) {
+  uint64_t slots = 16;
+
+  // at most half full
+  while (slots < 2 * tokens) {
+    slots <<= 1;
+  }
+
+  intern->entries =
+      (lcs_intern_entry_t *)calloc(slots, sizeof(lcs_intern_entry_t));
+  intern->mask = slots - 1;
+  intern->next_id = 0;
+
+  return intern->entries == NULL ? -1 : 0;
+}
+
+static uint32_t lcs_intern(lcs_intern_t *intern, const lcs_token_t *token) {
+  uint64_t hash = lcs_hash(token->start, token->length);
+
+  for (uint64_t slot = hash;; slot++) {
+    lcs_intern_entry_t *entry = &intern->entries[slot & intern->mask];
+
+    if (entry->token == NULL) {
+      entry->hash = hash;
+      entry->token = token;
+      entry->id = intern->next_id++;
+
+      return entry->id;
+    }
+
+    if (entry->hash == hash && lcs_token_equal(entry->token, token)) {
+      return entry->id;
+    }
+  }
+}
+
+/* ---------------------------------------------- */
+
+static inline uint64_t lcs_min(uint64_t x, uint64_t y) {
+  return x < y ? x : y;
+}
+
+static void lcs_write_range(FILE *out, char sign, uint64_t start,
+                            uint64_t length) {
+  // an empty range names the line before it
+  if (length == 0) {
+    fprintf(out, "%c%llu,0", sign, (unsigned long long)start);
+  } else if (length == 1) {
+    fprintf(out, "%c%llu", sign, (unsigned long long)start + 1);
+  } else {
+    fprintf(out, "%c%llu,%llu", sign, (unsigned long long)start + 1,
+            (unsigned long long)length);
+  }
+}
+
+static void lcs_write_lines(FILE *out, char sign, const lcs_tokens_t *tokens,
+                            uint64_t start, uint64_t length) {
+  for (uint64_t i = start; i < start + length; i++) {
+    fputc(sign, out);
+    fwrite(tokens->array[i].start, 1, tokens->array[i].length, out);
+    fputc('\n', out);
+  }
+}
+
+// Groups the changes of a script into hunks, changes that are at most
+// 2 * context lines apart share a hunk.
+static void lcs_write_unified(FILE *out, const lcs_tokens_t *x,
+                              const lcs_tokens_t *y, const lcs_edit_t *edits,
+                              uint64_t size, uint32_t context) {
+  uint64_t i = 0;
+
+  while (i < size) {
+    if (edits[i].op == LCS_KEEP) {
+      i++;
+
+      continue;
+    }
+
+    uint64_t end = i;
+    uint64_t j = i;
+
+    while (j < size) {
+      if (edits[j].op != LCS_KEEP) {
+        end = ++j;
+      } else if (j + 1 < size && edits[j].length <= 2 * (uint64_t)context) {
+        j++;
+      } else {
+        break;
+      }
+    }
+
+    // a change is always surrounded by keeps, if anything
+    uint64_t lead = i > 0 ? lcs_min(edits[i - 1].length, context) : 0;
+    uint64_t trail = end < size ? lcs_min(edits[end].length, context) : 0;
+    uint64_t x0 = edits[i].x - lead;
+    uint64_t y0 = edits[i].y - lead;
+    uint64_t x1 = (end < size ? edits[end].x : x->size) + trail;
+    uint64_t y1 = (end < size ? edits[end].y : y->size) + trail;
+
+    fputs("@@ ", out);
+    lcs_write_range(out, '-', x0, x1 - x0);
+    fputc(' ', out);
+    lcs_write_range(out, '+', y0, y1 - y0);
+    fputs(" @@\n", out);
+
+    lcs_write_lines(out, ' ', x, x0, lead);
+
+    for (uint64_t k = i; k < end; k++) {
+      const lcs_edit_t *edit = &edits[k];
+
+      if (edit->op == LCS_KEEP) {
+        lcs_write_lines(out, ' ', x, edit->x, edit->length);
+      } else if (edit->op == LCS_DELETE) {
+        lcs_write_lines(out, '-', x, edit->x, edit->length);
+      } else {
+        lcs_write_lines(out, '+', y, edit->y, edit->length);
+      }
+    }
+
+    if (end < size) {
+      lcs_write_lines(out, ' ', x, edits[end].x, trail);
+    }
+
+    i = end;
+  }
+}
+
+int lcs_diff_text(const char *x, uint64_t xl, const char *y, uint64_t yl,
+                  lcs_split_t split, uint32_t context, const char *xname,
+                  const char *yname, FILE *out) {
+  lcs_tokens_t xt = {.array = NULL};
+  lcs_tokens_t yt = {.array = NULL};
+  lcs_intern_t intern = {.entries = NULL};
+  uint32_t *ids = NULL;
+  lcs_script_t script = {.array = NULL};
+  lcs_edit_t *edits = NULL;
+  int result = -1;
+
+  if (lcs_tokenize(x, xl, split, &xt) < 0 ||
+      lcs_tokenize(y, yl, split, &yt) < 0) {
+    goto cleanup;
+  }
+
+  // the common prefix and suffix are kept without being interned
+  uint64_t prefix = 0;
+  uint64_t suffix = 0;
+
+  while (prefix < xt.size && prefix < yt.size &&
+         lcs_token_equal(&xt.array[prefix], &yt.array[prefix])) {
+    prefix++;
+  }
+
+  while (suffix < xt.size - prefix && suffix < yt.size - prefix &&
+         lcs_token_equal(&xt.array[xt.size - suffix - 1],
+                         &yt.array[yt.size - suffix - 1])) {
+    suffix++;
+  }
+
+  uint64_t xn = xt.size - prefix - suffix;
+  uint64_t yn = yt.size - prefix - suffix;
+
+  if (xn == 0 && yn == 0) {
+    result = 0;
+
+    goto cleanup;
+  }
+
+  ids = (uint32_t *)malloc(sizeof(uint32_t) * (xn + yn + 1));
+
+  if (ids == NULL || lcs_intern_init(&intern, xn + yn) < 0) {
+    goto cleanup;
+  }
+
+  for (uint64_t i = 0; i < xn; i++) {
+    ids[i] = lcs_intern(&intern, &xt.array[prefix + i]);
+  }
+
+  for (uint64_t i = 0; i < yn; i++) {
+    ids[xn + i] = lcs_intern(&intern, &yt.array[prefix + i]);
+  }
+
+  if (lcs_diff_ids(ids, xn, ids + xn, yn, LCS_UNBOUNDED, &script) < 0) {
+    goto cleanup;
+  }
+
+  // put the prefix and suffix back around the script
+  edits = (lcs_edit_t *)malloc(sizeof(lcs_edit_t) * (script.size + 2));
+
+  if (edits == NULL) {
+    goto cleanup;
+  }
+
+  uint64_t size = 0;
+
+  if (prefix > 0) {
+    edits[size++] =
+        (lcs_edit_t){.op = LCS_KEEP, .x = 0, .y = 0, .length = prefix};
+  }
+
+  for (uint64_t i = 0; i < script.size; i++) {
+    lcs_edit_t edit = script.array[i];
+
+    edit.x += prefix;
+    edit.y += prefix;
+
+    if (size > 0 && edit.op == LCS_KEEP && edits[size - 1].op == LCS_KEEP) {
+      edits[size - 1].length += edit.length;
+    } else {
+      edits[size++] = edit;
+    }
+  }
+
+  if (suffix > 0) {
+    if (size > 0 && edits[size - 1].op == LCS_KEEP) {
+      edits[size - 1].length += suffix;
+    } else {
+      edits[size++] = (lcs_edit_t){.op = LCS_KEEP,
+                                   .x = xt.size - suffix,
+                                   .y = yt.size - suffix,
+                                   .length = suffix};
+    }
+  }
+
+  fprintf(out, "--- %s\n+++ %s\n", xname, yname);
+  lcs_write_unified(out, &xt, &yt, edits, size, context);
+
+  result = 0;
+
+cleanup:
+  free(edits);
+  lcs_script_free(&script);
+  free(intern.entries);
+  free(ids);
+  free(xt.array);
+  free(yt.array);
+
+  return result;
+}
@@ -0,0 +1,238 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "lcs.h"
+
+// Inputs are taken through the buffer protocol so bytes, bytearray,
+// memoryview and numpy arrays are read in place. The views are held for
+// the whole call, which keeps them alive and unresizable while the GIL
+// is released.
+
+static int lcs_get_buffer(PyObject *object, Py_buffer *view) {
+  if (PyObject_GetBuffer(object, view, PyBUF_C_CONTIGUOUS) < 0) {
+    return -1;
+  }
+
+  if (view->itemsize != 1) {
+    PyErr_Format(PyExc_TypeError, "expected a buffer of single bytes, got "
+                                  "items of size %zd",
+                 view->itemsize);
+    PyBuffer_Release(view);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+static int lcs_get_buffers(PyObject *x, PyObject *y, Py_buffer *xview,
+                           Py_buffer *yview) {
+  if (lcs_get_buffer(x, xview) < 0) {
+    return -1;
+  }
+
+  if (lcs_get_buffer(y, yview) < 0) {
+    PyBuffer_Release(xview);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+static PyObject *py_lcs(PyObject *self, PyObject *args) {
+  PyObject *x;
+  PyObject *y;
+  Py_buffer xview;
+  Py_buffer yview;
+
+  if (!PyArg_ParseTuple(args, "OO:lcs", &x, &y)) {
+    return NULL;
+  }
+
+  if (lcs_get_buffers(x, y, &xview, &yview) < 0) {
+    return NULL;
+  }
+
+  lcs_script_t script;
+  int result;
+
+  Py_BEGIN_ALLOW_THREADS
+  result = lcs_diff(xview.buf, xview.len, yview.buf, yview.len, LCS_UNBOUNDED,
+                    &script);
+  Py_END_ALLOW_THREADS
+
+  PyObject *common = NULL;
+
+  if (result < 0) {
+    PyErr_NoMemory();
+  } else {
+    uint64_t length = 0;
+
+    for (uint64_t i = 0; i < script.size; i++) {
+      if (script.array[i].op == LCS_KEEP) {
+        length += script.array[i].length;
+      }
+    }
+
+    common = PyBytes_FromStringAndSize(NULL, length);
+
+    if (common != NULL) {
+      char *out = PyBytes_AS_STRING(common);
+
+      for (uint64_t i = 0; i < script.size; i++) {
+        lcs_edit_t *edit = &script.array[i];
+
+        if (edit->op == LCS_KEEP) {
+          memcpy(out, (const char *)xview.buf + edit->x, edit->length);
+          out += edit->length;
+        }
+      }
+    }
+
+    lcs_script_free(&script);
+  }
+
+  PyBuffer_Release(&xview);
+  PyBuffer_Release(&yview);
+
+  return common;
+}
+
+static PyObject *py_lcs_length(PyObject *self, PyObject *args) {
+  PyObject *x;
+  PyObject *y;
+  Py_buffer xview;
+  Py_buffer yview;
+
+  if (!PyArg_ParseTuple(args, "OO:lcs_length", &x, &y)) {
+    return NULL;
+  }
+
+  if (lcs_get_buffers(x, y, &xview, &yview) < 0) {
+    return NULL;
+  }
+
+  uint64_t length;
+
+  Py_BEGIN_ALLOW_THREADS
+  length = lcs_length(xview.buf, xview.len, yview.buf, yview.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&xview);
+  PyBuffer_Release(&yview);
+
+  return PyLong_FromUnsignedLongLong(length);
+}
+
+static PyObject *py_diff(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *keywords[] = {"x", "y", "max_cost", NULL};
+  PyObject *x;
+  PyObject *y;
+  long long max_cost = -1;
+  Py_buffer xview;
+  Py_buffer yview;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|L:diff", keywords, &x,
+                                   &y, &max_cost)) {
+    return NULL;
+  }
+
+  if (lcs_get_buffers(x, y, &xview, &yview) < 0) {
+    return NULL;
+  }
+
+  lcs_script_t script;
+  int result;
+
+  Py_BEGIN_ALLOW_THREADS
+  result = lcs_diff(xview.buf, xview.len, yview.buf, yview.len,
+                    max_cost < 0 ? LCS_UNBOUNDED : (uint64_t)max_cost, &script);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&xview);
+  PyBuffer_Release(&yview);
+
+  if (result < 0) {
+    return PyErr_NoMemory();
+  }
+
+  static const char *names[] = {"keep", "delete", "insert"};
+  PyObject *edits = PyList_New(script.size);
+
+  for (uint64_t i = 0; edits != NULL && i < script.size; i++) {
+    lcs_edit_t *edit = &script.array[i];
+    PyObject *item = Py_BuildValue("(sKKK)", names[edit->op], edit->x,
+                                   edit->y, edit->length);
+
+    if (item == NULL) {
+      Py_CLEAR(edits);
+    } else {
+      PyList_SET_ITEM(edits, i, item);
+    }
+  }
+
+  bool exact = script.exact;
+
+  lcs_script_free(&script);
+
+  if (edits == NULL) {
+    return NULL;
+  }
+
+  return Py_BuildValue("(NO)", edits, exact ? Py_True : Py_False);
+}
+
+static PyObject *py_substring(PyObject *self, PyObject *args) {
+  PyObject *x;
+  PyObject *y;
+  Py_buffer xview;
+  Py_buffer yview;
+
+  if (!PyArg_ParseTuple(args, "OO:substring", &x, &y)) {
+    return NULL;
+  }
+
+  if (lcs_get_buffers(x, y, &xview, &yview) < 0) {
+    return NULL;
+  }
+
+  uint64_t offset;
+  uint64_t length;
+  int result;
+
+  Py_BEGIN_ALLOW_THREADS
+  result = lcs_substring(xview.buf, xview.len, yview.buf, yview.len, &offset,
+                         &length);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&xview);
+  PyBuffer_Release(&yview);
+
+  if (result < 0) {
+    return PyErr_NoMemory();
+  }
+
+  return Py_BuildValue("(KK)", offset, length);
+}
+
+static PyMethodDef lcs_methods[] = {
+    {"lcs", py_lcs, METH_VARARGS,
+     "lcs(x, y) -> bytes\n\nLongest common subsequence of two buffers."},
+    {"lcs_length", py_lcs_length, METH_VARARGS,
+     "lcs_length(x, y) -> int\n\nLength of the longest common subsequence."},
+    {"diff", (PyCFunction)(void (*)(void))py_diff,
+     METH_VARARGS | METH_KEYWORDS,
+     "diff(x, y, max_cost=-1) -> (edits, exact)\n\n"
+     "Myers edit script as (op, x, y, length) runs, op is one of 'keep',\n"
+     "'delete' or 'insert'. exact is False when max_cost was exceeded."},
+    {"substring", py_substring, METH_VARARGS,
+     "substring(x, y) -> (offset, length)\n\n"
+     "Longest common substring, found at x[offset:offset + length]."},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef lcs_module = {
+    PyModuleDef_HEAD_INIT, "_lcs",
+    "Native longest common subsequence engine.", -1, lcs_methods};
+
+PyMODINIT_FUNC PyInit__lcs(void) { return PyModule_Create(&lcs_module); }
@@ -0,0 +1,13 @@
+from setuptools import Extension, setup
+
+setup(
+    name="lcs",
+    py_modules=["lcs"],
+    ext_modules=[
+        Extension(
+            "_lcs",
+            sources=["lcsmodule.c", "lcs.c", "lcs_substring.c"],
+            extra_compile_args=["-O2"],
+        )
+    ],
+)
@@ -0,0 +1,528 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/frozen_set.h"
+#include "../common/node_pool.h"
+#include "../common/perf_counters.h"
+#include "../common/trace_log.h"
+#include "../common/tree_image.h"
+#include "../common/workload_trace.h"
+
+/*
+
+The red-black tree of rb_tree.c with its nodes in a node_pool_t: the
+links are 32-bit indices into one array rather than pointers and the
+color is the top bit of the parent index, which takes a node from 32
+bytes plus the malloc header down to 16 bytes.
+
+Index 0 is a black sentinel that stands for every NIL leaf. As in the
+textbook version of the algorithm the removal may set the sentinel's
+parent while it rebalances, which saves the NULL checks on that path.
+
+The whole tree is the pool plus the root index, so freeing it is a single
+munmap and the array can be grown with mremap or written out as it is.
+Pointers to nodes are only held between allocations.
+
+*/
+
+typedef enum rb_color { BLACK, RED } rb_color_t;
+
+#define LEFT 0
+#define RIGHT 1
+
+typedef struct rb_pool_node {
+  int value;
+  // parent index in the low 31 bits, the color in the top one
+  uint32_t parent_color;
+  uint32_t child[2];
+} rb_pool_node_t;
+
+typedef struct rb_pool_tree {
+  node_pool_t pool;
+  uint32_t root;
+  uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
+} rb_pool_tree_t;
+
+#define NIL NODE_POOL_NIL
+#define RB_NODE(TREE, INDEX) ((rb_pool_node_t *)(TREE)->pool.base + (INDEX))
+#define RB_COLOR_BIT ((uint32_t)1 << 31)
+
+static inline uint32_t rb_pool_parent(rb_pool_tree_t *tree, uint32_t index) {
+  return RB_NODE(tree, index)->parent_color & ~RB_COLOR_BIT;
+}
+
+static inline void rb_pool_set_parent(rb_pool_tree_t *tree, uint32_t index,
+                                      uint32_t parent) {
+  rb_pool_node_t *node = RB_NODE(tree, index);
+
+  node->parent_color = (node->parent_color & RB_COLOR_BIT) | parent;
+}
+
+static inline bool rb_pool_is_red(rb_pool_tree_t *tree, uint32_t index) {
+  return (RB_NODE(tree, index)->parent_color & RB_COLOR_BIT) != 0;
+}
+
+static inline void rb_pool_set_color(rb_pool_tree_t *tree, uint32_t index,
+                                     rb_color_t color) {
+  rb_pool_node_t *node = RB_NODE(tree, index);
+
+  node->parent_color =
+      (node->parent_color & ~RB_COLOR_BIT) | (color == RED ? RB_COLOR_BIT : 0);
+}
+
+static inline int rb_pool_dir(rb_pool_tree_t *tree, uint32_t parent,
+                              uint32_t child) {
+  return RB_NODE(tree, parent)->child[LEFT] == child ? LEFT : RIGHT;
+}
+
+rb_pool_tree_t rb_pool_create(int value) {
+  rb_pool_tree_t tree = {.root = NIL, .size = 0};
+
+  if (node_pool_init(&tree.pool, sizeof(rb_pool_node_t), 0) < 0) {
+    return tree;
+  }
+
+  tree.root = node_pool_alloc(&tree.pool);
+  tree.size = 1;
+  RB_NODE(&tree, tree.root)->value = value;
+
+  return tree;
+}
+
+void rb_pool_free(rb_pool_tree_t *tree) {
+  node_pool_destroy(&tree->pool);
+
+  tree->root = NIL;
+  tree->size = 0;
+}
+
+// same direction convention as rb_rotate: the child on the other side
+// takes the place of node, which goes down on the `direction` side
+static void rb_pool_rotate(rb_pool_tree_t *tree, uint32_t node,
+                           int direction) {
+  rb_pool_node_t *x = RB_NODE(tree, node);
+  uint32_t child = x->child[1 - direction];
+  rb_pool_node_t *y = RB_NODE(tree, child);
+  uint32_t parent = rb_pool_parent(tree, node);
+
+  x->child[1 - direction] = y->child[direction];
+
+  if (y->child[direction] != NIL) {
+    rb_pool_set_parent(tree, y->child[direction], node);
+  }
+
+  rb_pool_set_parent(tree, child, parent);
+
+  if (parent == NIL) {
+    tree->root = child;
+  } else {
+    RB_NODE(tree, parent)->child[rb_pool_dir(tree, parent, node)] = child;
+  }
+
+  y->child[direction] = node;
+  rb_pool_set_parent(tree, node, child);
+}
+
+PERF_DEFINE_REGION(rb_pool_perf_descent, "descent");
+PERF_DEFINE_REGION(rb_pool_perf_insert_fixup, "rb_insert_fixup");
+PERF_DEFINE_REGION(rb_pool_perf_delete_fixup, "rb_delete_fixup");
+
+static void rb_pool_insert_fixup(rb_pool_tree_t *tree, uint32_t node) {
+  PERF_BEGIN(rb_pool_perf_insert_fixup);
+
+  while (rb_pool_is_red(tree, rb_pool_parent(tree, node))) {
+    uint32_t parent = rb_pool_parent(tree, node);
+    uint32_t grandparent = rb_pool_parent(tree, parent);
+    int dir = rb_pool_dir(tree, grandparent, parent);
+    uint32_t uncle = RB_NODE(tree, grandparent)->child[1 - dir];
+
+    if (rb_pool_is_red(tree, uncle)) {
+      rb_pool_set_color(tree, parent, BLACK);
+      rb_pool_set_color(tree, uncle, BLACK);
+      rb_pool_set_color(tree, grandparent, RED);
+      node = grandparent;
+
+      TRACE_LOG(TRACE_VERBOSE, TRACE_REBALANCE, "recoloured up to %d",
+                RB_NODE(tree, node)->value);
+      continue;
+    }
+
+    if (RB_NODE(tree, parent)->child[1 - dir] == node) {
+      node = parent;
+      rb_pool_rotate(tree, node, dir);
+      parent = rb_pool_parent(tree, node);
+    }
+
+    rb_pool_set_color(tree, parent, BLACK);
+    rb_pool_set_color(tree, grandparent, RED);
+    rb_pool_rotate(tree, grandparent, 1 - dir);
+
+    TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "rotated, %d is black",
+              RB_NODE(tree, parent)->value);
+  }
+
+  rb_pool_set_color(tree, tree->root, BLACK);
+
+  PERF_END(rb_pool_perf_insert_fixup);
+}
+
+int rb_pool_insert(rb_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
+  if (tree->pool.base == NULL &&
+      node_pool_init(&tree->pool, sizeof(rb_pool_node_t), 0) < 0) {
+    return -1;
+  }
+
+  uint32_t index = node_pool_alloc(&tree->pool);
+
+  if (index == NIL) {
+    return -1;
+  }
+
+  RB_NODE(tree, index)->value = value;
+  tree->size++;
+
+  if (tree->root == NIL) {
+    tree->root = index;
+
+    return 0;
+  }
+
+  PERF_BEGIN(rb_pool_perf_descent);
+
+  // equal values go left, as in rb_tree.c
+  uint32_t current = tree->root;
+
+  for (;;) {
+    rb_pool_node_t *current_node = RB_NODE(tree, current);
+    int dir = current_node->value < value ? RIGHT : LEFT;
+
+    if (current_node->child[dir] == NIL) {
+      current_node->child[dir] = index;
+      break;
+    }
+
+    current = current_node->child[dir];
+  }
+
+  PERF_END(rb_pool_perf_descent);
+
+  RB_NODE(tree, index)->parent_color = current | RB_COLOR_BIT;
+
+  rb_pool_insert_fixup(tree, index);
+
+  return 0;
+}
+
+uint32_t rb_pool_find(rb_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
+
+  uint32_t current = tree->root;
+
+  while (current != NIL && RB_NODE(tree, current)->value != value) {
+    rb_pool_node_t *node = RB_NODE(tree, current);
+
+    current = node->child[node->value < value ? RIGHT : LEFT];
+  }
+
+  return current;
+}
+
+// puts `to` where `from` hangs, setting the parent of `to` even when it
+// is the sentinel
+static inline void rb_pool_transplant(rb_pool_tree_t *tree, uint32_t from,
+                                      uint32_t to) {
+  uint32_t parent = rb_pool_parent(tree, from);
+
+  if (parent == NIL) {
+    tree->root = to;
+  } else {
+    RB_NODE(tree, parent)->child[rb_pool_dir(tree, parent, from)] = to;
+  }
+
+  rb_pool_set_parent(tree, to, parent);
+}
+
+// `node` carries an extra black, push it up or absorb it with rotations
+static void rb_pool_delete_fixup(rb_pool_tree_t *tree, uint32_t node) {
+  PERF_BEGIN(rb_pool_perf_delete_fixup);
+
+  while (node != tree->root && !rb_pool_is_red(tree, node)) {
+    uint32_t parent = rb_pool_parent(tree, node);
+    int dir = rb_pool_dir(tree, parent, node);
+    uint32_t sibling = RB_NODE(tree, parent)->child[1 - dir];
+
+    if (rb_pool_is_red(tree, sibling)) {
+      rb_pool_set_color(tree, sibling, BLACK);
+      rb_pool_set_color(tree, parent, RED);
+      rb_pool_rotate(tree, parent, dir);
+      sibling = RB_NODE(tree, parent)->child[1 - dir];
+    }
+
+    rb_pool_node_t *sibling_node = RB_NODE(tree, sibling);
+
+    if (!rb_pool_is_red(tree, sibling_node->child[LEFT]) &&
+        !rb_pool_is_red(tree, sibling_node->child[RIGHT])) {
+      rb_pool_set_color(tree, sibling, RED);
+      node = parent;
+      continue;
+    }
+
+    if (!rb_pool_is_red(tree, sibling_node->child[1 - dir])) {
+      rb_pool_set_color(tree, sibling_node->child[dir], BLACK);
+      rb_pool_set_color(tree, sibling, RED);
+      rb_pool_rotate(tree, sibling, 1 - dir);
+      sibling = RB_NODE(tree, parent)->child[1 - dir];
+    }
+
+    rb_pool_set_color(tree, sibling,
+                      rb_pool_is_red(tree, parent) ? RED : BLACK);
+    rb_pool_set_color(tree, parent, BLACK);
+    rb_pool_set_color(tree, RB_NODE(tree, sibling)->child[1 - dir], BLACK);
+    rb_pool_rotate(tree, parent, dir);
+
+    TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "rotated at %d",
+              RB_NODE(tree, parent)->value);
+
+    node = tree->root;
+  }
+
+  rb_pool_set_color(tree, node, BLACK);
+
+  PERF_END(rb_pool_perf_delete_fixup);
+}
+
+int rb_pool_remove(rb_pool_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
+  PERF_BEGIN(rb_pool_perf_descent);
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && RB_NODE(tree, index)->value != value) {
+    rb_pool_node_t *node = RB_NODE(tree, index);
+
+    index = node->child[node->value < value ? RIGHT : LEFT];
+  }
+
+  PERF_END(rb_pool_perf_descent);
+
+  if (index == NIL) {
+    return -1;
+  }
+
+  rb_pool_node_t *node = RB_NODE(tree, index);
+  bool removed_red = rb_pool_is_red(tree, index);
+  uint32_t fixup;
+
+  if (node->child[LEFT] == NIL) {
+    fixup = node->child[RIGHT];
+    rb_pool_transplant(tree, index, fixup);
+  } else if (node->child[RIGHT] == NIL) {
+    fixup = node->child[LEFT];
+    rb_pool_transplant(tree, index, fixup);
+  } else {
+    // the successor takes the place and the color of the node, so the
+    // black that goes missing is the successor's
+    uint32_t successor = node->child[RIGHT];
+
+    while (RB_NODE(tree, successor)->child[LEFT] != NIL) {
+      successor = RB_NODE(tree, successor)->child[LEFT];
+    }
+
+    rb_pool_node_t *successor_node = RB_NODE(tree, successor);
+
+    removed_red = rb_pool_is_red(tree, successor);
+    fixup = successor_node->child[RIGHT];
+
+    if (rb_pool_parent(tree, successor) == index) {
+      rb_pool_set_parent(tree, fixup, successor);
+    } else {
+      rb_pool_transplant(tree, successor, fixup);
+      successor_node->child[RIGHT] = node->child[RIGHT];
+      rb_pool_set_parent(tree, successor_node->child[RIGHT], successor);
+    }
+
+    rb_pool_transplant(tree, index, successor);
+    successor_node->child[LEFT] = node->child[LEFT];
+    rb_pool_set_parent(tree, successor_node->child[LEFT], successor);
+    rb_pool_set_color(tree, successor,
+                      rb_pool_is_red(tree, index) ? RED : BLACK);
+  }
+
+  node_pool_release(&tree->pool, index);
+  tree->size--;
+
+  if (!removed_red) {
+    rb_pool_delete_fixup(tree, fixup);
+  }
+
+  return 0;
+}
+
+// in order successor, NIL after the largest value
+uint32_t rb_pool_next(rb_pool_tree_t *tree, uint32_t index) {
+  if (RB_NODE(tree, index)->child[RIGHT] != NIL) {
+    index = RB_NODE(tree, index)->child[RIGHT];
+
+    while (RB_NODE(tree, index)->child[LEFT] != NIL) {
+      index = RB_NODE(tree, index)->child[LEFT];
+    }
+
+    return index;
+  }
+
+  uint32_t parent = rb_pool_parent(tree, index);
+
+  while (parent != NIL && RB_NODE(tree, parent)->child[RIGHT] == index) {
+    index = parent;
+    parent = rb_pool_parent(tree, index);
+  }
+
+  return parent;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t rb_pool_range(rb_pool_tree_t *tree, int low, int high, int *out,
+                       uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  uint32_t current = tree->root;
+  uint32_t first = NIL;
+  uint64_t count = 0;
+
+  // the leftmost node not below low
+  while (current != NIL) {
+    if (RB_NODE(tree, current)->value >= low) {
+      first = current;
+      current = RB_NODE(tree, current)->child[LEFT];
+    } else {
+      current = RB_NODE(tree, current)->child[RIGHT];
+    }
+  }
+
+  for (uint32_t index = first;
+       index != NIL && RB_NODE(tree, index)->value <= high;
+       index = rb_pool_next(tree, index)) {
+    if (out != NULL && count < capacity) {
+      out[count] = RB_NODE(tree, index)->value;
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+// Copies the values into a read-only frozen set, which answers lookups
+// without chasing node indices. The tree is left as it is.
+int rb_pool_freeze(rb_pool_tree_t *tree, frozen_set_t *set) {
+  int *sorted = (int *)malloc(sizeof(int) * (tree->size ? tree->size : 1));
+  uint64_t count = 0;
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && RB_NODE(tree, index)->child[LEFT] != NIL) {
+    index = RB_NODE(tree, index)->child[LEFT];
+  }
+
+  for (; index != NIL; index = rb_pool_next(tree, index)) {
+    sorted[count++] = RB_NODE(tree, index)->value;
+  }
+
+  int result = frozen_set_init(set, sorted, count);
+
+  free(sorted);
+
+  return result;
+}
+
+// Writes the node array to path as a tree image (common/tree_image.h),
+// free slots included, so that saving is a single copy.
+int rb_pool_save(rb_pool_tree_t *tree, const char *path) {
+  return tree_image_save_pool(path, TREE_IMAGE_RB, &tree->pool, tree->root,
+                              tree->size, sizeof(rb_pool_node_t));
+}
+
+// Replaces the tree with the image at path. The nodes are mapped rather
+// than read, so lookups can start at once and only fault in the pages
+// they visit; inserts and removes copy a page on its first write, and
+// the first growth of the pool moves the tree to anonymous memory. With
+// verify the whole image is read and checked against its checksum.
+int rb_pool_load(rb_pool_tree_t *tree, const char *path, bool verify) {
+  node_pool_t pool;
+  tree_image_header_t header;
+
+  if (tree_image_load(&pool, path, TREE_IMAGE_RB, sizeof(rb_pool_node_t),
+                      &header, verify) < 0) {
+    return -1;
+  }
+
+  node_pool_destroy(&tree->pool);
+  tree->pool = pool;
+  tree->root = header.root;
+  tree->size = header.size;
+
+  return 0;
+}
+
+void rb_pool_print(rb_pool_tree_t *tree) {
+  printf("Tree Size: %llu, %u nodes mapped, ", (unsigned long long)tree->size,
+         tree->pool.capacity);
+
+  uint32_t index = tree->root;
+
+  while (index != NIL && RB_NODE(tree, index)->child[LEFT] != NIL) {
+    index = RB_NODE(tree, index)->child[LEFT];
+  }
+
+  for (; index != NIL; index = rb_pool_next(tree, index)) {
+    printf("(%d%s)", RB_NODE(tree, index)->value,
+           rb_pool_is_red(tree, index) ? "r" : "");
+  }
+
+  printf("\n");
+}
+
+#ifndef RB_POOL_NO_MAIN
+int main() {
+  printf("%zu bytes per node\n", sizeof(rb_pool_node_t));
+
+  rb_pool_tree_t tree = rb_pool_create(7);
+  rb_pool_insert(&tree, 3);
+  rb_pool_insert(&tree, 18);
+  rb_pool_insert(&tree, 10);
+  rb_pool_insert(&tree, 22);
+  rb_pool_insert(&tree, 26);
+  rb_pool_insert(&tree, 8);
+  rb_pool_insert(&tree, 11);
+  rb_pool_print(&tree);
+  rb_pool_insert(&tree, 15);
+  rb_pool_print(&tree);
+  rb_pool_remove(&tree, 11);
+  rb_pool_print(&tree);
+
+  for (int i = 0; i < 100000; i++) {
+    rb_pool_insert(&tree, i);
+  }
+
+  printf("%llu values\n", (unsigned long long)tree.size);
+
+  rb_pool_free(&tree);
+  return 0;
+}
+#endif
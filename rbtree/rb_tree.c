@@ -5,67 +5,17 @@
 #include <string.h>
 #include <wchar.h>
 
-typedef struct rb_node rb_node_t;
-
-// START OF STACK IMPLEMENTATION
-
-typedef struct rb_node_stack {
-  rb_node_t **array;
-  uint32_t size;
-  int64_t top;
-} rb_node_stack_t;
-
-rb_node_stack_t stack_create(uint32_t size) {
-  rb_node_stack_t stack = {.array =
-                               (rb_node_t **)malloc(sizeof(rb_node_t *) * size),
-                           .size = size,
-                           .top = -1};
-
-  return stack;
-}
-
-void stack_free(rb_node_stack_t *stack) {
-  if (stack->array != NULL) {
-    free(stack->array);
-  }
-
-  stack->size = 0;
-  stack->top = -1;
-}
-
-rb_node_t *stack_peek(rb_node_stack_t *stack) {
-  if (stack->top == -1) {
-    return NULL;
-  }
-
-  return stack->array[stack->top];
-}
-
-rb_node_t *stack_pop(rb_node_stack_t *stack) {
-  if (stack->top == -1) {
-    return NULL;
-  }
-
-  rb_node_t *node = stack->array[stack->top];
-
-  stack->array[(stack->top)--] = NULL;
-
-  return node;
-}
-
-int stack_push(rb_node_stack_t *stack, rb_node_t *node) {
-  if (stack->top + 1 >= stack->size) {
-    return -1;
-  }
-
-  stack->array[++(stack->top)] = node;
-
-  return 0;
-}
+#include "../common/ascii_tree.h"
+#include "../common/frozen_set.h"
+#include "../common/node_stack.h"
+#include "../common/perf_counters.h"
+#include "../common/radix_sort.h"
+#include "../common/trace_log.h"
+#include "../common/tree_export.h"
+#include "../common/tree_image.h"
+#include "../common/workload_trace.h"
 
-bool stack_is_empty(rb_node_stack_t *stack) { return stack->top == -1; }
-
-// END OF STACK IMPLEMENTATION
+typedef struct rb_node rb_node_t;
 
 typedef enum rb_color { BLACK, RED } rb_color_t;
 
@@ -84,258 +34,211 @@ struct rb_node {
   rb_color_t color;
 };
 
-// TAKEN FROM THE INTERNET
-//
-// https://gist.github.com/ximik777/e04e5a9f0548a2f41cb09530924bdd9a/
-
-// printing tree in ascii
+// Printing the tree in ascii, see common/ascii_tree.h
 
-typedef struct asciinode_struct asciinode;
+// The number of nodes and the height of the subtree under top, for the
+// marker of a subtree that a view leaves out, in preorder over the
+// parent links.
+static void rb_subtree_shape(rb_node_t *top, uint64_t *count,
+                             int32_t *height) {
+  rb_node_t *node = top;
+  int32_t level = 1;
 
-struct asciinode_struct {
-  asciinode *left, *right;
+  *count = 0;
+  *height = 0;
 
-  // length of the edge from this node to its children
-  int edge_length;
+  while (node != NULL) {
+    (*count)++;
 
-  int height;
+    if (level > *height) {
+      *height = level;
+    }
 
-  int lablen;
+    if (LCHILD(node) != NULL) {
+      node = LCHILD(node);
+      level++;
+    } else if (RCHILD(node) != NULL) {
+      node = RCHILD(node);
+      level++;
+    } else {
+      // up to the first left child with a right sibling
+      while (node != top && (RCHILD(node->parent) == node ||
+                             RCHILD(node->parent) == NULL)) {
+        node = node->parent;
+        level--;
+      }
 
-  //-1=I am left, 0=I am root, 1=right
-  int parent_dir;
+      node = node != top ? RCHILD(node->parent) : NULL;
+    }
+  }
+}
 
-  // max supported unit32 in dec, 10 digits max
-  char label[11];
-};
+// Copy the top depth levels of the tree under root into the ascii node
+// structure, all of them for a negative depth, with a marker of its size
+// for each subtree below them and the label of focus, if it is there, in
+// angle brackets. In preorder with a stack of the tree nodes still to
+// copy, each on top of its level and of the link its copy goes to, a
+// right child for each level at most. NULL if memory runs out.
+asciinode *build_ascii_view(rb_node_t *root, int depth, rb_node_t *focus) {
+  asciinode *proot = NULL;
+  node_stack_t pending;
+  bool failed = false;
+
+  if (root == NULL)
+    return NULL;
 
-#define MAX_HEIGHT 1000
-int lprofile[MAX_HEIGHT];
-int rprofile[MAX_HEIGHT];
-#define INFINITY (1 << 20)
+  node_stack_init(&pending);
+  node_stack_push(&pending, &proot);
+  node_stack_push(&pending, (void *)(uintptr_t)0);
+  node_stack_push(&pending, root);
 
-// adjust gap between left and right nodes
-int gap = 3;
+  while (!failed && !node_stack_is_empty(&pending)) {
+    rb_node_t *t = (rb_node_t *)node_stack_pop(&pending);
+    int level = (int)(uintptr_t)node_stack_pop(&pending);
+    asciinode **link = (asciinode **)node_stack_pop(&pending);
+    asciinode *node = malloc(sizeof(asciinode));
 
-// used for printing next node in the same level,
-// this is the x coordinate of the next char printed
-int print_next;
+    *link = node;
 
-int MIN(int X, int Y) { return ((X) < (Y)) ? (X) : (Y); }
+    if (node == NULL) {
+      failed = true;
+      break;
+    }
 
-int MAX(int X, int Y) { return ((X) > (Y)) ? (X) : (Y); }
+    if (depth >= 0 && level >= depth) {
+      uint64_t count;
+      int32_t height;
 
-asciinode *build_ascii_tree_recursive(rb_node_t *t) {
-  asciinode *node;
+      rb_subtree_shape(t, &count, &height);
+      ascii_tree_collapse(node, count, height);
+      continue;
+    }
 
-  if (t == NULL)
-    return NULL;
+    node->left = NULL;
+    node->right = NULL;
+    node->x = 0;
+    if (t->color == BLACK) {
+      sprintf(node->label, t == focus ? "<B%d>" : "B%d", t->value);
+    } else {
+      sprintf(node->label, t == focus ? "<R%d>" : "R%d", t->value);
+    }
+    node->lablen = (int)strlen(node->label);
 
-  node = malloc(sizeof(asciinode));
-  node->left = build_ascii_tree_recursive(LCHILD(t));
-  node->right = build_ascii_tree_recursive(RCHILD(t));
+    // the right child is copied after the left one
+    if (RCHILD(t) != NULL) {
+      failed = node_stack_push(&pending, &node->right) < 0 ||
+               node_stack_push(&pending, (void *)(uintptr_t)(level + 1)) < 0 ||
+               node_stack_push(&pending, RCHILD(t)) < 0;
+    }
 
-  if (node->left != NULL) {
-    node->left->parent_dir = -1;
+    if (LCHILD(t) != NULL && !failed) {
+      failed = node_stack_push(&pending, &node->left) < 0 ||
+               node_stack_push(&pending, (void *)(uintptr_t)(level + 1)) < 0 ||
+               node_stack_push(&pending, LCHILD(t)) < 0;
+    }
   }
 
-  if (node->right != NULL) {
-    node->right->parent_dir = 1;
-  }
+  node_stack_free(&pending);
 
-  if (t->color == BLACK) {
-    sprintf(node->label, "B%d", t->value);
-  } else {
-    sprintf(node->label, "R%d", t->value);
+  // out of memory, the links still pending are NULL
+  if (failed) {
+    free_ascii_tree(proot);
+
+    return NULL;
   }
-  node->lablen = (int)strlen(node->label);
 
-  return node;
+  return proot;
 }
 
-// Copy the tree into the ascii node structure
-asciinode *build_ascii_tree(rb_node_t *t) {
-  asciinode *node;
-  if (t == NULL)
-    return NULL;
-  node = build_ascii_tree_recursive(t);
-  node->parent_dir = 0;
-  return node;
+// Copy the tree into the ascii node structure. NULL if memory runs out.
+asciinode *build_ascii_tree(rb_node_t *root) {
+  return build_ascii_view(root, -1, NULL);
 }
 
-// Free all the nodes of the given tree
-void free_ascii_tree(asciinode *node) {
-  if (node == NULL)
-    return;
-  free_ascii_tree(node->left);
-  free_ascii_tree(node->right);
-  free(node);
-}
+// Draws the tree under t to fd in one write, without touching stdout or
+// any global state, so that threads can draw trees at the same time.
+// Returns -1 if memory runs out or the write fails.
+int print_ascii_tree_fd(rb_node_t *t, int fd) {
+  asciinode *proot = build_ascii_tree(t);
+  ascii_tree_t ascii;
+  int result;
 
-// The following function fills in the lprofile array for the given tree.
-// It assumes that the centre of the label of the root of this tree
-// is located at a position (x,y).  It assumes that the edge_length
-// fields have been computed for this tree.
-void compute_lprofile(asciinode *node, int x, int y) {
-  int i, isleft;
-  if (node == NULL)
-    return;
-  isleft = (node->parent_dir == -1);
-  lprofile[y] = MIN(lprofile[y], x - ((node->lablen - isleft) / 2));
-  if (node->left != NULL) {
-    for (i = 1; i <= node->edge_length && y + i < MAX_HEIGHT; i++) {
-      lprofile[y + i] = MIN(lprofile[y + i], x - i);
-    }
-  }
-  compute_lprofile(node->left, x - node->edge_length - 1,
-                   y + node->edge_length + 1);
-  compute_lprofile(node->right, x + node->edge_length + 1,
-                   y + node->edge_length + 1);
-}
+  if (t != NULL && proot == NULL)
+    return -1;
 
-void compute_rprofile(asciinode *node, int x, int y) {
-  int i, notleft;
-  if (node == NULL)
-    return;
-  notleft = (node->parent_dir != -1);
-  rprofile[y] = MAX(rprofile[y], x + ((node->lablen - notleft) / 2));
-  if (node->right != NULL) {
-    for (i = 1; i <= node->edge_length && y + i < MAX_HEIGHT; i++) {
-      rprofile[y + i] = MAX(rprofile[y + i], x + i);
-    }
-  }
-  compute_rprofile(node->left, x - node->edge_length - 1,
-                   y + node->edge_length + 1);
-  compute_rprofile(node->right, x + node->edge_length + 1,
-                   y + node->edge_length + 1);
+  ascii_tree_init(&ascii);
+  result = ascii_tree_render(&ascii, proot);
+  if (result == 0)
+    result = ascii_tree_write(&ascii, fd);
+  ascii_tree_free(&ascii);
+  free_ascii_tree(proot);
+
+  return result;
 }
 
-// This function fills in the edge_length and
-// height fields of the specified tree
-void compute_edge_lengths(asciinode *node) {
-  int h, hmin, i, delta;
-  if (node == NULL)
-    return;
-  compute_edge_lengths(node->left);
-  compute_edge_lengths(node->right);
+// Draws the view of build_ascii_view to fd, a line at a time.
+static int print_ascii_tree_view(rb_node_t *t, int fd, int depth,
+                                 rb_node_t *focus) {
+  asciinode *proot = build_ascii_view(t, depth, focus);
+  ascii_tree_t ascii;
+  int result;
 
-  /* first fill in the edge_length of node */
-  if (node->right == NULL && node->left == NULL) {
-    node->edge_length = 0;
-  } else {
-    if (node->left != NULL) {
-      for (i = 0; i < node->left->height && i < MAX_HEIGHT; i++) {
-        rprofile[i] = -INFINITY;
-      }
-      compute_rprofile(node->left, 0, 0);
-      hmin = node->left->height;
-    } else {
-      hmin = 0;
-    }
-    if (node->right != NULL) {
-      for (i = 0; i < node->right->height && i < MAX_HEIGHT; i++) {
-        lprofile[i] = INFINITY;
-      }
-      compute_lprofile(node->right, 0, 0);
-      hmin = MIN(node->right->height, hmin);
-    } else {
-      hmin = 0;
-    }
-    delta = 4;
-    for (i = 0; i < hmin; i++) {
-      delta = MAX(delta, gap + 1 + rprofile[i] - lprofile[i]);
-    }
+  if (t != NULL && proot == NULL)
+    return -1;
 
-    // If the node has two children of height 1, then we allow the
-    // two leaves to be within 1, instead of 2
-    if (((node->left != NULL && node->left->height == 1) ||
-         (node->right != NULL && node->right->height == 1)) &&
-        delta > 4) {
-      delta--;
-    }
+  ascii_tree_init(&ascii);
+  ascii.fd = fd;
+  result = ascii_tree_render(&ascii, proot);
+  ascii_tree_free(&ascii);
+  free_ascii_tree(proot);
 
-    node->edge_length = ((delta + 1) / 2) - 1;
-  }
+  return result;
+}
 
-  // now fill in the height of node
-  h = 1;
-  if (node->left != NULL) {
-    h = MAX(node->left->height + node->edge_length + 1, h);
-  }
-  if (node->right != NULL) {
-    h = MAX(node->right->height + node->edge_length + 1, h);
-  }
-  node->height = h;
+// prints ascii tree for given Tree structure
+void print_ascii_tree(rb_node_t *t) {
+  // what printf holds back goes first
+  fflush(stdout);
+  print_ascii_tree_fd(t, STDOUT_FILENO);
 }
 
-// This function prints the given level of the given tree, assuming
-// that the node has the given x coordinate.
-void print_level(asciinode *node, int x, int level) {
-  int i, isleft;
-  if (node == NULL)
-    return;
-  isleft = (node->parent_dir == -1);
-  if (level == 0) {
-    for (i = 0; i < (x - print_next - ((node->lablen - isleft) / 2)); i++) {
-      printf(" ");
-    }
-    print_next += i;
-    printf("%s", node->label);
-    print_next += node->lablen;
-  } else if (node->edge_length >= level) {
-    if (node->left != NULL) {
-      for (i = 0; i < (x - print_next - (level)); i++) {
-        printf(" ");
-      }
-      print_next += i;
-      printf("/");
-      print_next++;
-    }
-    if (node->right != NULL) {
-      for (i = 0; i < (x - print_next + (level)); i++) {
-        printf(" ");
-      }
-      print_next += i;
-      printf("\\");
-      print_next++;
-    }
-  } else {
-    print_level(node->left, x - node->edge_length - 1,
-                level - node->edge_length - 1);
-    print_level(node->right, x + node->edge_length + 1,
-                level - node->edge_length - 1);
-  }
+// Draws the top depth levels of the tree under t to fd, with the size
+// of each subtree below them in its place. The lines go out as they are
+// drawn, so the memory it takes goes with the part that is drawn rather
+// than with the tree, and counting the nodes of the subtrees left out is
+// a walk over them in constant space. Returns -1 if memory runs out or a
+// write fails.
+int print_ascii_tree_top(rb_node_t *t, int fd, int depth) {
+  return print_ascii_tree_view(t, fd, depth < 0 ? 0 : depth, NULL);
 }
 
-// prints ascii tree for given Tree structure
-void print_ascii_tree(rb_node_t *t) {
-  asciinode *proot;
-  int xmin, i;
-  if (t == NULL)
-    return;
-  proot = build_ascii_tree(t);
-  compute_edge_lengths(proot);
-  for (i = 0; i < proot->height && i < MAX_HEIGHT; i++) {
-    lprofile[i] = INFINITY;
-  }
-  compute_lprofile(proot, 0, 0);
-  xmin = 0;
-  for (i = 0; i < proot->height && i < MAX_HEIGHT; i++) {
-    xmin = MIN(xmin, lprofile[i]);
-  }
-  for (i = 0; i < proot->height; i++) {
-    print_next = 0;
-    print_level(proot, -xmin, i);
-    printf("\n");
+// Draws the part of the tree under t around key: from above levels over
+// the node of key, or the one it would go under if it is not there, down
+// to below levels under it, with that node in angle brackets. As
+// print_ascii_tree_top otherwise.
+int print_ascii_tree_around(rb_node_t *t, int fd, int key, int above,
+                            int below) {
+  rb_node_t *focus = t;
+  rb_node_t *top;
+  int depth = 1 + (below < 0 ? 0 : below);
+
+  while (focus != NULL && focus->value != key) {
+    rb_node_t *next = focus->value > key ? LCHILD(focus) : RCHILD(focus);
+
+    if (next == NULL) {
+      break;
+    }
+
+    focus = next;
   }
-  if (proot->height >= MAX_HEIGHT) {
-    printf("(This tree is taller than %d, and may be drawn incorrectly.)\n",
-           MAX_HEIGHT);
+
+  for (top = focus; top != NULL && top != t && above > 0; above--) {
+    top = top->parent;
+    depth++;
   }
-  free_ascii_tree(proot);
-}
 
-// THE ABOVE WAS TAKEN FROM THE INTERNET
+  return print_ascii_tree_view(top, fd, depth, focus);
+}
 
 static inline void rb_print_node(rb_node_t *node) {
   if (node == NULL) {
@@ -355,6 +258,9 @@ static inline void rb_print_node(rb_node_t *node) {
 typedef struct rb_tree {
   rb_node_t *root;
   uint64_t size;
+#ifdef TREE_RECORD
+  workload_recorder_t *recorder;
+#endif
 } rb_tree_t;
 
 #define NIL (NULL)
@@ -372,32 +278,157 @@ rb_tree_t rb_tree_create(int value) {
   return tree;
 }
 
+// Post-order walks in constant space, over the parent links: the first
+// node of a subtree is the leaf reached by going left where there is a
+// left child and right otherwise, and the node after one is its parent,
+// unless it is a left child with a right sibling, whose subtree comes
+// first. rb_post_next reads nothing of node but its parent link, so the
+// caller may free node right after.
+
+static rb_node_t *rb_post_first(rb_node_t *node) {
+  while (LCHILD(node) != NIL || RCHILD(node) != NIL) {
+    node = LCHILD(node) != NIL ? LCHILD(node) : RCHILD(node);
+  }
+
+  return node;
+}
+
+// the node after node in the post-order of the subtree under top, or NULL
+// after top
+static rb_node_t *rb_post_next(rb_node_t *node, rb_node_t *top) {
+  if (node == top) {
+    return NULL;
+  }
+
+  rb_node_t *parent = node->parent;
+
+  if (LCHILD(parent) == node && RCHILD(parent) != NIL) {
+    return rb_post_first(RCHILD(parent));
+  }
+
+  return parent;
+}
+
+static void rb_free_subtree(rb_node_t *top) {
+  rb_node_t *node = rb_post_first(top);
+
+  while (node != NULL) {
+    rb_node_t *next = rb_post_next(node, top);
+
+    free(node);
+    node = next;
+  }
+}
+
 void rb_tree_free(rb_tree_t *tree) {
-  rb_node_stack_t node_stack = stack_create(tree->size);
-  rb_node_stack_t temp_stack = stack_create(tree->size);
+  if (tree->root == NULL) {
+    return;
+  }
+
+  rb_free_subtree(tree->root);
 
-  stack_push(&temp_stack, tree->root);
+  tree->root = NULL;
+  tree->size = 0;
+}
 
-  while (!stack_is_empty(&temp_stack)) {
-    rb_node_t *node = stack_pop(&temp_stack);
+// subtrees handed out to the threads, several for each thread
+#define RB_FREE_TASKS_PER_THREAD 4
+// below this many nodes per thread the threads cost more than they save
+#define RB_FREE_MIN_NODES (1 << 16)
 
-    if (LCHILD(node) != NULL) {
-      stack_push(&temp_stack, LCHILD(node));
+typedef struct rb_free_job {
+  rb_node_t **tops;
+  uint64_t count;
+  _Atomic uint64_t next;
+} rb_free_job_t;
+
+static void *rb_free_worker(void *arg) {
+  rb_free_job_t *job = (rb_free_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->count) {
+      return NULL;
     }
 
-    if (RCHILD(node) != NULL) {
-      stack_push(&temp_stack, RCHILD(node));
+    rb_free_subtree(job->tops[index]);
+  }
+}
+
+// Frees the tree as rb_tree_free does, on up to nthreads threads: the
+// top levels are freed a level at a time until there are enough disjoint
+// subtrees left under them, and the threads take those. Falls back to one
+// thread if the list of subtrees cannot be allocated. Build with -pthread.
+void rb_tree_free_parallel(rb_tree_t *tree, uint32_t nthreads) {
+  if (nthreads > tree->size / RB_FREE_MIN_NODES) {
+    nthreads = (uint32_t)(tree->size / RB_FREE_MIN_NODES);
+  }
+
+  if (nthreads > RADIX_MAX_THREADS) {
+    nthreads = RADIX_MAX_THREADS;
+  }
+
+  uint64_t wide = (uint64_t)nthreads * RB_FREE_TASKS_PER_THREAD;
+  // a level of the subtrees holds at most twice as many as the one above
+  rb_node_t **tops = nthreads > 1
+                          ? (rb_node_t **)malloc(sizeof(rb_node_t *) * 4 *
+                                                  wide)
+                          : NULL;
+
+  if (tops == NULL) {
+    rb_tree_free(tree);
+
+    return;
+  }
+
+  rb_node_t **level = tops;
+  rb_node_t **below = tops + 2 * wide;
+  uint64_t count = 1;
+
+  level[0] = tree->root;
+
+  while (count > 0 && count < wide) {
+    uint64_t next = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+      rb_node_t *node = level[i];
+
+      if (LCHILD(node) != NIL) {
+        below[next++] = LCHILD(node);
+      }
+
+      if (RCHILD(node) != NIL) {
+        below[next++] = RCHILD(node);
+      }
+
+      free(node);
     }
 
-    stack_push(&node_stack, node);
+    rb_node_t **swap = level;
+    level = below;
+    below = swap;
+    count = next;
+  }
+
+  rb_free_job_t job = {.tops = level, .count = count, .next = 0};
+  pthread_t threads[RADIX_MAX_THREADS];
+  bool started[RADIX_MAX_THREADS];
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    started[t] =
+        pthread_create(&threads[t], NULL, rb_free_worker, &job) == 0;
   }
 
-  while (!stack_is_empty(&node_stack)) {
-    free(stack_pop(&node_stack));
+  rb_free_worker(&job);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
   }
 
-  stack_free(&node_stack);
-  stack_free(&temp_stack);
+  free(tops);
 
   tree->root = NULL;
   tree->size = 0;
@@ -467,28 +498,35 @@ bool rb_is_sibling_red(rb_node_t *node) {
   return !rb_is_black(rb_get_sibling(node));
 }
 
+PERF_DEFINE_REGION(rb_perf_descent, "descent");
+PERF_DEFINE_REGION(rb_perf_insert_fixup, "rb_insert_fixup");
+PERF_DEFINE_REGION(rb_perf_delete_fixup, "rb_delete_fixup");
+
 void rb_node_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *x_node) {
   rb_node_t *current_node = node;
 
-  if (x_node->value == 8)
-    rb_print_node(x_node);
+  PERF_BEGIN(rb_perf_descent);
 
   while (rb_can_step(current_node, x_node)) {
     current_node = current_node->child[VALUEDIR(current_node, x_node)];
   }
 
+  PERF_END(rb_perf_descent);
+
   x_node->parent = current_node;
 
   current_node->child[VALUEDIR(current_node, x_node)] = x_node;
 
   rb_node_t *parent_node = current_node;
 
-  if (x_node->value == 8)
-    rb_print_node(x_node);
+  TRACE_LOG(TRACE_DEBUG, TRACE_INSERT, "%d: under %s %d", x_node->value,
+            current_node->color == RED ? "red" : "black", current_node->value);
 
   // note: if the parent does not have a parent then it is the
   // root
 
+  PERF_BEGIN(rb_perf_insert_fixup);
+
   while (parent_node != NULL && parent_node->color != BLACK) {
     rb_node_t *grandparent_node = parent_node->parent;
 
@@ -524,8 +562,11 @@ void rb_node_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *x_node) {
           tree->root = x_node;
       }
 
-      if (x_node->value == 8)
-        rb_print_node(x_node);
+      TRACE_LOG(TRACE_DEBUG, TRACE_REBALANCE, "rotated, %d is black",
+                parent_direction == direction ? parent_node->value
+                                              : x_node->value);
+
+      PERF_END(rb_perf_insert_fixup);
 
       return;
     }
@@ -534,11 +575,15 @@ void rb_node_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *x_node) {
     parent_node = grandparent_node->parent;
   }
 
-  if (x_node->value == 8)
-    rb_print_node(x_node);
+  PERF_END(rb_perf_insert_fixup);
+
+  TRACE_LOG(TRACE_VERBOSE, TRACE_REBALANCE, "recoloured up to %d",
+            x_node->value);
 }
 
 void rb_tree_insert(rb_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_INSERT, value, value);
+
   rb_node_t *node = (rb_node_t *)malloc(sizeof(rb_node_t));
   node->value = value;
   node->parent = NULL;
@@ -551,9 +596,6 @@ void rb_tree_insert(rb_tree_t *tree, int value) {
 
     tree->size++;
 
-    if (node->value == 8)
-      rb_print_node(node);
-
     return;
   }
 
@@ -570,39 +612,142 @@ void rb_tree_print(rb_tree_t *tree) {
   printf("Tree Size: %lu, ", tree->size);
 #endif
 
-  rb_node_stack_t node_stack = stack_create(tree->size);
-  rb_node_stack_t temp_stack = stack_create(tree->size);
+  if (tree->root != NIL) {
+    rb_node_t *node = rb_post_first(tree->root);
+
+    for (; node != NIL; node = rb_post_next(node, tree->root)) {
+      if (node->color == BLACK) {
+        printf("(B%d)", node->value);
+      } else {
+        printf("(R%d)", node->value);
+      }
+    }
+  }
 
-  stack_push(&temp_stack, tree->root);
+  printf("\n");
+}
 
-  while (!stack_is_empty(&temp_stack)) {
-    rb_node_t *node = stack_pop(&temp_stack);
+// Writes the tree to fd in the DOT language of Graphviz, see
+// common/tree_export.h, in preorder over the parent links. Returns -1 if
+// a write fails.
+int rb_tree_export_dot(rb_tree_t *tree, int fd) {
+  tree_export_t *out = (tree_export_t *)malloc(sizeof(tree_export_t));
+  rb_node_t *node = tree->root;
 
-    if (LCHILD(node) != NULL) {
-      stack_push(&temp_stack, LCHILD(node));
+  if (out == NULL) {
+    return -1;
+  }
+
+  tree_export_init(out, fd);
+  tree_export_dot_begin(out);
+
+  while (node != NIL) {
+    tree_export_dot_node(out, node, node->value,
+                         node->color == BLACK ? "black" : "red");
+
+    if (LCHILD(node) != NIL) {
+      tree_export_dot_edge(out, node, LCHILD(node));
+    } else if (RCHILD(node) != NIL) {
+      tree_export_dot_nil(out, node);
     }
 
-    if (RCHILD(node) != NULL) {
-      stack_push(&temp_stack, RCHILD(node));
+    if (RCHILD(node) != NIL) {
+      tree_export_dot_edge(out, node, RCHILD(node));
+    } else if (LCHILD(node) != NIL) {
+      tree_export_dot_nil(out, node);
+    }
+
+    if (LCHILD(node) != NIL) {
+      node = LCHILD(node);
+    } else if (RCHILD(node) != NIL) {
+      node = RCHILD(node);
+    } else {
+      // up to the first left child with a right sibling
+      while (node->parent != NIL && (RCHILD(node->parent) == node ||
+                                     RCHILD(node->parent) == NIL)) {
+        node = node->parent;
+      }
+
+      node = node->parent != NIL ? RCHILD(node->parent) : NIL;
     }
+  }
+
+  tree_export_dot_end(out);
+
+  int result = tree_export_finish(out);
+
+  free(out);
+
+  return result;
+}
+
+// Writes the tree to fd in JSON, see common/tree_export.h, in a walk over
+// the parent links that writes each node on the way down and closes it on
+// the way back up. Returns -1 if a write fails.
+int rb_tree_export_json(rb_tree_t *tree, int fd) {
+  tree_export_t *out = (tree_export_t *)malloc(sizeof(tree_export_t));
+  rb_node_t *node = tree->root;
 
-    stack_push(&node_stack, node);
+  if (out == NULL) {
+    return -1;
   }
 
-  while (!stack_is_empty(&node_stack)) {
-    rb_node_t *node = stack_pop(&node_stack);
+  tree_export_init(out, fd);
+  tree_export_json_begin(out, tree->size);
 
-    if (node->color == BLACK) {
-      printf("(B%d)", node->value);
-    } else {
-      printf("(R%d)", node->value);
+  if (node == NIL) {
+    tree_export_json_null(out);
+  }
+
+  while (node != NIL) {
+    tree_export_json_open(out, node->value,
+                          node->color == BLACK ? "black" : "red");
+
+    if (LCHILD(node) != NIL) {
+      node = LCHILD(node);
+      continue;
+    }
+
+    tree_export_json_null(out);
+    tree_export_json_right(out);
+
+    if (RCHILD(node) != NIL) {
+      node = RCHILD(node);
+      continue;
     }
+
+    tree_export_json_null(out);
+    tree_export_json_close(out);
+
+    // up to the first node whose right subtree is still to write, closing
+    // the ones that are done
+    while (node != tree->root) {
+      rb_node_t *parent = node->parent;
+
+      if (LCHILD(parent) == node) {
+        tree_export_json_right(out);
+
+        if (RCHILD(parent) != NIL) {
+          break;
+        }
+
+        tree_export_json_null(out);
+      }
+
+      tree_export_json_close(out);
+      node = parent;
+    }
+
+    node = node != tree->root ? RCHILD(node->parent) : NIL;
   }
 
-  printf("\n");
+  tree_export_json_end(out);
+
+  int result = tree_export_finish(out);
+
+  free(out);
 
-  stack_free(&node_stack);
-  stack_free(&temp_stack);
+  return result;
 }
 
 rb_node_t *rb_find_max(rb_node_t *node) {
@@ -618,9 +763,12 @@ rb_node_t *rb_find_max(rb_node_t *node) {
 #define NILDIR(X) ((LCHILD(X) == NIL) ? LEFT : RIGHT)
 
 int rb_delete_non_root_black_leaf(rb_node_t *node) {
-  rb_print_node(node);
   rb_node_t *parent = node->parent;
-  rb_print_node(parent);
+
+  TRACE_LOG(TRACE_DEBUG, TRACE_REMOVE, "black leaf %d under %s %d",
+            node->value, parent->color == RED ? "red" : "black",
+            parent->value);
+
   int direction;
   rb_node_t *sibling;
   rb_node_t *close_nephew;
@@ -684,11 +832,21 @@ Case_D6:
   return 0;
 }
 
+// the rotations in rb_delete_non_root_black_leaf can move a new node to
+// the top of the tree
+static inline void rb_update_root(rb_tree_t *tree) {
+  while (tree->root->parent != NULL) {
+    tree->root = tree->root->parent;
+  }
+}
+
 int rb_node_remove(rb_tree_t *tree, rb_node_t *node, int value) {
   rb_node_t *current_node = node;
 
   bool found = false;
 
+  PERF_BEGIN(rb_perf_descent);
+
   while (!found && current_node) {
     if (current_node->value == value) {
       found = true;
@@ -698,6 +856,8 @@ int rb_node_remove(rb_tree_t *tree, rb_node_t *node, int value) {
     }
   }
 
+  PERF_END(rb_perf_descent);
+
   if (!found) {
     return -1;
   }
@@ -711,7 +871,10 @@ int rb_node_remove(rb_tree_t *tree, rb_node_t *node, int value) {
       if (current_node->parent == NULL) {
         tree->root = NULL;
       } else {
+        PERF_BEGIN(rb_perf_delete_fixup);
         rb_delete_non_root_black_leaf(current_node);
+        rb_update_root(tree);
+        PERF_END(rb_perf_delete_fixup);
       }
 
       free(current_node);
@@ -733,7 +896,10 @@ int rb_node_remove(rb_tree_t *tree, rb_node_t *node, int value) {
         rb_node_t *parent_node = max_node->parent;
         parent_node->child[DIR(parent_node, max_node)] = NIL;
       } else { // black leaf
+        PERF_BEGIN(rb_perf_delete_fixup);
         rb_delete_non_root_black_leaf(max_node);
+        rb_update_root(tree);
+        PERF_END(rb_perf_delete_fixup);
       }
 
       free(max_node);
@@ -755,6 +921,8 @@ int rb_node_remove(rb_tree_t *tree, rb_node_t *node, int value) {
 }
 
 int rb_tree_remove(rb_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, value, value);
+
   if (tree->root == NULL) {
     return 0;
   }
@@ -768,31 +936,1397 @@ int rb_tree_remove(rb_tree_t *tree, int value) {
   return -1;
 }
 
-int main() {
-  rb_tree_t tree = rb_tree_create(7);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 3);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 18);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 10);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 22);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 26);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 8);
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 11);
-  rb_tree_print(&tree);
+rb_node_t *rb_tree_find(rb_tree_t *tree, int value) {
+  WORKLOAD_RECORD(tree, WORKLOAD_FIND, value, value);
 
-  printf("before first tree\n");
-  print_ascii_tree(tree.root);
-  rb_tree_insert(&tree, 15);
-  print_ascii_tree(tree.root);
-  rb_tree_remove(&tree, 11);
-  print_ascii_tree(tree.root);
+  rb_node_t *current_node = tree->root;
 
-  rb_tree_free(&tree);
-  return 0;
+  while (current_node != NIL && current_node->value != value) {
+    current_node =
+        current_node->child[current_node->value < value ? RIGHT : LEFT];
+  }
+
+  return current_node;
 }
+
+// in order successor, NULL after the largest value
+rb_node_t *rb_next(rb_node_t *node) {
+  if (RCHILD(node) != NIL) {
+    node = RCHILD(node);
+
+    while (LCHILD(node) != NIL) {
+      node = LCHILD(node);
+    }
+
+    return node;
+  }
+
+  while (node->parent != NULL && RCHILD(node->parent) == node) {
+    node = node->parent;
+  }
+
+  return node->parent;
+}
+
+// Counts the values in [low, high] and copies the first `capacity` of
+// them, in ascending order, to out (which may be NULL).
+uint64_t rb_tree_range(rb_tree_t *tree, int low, int high, int *out,
+                       uint64_t capacity) {
+  WORKLOAD_RECORD(tree, WORKLOAD_RANGE, low, high);
+
+  rb_node_t *current_node = tree->root;
+  rb_node_t *first = NIL;
+  uint64_t count = 0;
+
+  // the leftmost node not below low
+  while (current_node != NIL) {
+    if (current_node->value >= low) {
+      first = current_node;
+      current_node = LCHILD(current_node);
+    } else {
+      current_node = RCHILD(current_node);
+    }
+  }
+
+  for (rb_node_t *node = first; node != NIL && node->value <= high;
+       node = rb_next(node)) {
+    if (out != NULL && count < capacity) {
+      out[count] = node->value;
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+// Copies the values into a read-only frozen set, which answers lookups
+// without chasing node pointers. The tree is left as it is.
+int rb_tree_freeze(rb_tree_t *tree, frozen_set_t *set) {
+  int *sorted = (int *)malloc(sizeof(int) * (tree->size ? tree->size : 1));
+  uint64_t count = 0;
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  rb_node_t *node = tree->root;
+
+  while (node != NIL && LCHILD(node) != NIL) {
+    node = LCHILD(node);
+  }
+
+  for (; node != NIL; node = rb_next(node)) {
+    sorted[count++] = node->value;
+  }
+
+  int result = frozen_set_init(set, sorted, count);
+
+  free(sorted);
+
+  return result;
+}
+
+/* ---------------------------------------------- */
+
+// Bulk construction from an unsorted batch: the values are radix sorted
+// (common/radix_sort.h) and the tree is built top down by splitting the
+// sorted run at its middle, which puts every leaf of a subtree of n
+// values at depth ceil(log2(n + 1)) or one above it. Coloring the nodes
+// on that deepest level red and all others black then meets the red-black
+// rules without any fixup. The top levels are built on the calling thread
+// and the subtrees below them handed out to the threads. A thread mallocs
+// the nodes of its subtrees one at a time, in the order it builds them.
+
+// subtrees below the top levels, several per thread for the balance
+#define RB_BUILD_TASKS_PER_THREAD 4
+
+typedef struct rb_build_task {
+  uint64_t begin;
+  uint64_t end;
+  rb_node_t *parent;
+  // where the root of the subtree goes
+  rb_node_t **link;
+  uint32_t depth;
+} rb_build_task_t;
+
+typedef struct rb_build_job {
+  const int *sorted;
+  rb_build_task_t *tasks;
+  uint64_t count;
+  // of the whole tree, the depth of its red nodes
+  uint32_t height;
+  _Atomic uint64_t next;
+  _Atomic bool failed;
+} rb_build_job_t;
+
+// depth is 1 for the root
+static rb_node_t *rb_build_node(rb_build_job_t *job, uint64_t begin,
+                                uint64_t end, rb_node_t *parent,
+                                uint32_t depth) {
+  uint64_t middle = begin + (end - begin) / 2;
+  rb_node_t *node = (rb_node_t *)malloc(sizeof(rb_node_t));
+
+  if (node == NULL) {
+    job->failed = true;
+
+    return NULL;
+  }
+
+  node->value = job->sorted[middle];
+  node->parent = parent;
+  node->child[LEFT] = NULL;
+  node->child[RIGHT] = NULL;
+  // the root of a single node tree stays black
+  node->color = depth == job->height && depth > 1 ? RED : BLACK;
+
+  return node;
+}
+
+static rb_node_t *rb_build_subtree(rb_build_job_t *job, uint64_t begin,
+                                   uint64_t end, rb_node_t *parent,
+                                   uint32_t depth) {
+  if (begin == end) {
+    return NULL;
+  }
+
+  rb_node_t *node = rb_build_node(job, begin, end, parent, depth);
+  uint64_t middle = begin + (end - begin) / 2;
+
+  if (node != NULL) {
+    node->child[LEFT] = rb_build_subtree(job, begin, middle, node, depth + 1);
+    node->child[RIGHT] =
+        rb_build_subtree(job, middle + 1, end, node, depth + 1);
+  }
+
+  return node;
+}
+
+// builds the levels down to `levels` and queues the subtrees below them
+static void rb_build_top(rb_build_job_t *job, uint64_t begin, uint64_t end,
+                         rb_node_t *parent, rb_node_t **link, uint32_t depth,
+                         uint32_t levels) {
+  if (begin == end) {
+    *link = NULL;
+
+    return;
+  }
+
+  if (depth > levels) {
+    job->tasks[job->count++] =
+        (rb_build_task_t){begin, end, parent, link, depth};
+
+    return;
+  }
+
+  rb_node_t *node = *link = rb_build_node(job, begin, end, parent, depth);
+  uint64_t middle = begin + (end - begin) / 2;
+
+  if (node != NULL) {
+    rb_build_top(job, begin, middle, node, &node->child[LEFT], depth + 1,
+                 levels);
+    rb_build_top(job, middle + 1, end, node, &node->child[RIGHT], depth + 1,
+                 levels);
+  }
+}
+
+static void *rb_build_worker(void *arg) {
+  rb_build_job_t *job = (rb_build_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->count) {
+      return NULL;
+    }
+
+    rb_build_task_t *task = &job->tasks[index];
+
+    *task->link = rb_build_subtree(job, task->begin, task->end, task->parent,
+                                   task->depth);
+  }
+}
+
+// Builds the tree from n values in any order, into an empty tree, using
+// up to nthreads threads for the sort and the build. With unique only
+// one copy of each value is kept. Returns -1 if the tree is not empty or
+// memory runs out, leaving it empty. Build with -pthread.
+int rb_tree_build(rb_tree_t *tree, const int *keys, uint64_t n,
+                   uint32_t nthreads, bool unique) {
+  if (tree->root != NULL) {
+    return -1;
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  if (nthreads == 0) {
+    nthreads = 1;
+  } else if (nthreads > RADIX_MAX_THREADS) {
+    nthreads = RADIX_MAX_THREADS;
+  }
+
+  int *sorted = (int *)malloc(sizeof(int) * n);
+
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  memcpy(sorted, keys, sizeof(int) * n);
+
+  if (radix_sort(sorted, n, nthreads) < 0) {
+    free(sorted);
+
+    return -1;
+  }
+
+  if (unique) {
+    n = radix_unique(sorted, n);
+  }
+
+  // enough levels on top for RB_BUILD_TASKS_PER_THREAD subtrees a thread
+  uint64_t tasks = (uint64_t)nthreads * RB_BUILD_TASKS_PER_THREAD;
+  uint32_t depth = 0;
+
+  while (nthreads > 1 && ((uint64_t)1 << depth) < tasks &&
+         ((uint64_t)1 << depth) < n) {
+    depth++;
+  }
+
+  rb_build_job_t job = {.sorted = sorted,
+                        .count = 0,
+                        .height = 64 - __builtin_clzll(n),
+                        .next = 0,
+                        .failed = false};
+  pthread_t threads[RADIX_MAX_THREADS];
+  bool started[RADIX_MAX_THREADS];
+
+  job.tasks = (rb_build_task_t *)malloc(sizeof(rb_build_task_t) *
+                                        ((size_t)1 << depth));
+
+  if (job.tasks == NULL) {
+    free(sorted);
+
+    return -1;
+  }
+
+  rb_build_top(&job, 0, n, NULL, &tree->root, 1, depth);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    started[t] =
+        pthread_create(&threads[t], NULL, rb_build_worker, &job) == 0;
+  }
+
+  rb_build_worker(&job);
+
+  for (uint32_t t = 0; t + 1 < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+
+  free(job.tasks);
+  free(sorted);
+
+  tree->size = n;
+
+  if (job.failed) {
+    rb_tree_free(tree);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ---------------------------------------------- */
+
+// Batched updates: the batch is radix sorted and merged into the tree by
+// a union (insert) or difference (remove) built on join, as in Blelloch,
+// Ferizovic and Sun, "Just Join for Parallel Ordered Sets". It goes in
+// the two sweeps of avl_tree_insert_batch. The first goes down breadth
+// first, splitting the run of keys that reaches each node around its
+// value and prefetching the children the halves go on to, and takes a
+// run of a single key on down by itself: for an insert to a leaf, with
+// the usual insert fix-up, for a remove to its node, which is joined out
+// with joins back up the parent links as far as the black height
+// changed, both kept inside the subtree the run reached. That saves the
+// entries of the levels below, most of the tree for a small batch. The
+// second goes back up, building the subtrees that runs land in empty,
+// colored as rb_tree_build does, and joining the two sides back under
+// each node, which recolors and rotates only along the spine where their
+// black heights meet. Below the first level with enough nodes on it the
+// threads take the subtrees from there up.
+//
+// A black height here counts the black nodes on a path from the top of
+// the subtree, its own top included, down to a NIL, which counts for 0.
+// Subtrees in between may have a red top, but never a red node under a
+// red one.
+
+// nodes of the level handed out to the threads, several for each thread
+#define RB_BATCH_TASKS_PER_THREAD 4
+// below this many keys per thread the threads cost more than they save
+#define RB_BATCH_MIN_KEYS (1 << 16)
+// runs of one key taken down together, few enough that a child prefetched
+// on one pass over them is still in the cache on the next
+#define RB_BATCH_TAIL_GROUP 64
+
+typedef struct rb_batch_entry {
+  rb_node_t *node;
+  // the run of keys that reaches node
+  uint64_t begin;
+  uint64_t end;
+  // the entries of the two sides, 0 for a side no key goes to
+  uint64_t left;
+  uint64_t right;
+  // a key of a remove is equal to the value of node
+  bool removed;
+  // the one key went down the rest of the way on its own
+  bool tail;
+  rb_node_t *result;
+  // of node on the way down, of result on the way up
+  uint32_t black_height;
+} rb_batch_entry_t;
+
+// a run of one key on its way down on its own
+typedef struct rb_batch_tail {
+  rb_node_t *node;
+  uint64_t entry;
+  int key;
+  // for a remove, of the subtree under node
+  uint32_t black_height;
+} rb_batch_tail_t;
+
+typedef struct rb_batch_job {
+  // the sorted batch
+  const int *keys;
+  // for an insert, a node holding each key
+  rb_node_t **nodes;
+  // for a remove, set for the keys that took out a node
+  bool *found;
+  rb_batch_entry_t *entries;
+  uint64_t count;
+  uint64_t capacity;
+  rb_batch_tail_t *tails;
+  // the level handed out to the threads
+  uint64_t first;
+  uint64_t last;
+  _Atomic uint64_t next;
+} rb_batch_job_t;
+
+// The joins take the black heights of their subtrees from the caller and
+// relink only the sides that change, so a node the batch does not reach
+// is never read.
+
+static inline void rb_join_set(rb_node_t *node, int direction,
+                               rb_node_t *child) {
+  node->child[direction] = child;
+
+  if (child != NIL)
+    child->parent = node;
+}
+
+// unlike rb_rotate this leaves the parent alone, returning the new top of
+// the subtree for the caller to link in
+static rb_node_t *rb_join_rotate(rb_node_t *node, int direction) {
+  rb_node_t *child = node->child[1 - direction];
+
+  rb_join_set(node, 1 - direction, child->child[direction]);
+  rb_join_set(child, direction, node);
+
+  return child;
+}
+
+// of the subtree under node, given that of node
+static inline uint32_t rb_child_height(rb_node_t *node, uint32_t height) {
+  return height - (node->color == BLACK);
+}
+
+// left is black higher than right: node and right go down its right spine
+// to the first black node as high as right, and a red node on a red one
+// that leaves is fixed by a rotation further up
+static rb_node_t *rb_join_right(rb_node_t *left, uint32_t left_height,
+                                rb_node_t *node, rb_node_t *right,
+                                uint32_t right_height) {
+  if (rb_is_black(left) && left_height == right_height) {
+    node->color = RED;
+    rb_join_set(node, LEFT, left);
+    rb_join_set(node, RIGHT, right);
+
+    return node;
+  }
+
+  rb_node_t *child = rb_join_right(RCHILD(left),
+                                   rb_child_height(left, left_height), node,
+                                   right, right_height);
+
+  rb_join_set(left, RIGHT, child);
+
+  if (left->color == BLACK && !rb_is_black(child) &&
+      !rb_is_black(RCHILD(child))) {
+    RCHILD(child)->color = BLACK;
+
+    return rb_join_rotate(left, LEFT);
+  }
+
+  return left;
+}
+
+static rb_node_t *rb_join_left(rb_node_t *left, uint32_t left_height,
+                               rb_node_t *node, rb_node_t *right,
+                               uint32_t right_height) {
+  if (rb_is_black(right) && left_height == right_height) {
+    node->color = RED;
+    rb_join_set(node, LEFT, left);
+    rb_join_set(node, RIGHT, right);
+
+    return node;
+  }
+
+  rb_node_t *child = rb_join_left(left, left_height, node, LCHILD(right),
+                                  rb_child_height(right, right_height));
+
+  rb_join_set(right, LEFT, child);
+
+  if (right->color == BLACK && !rb_is_black(child) &&
+      !rb_is_black(LCHILD(child))) {
+    LCHILD(child)->color = BLACK;
+
+    return rb_join_rotate(right, RIGHT);
+  }
+
+  return right;
+}
+
+// Makes a subtree of left, node and right, where every value in left is
+// at most that of node and every one in right at least that, and sets
+// height to its black height.
+static rb_node_t *rb_join(rb_node_t *left, uint32_t left_height,
+                          rb_node_t *node, rb_node_t *right,
+                          uint32_t right_height, uint32_t *height) {
+  if (left_height == right_height) {
+    node->color = rb_is_black(left) && rb_is_black(right) ? RED : BLACK;
+    *height = left_height + (node->color == BLACK);
+    rb_join_set(node, LEFT, left);
+    rb_join_set(node, RIGHT, right);
+
+    return node;
+  }
+
+  int direction = left_height > right_height ? RIGHT : LEFT;
+  rb_node_t *root;
+
+  if (direction == RIGHT) {
+    root = rb_join_right(left, left_height, node, right, right_height);
+    *height = left_height;
+  } else {
+    root = rb_join_left(left, left_height, node, right, right_height);
+    *height = right_height;
+  }
+
+  if (root->color == RED && !rb_is_black(root->child[direction])) {
+    root->color = BLACK;
+    (*height)++;
+  }
+
+  return root;
+}
+
+// takes the largest node out of the subtree, returns what is left
+static rb_node_t *rb_split_last(rb_node_t *node, uint32_t node_height,
+                                rb_node_t **last, uint32_t *height) {
+  uint32_t child_height = rb_child_height(node, node_height);
+
+  if (RCHILD(node) == NIL) {
+    *last = node;
+    *height = child_height;
+
+    return LCHILD(node);
+  }
+
+  uint32_t right_height;
+  rb_node_t *right =
+      rb_split_last(RCHILD(node), child_height, last, &right_height);
+
+  // the right side lost at most one level
+  if (right_height == child_height &&
+      (node->color == BLACK || rb_is_black(right))) {
+    rb_join_set(node, RIGHT, right);
+    *height = node_height;
+
+    return node;
+  }
+
+  return rb_join(LCHILD(node), child_height, node, right, right_height,
+                 height);
+}
+
+// rb_join without the node in the middle
+static rb_node_t *rb_join2(rb_node_t *left, uint32_t left_height,
+                           rb_node_t *right, uint32_t right_height,
+                           uint32_t *height) {
+  if (left == NIL) {
+    *height = right_height;
+
+    return right;
+  }
+
+  rb_node_t *last;
+
+  left = rb_split_last(left, left_height, &last, &left_height);
+
+  return rb_join(left, left_height, last, right, right_height, height);
+}
+
+// the first key in [begin, end) not below value, or with after not
+// equal to it either
+static uint64_t rb_batch_search(const int *keys, uint64_t begin,
+                                uint64_t end, int value, bool after) {
+  while (begin < end) {
+    uint64_t middle = begin + (end - begin) / 2;
+
+    if (keys[middle] < value || (after && keys[middle] == value)) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+
+  return begin;
+}
+
+static int rb_batch_reserve(rb_batch_job_t *job, uint64_t capacity) {
+  if (capacity <= job->capacity) {
+    return 0;
+  }
+
+  rb_batch_entry_t *entries = (rb_batch_entry_t *)realloc(
+      job->entries, sizeof(rb_batch_entry_t) * capacity);
+
+  if (entries == NULL) {
+    return -1;
+  }
+
+  job->entries = entries;
+  job->capacity = capacity;
+
+  return 0;
+}
+
+// Hangs leaf on the given side of node, at the bottom of the subtree of
+// entry, and fixes up the path to its top as rb_insert_fixup would, with
+// the top standing in for the root.
+static void rb_batch_attach(rb_batch_entry_t *entry, rb_node_t *node,
+                            int direction, rb_node_t *leaf) {
+  rb_node_t *top = entry->node;
+  rb_node_t *current = leaf;
+
+  LCHILD(leaf) = NIL;
+  RCHILD(leaf) = NIL;
+  leaf->color = RED;
+  rb_join_set(node, direction, leaf);
+  entry->result = top;
+
+  for (;;) {
+    rb_node_t *parent = current->parent;
+
+    if (parent->color == BLACK) {
+      return;
+    }
+
+    // a red top with a red child takes the place of the red root
+    if (parent == top) {
+      top->color = BLACK;
+      entry->black_height++;
+
+      return;
+    }
+
+    rb_node_t *grand = parent->parent;
+    int side = RCHILD(grand) == parent ? RIGHT : LEFT;
+    rb_node_t *uncle = grand->child[1 - side];
+
+    if (!rb_is_black(uncle)) {
+      parent->color = BLACK;
+      uncle->color = BLACK;
+      grand->color = RED;
+
+      if (grand == top) {
+        return;
+      }
+
+      current = grand;
+
+      continue;
+    }
+
+    if (parent->child[1 - side] == current) {
+      rb_join_set(grand, side, rb_join_rotate(parent, side));
+      parent = current;
+    }
+
+    rb_node_t *above = grand->parent;
+    int above_side = grand != top && RCHILD(above) == grand ? RIGHT : LEFT;
+
+    parent->color = BLACK;
+    grand->color = RED;
+    parent = rb_join_rotate(grand, 1 - side);
+
+    if (grand == top) {
+      entry->result = parent;
+    } else {
+      rb_join_set(above, above_side, parent);
+    }
+
+    return;
+  }
+}
+
+// Takes node, of the given black height, out of the bottom of the
+// subtree of entry, and joins the sides back together on the way up to
+// its top, as rb_batch_settle would at each node, but only until a
+// subtree keeps its black height and fits under its parent.
+static void rb_batch_detach(rb_batch_entry_t *entry, rb_node_t *node,
+                            uint32_t height) {
+  rb_node_t *top = entry->node;
+  rb_node_t *current = node;
+  rb_node_t *parent = node != top ? node->parent : NIL;
+  uint32_t child_height = rb_child_height(node, height);
+  uint32_t result_height;
+  rb_node_t *result = rb_join2(LCHILD(node), child_height, RCHILD(node),
+                               child_height, &result_height);
+
+  free(node);
+
+  // current is the node whose place result takes, height its black
+  // height before
+  while (current != top) {
+    int side = RCHILD(parent) == current ? RIGHT : LEFT;
+    rb_node_t *above = parent != top ? parent->parent : NIL;
+
+    if (result_height == height &&
+        (parent->color == BLACK || rb_is_black(result))) {
+      rb_join_set(parent, side, result);
+      entry->result = top;
+
+      return;
+    }
+
+    rb_node_t *sibling = parent->child[1 - side];
+    uint32_t parent_height = height + (parent->color == BLACK);
+
+    if (side == LEFT) {
+      result = rb_join(result, result_height, parent, sibling, height,
+                       &result_height);
+    } else {
+      result = rb_join(sibling, height, parent, result, result_height,
+                       &result_height);
+    }
+
+    current = parent;
+    height = parent_height;
+    parent = above;
+  }
+
+  entry->result = result;
+  entry->black_height = result_height;
+}
+
+// Takes the runs of one key down the rest of the way, a level at a time
+// for a group of them, so that their cache misses overlap as well.
+static void rb_batch_tails(rb_batch_job_t *job, uint64_t total) {
+  for (uint64_t begin = 0; begin < total; begin += RB_BATCH_TAIL_GROUP) {
+    rb_batch_tail_t *tails = job->tails + begin;
+    uint64_t count = total - begin < RB_BATCH_TAIL_GROUP
+                         ? total - begin
+                         : RB_BATCH_TAIL_GROUP;
+
+    while (count > 0) {
+      for (uint64_t i = 0; i < count;) {
+        rb_node_t *node = tails[i].node;
+        // equal values go left, as in rb_node_insert
+        int direction = tails[i].key <= node->value ? LEFT : RIGHT;
+        rb_node_t *child = node->child[direction];
+
+        if (child != NIL) {
+          __builtin_prefetch(child);
+
+          tails[i++].node = child;
+        } else {
+          rb_batch_entry_t *entry = &job->entries[tails[i].entry];
+
+          rb_batch_attach(entry, node, direction, job->nodes[entry->begin]);
+
+          tails[i] = tails[--count];
+        }
+      }
+    }
+  }
+}
+
+// rb_batch_tails for a remove, down to the node of each key
+static void rb_batch_remove_tails(rb_batch_job_t *job, uint64_t total) {
+  for (uint64_t begin = 0; begin < total; begin += RB_BATCH_TAIL_GROUP) {
+    rb_batch_tail_t *tails = job->tails + begin;
+    uint64_t count = total - begin < RB_BATCH_TAIL_GROUP
+                         ? total - begin
+                         : RB_BATCH_TAIL_GROUP;
+
+    while (count > 0) {
+      for (uint64_t i = 0; i < count;) {
+        rb_node_t *node = tails[i].node;
+        rb_batch_entry_t *entry = &job->entries[tails[i].entry];
+
+        if (tails[i].key == node->value) {
+          job->found[entry->begin] = true;
+          rb_batch_detach(entry, node, tails[i].black_height);
+
+          tails[i] = tails[--count];
+          continue;
+        }
+
+        rb_node_t *child =
+            node->child[tails[i].key < node->value ? LEFT : RIGHT];
+
+        if (child != NIL) {
+          __builtin_prefetch(child);
+
+          tails[i].black_height =
+              rb_child_height(node, tails[i].black_height);
+          tails[i++].node = child;
+        } else {
+          // not there, the subtree is as it was
+          entry->result = entry->node;
+
+          tails[i] = tails[--count];
+        }
+      }
+    }
+  }
+}
+
+// The first sweep, down from root, of the given black height, with
+// keys[0, n). It changes nothing but the tails, which go last, so it can
+// fail for want of memory with the tree as it was.
+static int rb_batch_descend(rb_batch_job_t *job, rb_node_t *root,
+                            uint32_t black_height, uint64_t n,
+                            uint32_t nthreads) {
+  // a level has no more entries than keys; the depth of the tree is only
+  // known to be between its black height and twice that, so the entries
+  // start from a guess a little past the first and grow if need be
+  uint64_t capacity = 0;
+
+  for (uint32_t depth = 0; depth <= black_height + 2; depth++) {
+    capacity += depth < 63 && ((uint64_t)1 << depth) < n
+                    ? (uint64_t)1 << depth
+                    : n;
+  }
+
+  if (rb_batch_reserve(job, capacity) < 0) {
+    return -1;
+  }
+
+  uint64_t wide = (uint64_t)nthreads * RB_BATCH_TASKS_PER_THREAD;
+  uint64_t count = 1;
+  uint64_t level_end = 1;
+  uint64_t tails = 0;
+
+  job->entries[0] = (rb_batch_entry_t){
+      .node = root, .begin = 0, .end = n, .black_height = black_height};
+  job->first = 0;
+  job->last = 0;
+
+  for (uint64_t i = 0; i < count; i++) {
+    // [i, count) is the next level down
+    if (i == level_end) {
+      if (nthreads > 1 && job->last == 0 && count - i >= wide) {
+        job->first = i;
+        job->last = count;
+      }
+
+      level_end = count;
+    }
+
+    if (count + 2 > job->capacity &&
+        rb_batch_reserve(job, 2 * job->capacity) < 0) {
+      return -1;
+    }
+
+    rb_batch_entry_t *entries = job->entries;
+    rb_batch_entry_t *entry = &entries[i];
+    rb_node_t *node = entry->node;
+
+    entry->left = 0;
+    entry->right = 0;
+    entry->removed = false;
+    entry->tail = false;
+
+    if (node == NIL) {
+      continue;
+    }
+
+    if (entry->end - entry->begin == 1) {
+      entry->tail = true;
+      job->tails[tails++] =
+          (rb_batch_tail_t){.node = node,
+                            .entry = i,
+                            .key = job->keys[entry->begin],
+                            .black_height = entry->black_height};
+
+      continue;
+    }
+
+    // equal values go left for an insert, as in rb_node_insert; for a
+    // remove the one equal key takes out node
+    uint64_t split = rb_batch_search(job->keys, entry->begin, entry->end,
+                                     node->value, job->found == NULL);
+    uint64_t right = split;
+    uint32_t child_height = rb_child_height(node, entry->black_height);
+
+    if (job->found != NULL && split < entry->end &&
+        job->keys[split] == node->value) {
+      entry->removed = true;
+      job->found[split] = true;
+      right++;
+    }
+
+    if (split > entry->begin) {
+      if (LCHILD(node) != NIL) {
+        __builtin_prefetch(LCHILD(node));
+      }
+
+      entry->left = count;
+      entries[count++] = (rb_batch_entry_t){.node = LCHILD(node),
+                                            .begin = entry->begin,
+                                            .end = split,
+                                            .black_height = child_height};
+    }
+
+    if (right < entry->end) {
+      if (RCHILD(node) != NIL) {
+        __builtin_prefetch(RCHILD(node));
+      }
+
+      entry->right = count;
+      entries[count++] = (rb_batch_entry_t){.node = RCHILD(node),
+                                            .begin = right,
+                                            .end = entry->end,
+                                            .black_height = child_height};
+    }
+  }
+
+  job->count = count;
+
+  if (job->found != NULL) {
+    rb_batch_remove_tails(job, tails);
+  } else {
+    rb_batch_tails(job, tails);
+  }
+
+  return 0;
+}
+
+static rb_node_t *rb_batch_build(rb_node_t **nodes, uint64_t begin,
+                                 uint64_t end, uint32_t depth,
+                                 uint32_t height) {
+  if (begin == end) {
+    return NIL;
+  }
+
+  uint64_t middle = begin + (end - begin) / 2;
+  rb_node_t *node = nodes[middle];
+
+  node->color = depth == height && depth > 1 ? RED : BLACK;
+  rb_join_set(node, LEFT,
+              rb_batch_build(nodes, begin, middle, depth + 1, height));
+  rb_join_set(node, RIGHT,
+              rb_batch_build(nodes, middle + 1, end, depth + 1, height));
+
+  return node;
+}
+
+// The second sweep at one entry, whose sides are done. A side no key went
+// to is as it was, still linked to node, with a black top if node is red,
+// and unless the black heights differ it is not touched at all: for a
+// small batch most of the nodes on the way down have such a side.
+static void rb_batch_settle(rb_batch_job_t *job, rb_batch_entry_t *entry) {
+  rb_node_t *node = entry->node;
+
+  if (entry->tail) {
+    return;
+  }
+
+  if (node == NIL) {
+    uint64_t n = job->nodes != NULL ? entry->end - entry->begin : 0;
+    uint32_t height = n ? 64 - __builtin_clzll(n) : 0;
+
+    entry->result = rb_batch_build(job->nodes, entry->begin,
+                                   entry->begin + n, 1, height);
+    entry->black_height = height > 1 ? height - 1 : height;
+
+    return;
+  }
+
+  rb_batch_entry_t *left = entry->left ? &job->entries[entry->left] : NULL;
+  rb_batch_entry_t *right = entry->right ? &job->entries[entry->right] : NULL;
+  uint32_t child_height = rb_child_height(node, entry->black_height);
+  rb_node_t *left_node = left != NULL ? left->result : LCHILD(node);
+  rb_node_t *right_node = right != NULL ? right->result : RCHILD(node);
+  uint32_t left_height = left != NULL ? left->black_height : child_height;
+  uint32_t right_height = right != NULL ? right->black_height : child_height;
+
+  if (entry->removed) {
+    entry->result = rb_join2(left_node, left_height, right_node,
+                             right_height, &entry->black_height);
+
+    free(node);
+
+    return;
+  }
+
+  if (left_height != right_height ||
+      (node->color == RED &&
+       ((left != NULL && !rb_is_black(left_node)) ||
+        (right != NULL && !rb_is_black(right_node))))) {
+    entry->result = rb_join(left_node, left_height, node, right_node,
+                            right_height, &entry->black_height);
+
+    return;
+  }
+
+  if (left != NULL) {
+    rb_join_set(node, LEFT, left_node);
+  }
+
+  if (right != NULL) {
+    rb_join_set(node, RIGHT, right_node);
+  }
+
+  entry->result = node;
+  entry->black_height = left_height + (node->color == BLACK);
+}
+
+// the second sweep over the subtree of an entry, depth first
+static void rb_batch_finish(rb_batch_job_t *job, uint64_t index) {
+  rb_batch_entry_t *entry = &job->entries[index];
+
+  if (entry->left) {
+    rb_batch_finish(job, entry->left);
+  }
+
+  if (entry->right) {
+    rb_batch_finish(job, entry->right);
+  }
+
+  rb_batch_settle(job, entry);
+}
+
+static void *rb_batch_worker(void *arg) {
+  rb_batch_job_t *job = (rb_batch_job_t *)arg;
+
+  for (;;) {
+    uint64_t index = job->next++;
+
+    if (index >= job->last) {
+      return NULL;
+    }
+
+    rb_batch_finish(job, index);
+  }
+}
+
+// of the whole tree, down its left edge
+static uint32_t rb_black_height(rb_node_t *node) {
+  uint32_t height = 0;
+
+  for (; node != NIL; node = LCHILD(node)) {
+    height += node->color == BLACK;
+  }
+
+  return height;
+}
+
+// runs both sweeps for keys[0, n), returns -1, with the tree as it was,
+// if memory runs out
+static int rb_batch_run(rb_batch_job_t *job, rb_node_t **root, uint64_t n,
+                        uint32_t nthreads) {
+  if (rb_batch_descend(job, *root, rb_black_height(*root), n, nthreads) <
+      0) {
+    return -1;
+  }
+
+  uint64_t top = job->count;
+
+  if (job->last > job->first) {
+    pthread_t threads[RADIX_MAX_THREADS];
+    bool started[RADIX_MAX_THREADS];
+
+    job->next = job->first;
+
+    for (uint32_t t = 0; t + 1 < nthreads; t++) {
+      started[t] =
+          pthread_create(&threads[t], NULL, rb_batch_worker, job) == 0;
+    }
+
+    rb_batch_worker(job);
+
+    for (uint32_t t = 0; t + 1 < nthreads; t++) {
+      if (started[t]) {
+        pthread_join(threads[t], NULL);
+      }
+    }
+
+    top = job->first;
+  }
+
+  // every entry comes after its parent
+  while (top-- > 0) {
+    rb_batch_settle(job, &job->entries[top]);
+  }
+
+  *root = job->entries[0].result;
+
+  if (*root != NIL) {
+    (*root)->parent = NULL;
+    (*root)->color = BLACK;
+  }
+
+  return 0;
+}
+
+// the threads a batch of n keys is worth
+static inline uint32_t rb_batch_threads(uint32_t nthreads, uint64_t n) {
+  if (nthreads > n / RB_BATCH_MIN_KEYS) {
+    nthreads = (uint32_t)(n / RB_BATCH_MIN_KEYS);
+  }
+
+  if (nthreads == 0) {
+    return 1;
+  }
+
+  return nthreads > RADIX_MAX_THREADS ? RADIX_MAX_THREADS : nthreads;
+}
+
+int rb_tree_insert_batch(rb_tree_t *tree, const int *keys, uint64_t n,
+                          uint32_t nthreads) {
+  for (uint64_t i = 0; i < n; i++) {
+    WORKLOAD_RECORD(tree, WORKLOAD_INSERT, keys[i], keys[i]);
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  nthreads = rb_batch_threads(nthreads, n);
+
+  rb_batch_job_t job = {.found = NULL, .entries = NULL, .capacity = 0};
+  int *sorted = (int *)malloc(sizeof(int) * n);
+
+  job.nodes = (rb_node_t **)malloc(sizeof(rb_node_t *) * n);
+  job.tails = (rb_batch_tail_t *)malloc(sizeof(rb_batch_tail_t) * n);
+
+  uint64_t allocated = 0;
+
+  if (sorted != NULL && job.nodes != NULL && job.tails != NULL) {
+    memcpy(sorted, keys, sizeof(int) * n);
+
+    if (radix_sort(sorted, n, nthreads) == 0) {
+      for (; allocated < n; allocated++) {
+        job.nodes[allocated] = (rb_node_t *)malloc(sizeof(rb_node_t));
+
+        if (job.nodes[allocated] == NULL) {
+          break;
+        }
+
+        job.nodes[allocated]->value = sorted[allocated];
+      }
+    }
+  }
+
+  job.keys = sorted;
+
+  int result = allocated == n
+                   ? rb_batch_run(&job, &tree->root, n, nthreads)
+                   : -1;
+
+  if (result < 0) {
+    for (uint64_t i = 0; i < allocated; i++) {
+      free(job.nodes[i]);
+    }
+  } else {
+    tree->size += n;
+  }
+
+  free(sorted);
+  free(job.nodes);
+  free(job.tails);
+  free(job.entries);
+
+  return result;
+}
+
+// Removes one copy of each of n values in any order, with the same
+// result as removing them one at a time, using up to nthreads threads.
+// Returns how many were found, or -1, with the tree as it was, if memory
+// runs out. Build with -pthread.
+int64_t rb_tree_remove_batch(rb_tree_t *tree, const int *keys, uint64_t n,
+                              uint32_t nthreads) {
+  for (uint64_t i = 0; i < n; i++) {
+    WORKLOAD_RECORD(tree, WORKLOAD_REMOVE, keys[i], keys[i]);
+  }
+
+  if (n == 0 || tree->root == NIL) {
+    return 0;
+  }
+
+  nthreads = rb_batch_threads(nthreads, n);
+
+  rb_batch_job_t job = {.nodes = NULL, .entries = NULL, .capacity = 0};
+  int *sorted = (int *)malloc(sizeof(int) * n);
+  int *copies = (int *)malloc(sizeof(int) * n);
+
+  job.found = (bool *)malloc(sizeof(bool) * n);
+  job.tails = (rb_batch_tail_t *)malloc(sizeof(rb_batch_tail_t) * n);
+
+  if (sorted == NULL || copies == NULL || job.found == NULL ||
+      job.tails == NULL) {
+    free(sorted);
+    free(copies);
+    free(job.found);
+    free(job.tails);
+
+    return -1;
+  }
+
+  memcpy(sorted, keys, sizeof(int) * n);
+
+  int64_t removed = radix_sort(sorted, n, nthreads);
+
+  // A node goes with one key at most, so the keys go in rounds of
+  // distinct ones: the copies of a value come back in the next round as
+  // long as the value was found.
+  for (bool first = true; removed >= 0 && n > 0; first = false) {
+    uint64_t unique = 0;
+    uint64_t extra = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+      if (unique == 0 || sorted[i] != sorted[unique - 1]) {
+        sorted[unique++] = sorted[i];
+      } else {
+        copies[extra++] = sorted[i];
+      }
+    }
+
+    memset(job.found, 0, sizeof(bool) * unique);
+
+    job.keys = sorted;
+
+    if (rb_batch_run(&job, &tree->root, unique, nthreads) < 0) {
+      if (first) {
+        removed = -1;
+
+        break;
+      }
+
+      // what is left, one at a time, rather than stop half way
+      memcpy(sorted + unique, copies, sizeof(int) * extra);
+
+      for (uint64_t i = 0; i < n; i++) {
+        if (tree->root != NIL &&
+            rb_node_remove(tree, tree->root, sorted[i]) >= 0) {
+          removed++;
+        }
+      }
+
+      break;
+    }
+
+    n = 0;
+
+    for (uint64_t i = 0, j = 0; i < extra; i++) {
+      while (sorted[j] != copies[i]) {
+        j++;
+      }
+
+      if (job.found[j]) {
+        copies[n++] = copies[i];
+      }
+    }
+
+    for (uint64_t j = 0; j < unique; j++) {
+      removed += job.found[j];
+    }
+
+    int *swap = sorted;
+    sorted = copies;
+    copies = swap;
+  }
+
+  if (removed > 0) {
+    tree->size -= removed;
+  }
+
+  free(sorted);
+  free(copies);
+  free(job.found);
+  free(job.tails);
+  free(job.entries);
+
+  return removed;
+}
+
+// A node as rbtree/rb_pool.c lays it out, which is what the image holds.
+typedef struct rb_image_node {
+  int value;
+  // the top bit is set for red
+  uint32_t parent_color;
+  uint32_t child[2];
+} rb_image_node_t;
+
+typedef struct rb_image_entry {
+  rb_node_t *node;
+  uint32_t parent;
+  // 0 for the root, else which link of the parent to fill in
+  uint32_t side;
+  uint32_t depth;
+} rb_image_entry_t;
+
+// Writes the tree to path as a tree image (common/tree_image.h), to be
+// loaded with rb_pool_load. The nodes are laid out in blocks: each
+// block is the top levels of a subtree, in breadth first order, as many
+// as fill a page, so a lookup in the mapped image faults in about one
+// page per block rather than one per level.
+int rb_tree_save(rb_tree_t *tree, const char *path) {
+  uint32_t block_depth = tree_image_block_depth(sizeof(rb_image_node_t));
+  uint64_t roots_capacity = 64;
+  uint64_t roots_count = 0;
+  rb_image_entry_t *roots =
+      (rb_image_entry_t *)malloc(sizeof(rb_image_entry_t) * roots_capacity);
+  rb_image_entry_t *block = (rb_image_entry_t *)malloc(
+      sizeof(rb_image_entry_t) * ((size_t)1 << block_depth));
+  tree_image_writer_t writer;
+
+  if (roots == NULL || block == NULL ||
+      tree_image_create(&writer, path, TREE_IMAGE_RB,
+                        sizeof(rb_image_node_t), tree->size + 1) < 0) {
+    free(roots);
+    free(block);
+
+    return -1;
+  }
+
+  rb_image_node_t *nodes = (rb_image_node_t *)writer.nodes;
+  uint32_t next = 1;
+
+  if (tree->root != NULL) {
+    roots[roots_count++] = (rb_image_entry_t){tree->root, 0, 0, 0};
+  }
+
+  for (uint64_t r = 0; r < roots_count; r++) {
+    uint64_t head = 0;
+    uint64_t tail = 0;
+
+    block[tail++] = roots[r];
+
+    while (head < tail) {
+      rb_image_entry_t entry = block[head++];
+      rb_node_t *node = entry.node;
+
+      if (next > tree->size) {
+        // more nodes than the tree claims to hold
+        free(roots);
+        free(block);
+
+        return tree_image_abort(&writer);
+      }
+
+      uint32_t index = next++;
+      rb_image_node_t *image = &nodes[index];
+
+      image->value = node->value;
+      image->parent_color =
+          entry.parent | (node->color == RED ? (uint32_t)1 << 31 : 0);
+
+      if (entry.side != 0) {
+        nodes[entry.parent].child[entry.side - 1] = index;
+      }
+
+      rb_node_t *children[2] = {node->child[LEFT], node->child[RIGHT]};
+
+      for (uint32_t side = 0; side < 2; side++) {
+        if (children[side] == NULL) {
+          continue;
+        }
+
+        rb_image_entry_t child = {children[side], index, side + 1,
+                                   entry.depth + 1};
+
+        if (child.depth < block_depth) {
+          block[tail++] = child;
+          continue;
+        }
+
+        if (roots_count == roots_capacity) {
+          rb_image_entry_t *grown = (rb_image_entry_t *)realloc(
+              roots, sizeof(rb_image_entry_t) * roots_capacity * 2);
+
+          if (grown == NULL) {
+            free(roots);
+            free(block);
+
+            return tree_image_abort(&writer);
+          }
+
+          roots = grown;
+          roots_capacity *= 2;
+        }
+
+        child.depth = 0;
+        roots[roots_count++] = child;
+      }
+    }
+  }
+
+  free(roots);
+  free(block);
+
+  // fewer nodes than the tree claims to hold
+  if (next != tree->size + 1) {
+    return tree_image_abort(&writer);
+  }
+
+  return tree_image_finish(&writer, tree->root != NULL ? 1 : 0, tree->size,
+                           0);
+}
+
+#ifndef RB_TREE_NO_MAIN
+int main() {
+  rb_tree_t tree = rb_tree_create(7);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 3);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 18);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 10);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 22);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 26);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 8);
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 11);
+  rb_tree_print(&tree);
+
+  printf("before first tree\n");
+  print_ascii_tree(tree.root);
+  rb_tree_insert(&tree, 15);
+  print_ascii_tree(tree.root);
+  rb_tree_remove(&tree, 11);
+  print_ascii_tree(tree.root);
+
+  rb_tree_free(&tree);
+  return 0;
+}
+#endif